@@ -0,0 +1,453 @@
+/*
+ * Microbenchmarks of the containers and conversion kernels used by the
+ * playback pipeline. Results are printed as CSV, or as JSON with --json.
+ */
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/imgutils.h>
+#include <libswresample/swresample.h>
+#include <libswscale/swscale.h>
+
+#include "chalcocite.h"
+#include "histogram.h"
+#include "stats.h"
+#include "scale.h"
+#include "mixer.h"
+#include "scheduler.h"
+#include "container/packetqueue.h"
+#include "container/pool.h"
+#include "container/vectorptr.h"
+
+#define BENCH_PACKETS 200000
+#define BENCH_PACKET_SIZE 512
+#define BENCH_CONSUMERS 2
+#define BENCH_VECTOR_SIZE 100000
+#define BENCH_POOL_OBJECTS 1024
+#define BENCH_POOL_ROUNDS 200
+#define BENCH_FRAMES 50
+#define BENCH_AUDIO_FRAMES 2000
+#define BENCH_AUDIO_SAMPLES 1024
+
+struct BenchResult
+{
+	char name[32];
+	char parameters[48];
+	uint64_t iterations;
+	double seconds;
+	struct Histogram latency; ///< Per iteration, in nanoseconds. May be empty
+};
+
+static struct BenchResult results[32];
+static unsigned nResults;
+
+static struct BenchResult* bench_result(char const* name,
+                                        char const* parameters)
+{
+	struct BenchResult* result = &results[nResults++];
+	memset(result, 0, sizeof(struct BenchResult));
+	snprintf(result->name, sizeof(result->name), "%s", name);
+	snprintf(result->parameters, sizeof(result->parameters), "%s", parameters);
+	return result;
+}
+static void bench_print(bool json)
+{
+	if (json) printf("[\n");
+	else printf("benchmark,parameters,iterations,seconds,ops_per_second,"
+		            "p50_us,p99_us,max_us\n");
+	for (unsigned i = 0; i < nResults; ++i)
+	{
+		struct BenchResult const* const r = &results[i];
+		double opsPerSecond = r->seconds > 0.0 ? r->iterations / r->seconds : 0.0;
+		double p50 = Histogram_percentile(&r->latency, 0.5) / 1000.0;
+		double p99 = Histogram_percentile(&r->latency, 0.99) / 1000.0;
+		double max = Histogram_max(&r->latency) / 1000.0;
+		if (json)
+			printf("  {\"benchmark\":\"%s\",\"parameters\":\"%s\",\"iterations\":%llu,"
+			       "\"seconds\":%.6f,\"ops_per_second\":%.1f,\"p50_us\":%.3f,"
+			       "\"p99_us\":%.3f,\"max_us\":%.3f}%s\n",
+			       r->name, r->parameters, (unsigned long long) r->iterations,
+			       r->seconds, opsPerSecond, p50, p99, max,
+			       i + 1 < nResults ? "," : "");
+		else
+			printf("%s,%s,%llu,%.6f,%.1f,%.3f,%.3f,%.3f\n",
+			       r->name, r->parameters, (unsigned long long) r->iterations,
+			       r->seconds, opsPerSecond, p50, p99, max);
+	}
+	if (json) printf("]\n");
+}
+
+// PacketQueue: one producer, BENCH_CONSUMERS consumers
+
+struct QueueBench
+{
+	PacketQueue queue;
+	_Atomic enum State state;
+	struct Histogram latency;
+};
+
+static int bench_queue_consumer(struct QueueBench* const qb)
+{
+	while (true)
+	{
+		AVPacket packet;
+		if (PacketQueue_get(&qb->queue, &packet, true, &qb->state) < 0) break;
+		// The producer stores the time of PacketQueue_put in pts
+		Histogram_record(&qb->latency, stats_now() - (uint64_t) packet.pts);
+		bool sentinel = packet.stream_index < 0;
+		av_packet_unref(&packet);
+		if (sentinel) break;
+	}
+	return 0;
+}
+static void bench_queue(void)
+{
+	struct QueueBench qb;
+	PacketQueue_init(&qb.queue);
+	qb.state = STATE_NORMAL;
+	Histogram_reset(&qb.latency);
+
+	SDL_Thread* consumers[BENCH_CONSUMERS];
+	for (unsigned i = 0; i < BENCH_CONSUMERS; ++i)
+		consumers[i] = SDL_CreateThread((SDL_ThreadFunction) bench_queue_consumer,
+		                                "consumer", &qb);
+
+	uint64_t timeBegin = stats_now();
+	for (unsigned i = 0; i < BENCH_PACKETS + BENCH_CONSUMERS; ++i)
+	{
+		AVPacket packet;
+		av_init_packet(&packet);
+		if (av_new_packet(&packet, BENCH_PACKET_SIZE) < 0) break;
+		packet.stream_index = i < BENCH_PACKETS ? 0 : -1;
+		packet.pts = (int64_t) stats_now();
+		PacketQueue_put(&qb.queue, &packet);
+	}
+	for (unsigned i = 0; i < BENCH_CONSUMERS; ++i)
+		SDL_WaitThread(consumers[i], NULL);
+	uint64_t timeEnd = stats_now();
+
+	char parameters[48];
+	snprintf(parameters, sizeof(parameters), "1P%uC/%dB", BENCH_CONSUMERS,
+	         BENCH_PACKET_SIZE);
+	struct BenchResult* result = bench_result("packetqueue_put_get", parameters);
+	result->iterations = BENCH_PACKETS;
+	result->seconds = (timeEnd - timeBegin) / 1e9;
+	Histogram_merge(&result->latency, &qb.latency);
+	PacketQueue_destroy(&qb.queue);
+}
+
+// Vector and Pool
+
+static void bench_vector(void)
+{
+	char parameters[48];
+	snprintf(parameters, sizeof(parameters), "n=%d", BENCH_VECTOR_SIZE);
+
+	VectorPtr vp;
+	VectorPtr_init(&vp);
+	struct BenchResult* result = bench_result("vector_push_back", parameters);
+	uint64_t timeBegin = stats_now();
+	for (size_t i = 0; i < BENCH_VECTOR_SIZE; ++i)
+		VectorPtr_push_back(&vp, (void*) (i + 1));
+	result->seconds = (stats_now() - timeBegin) / 1e9;
+	result->iterations = BENCH_VECTOR_SIZE;
+
+	result = bench_result("vector_remove_unordered", parameters);
+	timeBegin = stats_now();
+	while (VectorPtr_size(&vp))
+		VectorPtr_remove_unordered(&vp, 0);
+	result->seconds = (stats_now() - timeBegin) / 1e9;
+	result->iterations = BENCH_VECTOR_SIZE;
+
+	for (size_t i = 0; i < BENCH_VECTOR_SIZE; ++i)
+		VectorPtr_push_back(&vp, (void*) (i + 1));
+	// Ordered removal from the front is the worst case
+	result = bench_result("vector_remove_front", parameters);
+	timeBegin = stats_now();
+	while (VectorPtr_size(&vp))
+		VectorPtr_remove(&vp, 0);
+	result->seconds = (stats_now() - timeBegin) / 1e9;
+	result->iterations = BENCH_VECTOR_SIZE;
+	VectorPtr_destroy(&vp);
+}
+static void bench_pool(void)
+{
+	char parameters[48];
+	snprintf(parameters, sizeof(parameters), "n=%d,size=%zu",
+	         BENCH_POOL_OBJECTS, sizeof(AVPacketList));
+	static void* objects[BENCH_POOL_OBJECTS];
+
+	Pool pool;
+	Pool_init(&pool, sizeof(AVPacketList), BENCH_POOL_OBJECTS / 16);
+	struct BenchResult* result = bench_result("pool_alloc_free", parameters);
+	uint64_t timeBegin = stats_now();
+	for (int round = 0; round < BENCH_POOL_ROUNDS; ++round)
+	{
+		for (int i = 0; i < BENCH_POOL_OBJECTS; ++i)
+			objects[i] = Pool_alloc(&pool);
+		for (int i = 0; i < BENCH_POOL_OBJECTS; ++i)
+			Pool_free(&pool, objects[i]);
+	}
+	result->seconds = (stats_now() - timeBegin) / 1e9;
+	result->iterations = (uint64_t) BENCH_POOL_OBJECTS * BENCH_POOL_ROUNDS;
+	Pool_destroy(&pool);
+
+	// The allocator PacketQueue used before
+	result = bench_result("av_malloc_free", parameters);
+	timeBegin = stats_now();
+	for (int round = 0; round < BENCH_POOL_ROUNDS; ++round)
+	{
+		for (int i = 0; i < BENCH_POOL_OBJECTS; ++i)
+			objects[i] = av_malloc(sizeof(AVPacketList));
+		for (int i = 0; i < BENCH_POOL_OBJECTS; ++i)
+			av_free(objects[i]);
+	}
+	result->seconds = (stats_now() - timeBegin) / 1e9;
+	result->iterations = (uint64_t) BENCH_POOL_OBJECTS * BENCH_POOL_ROUNDS;
+}
+
+// Video conversion
+
+struct BenchResolution
+{
+	char const* name;
+	int width, height;
+};
+static struct BenchResolution const resolutions[] =
+{
+	{ "720p", 1280, 720 },
+	{ "1080p", 1920, 1080 },
+	{ "4K", 3840, 2160 },
+};
+
+enum BenchConversion
+{
+	BENCH_COPY, ///< av_image_copy
+	BENCH_SWS, ///< sws_scale on the calling thread
+	BENCH_SLICED ///< SlicedScale on the scheduler
+};
+
+static void bench_picture(char const* name, struct BenchResolution const* res,
+                          enum AVPixelFormat formatIn,
+                          enum BenchConversion conversion)
+{
+	uint8_t* dataIn[4];
+	uint8_t* dataOut[4];
+	int linesizeIn[4];
+	int linesizeOut[4];
+	if (av_image_alloc(dataIn, linesizeIn, res->width, res->height, formatIn,
+	                   32) < 0)
+		return;
+	if (av_image_alloc(dataOut, linesizeOut, res->width, res->height,
+	                   AV_PIX_FMT_YUV420P, 32) < 0)
+	{
+		av_freep(&dataIn[0]);
+		return;
+	}
+	memset(dataIn[0], 0x80, av_image_get_buffer_size(formatIn, res->width,
+	       res->height, 32));
+	struct SlicedScale scale;
+	memset(&scale, 0, sizeof(struct SlicedScale));
+	if (conversion != BENCH_COPY)
+	{
+		if (!SlicedScale_init(&scale, res->width, res->height, formatIn,
+		                      AV_PIX_FMT_YUV420P, SWS_BILINEAR,
+		                      conversion == BENCH_SWS ? 1 : 0))
+		{
+			av_freep(&dataIn[0]);
+			av_freep(&dataOut[0]);
+			return;
+		}
+	}
+
+	struct BenchResult* result = bench_result(name, res->name);
+	uint64_t timeBegin = stats_now();
+	for (unsigned i = 0; i < BENCH_FRAMES; ++i)
+	{
+		uint64_t timeFrame = stats_now();
+		if (conversion == BENCH_COPY)
+			av_image_copy(dataOut, linesizeOut, (uint8_t const**) dataIn,
+			              linesizeIn, AV_PIX_FMT_YUV420P, res->width, res->height);
+		else
+			SlicedScale_scale(&scale, (uint8_t const* const*) dataIn, linesizeIn,
+			                  dataOut, linesizeOut);
+		Histogram_record(&result->latency, stats_now() - timeFrame);
+	}
+	result->seconds = (stats_now() - timeBegin) / 1e9;
+	result->iterations = BENCH_FRAMES;
+
+	SlicedScale_destroy(&scale);
+	av_freep(&dataIn[0]);
+	av_freep(&dataOut[0]);
+}
+static void bench_video(void)
+{
+	unsigned const nResolutions = sizeof(resolutions) / sizeof(resolutions[0]);
+	for (unsigned i = 0; i < nResolutions; ++i)
+	{
+		bench_picture("copy_yuv420p", &resolutions[i], AV_PIX_FMT_YUV420P,
+		              BENCH_COPY);
+		bench_picture("sws_yuv420p", &resolutions[i], AV_PIX_FMT_YUV420P,
+		              BENCH_SWS);
+		bench_picture("sws_nv12", &resolutions[i], AV_PIX_FMT_NV12, BENCH_SWS);
+		bench_picture("sliced_nv12", &resolutions[i], AV_PIX_FMT_NV12,
+		              BENCH_SLICED);
+	}
+}
+
+// Audio conversion
+
+struct BenchLayout
+{
+	char const* name;
+	uint64_t layoutIn;
+	enum AVSampleFormat formatIn;
+	int rateIn;
+	uint64_t layoutOut;
+	int rateOut;
+};
+static struct BenchLayout const layouts[] =
+{
+	{ "fltp_stereo_48k", AV_CH_LAYOUT_STEREO, AV_SAMPLE_FMT_FLTP, 48000,
+	  AV_CH_LAYOUT_STEREO, 48000 },
+	{ "s16_stereo_44k1_48k", AV_CH_LAYOUT_STEREO, AV_SAMPLE_FMT_S16, 44100,
+	  AV_CH_LAYOUT_STEREO, 48000 },
+	{ "fltp_5.1_stereo", AV_CH_LAYOUT_5POINT1, AV_SAMPLE_FMT_FLTP, 48000,
+	  AV_CH_LAYOUT_STEREO, 48000 },
+	{ "fltp_7.1_stereo", AV_CH_LAYOUT_7POINT1, AV_SAMPLE_FMT_FLTP, 48000,
+	  AV_CH_LAYOUT_STEREO, 48000 },
+};
+
+static void bench_resample(struct BenchLayout const* layout)
+{
+	struct SwrContext* swr = swr_alloc_set_opts(NULL,
+	                         layout->layoutOut, AV_SAMPLE_FMT_S16, layout->rateOut,
+	                         layout->layoutIn, layout->formatIn, layout->rateIn,
+	                         0, NULL);
+	if (!swr || swr_init(swr) < 0)
+	{
+		swr_free(&swr);
+		return;
+	}
+	int channelsIn = av_get_channel_layout_nb_channels(layout->layoutIn);
+	int channelsOut = av_get_channel_layout_nb_channels(layout->layoutOut);
+	uint8_t* dataIn[8] = { NULL };
+	int linesizeIn;
+	if (av_samples_alloc(dataIn, &linesizeIn, channelsIn, BENCH_AUDIO_SAMPLES,
+	                     layout->formatIn, 0) < 0)
+	{
+		swr_free(&swr);
+		return;
+	}
+	memset(dataIn[0], 0, linesizeIn *
+	       (av_sample_fmt_is_planar(layout->formatIn) ? channelsIn : 1));
+	// Room for rate conversion and the resampler delay
+	int samplesOut = BENCH_AUDIO_SAMPLES * 2;
+	uint8_t* dataOut = av_malloc(samplesOut * channelsOut * 2);
+
+	struct BenchResult* result = bench_result("swr_convert", layout->name);
+	uint64_t timeBegin = stats_now();
+	for (unsigned i = 0; i < BENCH_AUDIO_FRAMES; ++i)
+	{
+		uint64_t timeFrame = stats_now();
+		swr_convert(swr, &dataOut, samplesOut, (uint8_t const**) dataIn,
+		            BENCH_AUDIO_SAMPLES);
+		Histogram_record(&result->latency, stats_now() - timeFrame);
+	}
+	result->seconds = (stats_now() - timeBegin) / 1e9;
+	result->iterations = BENCH_AUDIO_FRAMES;
+
+	av_free(dataOut);
+	av_freep(&dataIn[0]);
+	swr_free(&swr);
+}
+/**
+ * @brief Mixes nTracks tracks of 5.1 into stereo, one frame of each per
+ *  iteration.
+ */
+static void bench_mix(unsigned nTracks)
+{
+	struct AudioMixer mixer;
+	AudioMixer_init(&mixer, NULL, "stereo");
+	struct AVCodecContext* cc[MIXER_TRACKS_MAX] = { NULL };
+	struct AVFrame* frame = av_frame_alloc();
+	int16_t* buffer = av_malloc(MIXER_PULL_FRAMES * 2 * sizeof(int16_t));
+	for (unsigned i = 0; i < nTracks; ++i)
+	{
+		cc[i] = avcodec_alloc_context3(NULL);
+		cc[i]->channel_layout = AV_CH_LAYOUT_5POINT1;
+		cc[i]->channels = 6;
+		cc[i]->sample_fmt = AV_SAMPLE_FMT_FLTP;
+		cc[i]->sample_rate = 48000;
+		AudioMixer_add_track(&mixer, i, cc[i], 0.5f);
+	}
+	bool ready = frame && buffer && AudioMixer_start(&mixer, 48000);
+	if (ready)
+	{
+		frame->format = AV_SAMPLE_FMT_FLTP;
+		frame->channel_layout = AV_CH_LAYOUT_5POINT1;
+		frame->nb_samples = BENCH_AUDIO_SAMPLES;
+		ready = av_frame_get_buffer(frame, 0) >= 0;
+	}
+	if (ready)
+	{
+		for (int c = 0; c < 6; ++c)
+			memset(frame->extended_data[c], 0, BENCH_AUDIO_SAMPLES * sizeof(float));
+		char parameters[32];
+		snprintf(parameters, sizeof(parameters), "%u_5.1_stereo", nTracks);
+		struct BenchResult* result = bench_result("audio_mixer", parameters);
+		uint64_t timeBegin = stats_now();
+		for (unsigned i = 0; i < BENCH_AUDIO_FRAMES; ++i)
+		{
+			uint64_t timeFrame = stats_now();
+			for (unsigned t = 0; t < nTracks; ++t)
+				AudioMixer_push(&mixer, t, frame);
+			while (AudioMixer_pull(&mixer, buffer, MIXER_PULL_FRAMES) > 0);
+			Histogram_record(&result->latency, stats_now() - timeFrame);
+		}
+		result->seconds = (stats_now() - timeBegin) / 1e9;
+		result->iterations = BENCH_AUDIO_FRAMES;
+	}
+	// The mixer frees the decoders but the first
+	AudioMixer_destroy(&mixer);
+	avcodec_free_context(&cc[0]);
+	av_frame_free(&frame);
+	av_free(buffer);
+}
+static void bench_audio(void)
+{
+	unsigned const nLayouts = sizeof(layouts) / sizeof(layouts[0]);
+	for (unsigned i = 0; i < nLayouts; ++i)
+		bench_resample(&layouts[i]);
+	bench_mix(1);
+	bench_mix(4);
+	bench_mix(8);
+}
+
+int main(int argc, char* argv[])
+{
+	bool json = argc > 1 && strcmp(argv[1], "--json") == 0;
+	if (SDL_Init(SDL_INIT_TIMER))
+	{
+		fprintf(stderr, "[SDL] %s\n", SDL_GetError());
+		return -1;
+	}
+	stats_thread_register("bench");
+	scheduler_init(0);
+
+	bench_queue();
+	bench_vector();
+	bench_pool();
+	bench_video();
+	bench_audio();
+
+	bench_print(json);
+	scheduler_quit();
+	SDL_Quit();
+	return 0;
+}
@@ -4,46 +4,72 @@
 
 #define MAX(a, b) (a) < (b) ? (b) : (a)
 
+/**
+ * @brief Channels of the converted audio: those of the mix layout when mixing.
+ */
+static int audio_channels(struct Media const* const media)
+{
+	if (AudioMixer_enabled(&media->mixer))
+		return av_get_channel_layout_nb_channels(
+		         AudioMixer_layout(&media->mixer));
+	return media->ccA->channels;
+}
 bool audio_load_SDL(struct Media* const media)
 {
 	SDL_AudioSpec specTarget;
+	memset(&specTarget, 0, sizeof(SDL_AudioSpec));
 	specTarget.freq = media->ccA->sample_rate;
 	specTarget.format = AUDIO_S16SYS;
-	specTarget.channels = media->ccA->channels;
+	specTarget.channels = audio_channels(media);
 	specTarget.silence = 0;
-	specTarget.samples = 1024;
+	specTarget.samples = media->liveLatency > 0.0 ? LIVE_AUDIO_SAMPLES : 1024;
 	specTarget.callback = NULL;
 
-	media->audioDevice = SDL_OpenAudioDevice(NULL, 0,
-			&specTarget, &media->audioSpec, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
-	if (!media->audioDevice)
-	{
-		fprintf(stderr, "[SDL] %s\n", SDL_GetError());
+	if (!Output_open_audio(media->output, &specTarget))
 		return false;
-	}
-	media->swrContext = swr_alloc_set_opts(NULL,
-			av_get_default_channel_layout(media->audioSpec.channels), AV_SAMPLE_FMT_S16, media->audioSpec.freq,
-			media->ccA->channel_layout, media->ccA->sample_fmt, media->ccA->sample_rate,
-			0, NULL);
-	if (!media->swrContext)
+	media->audioSpec = media->output->audioSpec;
+	if (AudioMixer_enabled(&media->mixer))
 	{
-		fprintf(stderr, "Unable to allocate Swr_Context\n");
-		SDL_CloseAudioDevice(media->audioDevice);
-		return false;
+		// The tracks are resampled by the mixer
+		if (!AudioMixer_start(&media->mixer, media->audioSpec.freq))
+			return false;
 	}
-	if (swr_init(media->swrContext) < 0)
+	else
 	{
-		fprintf(stderr, "Unable to initialise Swr_Context\n");
-		swr_free(&media->swrContext);
-		SDL_CloseAudioDevice(media->audioDevice);
-		return false;
+		media->swrContext = Output_resampler(media->output,
+		                                     media->ccA->channel_layout,
+		                                     media->ccA->sample_fmt,
+		                                     media->ccA->sample_rate);
+		if (!media->swrContext)
+			return false;
 	}
+	media->audioDevice = media->output->audioDevice;
 
 	SDL_PauseAudioDevice(media->audioDevice, 0);
 	return true;
 }
+bool audio_load_sink(struct Media* const media)
+{
+	// The mixer output needs no conversion
+	bool const mixing = AudioMixer_enabled(&media->mixer);
+	if (!Sink_open_audio(media->sink,
+	                     mixing ? AudioMixer_layout(&media->mixer) :
+	                     (int64_t) media->ccA->channel_layout,
+	                     mixing ? AV_SAMPLE_FMT_S16 : media->ccA->sample_fmt,
+	                     media->ccA->sample_rate, audio_channels(media)))
+		return false;
+	memset(&media->audioSpec, 0, sizeof(SDL_AudioSpec));
+	media->audioSpec.freq = media->ccA->sample_rate;
+	media->audioSpec.format = AUDIO_S16SYS;
+	media->audioSpec.channels = audio_channels(media);
+	if (mixing)
+		return AudioMixer_start(&media->mixer, media->ccA->sample_rate);
+	media->swrContext = media->sink->swrContext;
+	return true;
+}
 void audio_unload_SDL(struct Media* const media)
 {
-	swr_free(&media->swrContext);
-	SDL_CloseAudioDevice(media->audioDevice);
+	// The device and the resampler belong to media->output
+	media->swrContext = NULL;
+	media->audioDevice = 0;
 }
@@ -4,9 +4,15 @@
 #include "media.h"
 
 /**
- * Load the given media into SDL
+ * Load the given media into SDL, opening or reusing the audio device of
+ * media->output.
  */
 bool audio_load_SDL(struct Media* const media);
+/**
+ * Converts the audio of the given media for media->sink instead of the audio
+ * device.
+ */
+bool audio_load_sink(struct Media* const media);
 void audio_unload_SDL(struct Media* const media);
 
 
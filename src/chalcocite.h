@@ -6,11 +6,14 @@
 enum State
 {
 	STATE_NORMAL,
+	STATE_PAUSE,
 	STATE_QUIT	
 };
 
 #define CHAL_EVENT_QUIT (SDL_USEREVENT + 1)
 #define CHAL_EVENT_REFRESH (SDL_USEREVENT + 2)
+// Carries a struct ControlRequest of a control client
+#define CHAL_EVENT_CONTROL (SDL_USEREVENT + 3)
 #define CHAL_UNSIGNED_INVALID (unsigned) (-1)
 
 #endif // !CHALCOCITE__CHALCOCITE_H_
@@ -1,28 +1,59 @@
 #include "packetqueue.h"
 
+#include "../memstats.h"
+
+// Bytes accounted for a packet in the queue
+#define PACKET_FOOTPRINT(pkt) ((int64_t) ((pkt).size + sizeof(AVPacketList)))
+
 inline void PacketQueue_init(PacketQueue* const pq)
 {
 	memset(pq, 0, sizeof(PacketQueue));
 	pq->mutex = SDL_CreateMutex();
 	pq->cond = SDL_CreateCond();
+	Pool_init(&pq->nodes, sizeof(AVPacketList), PACKETQUEUE_POOL_BLOCK);
 }
 inline void PacketQueue_destroy(PacketQueue* const pq)
 {
+	PacketQueue_flush(pq);
+	Pool_destroy(&pq->nodes);
 	SDL_DestroyMutex(pq->mutex);
 	SDL_DestroyCond(pq->cond);
 }
+void PacketQueue_flush(PacketQueue* const pq)
+{
+	SDL_LockMutex(pq->mutex);
+	AVPacketList* pl = pq->first;
+	while (pl)
+	{
+		AVPacketList* next = pl->next;
+		memstats_add(MEM_PACKETS, -PACKET_FOOTPRINT(pl->pkt));
+		av_packet_unref(&pl->pkt);
+		Pool_free(&pq->nodes, pl);
+		pl = next;
+	}
+	pq->first = pq->last = NULL;
+	pq->nPackets = 0;
+	pq->size = 0;
+	SDL_UnlockMutex(pq->mutex);
+}
 bool PacketQueue_put(PacketQueue* pq, AVPacket* packet)
 {
-	AVPacketList* pl;
-	pl = av_malloc(sizeof(AVPacketList));
-	if (!pl)
-		return false;
-	if (av_packet_ref(&pl->pkt, packet) < 0)
+	AVPacket ref;
+	if (av_packet_ref(&ref, packet) < 0)
 		return false;
-	pl->pkt = *packet;
-	pl->next = NULL;
 
 	SDL_LockMutex(pq->mutex);
+	AVPacketList* pl = Pool_alloc(&pq->nodes);
+	if (!pl)
+	{
+		SDL_UnlockMutex(pq->mutex);
+		av_packet_unref(&ref);
+		return false;
+	}
+	av_packet_unref(packet);
+	pl->pkt = ref;
+	pl->next = NULL;
+	memstats_add(MEM_PACKETS, PACKET_FOOTPRINT(pl->pkt));
 	if (!pq->last)
 		pq->first = pl;
 	else
@@ -57,7 +88,8 @@ int PacketQueue_get(PacketQueue* pq, AVPacket* packet, bool block,
 			--pq->nPackets;
 			pq->size -= pl->pkt.size;
 			*packet = pl->pkt;
-			av_free(pl);
+			memstats_add(MEM_PACKETS, -PACKET_FOOTPRINT(pl->pkt));
+			Pool_free(&pq->nodes, pl);
 			result = 1;
 			break;
 		}
@@ -7,6 +7,9 @@
 #include <libavformat/avformat.h>
 
 #include "../chalcocite.h"
+#include "pool.h"
+
+#define PACKETQUEUE_POOL_BLOCK 64 // Nodes allocated at once
 
 /**
  * Linked list implementation of a queue.
@@ -17,6 +20,7 @@ typedef struct
 	AVPacketList* last; // Last element of the list
 	int nPackets;
 	size_t size; // Total size in bytes of the packets
+	Pool nodes; // Storage of the list nodes
 	SDL_mutex* mutex;
 	SDL_cond* cond;
 } PacketQueue;
@@ -25,11 +29,15 @@ typedef struct
  * @brief Initialise the given PacketQueue.
  */
 void PacketQueue_init(PacketQueue* const);
+/**
+ * @brief Frees all packets remaining in the queue.
+ */
 void PacketQueue_destroy(PacketQueue* const);
 
 /**
- * @brief Enqueue a AVPacket into a PacketQueue. Thread safe.
- * @return true if successful.
+ * @brief Enqueue a AVPacket into a PacketQueue. Thread safe. The queue takes a
+ *  reference to the packet and unreferences the given one.
+ * @return true if successful. The packet is left untouched otherwise.
  */
 bool PacketQueue_put(PacketQueue* pq, AVPacket* packet);
 
@@ -46,6 +54,11 @@ bool PacketQueue_put(PacketQueue* pq, AVPacket* packet);
 int PacketQueue_get(PacketQueue* pq, AVPacket* packet, bool block,
 		_Atomic enum State const* const state);
 
+/**
+ * @brief Frees all packets in the queue. Thread safe.
+ */
+void PacketQueue_flush(PacketQueue* const);
+
 static inline size_t PacketQueue_size(PacketQueue* const pq)
 {
 	return pq->size;
@@ -0,0 +1,63 @@
+#include "pool.h"
+
+#include <assert.h>
+#include <stdalign.h>
+#include <stdlib.h>
+
+void Pool_init(Pool* const pool, size_t objectSize, size_t blockCapacity)
+{
+	assert(blockCapacity);
+	// Free objects hold the free list pointer, and objects must stay aligned
+	if (objectSize < sizeof(void*)) objectSize = sizeof(void*);
+	size_t const alignment = alignof(max_align_t);
+	objectSize = (objectSize + alignment - 1) / alignment * alignment;
+
+	pool->objectSize = objectSize;
+	pool->blockCapacity = blockCapacity;
+	pool->freeList = NULL;
+	pool->nAllocated = 0;
+	VectorPtr_init(&pool->blocks);
+}
+void Pool_destroy(Pool* const pool)
+{
+	for (size_t i = 0; i < VectorPtr_size(&pool->blocks); ++i)
+		free(VectorPtr_at(&pool->blocks, i));
+	VectorPtr_destroy(&pool->blocks);
+	pool->freeList = NULL;
+	pool->nAllocated = 0;
+}
+
+static bool Pool_grow(Pool* const pool)
+{
+	char* block = malloc(pool->blockCapacity * pool->objectSize);
+	if (!block) return false;
+	if (!VectorPtr_push_back(&pool->blocks, block))
+	{
+		free(block);
+		return false;
+	}
+	// Thread the new objects onto the free list in address order
+	for (size_t i = pool->blockCapacity; i-- > 0;)
+	{
+		void* object = block + i * pool->objectSize;
+		*(void**) object = pool->freeList;
+		pool->freeList = object;
+	}
+	return true;
+}
+void* Pool_alloc(Pool* const pool)
+{
+	if (!pool->freeList && !Pool_grow(pool)) return NULL;
+	void* object = pool->freeList;
+	pool->freeList = *(void**) object;
+	++pool->nAllocated;
+	return object;
+}
+void Pool_free(Pool* const pool, void* object)
+{
+	if (!object) return;
+	assert(pool->nAllocated);
+	*(void**) object = pool->freeList;
+	pool->freeList = object;
+	--pool->nAllocated;
+}
@@ -0,0 +1,50 @@
+#ifndef CHALCOCITE_CONTAINER_POOL_H_
+#define CHALCOCITE_CONTAINER_POOL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "vectorptr.h"
+
+/**
+ * Must be initialised with \ref Pool_init and destroyed with
+ *  \ref Pool_destroy. Not thread safe.
+ * @brief Allocator of fixed-size objects. Objects are carved from blocks of
+ *  blockCapacity objects and recycled through a free list, so allocation and
+ *  release are O(1) and memory is only returned by Pool_destroy.
+ */
+typedef struct
+{
+	size_t objectSize;
+	size_t blockCapacity; ///< Objects per block
+	void* freeList; ///< Singly linked through the first bytes of each object
+	VectorPtr blocks;
+	size_t nAllocated; ///< Objects in use
+} Pool;
+
+void Pool_init(Pool* const, size_t objectSize, size_t blockCapacity);
+/**
+ * @warning Objects still in use are freed as well.
+ */
+void Pool_destroy(Pool* const);
+
+/**
+ * @return NULL if out of memory.
+ */
+void* Pool_alloc(Pool* const);
+void Pool_free(Pool* const, void* object);
+
+static inline size_t Pool_allocated(Pool const* const pool)
+{
+	return pool->nAllocated;
+}
+/**
+ * @brief Bytes reserved in blocks, whether in use or not.
+ */
+static inline size_t Pool_footprint(Pool const* const pool)
+{
+	return VectorPtr_size(&pool->blocks) * pool->blockCapacity *
+	       pool->objectSize;
+}
+
+#endif // !CHALCOCITE_CONTAINER_POOL_H_
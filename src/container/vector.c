@@ -0,0 +1,75 @@
+#include "vector.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define VECTOR_INITIAL_CAPACITY 8
+
+void Vector_init(Vector* const v, size_t elementSize)
+{
+	assert(elementSize);
+	memset(v, 0, sizeof(Vector));
+	v->elementSize = elementSize;
+}
+void Vector_init_inline(Vector* const v, size_t elementSize,
+                        void* buffer, size_t capacity)
+{
+	Vector_init(v, elementSize);
+	v->data = v->inlineData = buffer;
+	v->capacity = v->inlineCapacity = capacity;
+}
+void Vector_destroy(Vector* const v)
+{
+	if (v->data != v->inlineData) free(v->data);
+	v->data = v->inlineData;
+	v->capacity = v->inlineCapacity;
+	v->size = 0;
+}
+
+bool Vector_reserve(Vector* const v, size_t capacity)
+{
+	if (capacity <= v->capacity) return true;
+
+	void* data;
+	if (v->data == v->inlineData) // Spill out of the small buffer
+	{
+		data = malloc(capacity * v->elementSize);
+		if (!data) return false;
+		if (v->size) memcpy(data, v->data, v->size * v->elementSize);
+	}
+	else
+	{
+		data = realloc(v->data, capacity * v->elementSize);
+		if (!data) return false;
+	}
+	v->data = data;
+	v->capacity = capacity;
+	return true;
+}
+bool Vector_push_back(Vector* const v, void const* element)
+{
+	if (v->size == v->capacity)
+	{
+		size_t capacity = v->capacity ? v->capacity * 2 : VECTOR_INITIAL_CAPACITY;
+		if (!Vector_reserve(v, capacity)) return false;
+	}
+	memcpy((char*) v->data + v->size * v->elementSize, element, v->elementSize);
+	++v->size;
+	return true;
+}
+void Vector_remove(Vector* const v, size_t index)
+{
+	assert(index < v->size);
+	char* const element = (char*) v->data + index * v->elementSize;
+	memmove(element, element + v->elementSize,
+	        (v->size - index - 1) * v->elementSize);
+	--v->size;
+}
+void Vector_remove_unordered(Vector* const v, size_t index)
+{
+	assert(index < v->size);
+	--v->size;
+	if (index != v->size)
+		memcpy((char*) v->data + index * v->elementSize,
+		       (char*) v->data + v->size * v->elementSize, v->elementSize);
+}
@@ -0,0 +1,147 @@
+#ifndef CHALCOCITE_CONTAINER_VECTOR_H_
+#define CHALCOCITE_CONTAINER_VECTOR_H_
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Must be initialised with \ref Vector_init or \ref Vector_init_inline and
+ *  destroyed with \ref Vector_destroy.
+ * @brief Dynamic array of elements of elementSize bytes. The capacity doubles
+ *  when full, so push_back is amortised O(1).
+ *
+ * A vector initialised with Vector_init_inline stores up to inlineCapacity
+ * elements in a buffer supplied by the owner, usually a member of the same
+ * struct, and only allocates beyond that. Such a vector must not be moved.
+ *
+ * Use VECTOR_DEFINE or SMALLVECTOR_DEFINE for a typed interface.
+ */
+typedef struct
+{
+	void* data;
+	size_t size;
+	size_t capacity;
+	size_t elementSize;
+	void* inlineData; ///< Small buffer. NULL if unused
+	size_t inlineCapacity;
+} Vector;
+
+void Vector_init(Vector* const, size_t elementSize);
+void Vector_init_inline(Vector* const, size_t elementSize,
+                        void* buffer, size_t capacity);
+void Vector_destroy(Vector* const);
+
+/**
+ * @brief Removes all elements. The capacity is kept.
+ */
+static inline void Vector_clear(Vector* const v)
+{
+	v->size = 0;
+}
+static inline size_t Vector_size(Vector const* const v)
+{
+	return v->size;
+}
+static inline void* Vector_at(Vector const* const v, size_t index)
+{
+	assert(index < v->size);
+	return (char*) v->data + index * v->elementSize;
+}
+/**
+ * @brief Ensures room for capacity elements without reallocation.
+ */
+bool Vector_reserve(Vector* const, size_t capacity);
+/**
+ * @brief Copies elementSize bytes from element to the end.
+ */
+bool Vector_push_back(Vector* const, void const* element);
+static inline void Vector_pop_back(Vector* const v)
+{
+	assert(v->size);
+	--v->size;
+}
+/**
+ * @brief Removes an element, preserving the order of the others. O(n)
+ */
+void Vector_remove(Vector* const, size_t index);
+/**
+ * @brief Removes an element by moving the last element into its place. O(1)
+ */
+void Vector_remove_unordered(Vector* const, size_t index);
+
+/**
+ * @brief Declares a typed vector Name of elements of Type with functions
+ *  Name_init, Name_destroy, Name_clear, Name_size, Name_at (by value),
+ *  Name_ptr, Name_reserve, Name_push_back, Name_pop_back, Name_remove and
+ *  Name_remove_unordered.
+ */
+#define VECTOR_DEFINE(Name, Type) \
+	typedef struct \
+	{ \
+		Vector base; \
+	} Name; \
+	static inline void Name##_init(Name* const v) \
+	{ \
+		Vector_init(&v->base, sizeof(Type)); \
+	} \
+	VECTOR_DEFINE_FUNCTIONS_(Name, Type)
+
+/**
+ * @brief As VECTOR_DEFINE, with room for N elements before allocating.
+ */
+#define SMALLVECTOR_DEFINE(Name, Type, N) \
+	typedef struct \
+	{ \
+		Vector base; \
+		Type buffer[N]; \
+	} Name; \
+	static inline void Name##_init(Name* const v) \
+	{ \
+		Vector_init_inline(&v->base, sizeof(Type), v->buffer, N); \
+	} \
+	VECTOR_DEFINE_FUNCTIONS_(Name, Type)
+
+#define VECTOR_DEFINE_FUNCTIONS_(Name, Type) \
+	static inline void Name##_destroy(Name* const v) \
+	{ \
+		Vector_destroy(&v->base); \
+	} \
+	static inline void Name##_clear(Name* const v) \
+	{ \
+		Vector_clear(&v->base); \
+	} \
+	static inline size_t Name##_size(Name const* const v) \
+	{ \
+		return Vector_size(&v->base); \
+	} \
+	static inline Type* Name##_ptr(Name const* const v, size_t index) \
+	{ \
+		return (Type*) Vector_at(&v->base, index); \
+	} \
+	static inline Type Name##_at(Name const* const v, size_t index) \
+	{ \
+		return *Name##_ptr(v, index); \
+	} \
+	static inline bool Name##_reserve(Name* const v, size_t capacity) \
+	{ \
+		return Vector_reserve(&v->base, capacity); \
+	} \
+	static inline bool Name##_push_back(Name* const v, Type element) \
+	{ \
+		return Vector_push_back(&v->base, &element); \
+	} \
+	static inline void Name##_pop_back(Name* const v) \
+	{ \
+		Vector_pop_back(&v->base); \
+	} \
+	static inline void Name##_remove(Name* const v, size_t index) \
+	{ \
+		Vector_remove(&v->base, index); \
+	} \
+	static inline void Name##_remove_unordered(Name* const v, size_t index) \
+	{ \
+		Vector_remove_unordered(&v->base, index); \
+	}
+
+#endif // !CHALCOCITE_CONTAINER_VECTOR_H_
@@ -0,0 +1,602 @@
+#include "control.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __unix__
+	#include <fcntl.h>
+	#include <poll.h>
+	#include <sys/socket.h>
+	#include <sys/un.h>
+	#include <unistd.h>
+#endif
+
+#include "chalcocite.h"
+#include "playback.h"
+#include "memstats.h"
+#include "export.h"
+#include "trickplay.h"
+
+static char const* const controlCommandNames[CONTROL_COMMAND_COUNT] =
+{
+	[CONTROL_PLAY] = "play",
+	[CONTROL_PAUSE] = "pause",
+	[CONTROL_RESUME] = "resume",
+	[CONTROL_SEEK] = "seek",
+	[CONTROL_STOP] = "stop",
+	[CONTROL_QUIT] = "quit",
+	[CONTROL_STATS] = "stats",
+	[CONTROL_TRICK] = "trick",
+};
+
+static _Atomic bool controlReceiver;
+static _Atomic bool controlQuit;
+
+void control_set_receiver(bool receiver)
+{
+	atomic_store(&controlReceiver, receiver);
+}
+bool control_receiver(void)
+{
+	return atomic_load(&controlReceiver);
+}
+bool control_quit(void)
+{
+	return atomic_load(&controlQuit);
+}
+
+bool control_parse(char const* line, struct ControlRequest* const request,
+                   char const** error)
+{
+	size_t length = strcspn(line, " ");
+	char const* argument = line[length] ? line + length + 1 : line + length;
+	*error = NULL;
+	request->command = CONTROL_COMMAND_COUNT;
+	for (int i = 0; i < CONTROL_COMMAND_COUNT; ++i)
+		if (strlen(controlCommandNames[i]) == length &&
+		    strncmp(line, controlCommandNames[i], length) == 0)
+			request->command = (enum ControlCommand) i;
+
+	switch (request->command)
+	{
+	case CONTROL_COMMAND_COUNT:
+		*error = "Unknown command";
+		return false;
+	case CONTROL_PLAY:
+		if (!argument[0] || strlen(argument) >= sizeof(request->argument))
+		{
+			*error = "Please supply a file";
+			return false;
+		}
+		strcpy(request->argument, argument);
+		return true;
+	case CONTROL_SEEK:
+	{
+		// +s and -s are relative, others are times as accepted by export
+		request->relative = argument[0] == '+' || argument[0] == '-';
+		char* end = NULL;
+		if (request->relative)
+			request->seconds = strtod(argument, &end);
+		if (request->relative ?
+		    end == argument || *end != '\0' || !isfinite(request->seconds) :
+		    !export_parse_time(argument, &request->seconds))
+		{
+			*error = "Please supply seconds, [HH:]MM:SS or +/-seconds";
+			return false;
+		}
+		return true;
+	}
+	case CONTROL_TRICK:
+	{
+		char* end = NULL;
+		long const speed = strtol(argument, &end, 10);
+		if (end == argument || *end != '\0' ||
+		    speed < -TRICK_SPEED_MAX || speed > TRICK_SPEED_MAX ||
+		    !trick_speed_valid((int) speed))
+		{
+			*error = "Please supply 0 or a speed of 2 to 32, negative to rewind";
+			return false;
+		}
+		request->speed = (int) speed;
+		return true;
+	}
+	default:
+		if (argument[0])
+		{
+			*error = "Unexpected argument";
+			return false;
+		}
+		return true;
+	}
+}
+size_t control_json_string(char* dst, size_t size, char const* src)
+{
+	static char const hex[] = "0123456789abcdef";
+	if (size < 3)
+	{
+		if (size) dst[0] = '\0';
+		return 0;
+	}
+	size_t n = 0;
+	dst[n++] = '"';
+	// Room for the closing quote and the null
+	for (; *src && n + 2 < size; ++src)
+	{
+		unsigned char const c = *src;
+		char escape = 0;
+		switch (c)
+		{
+		case '"': escape = '"'; break;
+		case '\\': escape = '\\'; break;
+		case '\n': escape = 'n'; break;
+		case '\r': escape = 'r'; break;
+		case '\t': escape = 't'; break;
+		default: break;
+		}
+		if (escape || c < 0x20)
+		{
+			size_t const width = escape ? 2 : 6;
+			if (n + width + 2 > size) break;
+			dst[n++] = '\\';
+			if (escape)
+				dst[n++] = escape;
+			else
+			{
+				memcpy(dst + n, "u00", 3);
+				dst[n + 3] = hex[c >> 4];
+				dst[n + 4] = hex[c & 0xF];
+				n += 5;
+			}
+		}
+		else
+			dst[n++] = c;
+	}
+	dst[n++] = '"';
+	dst[n] = '\0';
+	return n;
+}
+/**
+ * @brief Writes {"ok":false,"error":...} into dst.
+ */
+static void control_json_error(char* dst, size_t size, char const* error)
+{
+	char quoted[256];
+	control_json_string(quoted, sizeof(quoted), error);
+	snprintf(dst, size, "{\"ok\":false,\"error\":%s}", quoted);
+}
+/**
+ * @brief Writes a number, or null if it is not finite.
+ */
+static char const* control_json_number(char* dst, size_t size, double value)
+{
+	if (isfinite(value))
+		snprintf(dst, size, "%.3f", value);
+	else
+		snprintf(dst, size, "null");
+	return dst;
+}
+/**
+ * @brief Writes the stats reply from the published snapshot and the memory
+ *  accounting, all read without locks.
+ */
+static void control_stats(char* dst, size_t size)
+{
+	struct PlaybackSnapshot snapshot;
+	playback_snapshot(&snapshot);
+	char fileName[512], position[32], duration[32];
+	control_json_string(fileName, sizeof(fileName), snapshot.fileName);
+	int n = snprintf(dst, size,
+	  "{\"ok\":true,\"playing\":%s,\"paused\":%s,\"live\":%s,\"file\":%s,"
+	  "\"position\":%s,\"duration\":%s,\"clock\":\"%s\",\"speed\":%.2f,"
+	  "\"trick\":%d,\"quality\":\"%s\",\"frames\":{\"presented\":%llu,\"late\":%llu,"
+	  "\"dropped\":%llu,\"repeated\":%llu},\"audioUnderruns\":%llu,"
+	  "\"sync\":{\"aheadP99\":%.4f,\"behindP99\":%.4f,\"latenessP99\":%.4f},"
+	  "\"playbacks\":%llu,\"memory\":{",
+	  snapshot.playing ? "true" : "false", snapshot.paused ? "true" : "false",
+	  snapshot.live ? "true" : "false", snapshot.fileName[0] ? fileName : "null",
+	  control_json_number(position, sizeof(position), snapshot.position),
+	  control_json_number(duration, sizeof(duration), snapshot.duration),
+	  clock_source_name(snapshot.master), snapshot.speed, snapshot.trickSpeed,
+	  governor_level_name(snapshot.level),
+	  (unsigned long long) snapshot.framesPresented,
+	  (unsigned long long) snapshot.framesLate,
+	  (unsigned long long) snapshot.framesDropped,
+	  (unsigned long long) snapshot.framesRepeated,
+	  (unsigned long long) snapshot.audioUnderruns,
+	  snapshot.aheadP99, snapshot.behindP99, snapshot.latenessP99,
+	  (unsigned long long) snapshot.nPlaybacks);
+	for (unsigned i = 0; i < MEM_COUNT && n > 0 && (size_t) n < size; ++i)
+		n += snprintf(dst + n, size - n, "\"%s\":%lld,",
+		              mem_category_name((enum MemCategory) i),
+		              (long long) memstats_get((enum MemCategory) i));
+	if (n > 0 && (size_t) n < size)
+		snprintf(dst + n, size - n, "\"total\":%lld,\"rss\":%llu}}",
+		         (long long) memstats_total(),
+		         (unsigned long long) memstats_rss());
+}
+
+static void ControlRequest_release(struct ControlRequest* const request)
+{
+	if (atomic_fetch_sub(&request->refs, 1) == 1)
+	{
+		SDL_DestroySemaphore(request->done);
+		free(request);
+	}
+}
+struct ControlRequest* control_event_request(SDL_Event const* event)
+{
+	struct ControlRequest* const request = event->user.data1;
+	// The client holds the other reference while it waits
+	if (atomic_load(&request->refs) < 2)
+	{
+		ControlRequest_release(request);
+		return NULL;
+	}
+	return request;
+}
+void ControlRequest_reply(struct ControlRequest* const request,
+                          char const* error)
+{
+	if (error)
+		control_json_error(request->reply, sizeof(request->reply), error);
+	else
+		snprintf(request->reply, sizeof(request->reply), "{\"ok\":true}");
+	SDL_SemPost(request->done);
+#ifdef __unix__
+	// The pipe is closed by ControlServer_stop, on this thread, after the
+	// client stopped waiting
+	int const wake = atomic_load(&request->wake);
+	char const byte = 0;
+	if (wake >= 0 && write(wake, &byte, 1) < 0 && errno != EAGAIN)
+		fprintf(stderr, "[Control] Unable to wake the control thread\n");
+#endif
+	ControlRequest_release(request);
+}
+void control_reject_pending(char const* error)
+{
+	SDL_Event event;
+	while (SDL_PeepEvents(&event, 1, SDL_GETEVENT, CHAL_EVENT_CONTROL,
+	                      CHAL_EVENT_CONTROL) > 0)
+	{
+		struct ControlRequest* const request = control_event_request(&event);
+		if (request) ControlRequest_reply(request, error);
+	}
+}
+/**
+ * @brief Executes a command line. Commands other than stats are sent to the
+ *  main thread, which writes to wake once it replied.
+ * @return The request waiting for the main thread. NULL if the JSON reply was
+ *  written into dst at once.
+ */
+static struct ControlRequest* control_submit(char const* line, char* dst,
+                                             size_t size, int wake)
+{
+	struct ControlRequest* const request = calloc(1,
+	                                       sizeof(struct ControlRequest));
+	char const* error = NULL;
+	if (!request)
+	{
+		control_json_error(dst, size, "Out of memory");
+		return NULL;
+	}
+	if (!control_parse(line, request, &error))
+	{
+		control_json_error(dst, size, error);
+		free(request);
+		return NULL;
+	}
+	if (request->command == CONTROL_STATS)
+	{
+		control_stats(dst, size);
+		free(request);
+		return NULL;
+	}
+	if (request->command == CONTROL_QUIT)
+		atomic_store(&controlQuit, true);
+	if (!control_receiver())
+	{
+		if (request->command == CONTROL_QUIT)
+			snprintf(dst, size, "{\"ok\":true}");
+		else
+			control_json_error(dst, size, "Nothing is playing");
+		free(request);
+		return NULL;
+	}
+
+	request->done = SDL_CreateSemaphore(0);
+	atomic_init(&request->wake, wake);
+	atomic_init(&request->refs, 2);
+	SDL_Event event;
+	memset(&event, 0, sizeof(SDL_Event));
+	event.type = CHAL_EVENT_CONTROL;
+	event.user.data1 = request;
+	if (!request->done || SDL_PushEvent(&event) <= 0)
+	{
+		control_json_error(dst, size, "Unable to reach the player");
+		if (request->done) SDL_DestroySemaphore(request->done);
+		free(request);
+		return NULL;
+	}
+	return request;
+}
+
+#ifdef __unix__
+
+/**
+ * @brief Releases the request of a client that stops waiting for its reply.
+ */
+static void ControlRequest_abandon(struct ControlRequest* const request)
+{
+	atomic_store(&request->wake, -1);
+	ControlRequest_release(request);
+}
+static void ControlServer_close_client(struct ControlServer* const server,
+                                       unsigned index)
+{
+	struct ControlClient* const client = &server->clients[index];
+	if (client->pending) ControlRequest_abandon(client->pending);
+	close(client->fd);
+	*client = server->clients[--server->nClients];
+}
+/**
+ * @brief Sends a reply line to a client.
+ * @return false if the client must be disconnected.
+ */
+static bool ControlServer_reply(struct ControlServer* const server,
+                                struct ControlClient* const client,
+                                char const* reply)
+{
+	char line[CONTROL_REPLY_MAX + 1];
+	int const length = snprintf(line, sizeof(line), "%s\n", reply);
+	atomic_fetch_add(&server->nCommands, 1);
+	// Replies are small. A client whose socket is full is not reading them
+	return send(client->fd, line, length, MSG_NOSIGNAL) == length;
+}
+/**
+ * @brief Executes the complete lines received from a client, up to the first
+ *  that waits for the main thread.
+ * @return false if the client must be disconnected.
+ */
+static bool ControlServer_execute(struct ControlServer* const server,
+                                  struct ControlClient* const client)
+{
+	char reply[CONTROL_REPLY_MAX];
+	char* begin = client->line;
+	char* end;
+	bool connected = true;
+	while (connected && !client->pending &&
+	       (end = memchr(begin, '\n', client->line + client->length - begin)))
+	{
+		*end = '\0';
+		if (end > begin && end[-1] == '\r') end[-1] = '\0';
+		char const* const line = begin;
+		begin = end + 1;
+		if (!*line) continue;
+		client->pending = control_submit(line, reply, sizeof(reply),
+		                                 server->wake[1]);
+		if (client->pending)
+			client->deadline = SDL_GetTicks() + CONTROL_TIMEOUT;
+		else
+			connected = ControlServer_reply(server, client, reply);
+	}
+	client->length -= begin - client->line;
+	memmove(client->line, begin, client->length);
+	// No line break within CONTROL_LINE_MAX
+	return connected && (client->pending ||
+	                     client->length < sizeof(client->line));
+}
+/**
+ * @brief Receives from a client and executes its complete lines.
+ * @return false if the client must be disconnected.
+ */
+static bool ControlServer_serve(struct ControlServer* const server,
+                                struct ControlClient* const client)
+{
+	ssize_t const received = recv(client->fd, client->line + client->length,
+	                              sizeof(client->line) - client->length, 0);
+	if (received == 0) return false;
+	if (received < 0) return errno == EAGAIN || errno == EINTR;
+	client->length += received;
+	return ControlServer_execute(server, client);
+}
+/**
+ * @brief Answers the pending request of a client once the main thread
+ *  replied or at its deadline, then executes the lines received meanwhile.
+ * @return false if the client must be disconnected.
+ */
+static bool ControlServer_complete(struct ControlServer* const server,
+                                   struct ControlClient* const client,
+                                   uint32_t now)
+{
+	struct ControlRequest* const request = client->pending;
+	char timedOut[128];
+	char const* reply = request->reply;
+	if (SDL_SemTryWait(request->done) != 0)
+	{
+		if (!SDL_TICKS_PASSED(now, client->deadline)) return true;
+		control_json_error(timedOut, sizeof(timedOut), "Timed out");
+		reply = timedOut;
+	}
+	bool const connected = ControlServer_reply(server, client, reply);
+	ControlRequest_abandon(request);
+	client->pending = NULL;
+	return connected && ControlServer_execute(server, client);
+}
+static int control_thread(struct ControlServer* const server)
+{
+	struct pollfd fds[CONTROL_CLIENTS_MAX + 2];
+	while (!atomic_load(&server->quit))
+	{
+		fds[0] = (struct pollfd) { .fd = server->wake[0], .events = POLLIN };
+		fds[1] = (struct pollfd) { .fd = server->fd, .events = POLLIN };
+		// Clients waiting for a reply are not read, and set the timeout
+		uint32_t now = SDL_GetTicks();
+		int timeout = -1;
+		unsigned const nClients = server->nClients;
+		for (unsigned i = 0; i < nClients; ++i)
+		{
+			struct ControlClient const* const client = &server->clients[i];
+			fds[i + 2] = (struct pollfd)
+			{
+				.fd = client->fd, .events = client->pending ? 0 : POLLIN
+			};
+			if (!client->pending) continue;
+			int const left = SDL_TICKS_PASSED(now, client->deadline) ? 0 :
+			                 (int) (client->deadline - now);
+			if (timeout < 0 || left < timeout) timeout = left;
+		}
+		if (poll(fds, nClients + 2, timeout) < 0)
+		{
+			if (errno == EINTR) continue;
+			fprintf(stderr, "[Control] poll: %s\n", strerror(errno));
+			break;
+		}
+		if (fds[0].revents & POLLIN)
+		{
+			char bytes[64];
+			while (read(server->wake[0], bytes, sizeof(bytes)) > 0);
+		}
+		now = SDL_GetTicks();
+		// Backwards, since closing moves the last client into the slot
+		for (unsigned i = nClients; i-- > 0;)
+		{
+			struct ControlClient* const client = &server->clients[i];
+			// Only a hang up or an error is polled while waiting
+			bool connected = true;
+			if (fds[i + 2].revents)
+				connected = !client->pending && ControlServer_serve(server, client);
+			if (connected && client->pending)
+				connected = ControlServer_complete(server, client, now);
+			if (!connected)
+				ControlServer_close_client(server, i);
+		}
+		if (fds[1].revents & POLLIN)
+		{
+			int const fd = accept(server->fd, NULL, NULL);
+			if (fd >= 0 && server->nClients < CONTROL_CLIENTS_MAX &&
+			    fcntl(fd, F_SETFL, O_NONBLOCK) == 0)
+				server->clients[server->nClients++] =
+					(struct ControlClient) { .fd = fd };
+			else if (fd >= 0)
+				close(fd);
+		}
+	}
+	while (server->nClients)
+		ControlServer_close_client(server, 0);
+	return 0;
+}
+/**
+ * @return A socket bound to addr and listening. -1 if failed.
+ */
+static int control_listen(struct sockaddr_un const* addr)
+{
+	int const fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	if (fcntl(fd, F_SETFD, FD_CLOEXEC) == 0 &&
+	    bind(fd, (struct sockaddr const*) addr, sizeof(*addr)) == 0 &&
+	    listen(fd, CONTROL_CLIENTS_MAX) == 0)
+		return fd;
+	int const error = errno;
+	close(fd);
+	errno = error;
+	return -1;
+}
+bool ControlServer_start(struct ControlServer* const server, char const* path)
+{
+	memset(server, 0, sizeof(struct ControlServer));
+	server->fd = -1;
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(addr.sun_path) ||
+	    strlen(path) >= sizeof(server->path))
+	{
+		fprintf(stderr, "[Control] Socket path is too long: %s\n", path);
+		return false;
+	}
+	strcpy(addr.sun_path, path);
+	int fd = control_listen(&addr);
+	if (fd < 0 && errno == EADDRINUSE)
+	{
+		// Replaced only if no process accepts connections on it
+		int const probe = socket(AF_UNIX, SOCK_STREAM, 0);
+		bool const stale = probe >= 0 &&
+		                   connect(probe, (struct sockaddr const*) &addr,
+		                           sizeof(addr)) < 0 && errno == ECONNREFUSED;
+		if (probe >= 0) close(probe);
+		if (stale && unlink(path) == 0)
+			fd = control_listen(&addr);
+		else
+			errno = EADDRINUSE;
+	}
+	if (fd < 0)
+	{
+		fprintf(stderr, "[Control] Unable to listen on %s: %s\n", path,
+		        strerror(errno));
+		return false;
+	}
+	bool const piped = pipe(server->wake) == 0;
+	if (!piped || fcntl(server->wake[0], F_SETFL, O_NONBLOCK) < 0 ||
+	    fcntl(server->wake[1], F_SETFL, O_NONBLOCK) < 0)
+	{
+		if (piped)
+		{
+			close(server->wake[0]);
+			close(server->wake[1]);
+		}
+		close(fd);
+		unlink(path);
+		return false;
+	}
+	strcpy(server->path, path);
+	server->fd = fd;
+	atomic_init(&server->quit, false);
+	atomic_init(&server->nCommands, 0);
+	server->thread = SDL_CreateThread((SDL_ThreadFunction) control_thread,
+	                                  "control", server);
+	if (!server->thread)
+	{
+		ControlServer_stop(server);
+		return false;
+	}
+	fprintf(stdout, "[Control] Listening on %s\n", path);
+	return true;
+}
+void ControlServer_stop(struct ControlServer* const server)
+{
+	if (server->fd < 0) return;
+	atomic_store(&server->quit, true);
+	if (server->thread)
+	{
+		char const byte = 0;
+		if (write(server->wake[1], &byte, 1) < 0)
+			fprintf(stderr, "[Control] Unable to wake the control thread\n");
+		SDL_WaitThread(server->thread, NULL);
+	}
+	close(server->wake[0]);
+	close(server->wake[1]);
+	close(server->fd);
+	unlink(server->path);
+	server->fd = -1;
+	fprintf(stdout, "[Control] %llu commands served\n",
+	        (unsigned long long) atomic_load(&server->nCommands));
+}
+
+#else // !__unix__
+
+bool ControlServer_start(struct ControlServer* const server, char const* path)
+{
+	memset(server, 0, sizeof(struct ControlServer));
+	server->fd = -1;
+	fprintf(stderr, "[Control] Unix domain sockets are unavailable: %s\n",
+	        path);
+	(void) control_submit;
+	return false;
+}
+void ControlServer_stop(struct ControlServer* const server)
+{
+	(void) server;
+}
+
+#endif // __unix__
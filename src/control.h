@@ -0,0 +1,135 @@
+#ifndef CHALCOCITE__CONTROL_H_
+#define CHALCOCITE__CONTROL_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <SDL2/SDL.h>
+
+#define CONTROL_CLIENTS_MAX 32
+#define CONTROL_LINE_MAX 1024 // Bytes of a command. Longer lines are refused
+#define CONTROL_REPLY_MAX 2048
+#define CONTROL_PATH_MAX 108 // sun_path of struct sockaddr_un
+// Milliseconds a command waits for the main thread to execute it
+#define CONTROL_TIMEOUT 2000
+
+/**
+ * @brief Line commands of control clients.
+ */
+enum ControlCommand
+{
+	CONTROL_PLAY, ///< Plays a file after stopping the current playback
+	CONTROL_PAUSE,
+	CONTROL_RESUME,
+	CONTROL_SEEK,
+	CONTROL_STOP, ///< Stops the current playback
+	CONTROL_QUIT, ///< Stops and ends the playlist or --serve
+	CONTROL_STATS, ///< Answered by the control thread from a snapshot
+	CONTROL_TRICK, ///< Fast-forward or rewind, as of trick_speed_next
+	CONTROL_COMMAND_COUNT
+};
+
+/**
+ * Received by the main thread in a CHAL_EVENT_CONTROL event, taken with
+ *  \ref control_event_request and answered with \ref ControlRequest_reply.
+ * @brief Command of a control client executed by the main thread.
+ */
+struct ControlRequest
+{
+	enum ControlCommand command;
+	char argument[CONTROL_LINE_MAX]; ///< File of CONTROL_PLAY
+	double seconds; ///< Target of CONTROL_SEEK
+	bool relative; ///< CONTROL_SEEK from the current position
+	int speed; ///< Of CONTROL_TRICK. 0 for normal playback
+	char reply[CONTROL_REPLY_MAX]; ///< One JSON object
+	SDL_sem* done;
+	// Written to once replied. -1 once the client stopped waiting
+	_Atomic int wake;
+	_Atomic int refs; ///< Held by the event and by the waiting client
+};
+
+/**
+ * @brief Parses a command line without its line break.
+ * @param[out] error Reason if the line is not a command
+ * @return false if the line is not a command.
+ */
+bool control_parse(char const* line, struct ControlRequest* const,
+                   char const** error);
+/**
+ * @brief Writes src into dst as a quoted JSON string, truncated to fit.
+ * @return Length written without the terminating null.
+ */
+size_t control_json_string(char* dst, size_t size, char const* src);
+
+/**
+ * @return The request of a CHAL_EVENT_CONTROL event. NULL if its client timed
+ *  out, in which case the request is released.
+ */
+struct ControlRequest* control_event_request(SDL_Event const* event);
+/**
+ * @brief Answers a request taken from its event and releases it.
+ * @param[in] error NULL if the command succeeded
+ */
+void ControlRequest_reply(struct ControlRequest* const, char const* error);
+/**
+ * @brief Answers with error the requests of the events left in the SDL queue.
+ */
+void control_reject_pending(char const* error);
+
+/**
+ * @brief Marks whether the main thread handles CHAL_EVENT_CONTROL events.
+ *  Commands other than stats fail at once while none does.
+ */
+void control_set_receiver(bool);
+bool control_receiver(void);
+/**
+ * @return true once a client sent quit.
+ */
+bool control_quit(void);
+
+struct ControlClient
+{
+	int fd;
+	char line[CONTROL_LINE_MAX]; ///< Received part of the next command
+	size_t length;
+	/**
+	 * Command sent to the main thread. The lines after it wait for its reply,
+	 *  until deadline in SDL_GetTicks(). NULL if none.
+	 */
+	struct ControlRequest* pending;
+	uint32_t deadline;
+};
+
+/**
+ * Must be started with \ref ControlServer_start and stopped with
+ *  \ref ControlServer_stop.
+ * @brief Unix domain socket that accepts line commands and answers each with
+ *  a line of JSON. Clients are served by one thread with non-blocking sockets,
+ *  and a client that does not read its replies is disconnected. The thread
+ *  keeps serving other clients while one waits for the main thread.
+ */
+struct ControlServer
+{
+	char path[CONTROL_PATH_MAX];
+	int fd; ///< Listening socket. -1 if not started
+	int wake[2]; ///< Pipe that interrupts the poll of the thread. Non-blocking
+	struct ControlClient clients[CONTROL_CLIENTS_MAX];
+	unsigned nClients;
+	SDL_Thread* thread;
+	_Atomic bool quit;
+	_Atomic uint64_t nCommands;
+};
+
+/**
+ * @brief Listens on path, replacing a stale socket left by a previous process.
+ * @return false if the socket cannot be created.
+ */
+bool ControlServer_start(struct ControlServer* const, char const* path);
+/**
+ * @brief Closes all clients and removes the socket. No-op if not started.
+ */
+void ControlServer_stop(struct ControlServer* const);
+
+#endif // !CHALCOCITE__CONTROL_H_
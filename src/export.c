@@ -0,0 +1,249 @@
+#include "export.h"
+
+#include <stdlib.h>
+
+#include <libavformat/avformat.h>
+#include <libavutil/avstring.h>
+#include <libavutil/parseutils.h>
+
+#include "media.h"
+#include "stats.h"
+
+// Muxers that write edit lists, which hide the frames before an accurate cut
+#define EXPORT_EDIT_LIST_MUXERS "mov,mp4,ipod,ismv,3gp,3g2,psp,f4v"
+
+/**
+ * @brief Adds an output stream for each audio, video and subtitle stream the
+ *  muxer accepts.
+ * @param[out] map Index of the output stream of each input stream. -1 if the
+ *  stream is not copied.
+ * @return Number of output streams.
+ */
+static unsigned export_streams(struct AVFormatContext* const fc,
+                               struct AVFormatContext* const oc, int* const map)
+{
+	unsigned n = 0;
+	for (unsigned i = 0; i < fc->nb_streams; ++i)
+	{
+		map[i] = -1;
+		struct AVStream const* const ist = fc->streams[i];
+		enum AVMediaType const type = ist->codecpar->codec_type;
+		if (type != AVMEDIA_TYPE_AUDIO && type != AVMEDIA_TYPE_VIDEO &&
+		    type != AVMEDIA_TYPE_SUBTITLE)
+			continue;
+		if (avformat_query_codec(oc->oformat, ist->codecpar->codec_id,
+		                         FF_COMPLIANCE_NORMAL) == 0)
+		{
+			fprintf(stderr, "Stream %u: %s is not supported by %s, skipped\n", i,
+			        avcodec_get_name(ist->codecpar->codec_id), oc->oformat->name);
+			continue;
+		}
+		struct AVStream* const ost = avformat_new_stream(oc, NULL);
+		if (!ost || avcodec_parameters_copy(ost->codecpar, ist->codecpar) < 0)
+			continue;
+		// The tag of the input container may not exist in the output one
+		ost->codecpar->codec_tag = 0;
+		ost->time_base = ist->time_base;
+		map[i] = ost->index;
+		++n;
+	}
+	return n;
+}
+/**
+ * @brief Seeks to the last key frame at or before timestamp.
+ * @param[in] timestamp In AV_TIME_BASE
+ * @return Presentation time of the key frame in AV_TIME_BASE. timestamp if
+ *  there is no video stream. AV_NOPTS_VALUE if seeking fails.
+ */
+static int64_t export_keyframe(struct AVFormatContext* const fc, int indexV,
+                               int64_t timestamp)
+{
+	if (av_seek_frame(fc, -1, timestamp, AVSEEK_FLAG_BACKWARD) < 0)
+		return AV_NOPTS_VALUE;
+	if (indexV < 0) return timestamp;
+
+	int64_t keyframe = timestamp;
+	struct AVPacket packet;
+	while (av_read_frame(fc, &packet) >= 0)
+	{
+		bool const found = packet.stream_index == indexV &&
+		                   (packet.flags & AV_PKT_FLAG_KEY);
+		if (found)
+		{
+			int64_t const pts = packet.pts != AV_NOPTS_VALUE ? packet.pts :
+			                    packet.dts;
+			if (pts != AV_NOPTS_VALUE)
+				keyframe = av_rescale_q(pts, fc->streams[indexV]->time_base,
+				                        AV_TIME_BASE_Q);
+		}
+		av_packet_unref(&packet);
+		if (found) break;
+	}
+	return keyframe;
+}
+/**
+ * @brief Copies the packets of the mapped streams from cut until end.
+ * @return Number of packets written. Negative AVERROR on failure.
+ */
+static int64_t export_copy(struct AVFormatContext* const fc,
+                           struct AVFormatContext* const oc,
+                           int const* const map, int64_t cut, int64_t end)
+{
+	unsigned const n = fc->nb_streams;
+	bool* const started = calloc(n, sizeof(bool));
+	bool* const finished = calloc(n, sizeof(bool));
+	if (!started || !finished)
+	{
+		free(started);
+		free(finished);
+		return AVERROR(ENOMEM);
+	}
+	unsigned nActive = oc->nb_streams;
+	int64_t nPackets = 0;
+	struct AVPacket packet;
+	while (nActive && av_read_frame(fc, &packet) >= 0)
+	{
+		unsigned const i = packet.stream_index;
+		if (map[i] < 0 || finished[i])
+		{
+			av_packet_unref(&packet);
+			continue;
+		}
+		struct AVStream const* const ist = fc->streams[i];
+		AVRational const timeBase = ist->time_base;
+		int64_t const dts = packet.dts != AV_NOPTS_VALUE ? packet.dts :
+		                    packet.pts;
+		if (dts != AV_NOPTS_VALUE &&
+		    av_compare_ts(dts, timeBase, end, AV_TIME_BASE_Q) >= 0)
+		{
+			finished[i] = true;
+			--nActive;
+			av_packet_unref(&packet);
+			continue;
+		}
+		// Video begins at a key frame, other streams at the cut
+		if (!started[i])
+		{
+			if (ist->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+				started[i] = packet.flags & AV_PKT_FLAG_KEY;
+			else
+				started[i] = packet.pts == AV_NOPTS_VALUE ||
+				             av_compare_ts(packet.pts + packet.duration, timeBase, cut,
+				                           AV_TIME_BASE_Q) > 0;
+			if (!started[i])
+			{
+				av_packet_unref(&packet);
+				continue;
+			}
+		}
+
+		int64_t const offset = av_rescale_q(cut, AV_TIME_BASE_Q, timeBase);
+		if (packet.pts != AV_NOPTS_VALUE) packet.pts -= offset;
+		if (packet.dts != AV_NOPTS_VALUE) packet.dts -= offset;
+		av_packet_rescale_ts(&packet, timeBase, oc->streams[map[i]]->time_base);
+		packet.stream_index = map[i];
+		packet.pos = -1;
+		// Takes the packet
+		int const result = av_interleaved_write_frame(oc, &packet);
+		if (result < 0)
+		{
+			nPackets = result;
+			break;
+		}
+		++nPackets;
+	}
+	free(started);
+	free(finished);
+	return nPackets;
+}
+bool export_parse_time(char const* str, double* const seconds)
+{
+	int64_t microseconds;
+	if (av_parse_time(&microseconds, str, 1) < 0) return false;
+	*seconds = microseconds / 1e6;
+	return true;
+}
+bool export_segment(char const* fileIn, double start, double end,
+                    char const* fileOut, bool accurate)
+{
+	uint64_t const timeBegin = stats_now();
+	struct AVFormatContext* fc = av_open_file(fileIn);
+	if (!fc) return false;
+
+	struct AVFormatContext* oc = NULL;
+	int* const map = malloc(fc->nb_streams * sizeof(int));
+	bool success = false;
+	bool created = false; // The output file is removed on failure
+	int result = avformat_alloc_output_context2(&oc, NULL, NULL, fileOut);
+	if (result < 0 || !map)
+	{
+		fprintf(stderr, "Unable to find a muxer for %s\n", fileOut);
+		goto complete;
+	}
+	if (accurate && !av_match_name(oc->oformat->name, EXPORT_EDIT_LIST_MUXERS))
+	{
+		fprintf(stderr, "Accurate cuts need the edit lists of MP4 or MOV, not "
+		        "%s\n", oc->oformat->name);
+		goto complete;
+	}
+	if (!export_streams(fc, oc, map))
+	{
+		fprintf(stderr, "No stream to export\n");
+		goto complete;
+	}
+
+	// Times are from the start of the file, whose timestamps may not begin at 0
+	int64_t const origin = fc->start_time != AV_NOPTS_VALUE ? fc->start_time : 0;
+	int64_t const timestampStart = origin +
+	                               (start > 0.0 ? start * AV_TIME_BASE : 0);
+	int64_t const timestampEnd = origin + end * AV_TIME_BASE;
+	int const indexV = av_find_best_stream(fc, AVMEDIA_TYPE_VIDEO, -1, -1, NULL,
+	                                       0);
+	int64_t const keyframe = export_keyframe(fc, indexV, timestampStart);
+	// Seeking again restarts the copy at the key frame
+	if (keyframe == AV_NOPTS_VALUE ||
+	    av_seek_frame(fc, -1, timestampStart, AVSEEK_FLAG_BACKWARD) < 0)
+	{
+		fprintf(stderr, "Unable to seek in %s\n", fileIn);
+		goto complete;
+	}
+
+	if (!(oc->oformat->flags & AVFMT_NOFILE) &&
+	    (result = avio_open(&oc->pb, fileOut, AVIO_FLAG_WRITE)) < 0)
+	{
+		fprintf(stderr, "Unable to open %s: %s\n", fileOut, av_err2str(result));
+		goto complete;
+	}
+	created = !(oc->oformat->flags & AVFMT_NOFILE);
+	if ((result = avformat_write_header(oc, NULL)) < 0)
+	{
+		fprintf(stderr, "Unable to write the header of %s: %s\n", fileOut,
+		        av_err2str(result));
+		goto complete;
+	}
+	int64_t const cut = accurate ? timestampStart : keyframe;
+	int64_t const nPackets = export_copy(fc, oc, map, cut, timestampEnd);
+	result = av_write_trailer(oc);
+	if (nPackets < 0 || result < 0)
+	{
+		fprintf(stderr, "Unable to write %s: %s\n", fileOut,
+		        av_err2str(nPackets < 0 ? (int) nPackets : result));
+		goto complete;
+	}
+	fprintf(stdout, "Exported %lld packets of %u streams from %.3fs (key frame "
+	        "%.3fs) to %.3fs in %.1fms\n", (long long) nPackets, oc->nb_streams,
+	        (cut - origin) / (double) AV_TIME_BASE,
+	        (keyframe - origin) / (double) AV_TIME_BASE, end,
+	        (stats_now() - timeBegin) / 1e6);
+	success = true;
+
+complete:
+	if (oc && !(oc->oformat->flags & AVFMT_NOFILE))
+		avio_closep(&oc->pb);
+	if (created && !success)
+		remove(fileOut);
+	avformat_free_context(oc);
+	free(map);
+	avformat_close_input(&fc);
+	return success;
+}
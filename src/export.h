@@ -0,0 +1,30 @@
+#ifndef CHALCOCITE__EXPORT_H_
+#define CHALCOCITE__EXPORT_H_
+
+#include <stdbool.h>
+
+/**
+ * @brief Copies the audio, video and subtitle packets between start and end
+ *  of a file into a new file without decoding. The muxer is chosen from the
+ *  extension of the output name.
+ *
+ * The copy begins at the last key frame at or before start. Timestamps are
+ *  rebased so that the output begins at 0. If accurate is set, the rebase is
+ *  on start instead: the frames between the key frame and start get negative
+ *  timestamps, which only the edit lists of MP4 and MOV hide from playback.
+ *  Other muxers are refused. Each stream ends at its first packet decoded at
+ *  or after end. A partly written output is removed.
+ * @param[in] start Second from the start of the file
+ * @param[in] end Second. Greater than start
+ * @return false if the input cannot be opened or the output cannot be
+ *  written. Prints the error to stderr.
+ */
+bool export_segment(char const* fileIn, double start, double end,
+                    char const* fileOut, bool accurate);
+/**
+ * @brief Parses a time as seconds ("90.5") or [HH:]MM:SS[.m...] ("1:30.5").
+ * @return false if str is not a time.
+ */
+bool export_parse_time(char const* str, double* const seconds);
+
+#endif // !CHALCOCITE__EXPORT_H_
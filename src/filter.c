@@ -0,0 +1,108 @@
+#include "filter.h"
+
+#include <string.h>
+
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
+
+#include "scheduler.h"
+
+bool VideoFilter_init(struct VideoFilter* const vf, char const* description,
+                      struct AVCodecContext const* const cc,
+                      AVRational timeBase)
+{
+	memset(vf, 0, sizeof(struct VideoFilter));
+	vf->graph = avfilter_graph_alloc();
+	if (!vf->graph)
+	{
+		fprintf(stderr, "Unable to allocate filter graph\n");
+		return false;
+	}
+	// Must be set before the filters are created
+	vf->graph->thread_type = AVFILTER_THREAD_SLICE;
+	vf->graph->nb_threads = scheduler_workers();
+
+	char args[256];
+	AVRational aspect = cc->sample_aspect_ratio;
+	if (aspect.num == 0 || aspect.den == 0) aspect = (AVRational) { 1, 1 };
+	snprintf(args, sizeof(args),
+	         "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d",
+	         cc->width, cc->height, cc->pix_fmt, timeBase.num, timeBase.den,
+	         aspect.num, aspect.den);
+
+	AVFilterInOut* outputs = NULL;
+	AVFilterInOut* inputs = NULL;
+	int result = avfilter_graph_create_filter(&vf->source,
+	             avfilter_get_by_name("buffer"), "in", args, NULL, vf->graph);
+	if (result >= 0)
+		result = avfilter_graph_create_filter(&vf->sink,
+		         avfilter_get_by_name("buffersink"), "out", NULL, NULL, vf->graph);
+	if (result < 0) goto fail;
+
+	// The open ends of the description are linked to the source and the sink
+	outputs = avfilter_inout_alloc();
+	inputs = avfilter_inout_alloc();
+	if (!outputs || !inputs)
+	{
+		result = AVERROR(ENOMEM);
+		goto fail;
+	}
+	outputs->name = av_strdup("in");
+	outputs->filter_ctx = vf->source;
+	outputs->pad_idx = 0;
+	outputs->next = NULL;
+	inputs->name = av_strdup("out");
+	inputs->filter_ctx = vf->sink;
+	inputs->pad_idx = 0;
+	inputs->next = NULL;
+
+	result = avfilter_graph_parse_ptr(vf->graph, description, &inputs, &outputs,
+	                                  NULL);
+	if (result >= 0)
+		result = avfilter_graph_config(vf->graph, NULL);
+	if (result < 0) goto fail;
+
+	avfilter_inout_free(&inputs);
+	avfilter_inout_free(&outputs);
+	return true;
+fail:
+	fprintf(stderr, "Invalid filter graph \"%s\": %s\n", description,
+	        av_err2str(result));
+	avfilter_inout_free(&inputs);
+	avfilter_inout_free(&outputs);
+	VideoFilter_destroy(vf);
+	return false;
+}
+void VideoFilter_destroy(struct VideoFilter* const vf)
+{
+	// Frees the filters as well
+	avfilter_graph_free(&vf->graph);
+	vf->source = vf->sink = NULL;
+}
+
+int VideoFilter_push(struct VideoFilter* const vf, struct AVFrame* const frame)
+{
+	return av_buffersrc_add_frame_flags(vf->source, frame,
+	                                    AV_BUFFERSRC_FLAG_KEEP_REF);
+}
+int VideoFilter_pull(struct VideoFilter* const vf, struct AVFrame* const frame)
+{
+	return av_buffersink_get_frame(vf->sink, frame);
+}
+
+int VideoFilter_width(struct VideoFilter const* const vf)
+{
+	return av_buffersink_get_w(vf->sink);
+}
+int VideoFilter_height(struct VideoFilter const* const vf)
+{
+	return av_buffersink_get_h(vf->sink);
+}
+enum AVPixelFormat VideoFilter_format(struct VideoFilter const* const vf)
+{
+	return av_buffersink_get_format(vf->sink);
+}
+AVRational VideoFilter_time_base(struct VideoFilter const* const vf)
+{
+	return av_buffersink_get_time_base(vf->sink);
+}
@@ -0,0 +1,52 @@
+#ifndef CHALCOCITE__FILTER_H_
+#define CHALCOCITE__FILTER_H_
+
+#include <stdbool.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavfilter/avfilter.h>
+
+/**
+ * Must be initialised with \ref VideoFilter_init and destroyed with
+ *  \ref VideoFilter_destroy. A zeroed VideoFilter may be destroyed.
+ * @brief A libavfilter graph between the video decoder and the picture queue,
+ *  described as for ffmpeg -vf, for example "yadif,crop=640:360". Slice
+ *  threaded filters use as many threads as the scheduler has workers.
+ */
+struct VideoFilter
+{
+	AVFilterGraph* graph; ///< NULL if unused
+	AVFilterContext* source; ///< buffer
+	AVFilterContext* sink; ///< buffersink
+};
+
+/**
+ * @param[in] cc Decoder providing the input frames
+ * @param[in] timeBase Time base of the input timestamps
+ * @return false if the description is invalid. Prints the error to stderr.
+ */
+bool VideoFilter_init(struct VideoFilter* const, char const* description,
+                      struct AVCodecContext const* const cc,
+                      AVRational timeBase);
+void VideoFilter_destroy(struct VideoFilter* const);
+
+/**
+ * @brief Feeds a decoded frame. The frame is left untouched.
+ * @param[in] frame NULL ends the input. The pulls then return the frames the
+ *  filters hold back, then AVERROR_EOF.
+ * @return Negative AVERROR on failure.
+ */
+int VideoFilter_push(struct VideoFilter* const, struct AVFrame* const frame);
+/**
+ * @brief Takes a filtered frame. Call until it fails after each push.
+ * @return AVERROR(EAGAIN) if the graph needs more input.
+ */
+int VideoFilter_pull(struct VideoFilter* const, struct AVFrame* const frame);
+
+// Properties of the filtered frames
+int VideoFilter_width(struct VideoFilter const* const);
+int VideoFilter_height(struct VideoFilter const* const);
+enum AVPixelFormat VideoFilter_format(struct VideoFilter const* const);
+AVRational VideoFilter_time_base(struct VideoFilter const* const);
+
+#endif // !CHALCOCITE__FILTER_H_
@@ -0,0 +1,369 @@
+#include "framecache.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include "media.h"
+#include "memstats.h"
+
+void FrameCache_init(struct FrameCache* const cache, int64_t budget)
+{
+	assert(cache);
+	memset(cache, 0, sizeof(struct FrameCache));
+	FrameCacheEntries_init(&cache->entries);
+	Pool_init(&cache->nodes, sizeof(struct FrameCacheEntry),
+	          FRAME_CACHE_POOL_BLOCK);
+	cache->budget = budget > 0 ? budget : 0;
+	cache->mutex = SDL_CreateMutex();
+}
+void FrameCache_destroy(struct FrameCache* const cache)
+{
+	if (!cache) return;
+	for (size_t i = 0; i < FrameCacheEntries_size(&cache->entries); ++i)
+		av_frame_free(&FrameCacheEntries_at(&cache->entries, i)->frame);
+	FrameCacheEntries_destroy(&cache->entries);
+	Pool_destroy(&cache->nodes);
+	cache->leastRecent = cache->mostRecent = NULL;
+	memstats_add(MEM_FRAME_CACHE, -cache->size);
+	cache->size = 0;
+	SDL_DestroyMutex(cache->mutex);
+	cache->mutex = NULL;
+}
+
+static inline struct FrameCacheEntry* FrameCache_entry(
+  struct FrameCache const* const cache, size_t index)
+{
+	return FrameCacheEntries_at(&cache->entries, index);
+}
+/**
+ * @return Index of the first entry at or after pts.
+ */
+static size_t FrameCache_lower_bound(struct FrameCache const* const cache,
+                                     int64_t pts)
+{
+	size_t first = 0, last = FrameCacheEntries_size(&cache->entries);
+	while (first < last)
+	{
+		size_t const middle = first + (last - first) / 2;
+		if (FrameCache_entry(cache, middle)->pts < pts)
+			first = middle + 1;
+		else
+			last = middle;
+	}
+	return first;
+}
+/**
+ * @brief Removes an entry from the order of use. Requires the mutex.
+ */
+static void FrameCache_unlink(struct FrameCache* const cache,
+                              struct FrameCacheEntry* const entry)
+{
+	if (entry->prev) entry->prev->next = entry->next;
+	else cache->leastRecent = entry->next;
+	if (entry->next) entry->next->prev = entry->prev;
+	else cache->mostRecent = entry->prev;
+	entry->prev = entry->next = NULL;
+}
+/**
+ * @brief Adds an unlinked entry as the most recently used. Requires the mutex.
+ */
+static void FrameCache_append(struct FrameCache* const cache,
+                              struct FrameCacheEntry* const entry)
+{
+	entry->prev = cache->mostRecent;
+	if (cache->mostRecent) cache->mostRecent->next = entry;
+	else cache->leastRecent = entry;
+	cache->mostRecent = entry;
+}
+/**
+ * @brief Makes an entry the most recently used. Requires the mutex.
+ */
+static void FrameCache_touch(struct FrameCache* const cache,
+                             struct FrameCacheEntry* const entry)
+{
+	if (cache->mostRecent == entry) return;
+	FrameCache_unlink(cache, entry);
+	FrameCache_append(cache, entry);
+}
+/**
+ * @brief Whether no frame is missing between an entry and the later
+ *  timestamp. Half a frame of jitter is tolerated.
+ */
+static bool frame_cache_adjacent(struct FrameCacheEntry const* const entry,
+                                 int64_t later)
+{
+	return later - entry->pts <= entry->duration * 3 / 2;
+}
+static int64_t frame_size(struct AVFrame const* const frame)
+{
+	int64_t size = 0;
+	for (size_t i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; ++i)
+		size += frame->buf[i]->size;
+	return size;
+}
+/**
+ * @brief Evicts the least recently used entries other than keep until the
+ *  cache fits in its budget. Requires the mutex.
+ */
+static void FrameCache_evict(struct FrameCache* const cache, int64_t keep)
+{
+	int64_t const budget = cache->budget * memstats_queue_scale();
+	while (cache->size > budget)
+	{
+		struct FrameCacheEntry* entry = cache->leastRecent;
+		if (entry && entry->pts == keep) entry = entry->next;
+		if (!entry) break;
+		FrameCacheEntries_remove(&cache->entries,
+		                         FrameCache_lower_bound(cache, entry->pts));
+		FrameCache_unlink(cache, entry);
+		cache->size -= entry->size;
+		memstats_add(MEM_FRAME_CACHE, -entry->size);
+		av_frame_free(&entry->frame);
+		Pool_free(&cache->nodes, entry);
+		++cache->nEvictions;
+	}
+}
+bool FrameCache_put(struct FrameCache* const cache,
+                    struct AVFrame const* frame, int64_t pts, int64_t duration)
+{
+	if (!FrameCache_enabled(cache) || pts == AV_NOPTS_VALUE || !frame->buf[0])
+		return false;
+
+	SDL_LockMutex(cache->mutex);
+	size_t const index = FrameCache_lower_bound(cache, pts);
+	if (index < FrameCacheEntries_size(&cache->entries) &&
+	    FrameCache_entry(cache, index)->pts == pts)
+	{
+		FrameCache_touch(cache, FrameCache_entry(cache, index));
+		SDL_UnlockMutex(cache->mutex);
+		return true;
+	}
+	struct FrameCacheEntry* const entry = Pool_alloc(&cache->nodes);
+	if (entry)
+		*entry = (struct FrameCacheEntry)
+		{
+			.frame = av_frame_clone(frame),
+			.pts = pts,
+			.duration = duration,
+			.size = frame_size(frame)
+		};
+	bool const success = entry && entry->frame &&
+	                     FrameCacheEntries_push_back(&cache->entries, entry);
+	if (success)
+	{
+		// Moves the new entry from the back to its place
+		size_t const n = FrameCacheEntries_size(&cache->entries);
+		struct FrameCacheEntry** const base = FrameCacheEntries_ptr(
+		  &cache->entries, 0);
+		memmove(base + index + 1, base + index,
+		        (n - 1 - index) * sizeof(struct FrameCacheEntry*));
+		base[index] = entry;
+		FrameCache_append(cache, entry);
+		cache->size += entry->size;
+		memstats_add(MEM_FRAME_CACHE, entry->size);
+		FrameCache_evict(cache, pts);
+	}
+	else if (entry)
+	{
+		av_frame_free(&entry->frame);
+		Pool_free(&cache->nodes, entry);
+	}
+	SDL_UnlockMutex(cache->mutex);
+	return success;
+}
+/**
+ * @brief Takes a new reference to an entry and marks it as used. Requires the
+ *  mutex.
+ */
+static struct AVFrame* FrameCache_take(struct FrameCache* const cache,
+                                       size_t index)
+{
+	struct FrameCacheEntry* const entry = FrameCache_entry(cache, index);
+	FrameCache_touch(cache, entry);
+	++cache->nHits;
+	return av_frame_clone(entry->frame);
+}
+struct AVFrame* FrameCache_get(struct FrameCache* const cache, int64_t pts)
+{
+	if (!FrameCache_enabled(cache)) return NULL;
+	SDL_LockMutex(cache->mutex);
+	struct AVFrame* frame = NULL;
+	size_t const index = FrameCache_lower_bound(cache, pts);
+	if (index < FrameCacheEntries_size(&cache->entries) &&
+	    FrameCache_entry(cache, index)->pts == pts)
+		frame = FrameCache_take(cache, index);
+	else
+		++cache->nMisses;
+	SDL_UnlockMutex(cache->mutex);
+	return frame;
+}
+struct AVFrame* FrameCache_step(struct FrameCache* const cache, int64_t pts,
+                                int direction, int64_t* const found)
+{
+	if (!FrameCache_enabled(cache) || pts == AV_NOPTS_VALUE) return NULL;
+	SDL_LockMutex(cache->mutex);
+	struct AVFrame* frame = NULL;
+	size_t const n = FrameCacheEntries_size(&cache->entries);
+	if (direction > 0)
+	{
+		size_t const index = FrameCache_lower_bound(cache, pts + 1);
+		if (index < n)
+		{
+			struct FrameCacheEntry const* const entry =
+			  FrameCache_entry(cache, index);
+			// The frames have about the same duration
+			if (entry->pts - pts <= entry->duration * 3 / 2)
+			{
+				*found = entry->pts;
+				frame = FrameCache_take(cache, index);
+			}
+		}
+	}
+	else
+	{
+		size_t const index = FrameCache_lower_bound(cache, pts);
+		if (index > 0 &&
+		    frame_cache_adjacent(FrameCache_entry(cache, index - 1), pts))
+		{
+			*found = FrameCache_entry(cache, index - 1)->pts;
+			frame = FrameCache_take(cache, index - 1);
+		}
+	}
+	if (!frame) ++cache->nMisses;
+	SDL_UnlockMutex(cache->mutex);
+	return frame;
+}
+int64_t FrameCache_run_begin(struct FrameCache* const cache, int64_t pts)
+{
+	if (!FrameCache_enabled(cache) || pts == AV_NOPTS_VALUE)
+		return AV_NOPTS_VALUE;
+	SDL_LockMutex(cache->mutex);
+	int64_t begin = AV_NOPTS_VALUE;
+	size_t index = FrameCache_lower_bound(cache, pts + 1);
+	if (index > 0 &&
+	    frame_cache_adjacent(FrameCache_entry(cache, index - 1), pts))
+	{
+		--index;
+		while (index > 0 &&
+		       frame_cache_adjacent(FrameCache_entry(cache, index - 1),
+		                            FrameCache_entry(cache, index)->pts))
+			--index;
+		begin = FrameCache_entry(cache, index)->pts;
+	}
+	SDL_UnlockMutex(cache->mutex);
+	return begin;
+}
+void FrameCache_print(struct FrameCache* const cache, FILE* file)
+{
+	if (!FrameCache_enabled(cache)) return;
+	SDL_LockMutex(cache->mutex);
+	fprintf(file, "Frame cache: %zu frames, %.1f of %.1f MiB, %llu hits, "
+	        "%llu misses, %llu evictions\n",
+	        FrameCacheEntries_size(&cache->entries),
+	        cache->size / (1024.0 * 1024.0), cache->budget / (1024.0 * 1024.0),
+	        (unsigned long long) cache->nHits,
+	        (unsigned long long) cache->nMisses,
+	        (unsigned long long) cache->nEvictions);
+	SDL_UnlockMutex(cache->mutex);
+}
+
+// GopDecoder
+
+void GopDecoder_init(struct GopDecoder* const dec,
+                     struct FrameCache* const cache,
+                     char const* fileName, unsigned streamIndex)
+{
+	assert(dec);
+	memset(dec, 0, sizeof(struct GopDecoder));
+	dec->cache = cache;
+	strncpy(dec->fileName, fileName, sizeof(dec->fileName) - 1);
+	dec->streamIndex = streamIndex;
+	dec->target = AV_NOPTS_VALUE;
+	TaskGroup_init(&dec->group);
+}
+void GopDecoder_destroy(struct GopDecoder* const dec)
+{
+	if (!dec) return;
+	GopDecoder_wait(dec);
+	av_frame_free(&dec->frame);
+	avcodec_free_context(&dec->cc);
+	avformat_close_input(&dec->fc);
+}
+/**
+ * @brief Opens the demuxer and decoder on first use.
+ * @return false if they cannot be opened.
+ */
+static bool GopDecoder_open(struct GopDecoder* const dec)
+{
+	if (dec->failed || dec->cc) return !dec->failed;
+	dec->failed = true;
+	dec->fc = av_open_file(dec->fileName);
+	if (!dec->fc || dec->streamIndex >= dec->fc->nb_streams) return false;
+	if (!av_stream_context(dec->fc, dec->streamIndex, &dec->cc, false))
+		return false;
+	dec->frame = av_frame_alloc();
+	dec->failed = !dec->frame;
+	return !dec->failed;
+}
+static void GopDecoder_run(void* data)
+{
+	struct GopDecoder* const dec = data;
+	if (!GopDecoder_open(dec)) return;
+
+	struct AVStream* const stream = dec->fc->streams[dec->streamIndex];
+	if (av_seek_frame(dec->fc, dec->streamIndex, dec->target,
+	                  AVSEEK_FLAG_BACKWARD) < 0)
+		return;
+	avcodec_flush_buffers(dec->cc);
+	AVRational const frameRate = av_guess_frame_rate(dec->fc, stream, NULL);
+	int64_t const durationDefault = frameRate.num && frameRate.den ?
+	  av_rescale_q(1, av_inv_q(frameRate), stream->time_base) : 0;
+
+	unsigned nPackets = 0;
+	bool done = false;
+	while (!done && nPackets < FRAME_CACHE_GOP_PACKETS_MAX)
+	{
+		struct AVPacket packet;
+		int const result = av_read_frame(dec->fc, &packet);
+		if (result < 0) // Drains the decoder
+		{
+			av_init_packet(&packet);
+			packet.data = NULL;
+			packet.size = 0;
+		}
+		else if (packet.stream_index != (int) dec->streamIndex)
+		{
+			av_packet_unref(&packet);
+			continue;
+		}
+		++nPackets;
+		int finished = 0;
+		avcodec_decode_video2(dec->cc, dec->frame, &finished, &packet);
+		if (result >= 0) av_packet_unref(&packet);
+		if (!finished)
+		{
+			if (result < 0) break;
+			continue;
+		}
+		int64_t const pts = av_frame_get_best_effort_timestamp(dec->frame);
+		if (pts != AV_NOPTS_VALUE)
+		{
+			int64_t const duration = dec->frame->pkt_duration > 0 ?
+			                         dec->frame->pkt_duration : durationDefault;
+			FrameCache_put(dec->cache, dec->frame, pts, duration);
+			done = pts >= dec->target;
+		}
+		av_frame_unref(dec->frame);
+	}
+}
+bool GopDecoder_submit(struct GopDecoder* const dec, int64_t target)
+{
+	if (atomic_load(&dec->group.pending)) return false;
+	dec->target = target;
+	scheduler_submit(&dec->group, GopDecoder_run, dec);
+	return true;
+}
+void GopDecoder_wait(struct GopDecoder* const dec)
+{
+	TaskGroup_wait(&dec->group);
+}
@@ -0,0 +1,135 @@
+#ifndef CHALCOCITE__FRAMECACHE_H_
+#define CHALCOCITE__FRAMECACHE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <SDL2/SDL_thread.h>
+
+#include "scheduler.h"
+#include "container/pool.h"
+#include "container/vector.h"
+
+struct AVFrame;
+struct AVFormatContext;
+struct AVCodecContext;
+
+#define FRAME_CACHE_BUDGET_DEFAULT (256 * 1024 * 1024) // Bytes
+// Stepping backward keeps at least this many seconds decoded behind the cursor
+#define FRAME_CACHE_BEHIND 1.0
+// Bounds the packets read by a GOP decode, for streams with sparse key frames
+#define FRAME_CACHE_GOP_PACKETS_MAX 1000
+#define FRAME_CACHE_POOL_BLOCK 64 // Entries allocated at once
+
+struct FrameCacheEntry
+{
+	struct AVFrame* frame; ///< Reference owned by the cache
+	int64_t pts; ///< In the stream time base
+	int64_t duration; ///< In the stream time base
+	int64_t size; ///< Bytes of the frame buffers
+	// Neighbours in the order of use, prev being used less recently
+	struct FrameCacheEntry* prev;
+	struct FrameCacheEntry* next;
+};
+
+VECTOR_DEFINE(FrameCacheEntries, struct FrameCacheEntry*)
+
+/**
+ * Must be initialised with \ref FrameCache_init and destroyed with
+ *  \ref FrameCache_destroy. Thread safe.
+ * @brief Decoded frames of a video stream keyed by timestamp, so that frame
+ *  stepping and short backward scrubs need not decode again. The frames are
+ *  references, not copies. The least recently used frames are evicted beyond
+ *  the budget, scaled down by memstats_queue_scale(), in constant time each.
+ */
+struct FrameCache
+{
+	FrameCacheEntries entries; ///< Sorted by pts
+	Pool nodes; ///< Storage of the entries
+	// Least and most recently put or taken entries. NULL if empty
+	struct FrameCacheEntry* leastRecent;
+	struct FrameCacheEntry* mostRecent;
+	int64_t budget; ///< Bytes. 0 if disabled
+	int64_t size; ///< Bytes of the cached frames
+	uint64_t nHits, nMisses, nEvictions;
+	SDL_mutex* mutex;
+};
+
+/**
+ * @param[in] budget Bytes. 0 disables the cache
+ */
+void FrameCache_init(struct FrameCache* const, int64_t budget);
+void FrameCache_destroy(struct FrameCache* const);
+
+static inline bool FrameCache_enabled(struct FrameCache const* const cache)
+{
+	return cache->budget > 0;
+}
+/**
+ * @brief Adds a reference to frame, evicting the least recently used frames
+ *  if the budget is exceeded. A frame already cached at pts is only marked as
+ *  used.
+ * @param[in] duration Frame duration in the stream time base
+ * @return false if the frame is not cached.
+ */
+bool FrameCache_put(struct FrameCache* const, struct AVFrame const* frame,
+                    int64_t pts, int64_t duration);
+/**
+ * @return New reference to the frame at pts, to be freed with av_frame_free.
+ *  NULL if not cached.
+ */
+struct AVFrame* FrameCache_get(struct FrameCache* const, int64_t pts);
+/**
+ * @brief Finds the frame that follows (direction > 0) or precedes
+ *  (direction < 0) pts. A cached frame separated from pts by a gap, where
+ *  frames were not cached, does not count.
+ * @param[out] found Timestamp of the frame
+ * @return New reference to the frame. NULL if not cached.
+ */
+struct AVFrame* FrameCache_step(struct FrameCache* const, int64_t pts,
+                                int direction, int64_t* const found);
+/**
+ * @return Timestamp of the first frame of the gapless run of cached frames
+ *  that ends at or before pts. AV_NOPTS_VALUE if the frame at or just before
+ *  pts is not cached.
+ */
+int64_t FrameCache_run_begin(struct FrameCache* const, int64_t pts);
+void FrameCache_print(struct FrameCache* const, FILE*);
+
+/**
+ * Must be initialised with \ref GopDecoder_init and destroyed with
+ *  \ref GopDecoder_destroy.
+ * @brief Fills a FrameCache by decoding, on the scheduler, the group of
+ *  pictures that contains a timestamp. Uses its own demuxer and decoder so
+ *  that playback is not disturbed.
+ */
+struct GopDecoder
+{
+	struct FrameCache* cache;
+	char fileName[1024];
+	unsigned streamIndex;
+	struct AVFormatContext* fc; ///< Opened by the first decode
+	struct AVCodecContext* cc;
+	struct AVFrame* frame;
+	bool failed; ///< The file cannot be opened. Nothing is decoded
+	int64_t target; ///< Timestamp of the running decode
+	struct TaskGroup group;
+};
+
+void GopDecoder_init(struct GopDecoder* const, struct FrameCache* const,
+                     char const* fileName, unsigned streamIndex);
+/**
+ * @brief Waits for the running decode.
+ */
+void GopDecoder_destroy(struct GopDecoder* const);
+/**
+ * @brief Decodes from the key frame at or before target up to target in the
+ *  background.
+ * @param[in] target In the stream time base
+ * @return false if a decode is still running. Nothing is submitted.
+ */
+bool GopDecoder_submit(struct GopDecoder* const, int64_t target);
+void GopDecoder_wait(struct GopDecoder* const);
+
+#endif // !CHALCOCITE__FRAMECACHE_H_
@@ -0,0 +1,90 @@
+#include "governor.h"
+
+#include <string.h>
+
+#include <libavcodec/avcodec.h>
+
+static char const* const governor_levelNames[GOVERNOR_LEVEL_COUNT] =
+{
+	[GOVERNOR_FULL] = "full",
+	[GOVERNOR_SKIP_LOOP_FILTER] = "skip_loop_filter",
+	[GOVERNOR_SKIP_IDCT] = "skip_idct",
+	[GOVERNOR_SKIP_FRAME] = "skip_frame",
+};
+
+char const* governor_level_name(enum GovernorLevel level)
+{
+	return level < GOVERNOR_LEVEL_COUNT ? governor_levelNames[level] : "unknown";
+}
+
+void Governor_init(struct Governor* const gov, bool enabled)
+{
+	memset(gov, 0, sizeof(struct Governor));
+	gov->enabled = enabled;
+	gov->level = gov->levelMax = GOVERNOR_FULL;
+}
+
+bool Governor_update(struct Governor* const gov, double decodeTime,
+                     double duration, int nQueued)
+{
+	++gov->frames[gov->level];
+	if (!gov->enabled || duration <= 0.0) return false;
+
+	gov->load += (decodeTime / duration - gov->load) * GOVERNOR_SMOOTHING;
+	// An empty queue at low load means the source is slow, not the decoder
+	bool const pressure = gov->load > GOVERNOR_LOAD_HIGH ||
+	                      (gov->load > GOVERNOR_LOAD_LOW && nQueued == 0);
+	bool const relief = gov->load < GOVERNOR_LOAD_LOW && nQueued > 0;
+	gov->nPressure = pressure ? gov->nPressure + 1 : 0;
+	gov->nRelief = relief ? gov->nRelief + 1 : 0;
+
+	enum GovernorLevel level = gov->level;
+	if (gov->nPressure >= GOVERNOR_DEGRADE_FRAMES &&
+	    level + 1 < GOVERNOR_LEVEL_COUNT)
+		++level;
+	else if (gov->nRelief >= GOVERNOR_RECOVER_FRAMES && level > GOVERNOR_FULL)
+		--level;
+	if (level == gov->level) return false;
+
+	// The load of the new level has yet to be measured
+	gov->level = level;
+	gov->nPressure = gov->nRelief = 0;
+	if (level > gov->levelMax) gov->levelMax = level;
+	++gov->nChanges;
+	return true;
+}
+
+void Governor_apply(struct Governor const* const gov,
+                    struct AVCodecContext* const cc)
+{
+	cc->skip_loop_filter = gov->level >= GOVERNOR_SKIP_LOOP_FILTER ?
+	                       AVDISCARD_ALL : AVDISCARD_DEFAULT;
+	cc->skip_idct = gov->level >= GOVERNOR_SKIP_IDCT ?
+	                AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+	cc->skip_frame = gov->level >= GOVERNOR_SKIP_FRAME ?
+	                 AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+}
+
+void Governor_print(struct Governor const* const gov, FILE* file)
+{
+	uint64_t nFrames = 0;
+	for (int i = 0; i < GOVERNOR_LEVEL_COUNT; ++i)
+		nFrames += gov->frames[i];
+	if (!nFrames)
+	{
+		fprintf(file, "No video decoded\n");
+		return;
+	}
+	if (!gov->enabled)
+	{
+		fprintf(file, "Decode quality governor disabled\n");
+		return;
+	}
+	fprintf(file, "Decode quality: %s, worst %s, %llu changes\n",
+	        governor_level_name(gov->level), governor_level_name(gov->levelMax),
+	        (unsigned long long) gov->nChanges);
+	for (int i = 0; i < GOVERNOR_LEVEL_COUNT; ++i)
+		if (gov->frames[i])
+			fprintf(file, "%-16s %8llu frames\n", governor_level_name(i),
+			        (unsigned long long) gov->frames[i]);
+}
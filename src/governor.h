@@ -0,0 +1,81 @@
+#ifndef CHALCOCITE__GOVERNOR_H_
+#define CHALCOCITE__GOVERNOR_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct AVCodecContext;
+
+/**
+ * @brief Degradation levels of video decoding. Each level includes the ones
+ *  before it.
+ */
+enum GovernorLevel
+{
+	GOVERNOR_FULL,
+	GOVERNOR_SKIP_LOOP_FILTER, ///< No deblocking
+	GOVERNOR_SKIP_IDCT, ///< No IDCT on non-reference frames
+	GOVERNOR_SKIP_FRAME, ///< Non-reference frames are not decoded
+	GOVERNOR_LEVEL_COUNT
+};
+
+/*
+ * Decoding is under pressure when the smoothed decode time exceeds
+ * GOVERNOR_LOAD_HIGH of the frame interval, or exceeds GOVERNOR_LOAD_LOW while
+ * the picture queue runs empty. GOVERNOR_DEGRADE_FRAMES consecutive frames
+ * under pressure degrade by one level. GOVERNOR_RECOVER_FRAMES consecutive
+ * frames below GOVERNOR_LOAD_LOW with pictures queued recover by one level.
+ */
+#define GOVERNOR_LOAD_HIGH 0.85
+#define GOVERNOR_LOAD_LOW 0.5
+#define GOVERNOR_DEGRADE_FRAMES 8
+#define GOVERNOR_RECOVER_FRAMES 120
+#define GOVERNOR_SMOOTHING 0.125 // Weight of the latest frame in the load
+
+/**
+ * Must be initialised with \ref Governor_init. Updated by the video thread
+ *  only.
+ * @brief Steps the decode quality down when video decoding cannot keep up
+ *  with the frame rate and back up once the load drops.
+ */
+struct Governor
+{
+	bool enabled;
+	enum GovernorLevel level;
+	double load; ///< Smoothed decode time over the duration of video
+	unsigned nPressure; ///< Consecutive frames under pressure
+	unsigned nRelief; ///< Consecutive frames of low load
+	enum GovernorLevel levelMax; ///< Worst level reached
+	uint64_t nChanges;
+	uint64_t frames[GOVERNOR_LEVEL_COUNT]; ///< Frames decoded at each level
+};
+
+/**
+ * @param[in] enabled If false, the level stays at GOVERNOR_FULL.
+ */
+void Governor_init(struct Governor* const, bool enabled);
+/**
+ * @brief Accounts for a decoded frame.
+ * @param[in] decodeTime Seconds spent decoding the frame, and the frames
+ *  skipped since the previous one
+ * @param[in] duration Seconds of video decodeTime covers, the frame interval
+ *  times the frames decoded or skipped
+ * @param[in] nQueued Pictures ready for presentation when the frame was
+ *  decoded
+ * @return true if the level changed.
+ */
+bool Governor_update(struct Governor* const, double decodeTime,
+                     double duration, int nQueued);
+/**
+ * @brief Sets the skip options of a decoder to those of the current level.
+ */
+void Governor_apply(struct Governor const* const, struct AVCodecContext* const);
+
+char const* governor_level_name(enum GovernorLevel);
+/**
+ * @brief Prints the frames decoded at each level.
+ */
+void Governor_print(struct Governor const* const, FILE*);
+
+#endif // !CHALCOCITE__GOVERNOR_H_
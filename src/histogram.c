@@ -0,0 +1,94 @@
+#include "histogram.h"
+
+#include <assert.h>
+
+static unsigned Histogram_index(uint64_t value)
+{
+	if (value < HISTOGRAM_SUB_COUNT) return (unsigned) value;
+
+	unsigned msb = 63 - __builtin_clzll(value);
+	if (msb > HISTOGRAM_MAX_EXPONENT) return HISTOGRAM_BUCKETS - 1;
+
+	unsigned shift = msb - HISTOGRAM_SUB_BITS;
+	unsigned mantissa = (value >> shift) & (HISTOGRAM_SUB_COUNT - 1);
+	return HISTOGRAM_SUB_COUNT + shift * HISTOGRAM_SUB_COUNT + mantissa;
+}
+static uint64_t Histogram_upper_bound(unsigned index)
+{
+	if (index < HISTOGRAM_SUB_COUNT) return index;
+
+	unsigned shift = (index - HISTOGRAM_SUB_COUNT) / HISTOGRAM_SUB_COUNT;
+	uint64_t mantissa = index % HISTOGRAM_SUB_COUNT;
+	return ((HISTOGRAM_SUB_COUNT + mantissa + 1) << shift) - 1;
+}
+
+void Histogram_reset(struct Histogram* const h)
+{
+	for (unsigned i = 0; i < HISTOGRAM_BUCKETS; ++i)
+		atomic_store_explicit(&h->buckets[i], 0, memory_order_relaxed);
+	atomic_store_explicit(&h->count, 0, memory_order_relaxed);
+	atomic_store_explicit(&h->sum, 0, memory_order_relaxed);
+	atomic_store_explicit(&h->max, 0, memory_order_relaxed);
+}
+void Histogram_record(struct Histogram* const h, uint64_t value)
+{
+	atomic_fetch_add_explicit(&h->buckets[Histogram_index(value)], 1,
+	                          memory_order_relaxed);
+	atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&h->sum, value, memory_order_relaxed);
+
+	uint64_t max = atomic_load_explicit(&h->max, memory_order_relaxed);
+	while (value > max &&
+	       !atomic_compare_exchange_weak_explicit(&h->max, &max, value,
+	                                              memory_order_relaxed,
+	                                              memory_order_relaxed));
+}
+void Histogram_merge(struct Histogram* const dst,
+                     struct Histogram const* const src)
+{
+	for (unsigned i = 0; i < HISTOGRAM_BUCKETS; ++i)
+	{
+		uint64_t n = atomic_load_explicit(&src->buckets[i], memory_order_relaxed);
+		if (n)
+			atomic_fetch_add_explicit(&dst->buckets[i], n, memory_order_relaxed);
+	}
+	atomic_fetch_add_explicit(&dst->count, Histogram_count(src),
+	                          memory_order_relaxed);
+	atomic_fetch_add_explicit(&dst->sum,
+	                          atomic_load_explicit(&src->sum, memory_order_relaxed),
+	                          memory_order_relaxed);
+	uint64_t const value = Histogram_max(src);
+	uint64_t max = atomic_load_explicit(&dst->max, memory_order_relaxed);
+	while (value > max &&
+	       !atomic_compare_exchange_weak_explicit(&dst->max, &max, value,
+	                                              memory_order_relaxed,
+	                                              memory_order_relaxed));
+}
+double Histogram_mean(struct Histogram const* const h)
+{
+	uint64_t count = Histogram_count(h);
+	if (!count) return 0.0;
+	return atomic_load_explicit(&h->sum, memory_order_relaxed) / (double) count;
+}
+uint64_t Histogram_percentile(struct Histogram const* const h, double quantile)
+{
+	assert(quantile >= 0.0 && quantile <= 1.0);
+
+	uint64_t count = Histogram_count(h);
+	if (!count) return 0;
+
+	uint64_t target = (uint64_t)(quantile * count + 0.5);
+	if (target == 0) target = 1;
+	uint64_t max = Histogram_max(h);
+	uint64_t cumulative = 0;
+	for (unsigned i = 0; i < HISTOGRAM_BUCKETS; ++i)
+	{
+		cumulative += atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+		if (cumulative >= target)
+		{
+			uint64_t bound = Histogram_upper_bound(i);
+			return bound < max ? bound : max;
+		}
+	}
+	return max;
+}
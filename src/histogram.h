@@ -0,0 +1,59 @@
+#ifndef CHALCOCITE__HISTOGRAM_H_
+#define CHALCOCITE__HISTOGRAM_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Values below HISTOGRAM_SUB_COUNT are recorded exactly. Above that each power
+ * of two is split into HISTOGRAM_SUB_COUNT linear sub-buckets, which bounds
+ * the relative error to 1 / HISTOGRAM_SUB_COUNT. Values of
+ * 2^(HISTOGRAM_MAX_EXPONENT + 1) and above are clamped into the last bucket.
+ */
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAX_EXPONENT 36
+#define HISTOGRAM_BUCKETS (HISTOGRAM_SUB_COUNT * \
+                           (HISTOGRAM_MAX_EXPONENT - HISTOGRAM_SUB_BITS + 2))
+
+/**
+ * @brief HDR-style log-linear histogram of unsigned 64-bit values.
+ *
+ * Recording only uses relaxed atomic operations, so a histogram can be written
+ * by its owning thread while another thread reads it without locking. Readers
+ * may observe a sample in count before it appears in its bucket.
+ */
+struct Histogram
+{
+	_Atomic uint64_t buckets[HISTOGRAM_BUCKETS];
+	_Atomic uint64_t count;
+	_Atomic uint64_t sum;
+	_Atomic uint64_t max;
+};
+
+void Histogram_reset(struct Histogram* const);
+void Histogram_record(struct Histogram* const, uint64_t value);
+/**
+ * @brief Adds all samples of src to dst.
+ */
+void Histogram_merge(struct Histogram* const dst,
+                     struct Histogram const* const src);
+
+static inline uint64_t Histogram_count(struct Histogram const* const h)
+{
+	return atomic_load_explicit(&h->count, memory_order_relaxed);
+}
+static inline uint64_t Histogram_max(struct Histogram const* const h)
+{
+	return atomic_load_explicit(&h->max, memory_order_relaxed);
+}
+double Histogram_mean(struct Histogram const* const);
+/**
+ * @param[in] quantile In the range [0, 1]
+ * @return Upper bound of the bucket containing the given quantile, clamped to
+ *  the maximum recorded value. 0 if the histogram is empty.
+ */
+uint64_t Histogram_percentile(struct Histogram const* const, double quantile);
+
+#endif // !CHALCOCITE__HISTOGRAM_H_
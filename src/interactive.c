@@ -9,13 +9,24 @@
 #include "playback.h"
 #include "test.h"
 #include "media.h"
+#include "stats.h"
+#include "memstats.h"
+#include "threadpolicy.h"
+#include "library.h"
+#include "export.h"
+#include "overview.h"
+#include "control.h"
 #include "container/vectorptr.h"
 
 #define COMMAND(str) else if (strcmp(token, str) == 0)
 #define COMMAND2(str0, str1) else if (strcmp(token, str0) == 0 ||\
                                       strcmp(token, str1) == 0)
 
-int interactive_exec()
+#define FILTER_SIZE 1024
+#define MIX_SIZE 256
+
+int interactive_exec(struct PlaybackOptions const* initial,
+                     char const* libraryIndex)
 {
 	// Interactive console
 	int nAudioDevices = SDL_GetNumAudioDevices(0);
@@ -24,6 +35,24 @@ int interactive_exec()
 	{
 		fprintf(stdout, "Warning: No audio device found\n");
 	}
+	// Kept open between playbacks
+	struct Output output;
+	Output_init(&output);
+	struct PlaybackOptions options = *initial;
+	options.output = &output;
+	char filterGraph[FILTER_SIZE] = "";
+	if (initial->filter)
+		snprintf(filterGraph, sizeof(filterGraph), "%s", initial->filter);
+	options.filter = filterGraph;
+	char mixTracks[MIX_SIZE] = "", mixDownmix[MIX_SIZE] = "";
+	if (initial->audioTracks)
+		snprintf(mixTracks, sizeof(mixTracks), "%s", initial->audioTracks);
+	if (initial->downmix)
+		snprintf(mixDownmix, sizeof(mixDownmix), "%s", initial->downmix);
+	options.audioTracks = mixTracks;
+	options.downmix = mixDownmix;
+	struct Library library;
+	Library_init(&library, libraryIndex);
 
 
 	while (true)
@@ -45,21 +74,218 @@ int interactive_exec()
 		}
 		COMMAND("test")
 		{
-			test();
+			printf("Test %s\n", test() ? "passed" : "failed");
 		}
 		COMMAND2("refresh", "re")
 		{
 			nAudioDevices = SDL_GetNumAudioDevices(0);
 		}
 		COMMAND2("playfile", "pf")
+		{
+			VectorPtr playlist;
+			VectorPtr_init(&playlist);
+			while ((token = strtok(NULL, " ")))
+				VectorPtr_push_back(&playlist, (void*) token);
+			if (!VectorPtr_size(&playlist))
+				printf("Please supply an argument\n");
+			play_playlist(&playlist, &options);
+			VectorPtr_destroy(&playlist);
+			// Sent by a control client during the playback
+			if (control_quit())
+			{
+				free(line);
+				break;
+			}
+		}
+		COMMAND("stats")
 		{
 			token = strtok(NULL, " ");
 			if (!token)
 			{
-				printf("Please supply an argument\n");
-				continue;
+				if (!stats_print(stdout))
+					printf("No samples recorded\n");
+				printf("A/V sync of the last playback:\n");
+				SyncStats_print(playback_last_sync(), stdout);
+				Governor_print(playback_last_governor(), stdout);
+				memstats_print(stdout);
+			}
+			else if (strcmp(token, "reset") == 0)
+			{
+				stats_reset();
+				playback_last_sync_reset();
+			}
+			else
+			{
+				printf("Usage:\n"
+				       "stats: Print pipeline stage latencies\n"
+				       "stats reset: Clear all recorded samples and the A/V sync"
+				       " statistics\n");
+			}
+		}
+		COMMAND("budget")
+		{
+			token = strtok(NULL, " ");
+			char* end = NULL;
+			double budget = token ? strtod(token, &end) : -1.0;
+			if (!token)
+				printf("Memory budget: %.1f MiB (0 = unlimited)\n",
+				       memstats_budget() / (1024.0 * 1024.0));
+			else if (budget < 0.0 || end == token || *end != '\0')
+				printf("Usage:\n"
+				       "budget: Print the memory budget\n"
+				       "budget <MiB>: Set the memory budget of playbacks. 0 disables it\n");
+			else
+				memstats_set_budget((size_t) (budget * 1024 * 1024));
+		}
+		COMMAND("filter")
+		{
+			// The graph may contain spaces
+			token = strtok(NULL, "");
+			if (token)
+			{
+				token += strspn(token, " ");
+				if (*token == '\0') token = NULL;
+			}
+			if (!token)
+				printf("Video filter: %s\n",
+				       filterGraph[0] ? filterGraph : "none");
+			else if (strcmp(token, "none") == 0)
+				filterGraph[0] = '\0';
+			else
+				snprintf(filterGraph, sizeof(filterGraph), "%s", token);
+		}
+		COMMAND("mix")
+		{
+			token = strtok(NULL, " ");
+			char const* const downmix = token ? strtok(NULL, " ") : NULL;
+			struct MixerTrackSpec specs[MIXER_TRACKS_MAX];
+			unsigned nSpecs;
+			int64_t layout;
+			if (!token)
+				printf("Audio tracks: %s, downmix: %s\n",
+				       mixTracks[0] ? mixTracks : "first",
+				       mixDownmix[0] ? mixDownmix : "none");
+			else if (strcmp(token, "off") == 0)
+				mixTracks[0] = mixDownmix[0] = '\0';
+			else if (!mixer_parse_tracks(token, specs, &nSpecs) ||
+			         (downmix && !mixer_parse_downmix(downmix, &layout, NULL, NULL)))
+				printf("Usage:\n"
+				       "mix: Print the mixed audio tracks\n"
+				       "mix <tracks> [<layout>[:<matrix>]]: Mix audio tracks with a"
+				       " gain in dB and downmix them, for example mix 0,1:-6 stereo\n"
+				       "mix off: Play the first audio track\n");
+			else
+			{
+				snprintf(mixTracks, sizeof(mixTracks), "%s", token);
+				snprintf(mixDownmix, sizeof(mixDownmix), "%s",
+				         downmix ? downmix : "");
+			}
+		}
+		COMMAND("live")
+		{
+			token = strtok(NULL, " ");
+			char* end = NULL;
+			double ms = token ? strtod(token, &end) : -1.0;
+			if (!token)
+			{
+				if (options.latency > 0.0)
+					printf("Live sources, target latency %.0fms\n",
+					       options.latency * 1000);
+				else
+					printf("Files\n");
+			}
+			else if (strcmp(token, "off") == 0)
+				options.latency = 0.0;
+			else if (ms <= 0.0 || end == token || *end != '\0')
+				printf("Usage:\n"
+				       "live: Print whether playfile opens live sources\n"
+				       "live <ms>: Open live sources with a target latency\n"
+				       "live off: Open files\n");
+			else
+				options.latency = ms / 1000.0;
+		}
+		COMMAND("governor")
+		{
+			token = strtok(NULL, " ");
+			if (!token)
+			{
+				printf("Decode quality governor: %s\n",
+				       options.fullQuality ? "off" : "on");
+				Governor_print(playback_last_governor(), stdout);
 			}
-			play_file(token);
+			else if (strcmp(token, "on") == 0)
+				options.fullQuality = false;
+			else if (strcmp(token, "off") == 0)
+				options.fullQuality = true;
+			else
+				printf("Usage:\n"
+				       "governor: Print the decode quality of the last playback\n"
+				       "governor on/off: Lower the decode quality when decoding falls"
+				       " behind\n");
+		}
+		COMMAND("scan")
+		{
+			// The path may contain spaces
+			token = strtok(NULL, "");
+			if (token)
+				Library_scan(&library, token, stdout);
+			else
+				printf("Usage:\n"
+				       "scan <directory>: Probe the media files under a directory into"
+				       " the library index %s\n", library.indexPath);
+		}
+		COMMAND("list")
+		{
+			if (!Library_print(&library, NULL, stdout))
+				printf("No media in the library. Use scan <directory>\n");
+		}
+		COMMAND("find")
+		{
+			token = strtok(NULL, "");
+			if (!token)
+				printf("Usage:\n"
+				       "find <text>: List media whose path or codec contains text\n");
+			else if (!Library_print(&library, token, stdout))
+				printf("No match\n");
+		}
+		COMMAND("export")
+		{
+			char const* arguments[5] = { NULL };
+			for (int i = 0; i < 5 && (token = strtok(NULL, " ")); ++i)
+				arguments[i] = token;
+			double start, end;
+			bool const accurate = arguments[4] &&
+			                      strcmp(arguments[4], "accurate") == 0;
+			if (!arguments[3] || (arguments[4] && !accurate) ||
+			    !export_parse_time(arguments[1], &start) ||
+			    !export_parse_time(arguments[2], &end) || end <= start)
+				printf("Usage:\n"
+				       "export <in> <start> <end> <out> [accurate]: Copy the packets"
+				       " between start and end into out without re-encoding. Times"
+				       " are in seconds or [HH:]MM:SS. With accurate, the output"
+				       " starts at start instead of the preceding key frame, for MP4"
+				       " and MOV only, whose edit lists hide the frames before\n");
+			else
+				export_segment(arguments[0], start, end, arguments[3], accurate);
+		}
+		COMMAND("overview")
+		{
+			char const* const directory = strtok(NULL, " ");
+			VectorPtr files;
+			VectorPtr_init(&files);
+			while ((token = strtok(NULL, " ")))
+				VectorPtr_push_back(&files, (void*) token);
+			if (!VectorPtr_size(&files))
+				printf("Usage:\n"
+				       "overview <directory> <file>...: Write the audio peak and RMS"
+				       " overview of each file into directory\n");
+			else
+				overview_files(&files, directory, stdout);
+			VectorPtr_destroy(&files);
+		}
+		COMMAND("policy")
+		{
+			thread_policy_report(stdout);
 		}
 		COMMAND2("info", "i")
 		{
@@ -89,5 +315,7 @@ int interactive_exec()
 		}
 		free(line);
 	}
+	Library_destroy(&library);
+	Output_destroy(&output);
 	return 0;
 }
@@ -1,9 +1,15 @@
 #ifndef CHALCOCITE__INTERACTIVE_H_
 #define CHALCOCITE__INTERACTIVE_H_
 
+#include "playback.h"
+
 /**
  * @brief Starts the interactive console
+ * @param[in] initial Options of playbacks until changed by commands
+ * @param[in] libraryIndex Index file of the media library. NULL for the
+ *  default
  */
-int interactive_exec();
+int interactive_exec(struct PlaybackOptions const* initial,
+                     char const* libraryIndex);
 
 #endif // !CHALCOCITE__INTERACTIVE_H_
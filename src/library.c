@@ -0,0 +1,412 @@
+#define _GNU_SOURCE // strcasestr
+#include "library.h"
+
+#include <dirent.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <libavformat/avformat.h>
+
+#include "stats.h"
+#include "scheduler.h"
+#include "container/vectorptr.h"
+
+/*
+ * Index file: LIBRARY_MAGIC, uint32_t version, uint32_t count, then count
+ * records of the fixed fields of LibraryEntry in declaration order, uint16_t
+ * path length and the path without terminator. Native byte order.
+ */
+#define LIBRARY_MAGIC "CHALLIB"
+#define LIBRARY_VERSION 1
+// Bytes of a record with an empty path
+#define LIBRARY_RECORD_MIN (4 * 8 + 4 * 4 + 2 * LIBRARY_CODEC_SIZE + 2)
+
+static void LibraryEntry_destroy(struct LibraryEntry* const entry)
+{
+	free(entry->path);
+	entry->path = NULL;
+}
+static int LibraryEntry_compare(void const* a, void const* b)
+{
+	return strcmp(((struct LibraryEntry const*) a)->path,
+	              ((struct LibraryEntry const*) b)->path);
+}
+static void LibraryEntries_sort(LibraryEntries* const entries)
+{
+	size_t const n = LibraryEntries_size(entries);
+	if (n)
+		qsort(LibraryEntries_ptr(entries, 0), n, sizeof(struct LibraryEntry),
+		      LibraryEntry_compare);
+}
+// entries must be sorted
+static struct LibraryEntry* LibraryEntries_search(
+  LibraryEntries const* const entries, char const* path)
+{
+	size_t const n = LibraryEntries_size(entries);
+	if (!n) return NULL;
+	struct LibraryEntry const key = { .path = (char*) path };
+	return bsearch(&key, LibraryEntries_ptr(entries, 0), n,
+	               sizeof(struct LibraryEntry), LibraryEntry_compare);
+}
+
+// Index file
+
+static bool write_entry(FILE* file, struct LibraryEntry const* const entry)
+{
+	size_t const length = strlen(entry->path);
+	uint16_t const pathLength = (uint16_t) length;
+	int32_t const fields[] =
+	{
+		entry->width, entry->height, (int32_t) entry->nStreams,
+		(int32_t) entry->nKeyframes
+	};
+	return length <= UINT16_MAX &&
+	       fwrite(&entry->mtime, sizeof(entry->mtime), 1, file) == 1 &&
+	       fwrite(&entry->size, sizeof(entry->size), 1, file) == 1 &&
+	       fwrite(&entry->duration, sizeof(entry->duration), 1, file) == 1 &&
+	       fwrite(&entry->bitRate, sizeof(entry->bitRate), 1, file) == 1 &&
+	       fwrite(fields, sizeof(fields), 1, file) == 1 &&
+	       fwrite(entry->codecV, LIBRARY_CODEC_SIZE, 1, file) == 1 &&
+	       fwrite(entry->codecA, LIBRARY_CODEC_SIZE, 1, file) == 1 &&
+	       fwrite(&pathLength, sizeof(pathLength), 1, file) == 1 &&
+	       fwrite(entry->path, 1, length, file) == length;
+}
+static bool read_entry(FILE* file, struct LibraryEntry* const entry)
+{
+	memset(entry, 0, sizeof(struct LibraryEntry));
+	int32_t fields[4];
+	uint16_t pathLength;
+	if (fread(&entry->mtime, sizeof(entry->mtime), 1, file) != 1 ||
+	    fread(&entry->size, sizeof(entry->size), 1, file) != 1 ||
+	    fread(&entry->duration, sizeof(entry->duration), 1, file) != 1 ||
+	    fread(&entry->bitRate, sizeof(entry->bitRate), 1, file) != 1 ||
+	    fread(fields, sizeof(fields), 1, file) != 1 ||
+	    fread(entry->codecV, LIBRARY_CODEC_SIZE, 1, file) != 1 ||
+	    fread(entry->codecA, LIBRARY_CODEC_SIZE, 1, file) != 1 ||
+	    fread(&pathLength, sizeof(pathLength), 1, file) != 1)
+		return false;
+	entry->width = fields[0];
+	entry->height = fields[1];
+	entry->nStreams = fields[2];
+	entry->nKeyframes = fields[3];
+	entry->codecV[LIBRARY_CODEC_SIZE - 1] = '\0';
+	entry->codecA[LIBRARY_CODEC_SIZE - 1] = '\0';
+
+	entry->path = malloc(pathLength + 1);
+	if (!entry->path) return false;
+	if (fread(entry->path, 1, pathLength, file) != pathLength)
+	{
+		LibraryEntry_destroy(entry);
+		return false;
+	}
+	entry->path[pathLength] = '\0';
+	return true;
+}
+static void Library_load(struct Library* const lib)
+{
+	FILE* file = fopen(lib->indexPath, "rb");
+	if (!file) return; // No index yet
+
+	char magic[sizeof(LIBRARY_MAGIC)];
+	uint32_t version, count;
+	if (fread(magic, sizeof(magic), 1, file) != 1 ||
+	    memcmp(magic, LIBRARY_MAGIC, sizeof(magic)) != 0 ||
+	    fread(&version, sizeof(version), 1, file) != 1 ||
+	    version != LIBRARY_VERSION ||
+	    fread(&count, sizeof(count), 1, file) != 1)
+	{
+		fprintf(stderr, "Ignoring invalid library index %s\n", lib->indexPath);
+		fclose(file);
+		return;
+	}
+	// A corrupt count does not reserve more than the file can hold
+	long const offset = ftell(file);
+	struct stat info;
+	if (offset >= 0 && fstat(fileno(file), &info) == 0 &&
+	    info.st_size >= offset)
+	{
+		uint64_t const nMax = (info.st_size - offset) / LIBRARY_RECORD_MIN;
+		LibraryEntries_reserve(&lib->entries, count < nMax ? count : nMax);
+	}
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		struct LibraryEntry entry;
+		if (!read_entry(file, &entry))
+		{
+			fprintf(stderr, "Library index %s is truncated\n", lib->indexPath);
+			break;
+		}
+		LibraryEntries_push_back(&lib->entries, entry);
+	}
+	fclose(file);
+}
+
+void Library_init(struct Library* const lib, char const* indexPath)
+{
+	LibraryEntries_init(&lib->entries);
+	if (indexPath)
+		snprintf(lib->indexPath, sizeof(lib->indexPath), "%s", indexPath);
+	else
+	{
+		char const* home = getenv("HOME");
+		snprintf(lib->indexPath, sizeof(lib->indexPath), "%s/%s",
+		         home ? home : ".", LIBRARY_INDEX_NAME);
+	}
+	Library_load(lib);
+}
+void Library_destroy(struct Library* const lib)
+{
+	for (size_t i = 0; i < LibraryEntries_size(&lib->entries); ++i)
+		LibraryEntry_destroy(LibraryEntries_ptr(&lib->entries, i));
+	LibraryEntries_destroy(&lib->entries);
+}
+
+bool Library_save(struct Library const* const lib)
+{
+	char pathTemp[sizeof(lib->indexPath) + 4];
+	snprintf(pathTemp, sizeof(pathTemp), "%s.tmp", lib->indexPath);
+	FILE* file = fopen(pathTemp, "wb");
+	if (!file)
+	{
+		fprintf(stderr, "Unable to write library index %s\n", pathTemp);
+		return false;
+	}
+	uint32_t const version = LIBRARY_VERSION;
+	uint32_t const count = LibraryEntries_size(&lib->entries);
+	bool success = fwrite(LIBRARY_MAGIC, sizeof(LIBRARY_MAGIC), 1, file) == 1 &&
+	               fwrite(&version, sizeof(version), 1, file) == 1 &&
+	               fwrite(&count, sizeof(count), 1, file) == 1;
+	for (uint32_t i = 0; success && i < count; ++i)
+		success = write_entry(file, LibraryEntries_ptr(&lib->entries, i));
+	success = fclose(file) == 0 && success;
+	if (success && rename(pathTemp, lib->indexPath) == 0)
+		return true;
+	fprintf(stderr, "Unable to write library index %s\n", lib->indexPath);
+	remove(pathTemp);
+	return false;
+}
+
+// Scanning
+
+/**
+ * @brief Adds the regular files under path to files, with mtime and size.
+ *  Symbolic links to directories are not followed.
+ * @param[in] index Device and inode of the index file, which is not added.
+ *  NULL if it does not exist
+ */
+static void library_walk(char const* path, LibraryEntries* const files,
+                         struct stat const* index)
+{
+	DIR* dir = opendir(path);
+	if (!dir) return;
+	// Only the root "/" ends with a separator
+	char const* const separator = path[strlen(path) - 1] == '/' ? "" : "/";
+	struct dirent* item;
+	while ((item = readdir(dir)))
+	{
+		if (strcmp(item->d_name, ".") == 0 || strcmp(item->d_name, "..") == 0)
+			continue;
+		char child[PATH_MAX];
+		if (snprintf(child, sizeof(child), "%s%s%s", path, separator,
+		             item->d_name) >= (int) sizeof(child))
+			continue;
+		struct stat info;
+		if (lstat(child, &info) < 0) continue;
+		if (S_ISDIR(info.st_mode))
+		{
+			library_walk(child, files, index);
+			continue;
+		}
+		if (S_ISLNK(info.st_mode) && stat(child, &info) < 0) continue;
+		if (!S_ISREG(info.st_mode)) continue;
+		if (index && info.st_dev == index->st_dev && info.st_ino == index->st_ino)
+			continue;
+
+		struct LibraryEntry entry =
+		{
+			.path = strdup(child),
+			.mtime = info.st_mtime,
+			.size = info.st_size
+		};
+		if (entry.path) LibraryEntries_push_back(files, entry);
+	}
+	closedir(dir);
+}
+/**
+ * @brief Fills the metadata of an entry. Task run on the scheduler.
+ */
+static void LibraryEntry_probe(void* data)
+{
+	struct LibraryEntry* const entry = data;
+	struct AVFormatContext* fc = NULL;
+	if (avformat_open_input(&fc, entry->path, NULL, NULL) < 0) return;
+	if (avformat_find_stream_info(fc, NULL) < 0)
+	{
+		avformat_close_input(&fc);
+		return;
+	}
+	entry->nStreams = fc->nb_streams;
+	entry->duration = fc->duration != AV_NOPTS_VALUE ?
+	                  fc->duration / (double) AV_TIME_BASE : 0.0;
+	entry->bitRate = fc->bit_rate;
+
+	int const indexA = av_find_best_stream(fc, AVMEDIA_TYPE_AUDIO, -1, -1,
+	                                       NULL, 0);
+	if (indexA >= 0)
+		snprintf(entry->codecA, sizeof(entry->codecA), "%s",
+		         avcodec_get_name(fc->streams[indexA]->codec->codec_id));
+	int const indexV = av_find_best_stream(fc, AVMEDIA_TYPE_VIDEO, -1, -1,
+	                                       NULL, 0);
+	if (indexV >= 0)
+	{
+		struct AVCodecContext const* const cc = fc->streams[indexV]->codec;
+		snprintf(entry->codecV, sizeof(entry->codecV), "%s",
+		         avcodec_get_name(cc->codec_id));
+		entry->width = cc->width;
+		entry->height = cc->height;
+
+		// Key frames are counted from the packets. Nothing is decoded.
+		for (unsigned i = 0; i < fc->nb_streams; ++i)
+			if ((int) i != indexV)
+				fc->streams[i]->discard = AVDISCARD_ALL;
+		struct AVPacket packet;
+		while (av_read_frame(fc, &packet) >= 0)
+		{
+			if (packet.stream_index == indexV && (packet.flags & AV_PKT_FLAG_KEY))
+				++entry->nKeyframes;
+			av_packet_unref(&packet);
+		}
+	}
+	avformat_close_input(&fc);
+}
+bool Library_scan(struct Library* const lib, char const* directory,
+                  FILE* progress)
+{
+	uint64_t const timeBegin = stats_now();
+	char root[PATH_MAX];
+	if (!realpath(directory, root))
+	{
+		fprintf(stderr, "Unable to read directory %s\n", directory);
+		return false;
+	}
+	LibraryEntries files;
+	LibraryEntries_init(&files);
+	struct stat index;
+	bool const indexed = stat(lib->indexPath, &index) == 0;
+	library_walk(root, &files, indexed ? &index : NULL);
+	LibraryEntries_sort(&files);
+	size_t const nFiles = LibraryEntries_size(&files);
+
+	// Files unchanged since the last scan keep their metadata
+	VectorPtr pending;
+	VectorPtr_init(&pending);
+	for (size_t i = 0; i < nFiles; ++i)
+	{
+		struct LibraryEntry* const file = LibraryEntries_ptr(&files, i);
+		struct LibraryEntry const* const known =
+		  LibraryEntries_search(&lib->entries, file->path);
+		if (known && known->mtime == file->mtime && known->size == file->size)
+		{
+			char* const path = file->path;
+			*file = *known;
+			file->path = path;
+		}
+		else
+			VectorPtr_push_back(&pending, file);
+	}
+
+	// Probed in batches so that few files are open at once
+	size_t const nPending = VectorPtr_size(&pending);
+	unsigned const nWorkers = scheduler_workers();
+	size_t const batch = (nWorkers ? nWorkers : 1) * LIBRARY_BATCH_PER_WORKER;
+	int const logLevel = av_log_get_level();
+	av_log_set_level(AV_LOG_QUIET); // Many files are not media
+	for (size_t begin = 0; begin < nPending; begin += batch)
+	{
+		struct TaskGroup group;
+		TaskGroup_init(&group);
+		size_t const end = begin + batch < nPending ? begin + batch : nPending;
+		for (size_t i = begin; i < end; ++i)
+			scheduler_submit(&group, LibraryEntry_probe, VectorPtr_at(&pending, i));
+		TaskGroup_wait(&group);
+		if (progress)
+		{
+			fprintf(progress, "\rProbed %zu/%zu", end, nPending);
+			fflush(progress);
+		}
+	}
+	av_log_set_level(logLevel);
+	if (progress && nPending) fprintf(progress, "\n");
+	VectorPtr_destroy(&pending);
+
+	// Replace the entries under root. Every path is under "/"
+	size_t const rootLength = strcmp(root, "/") == 0 ? 0 : strlen(root);
+	size_t nRemoved = 0;
+	LibraryEntries merged;
+	LibraryEntries_init(&merged);
+	LibraryEntries_reserve(&merged, LibraryEntries_size(&lib->entries) + nFiles);
+	for (size_t i = 0; i < LibraryEntries_size(&lib->entries); ++i)
+	{
+		struct LibraryEntry* const entry = LibraryEntries_ptr(&lib->entries, i);
+		if (strncmp(entry->path, root, rootLength) == 0 &&
+		    entry->path[rootLength] == '/')
+		{
+			if (!LibraryEntries_search(&files, entry->path)) ++nRemoved;
+			LibraryEntry_destroy(entry);
+		}
+		else
+			LibraryEntries_push_back(&merged, *entry);
+	}
+	size_t nPlayable = 0;
+	for (size_t i = 0; i < nFiles; ++i)
+	{
+		struct LibraryEntry const* const file = LibraryEntries_ptr(&files, i);
+		if (file->nStreams) ++nPlayable;
+		LibraryEntries_push_back(&merged, *file);
+	}
+	LibraryEntries_destroy(&files);
+	LibraryEntries_destroy(&lib->entries);
+	lib->entries = merged;
+	LibraryEntries_sort(&lib->entries);
+
+	bool const saved = Library_save(lib);
+	if (progress)
+		fprintf(progress, "%zu files (%zu playable) in %.2fs: %zu probed, "
+		        "%zu unchanged, %zu removed%s\n", nFiles, nPlayable,
+		        (stats_now() - timeBegin) / 1e9, nPending, nFiles - nPending,
+		        nRemoved, saved ? "" : ", index not saved");
+	return true;
+}
+
+// Queries
+
+size_t Library_print(struct Library const* const lib, char const* pattern,
+                     FILE* file)
+{
+	size_t nPrinted = 0;
+	for (size_t i = 0; i < LibraryEntries_size(&lib->entries); ++i)
+	{
+		struct LibraryEntry const* const entry =
+		  LibraryEntries_ptr(&lib->entries, i);
+		if (!entry->nStreams) continue;
+		if (pattern && !strcasestr(entry->path, pattern) &&
+		    !strcasestr(entry->codecV, pattern) &&
+		    !strcasestr(entry->codecA, pattern))
+			continue;
+		if (!nPrinted)
+			fprintf(file, "%10s %9s %-10s %-10s %8s %6s %s\n", "Duration",
+			        "Size", "Video", "Audio", "kbit/s", "Keys", "Path");
+		char size[16] = "-";
+		if (entry->width)
+			snprintf(size, sizeof(size), "%dx%d", entry->width, entry->height);
+		fprintf(file, "%9.1fs %9s %-10s %-10s %8lld %6u %s\n", entry->duration,
+		        size, entry->codecV[0] ? entry->codecV : "-",
+		        entry->codecA[0] ? entry->codecA : "-",
+		        (long long) (entry->bitRate / 1000), entry->nKeyframes,
+		        entry->path);
+		++nPrinted;
+	}
+	return nPrinted;
+}
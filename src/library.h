@@ -0,0 +1,80 @@
+#ifndef CHALCOCITE__LIBRARY_H_
+#define CHALCOCITE__LIBRARY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "container/vector.h"
+
+#define LIBRARY_CODEC_SIZE 16
+#define LIBRARY_INDEX_NAME ".chalcocite-library" // In $HOME by default
+/*
+ * Files are probed in batches of LIBRARY_BATCH_PER_WORKER per scheduler
+ * worker, which bounds the files open at once.
+ */
+#define LIBRARY_BATCH_PER_WORKER 4
+
+/**
+ * @brief Metadata of a file in the library.
+ */
+struct LibraryEntry
+{
+	char* path; ///< Absolute. Owned by the entry
+	int64_t mtime; ///< Modification time when probed
+	int64_t size; ///< Bytes
+	double duration; ///< Second. 0 if unknown
+	int64_t bitRate; ///< Bit per second. 0 if unknown
+	int width, height; ///< 0 without video
+	unsigned nStreams; ///< 0 if the file cannot be played
+	unsigned nKeyframes; ///< Key frames of the video stream
+	char codecV[LIBRARY_CODEC_SIZE]; ///< Empty without video
+	char codecA[LIBRARY_CODEC_SIZE]; ///< Empty without audio
+};
+
+VECTOR_DEFINE(LibraryEntries, struct LibraryEntry)
+
+/**
+ * Must be initialised with \ref Library_init and destroyed with
+ *  \ref Library_destroy.
+ * @brief Index of media files and their metadata, kept in a binary file so
+ *  that queries need not probe the files again.
+ */
+struct Library
+{
+	LibraryEntries entries; ///< Sorted by path
+	char indexPath[1024];
+};
+
+/**
+ * @brief Loads the index file if it exists.
+ * @param[in] indexPath NULL for LIBRARY_INDEX_NAME in the home directory
+ */
+void Library_init(struct Library* const, char const* indexPath);
+void Library_destroy(struct Library* const);
+
+/**
+ * @brief Writes the index file. The previous file is replaced atomically.
+ * @return false if the file cannot be written.
+ */
+bool Library_save(struct Library const* const);
+/**
+ * @brief Walks a directory tree and probes, in parallel on the scheduler,
+ *  every regular file that is new or whose mtime or size changed. Entries of
+ *  files under the directory that no longer exist are removed. The index is
+ *  saved afterwards.
+ * @param[in] progress Receives progress and a summary. May be NULL
+ * @return false if the directory cannot be read.
+ */
+bool Library_scan(struct Library* const, char const* directory,
+                  FILE* progress);
+/**
+ * @brief Prints the playable entries whose path or codecs contain pattern,
+ *  ignoring case.
+ * @param[in] pattern NULL for all entries
+ * @return Number of entries printed.
+ */
+size_t Library_print(struct Library const* const, char const* pattern,
+                     FILE*);
+
+#endif // !CHALCOCITE__LIBRARY_H_
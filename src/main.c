@@ -11,6 +11,7 @@
 #include <SDL2/SDL_video.h>
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
+#include <libavfilter/avfilter.h>
 #include <libavutil/imgutils.h>
 #include <libavutil/time.h>
 #include <libswscale/swscale.h>
@@ -21,15 +22,220 @@
 #include "test.h"
 #include "interactive.h"
 #include "playback.h"
+#include "stats.h"
+#include "trace.h"
+#include "memstats.h"
+#include "scheduler.h"
+#include "threadpolicy.h"
+#include "library.h"
+#include "export.h"
+#include "control.h"
+#include "overview.h"
 
 int main(int argc, char* argv[])
 {
 	char const usage[] =
 	  "Usage:\n"
 	  "Execute with no argument to enter the interactive console\n"
-	  "--test/-t: Execute a test routine to check functions\n"
-	  "--file/-f: Play a media file. The file name must be supplied after the"
-	  " argument.\n";
+	  "--test/-t: Play synthetic media and check frame count, A/V sync and"
+	  " throughput\n"
+	  "--file/-f: Play media files in order. The file names must be supplied"
+	  " after the argument.\n"
+	  "--export <in> <start> <end> <out> [accurate]: Copy a segment into a new"
+	  " file without re-encoding\n"
+	  "--serve: Wait for play commands of control clients, without the"
+	  " console. Requires --control\n"
+	  "--overview <directory> <files>: Write audio peak and RMS overviews of"
+	  " the files into directory, several files at once\n"
+	  "Options (must precede the above):\n"
+	  "--trace <out.json>: Record a Chrome trace-event timeline of the"
+	  " pipeline threads and write it at exit\n"
+	  "--memory-budget <MiB>: Shrink queue depth targets as accounted memory"
+	  " approaches the budget\n"
+	  "--realtime: Run the audio and presentation threads with SCHED_FIFO,"
+	  " falling back to a high SDL priority\n"
+	  "--live <ms>: Open the files as live sources (- for stdin, named pipes,"
+	  " udp:// or tcp://) and drop frames beyond the target latency\n"
+	  "--library <index>: Index file of the media library of the console,"
+	  " $HOME/" LIBRARY_INDEX_NAME " by default\n"
+	  "--full-quality: Never lower the video decode quality when decoding"
+	  " falls behind\n"
+	  "--frame-cache <MiB>: Decoded frames kept for stepping with the arrow"
+	  " keys, 0 to disable. 256 by default\n"
+	  "--filter <graph>: Apply a libavfilter graph to the video, for example"
+	  " yadif,crop=640:360\n"
+	  "--audio-tracks <tracks>: Mix audio tracks, each with an optional gain"
+	  " in dB, for example 0,1:-6\n"
+	  "--downmix <layout>[:<matrix>]: Mix into a channel layout such as stereo,"
+	  " optionally with a matrix of rows separated by |\n"
+	  "--clock <clock>: Synchronise the video to the audio, video or external"
+	  " clock instead of the audio, or the external clock without audio\n"
+	  "--sink <sink>: Send the pictures and audio, as fast as decoded, to null,"
+	  " y4m:<file>, wav:<file> or shm:<name> instead of the window. - as file"
+	  " is stdout\n"
+	  "--affinity <role>=<cpus>: Pin the audio, present, decode or worker"
+	  " threads to CPUs, for example decode=2-7. May be repeated\n"
+	  "--control <socket>: Accept play, pause, resume, seek, trick, stop, quit"
+	  " and stats commands on a Unix domain socket and answer in JSON\n";
+
+	// Options
+	char const* filter = NULL;
+	char const* sink = NULL;
+	char const* audioTracks = NULL;
+	char const* downmix = NULL;
+	char const* clockSource = NULL;
+	double latency = 0.0;
+	bool fullQuality = false;
+	int64_t frameCache = 0;
+	char const* libraryIndex = NULL;
+	char const* controlPath = NULL;
+	int argi = 1;
+	while (argi < argc)
+	{
+		if (strcmp(argv[argi], "--trace") == 0)
+		{
+			if (argi + 1 >= argc)
+			{
+				fprintf(stderr, "Argument error: Please supply a trace file name\n");
+				return -1;
+			}
+			trace_enable(argv[argi + 1]);
+			argi += 2;
+		}
+		else if (strcmp(argv[argi], "--memory-budget") == 0)
+		{
+			char* end = NULL;
+			double budget = argi + 1 < argc ? strtod(argv[argi + 1], &end) : -1.0;
+			if (budget < 0.0 || end == argv[argi + 1] || *end != '\0')
+			{
+				fprintf(stderr, "Argument error: Please supply a budget in MiB\n");
+				return -1;
+			}
+			memstats_set_budget((size_t) (budget * 1024 * 1024));
+			argi += 2;
+		}
+		else if (strcmp(argv[argi], "--frame-cache") == 0)
+		{
+			char* end = NULL;
+			double budget = argi + 1 < argc ? strtod(argv[argi + 1], &end) : -1.0;
+			if (budget < 0.0 || end == argv[argi + 1] || *end != '\0')
+			{
+				fprintf(stderr, "Argument error: Please supply a size in MiB\n");
+				return -1;
+			}
+			frameCache = budget > 0.0 ? (int64_t) (budget * 1024 * 1024) : -1;
+			argi += 2;
+		}
+		else if (strcmp(argv[argi], "--filter") == 0)
+		{
+			if (argi + 1 >= argc)
+			{
+				fprintf(stderr, "Argument error: Please supply a filter graph\n");
+				return -1;
+			}
+			filter = argv[argi + 1];
+			argi += 2;
+		}
+		else if (strcmp(argv[argi], "--audio-tracks") == 0)
+		{
+			struct MixerTrackSpec specs[MIXER_TRACKS_MAX];
+			unsigned nSpecs;
+			if (argi + 1 >= argc ||
+			    !mixer_parse_tracks(argv[argi + 1], specs, &nSpecs))
+			{
+				fprintf(stderr, "Argument error: Please supply audio tracks\n");
+				return -1;
+			}
+			audioTracks = argv[argi + 1];
+			argi += 2;
+		}
+		else if (strcmp(argv[argi], "--downmix") == 0)
+		{
+			int64_t layout;
+			if (argi + 1 >= argc ||
+			    !mixer_parse_downmix(argv[argi + 1], &layout, NULL, NULL))
+			{
+				fprintf(stderr, "Argument error: Please supply a channel layout\n");
+				return -1;
+			}
+			downmix = argv[argi + 1];
+			argi += 2;
+		}
+		else if (strcmp(argv[argi], "--clock") == 0)
+		{
+			if (argi + 1 >= argc ||
+			    clock_source_parse(argv[argi + 1]) == CLOCK_SOURCE_COUNT)
+			{
+				fprintf(stderr, "Argument error: Please supply audio, video or"
+				        " external\n");
+				return -1;
+			}
+			clockSource = argv[argi + 1];
+			argi += 2;
+		}
+		else if (strcmp(argv[argi], "--sink") == 0)
+		{
+			if (argi + 1 >= argc)
+			{
+				fprintf(stderr, "Argument error: Please supply a sink\n");
+				return -1;
+			}
+			sink = argv[argi + 1];
+			argi += 2;
+		}
+		else if (strcmp(argv[argi], "--live") == 0)
+		{
+			char* end = NULL;
+			latency = argi + 1 < argc ? strtod(argv[argi + 1], &end) : -1.0;
+			if (latency <= 0.0 || end == argv[argi + 1] || *end != '\0')
+			{
+				fprintf(stderr, "Argument error: Please supply a latency in ms\n");
+				return -1;
+			}
+			latency /= 1000.0;
+			argi += 2;
+		}
+		else if (strcmp(argv[argi], "--library") == 0)
+		{
+			if (argi + 1 >= argc)
+			{
+				fprintf(stderr, "Argument error: Please supply an index file\n");
+				return -1;
+			}
+			libraryIndex = argv[argi + 1];
+			argi += 2;
+		}
+		else if (strcmp(argv[argi], "--control") == 0)
+		{
+			if (argi + 1 >= argc)
+			{
+				fprintf(stderr, "Argument error: Please supply a socket path\n");
+				return -1;
+			}
+			controlPath = argv[argi + 1];
+			argi += 2;
+		}
+		else if (strcmp(argv[argi], "--full-quality") == 0)
+		{
+			fullQuality = true;
+			argi += 1;
+		}
+		else if (strcmp(argv[argi], "--realtime") == 0)
+		{
+			thread_policy_set_realtime(true);
+			argi += 1;
+		}
+		else if (strcmp(argv[argi], "--affinity") == 0)
+		{
+			if (argi + 1 >= argc || !thread_policy_parse_affinity(argv[argi + 1]))
+			{
+				fprintf(stderr, "Argument error: Please supply <role>=<cpus>\n");
+				return -1;
+			}
+			argi += 2;
+		}
+		else break;
+	}
 
 	// Initialisation
 	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER))
@@ -37,37 +243,139 @@ int main(int argc, char* argv[])
 		fprintf(stderr, "[SDL] %s\n", SDL_GetError());
 		return -1;
 	}
+	struct ControlServer control = { .fd = -1 };
+	if (controlPath && !ControlServer_start(&control, controlPath))
+	{
+		SDL_Quit();
+		return -1;
+	}
 	av_register_all();
+	avformat_network_init();
+	avfilter_register_all();
+	thread_policy_apply(THREAD_ROLE_PRESENT);
+	scheduler_init(0);
+	stats_thread_register("main");
+	trace_thread_register("main");
+
+	struct PlaybackOptions options =
+	{
+		.filter = filter,
+		.latency = latency,
+		.fullQuality = fullQuality,
+		.frameCache = frameCache,
+		.sink = sink,
+		.audioTracks = audioTracks,
+		.downmix = downmix,
+		.clock = clockSource
+	};
 
 	// Parsing
-	if (argc > 1)
+	int result = 0;
+	if (argi < argc)
 	{
-		if (strcmp(argv[1], "--help") == 0)
+		if (strcmp(argv[argi], "--help") == 0)
 		{
 			fprintf(stdout, usage);
 		}
-		else if (strcmp(argv[1], "--test") == 0 ||
-		         strcmp(argv[1], "-t") == 0)
+		else if (strcmp(argv[argi], "--test") == 0 ||
+		         strcmp(argv[argi], "-t") == 0)
 		{
-			test();
+			result = test() ? 0 : 1;
 		}
-		else if (strcmp(argv[1], "--file") == 0 ||
-		         strcmp(argv[1], "-f") == 0)
+		else if (strcmp(argv[argi], "--file") == 0 ||
+		         strcmp(argv[argi], "-f") == 0)
 		{
-			if (argc > 2)
-				play_file(argv[2]);
+			if (argi + 1 < argc)
+			{
+				VectorPtr playlist;
+				VectorPtr_init(&playlist);
+				for (int i = argi + 1; i < argc; ++i)
+					VectorPtr_push_back(&playlist, argv[i]);
+				struct Output output;
+				Output_init(&output);
+				options.output = &output;
+				play_playlist(&playlist, &options);
+				Output_destroy(&output);
+				VectorPtr_destroy(&playlist);
+				stats_print(stdout);
+				memstats_print(stdout);
+			}
 			else
 				fprintf(stderr, "Argument error: Please supply one or more file names\n");
 		}
+		else if (strcmp(argv[argi], "--serve") == 0)
+		{
+			if (control.fd >= 0)
+			{
+				struct Output output;
+				Output_init(&output);
+				options.output = &output;
+				play_serve(&options);
+				Output_destroy(&output);
+				stats_print(stdout);
+				memstats_print(stdout);
+			}
+			else
+			{
+				fprintf(stderr, "Argument error: Please supply --control <socket>"
+				        " before --serve\n");
+				result = -1;
+			}
+		}
+		else if (strcmp(argv[argi], "--overview") == 0)
+		{
+			if (argi + 2 < argc)
+			{
+				VectorPtr files;
+				VectorPtr_init(&files);
+				for (int i = argi + 2; i < argc; ++i)
+					VectorPtr_push_back(&files, argv[i]);
+				result = overview_files(&files, argv[argi + 1], stdout) ==
+				         VectorPtr_size(&files) ? 0 : 1;
+				VectorPtr_destroy(&files);
+			}
+			else
+			{
+				fprintf(stderr, "Argument error: Please supply a directory and one"
+				        " or more file names\n");
+				result = -1;
+			}
+		}
+		else if (strcmp(argv[argi], "--export") == 0)
+		{
+			double start, end;
+			bool const accurate = argi + 5 < argc &&
+			                      strcmp(argv[argi + 5], "accurate") == 0;
+			if (argi + 4 < argc &&
+			    export_parse_time(argv[argi + 2], &start) &&
+			    export_parse_time(argv[argi + 3], &end) && end > start)
+				result = export_segment(argv[argi + 1], start, end, argv[argi + 4],
+				                        accurate) ? 0 : 1;
+			else
+			{
+				fprintf(stderr, "Argument error: Please supply <in> <start> <end>"
+				        " <out>\n");
+				result = -1;
+			}
+		}
 		else
 		{
 			fprintf(stderr, "Argument error: Unknown argument\n");
 			fprintf(stdout, usage);
 		}
-		return 0;
+		ControlServer_stop(&control);
+		scheduler_quit();
+		trace_write();
+		return result;
 	}
 
-	int result = interactive_exec();
+	result = interactive_exec(&options, libraryIndex);
+	ControlServer_stop(&control);
+	scheduler_quit();
+	stats_print(stdout);
+	memstats_print(stdout);
+	trace_write();
+	avformat_network_deinit();
 	SDL_Quit();
 	return result;
 }
@@ -1,10 +1,15 @@
 #include "media.h"
 
 #include <assert.h>
+#include <string.h>
 
 #include <SDL2/SDL_thread.h>
+#include <libavutil/pixdesc.h>
 #include <libavutil/time.h>
 
+#include "memstats.h"
+#include "scheduler.h"
+
 struct AVFormatContext* av_open_file(char const* fileName)
 {
 	struct AVFormatContext* fc = NULL;
@@ -21,8 +26,33 @@ struct AVFormatContext* av_open_file(char const* fileName)
 	}
 	return fc;
 }
+struct AVFormatContext* av_open_live(char const* url)
+{
+	// As for the ffmpeg command line
+	if (strcmp(url, "-") == 0) url = "pipe:0";
+
+	AVDictionary* options = NULL;
+	av_dict_set(&options, "fflags", "nobuffer", 0);
+	av_dict_set_int(&options, "probesize", LIVE_PROBE_SIZE, 0);
+	av_dict_set_int(&options, "analyzeduration", LIVE_ANALYZE_DURATION, 0);
+	struct AVFormatContext* fc = NULL;
+	int result = avformat_open_input(&fc, url, NULL, &options);
+	av_dict_free(&options);
+	if (result < 0)
+	{
+		fprintf(stderr, "Unable to open live source: %s\n", av_err2str(result));
+		return NULL;
+	}
+	if (avformat_find_stream_info(fc, NULL) < 0)
+	{
+		fprintf(stderr, "Unable to find streams within media\n");
+		avformat_close_input(&fc);
+		return NULL;
+	}
+	return fc;
+}
 bool av_stream_context(struct AVFormatContext* const fc, unsigned streamIndex,
-                       struct AVCodecContext** const cc)
+                       struct AVCodecContext** const cc, bool lowDelay)
 {
 	assert(streamIndex < fc->nb_streams);
 
@@ -39,6 +69,15 @@ bool av_stream_context(struct AVFormatContext* const fc, unsigned streamIndex,
 		avcodec_free_context(cc);
 		return false;
 	}
+	// Decoded pictures may be kept by the frame cache
+	if ((*cc)->codec_type == AVMEDIA_TYPE_VIDEO)
+		(*cc)->refcounted_frames = 1;
+	if (lowDelay)
+	{
+		// Frame threads each hold back a frame
+		(*cc)->thread_type = FF_THREAD_SLICE;
+		(*cc)->flags |= AV_CODEC_FLAG_LOW_DELAY;
+	}
 	if (avcodec_open2(*cc, codec, NULL) < 0)
 	{
 		fprintf(stderr, "Unsupported codec\n");
@@ -53,12 +92,20 @@ void Media_init(struct Media* const media)
 	assert(media);
 	memset(media, 0, sizeof(struct Media));
 	media->streamIndexA = media->streamIndexV = CHAL_UNSIGNED_INVALID;
+	media->pictUploaded = -1;
+	media->liveHeadV = AV_NOPTS_VALUE;
+	media->seekTarget = AV_NOPTS_VALUE;
+	media->cursor = AV_NOPTS_VALUE;
 	media->pictQueueMutex = SDL_CreateMutex();
 	media->pictQueueCond = SDL_CreateCond();
 	PacketQueue_init(&media->queueA);
 	PacketQueue_init(&media->queueV);
+	Subtitles_init(&media->subtitles);
 	media->frameVideo = av_frame_alloc();
+	media->frameFiltered = av_frame_alloc();
 	media->frameAudio = av_frame_alloc();
+	SyncStats_reset(&media->sync);
+	PlaybackClock_init(&media->clock, CLOCK_SOURCE_COUNT, false, false);
 }
 void Media_destroy(struct Media* const media)
 {
@@ -67,34 +114,149 @@ void Media_destroy(struct Media* const media)
 	SDL_DestroyCond(media->pictQueueCond);
 	PacketQueue_destroy(&media->queueA);
 	PacketQueue_destroy(&media->queueV);
-	swr_free(&media->swrContext);
-	sws_freeContext(media->swsContext);
+	SlicedScale_destroy(&media->scale);
+	SlicedScale_destroy(&media->scaleStep);
+	VideoFilter_destroy(&media->filter);
+	GopDecoder_destroy(&media->gopDecoder);
+	FrameCache_destroy(&media->frameCache);
+	AudioMixer_destroy(&media->mixer);
+	Subtitles_destroy(&media->subtitles);
 	av_frame_free(&media->frameVideo);
+	av_frame_free(&media->frameFiltered);
 	av_frame_free(&media->frameAudio);
 }
+_Static_assert(MEDIA_TILES_MAX * MEDIA_TEXTURES <= OUTPUT_TEXTURES,
+               "The textures are taken from Output");
+
+static bool renderer_supports(SDL_RendererInfo const* const info,
+                              uint32_t format)
+{
+	for (uint32_t i = 0; i < info->num_texture_formats; ++i)
+		if (info->texture_formats[i] == format) return true;
+	return false;
+}
+/**
+ * @brief Chooses a texture format and the matching picture format for
+ *  pictures decoded in format. Formats the renderer lists are preferred.
+ */
+static uint32_t texture_format(SDL_RendererInfo const* const info,
+                               enum AVPixelFormat format,
+                               enum AVPixelFormat* const pictFormat)
+{
+	if (format == AV_PIX_FMT_NV12 &&
+	    renderer_supports(info, SDL_PIXELFORMAT_NV12))
+	{
+		*pictFormat = AV_PIX_FMT_NV12;
+		return SDL_PIXELFORMAT_NV12;
+	}
+	if (format == AV_PIX_FMT_NV21 &&
+	    renderer_supports(info, SDL_PIXELFORMAT_NV21))
+	{
+		*pictFormat = AV_PIX_FMT_NV21;
+		return SDL_PIXELFORMAT_NV21;
+	}
+	// Any other format is converted to YUV420P
+	*pictFormat = AV_PIX_FMT_YUV420P;
+	if (!renderer_supports(info, SDL_PIXELFORMAT_IYUV) &&
+	    renderer_supports(info, SDL_PIXELFORMAT_YV12))
+		return SDL_PIXELFORMAT_YV12;
+	return SDL_PIXELFORMAT_IYUV;
+}
+/**
+ * @brief Splits size into the fewest tiles no larger than max. All tiles but
+ *  the last have the same even size, so chroma planes split evenly.
+ * @param[in] max 0 if unlimited
+ * @return Size of the tiles
+ */
+static int tile_size(int size, int max, unsigned* const nTiles)
+{
+	unsigned n = max > 0 ? (size + max - 1) / max : 1;
+	while (true)
+	{
+		int tile = ((size + n - 1) / n + 1) & ~1;
+		if (max <= 0 || tile <= max || tile >= size)
+		{
+			*nTiles = (size + tile - 1) / tile;
+			return tile;
+		}
+		++n;
+	}
+}
 bool Media_pictQueue_init(struct Media* const media)
 {
 	assert(media);
 	assert(media->renderer);
 	assert(media->outWidth != 0 && media->outHeight != 0);
 
-	size_t planeSizeY = media->outWidth * media->outHeight;
-	size_t planeSizeUV = planeSizeY / 4;
+	SDL_RendererInfo info;
+	if (SDL_GetRendererInfo(media->renderer, &info) < 0)
+	{
+		info.num_texture_formats = 0;
+		info.max_texture_width = info.max_texture_height = 0;
+	}
+	media->textureFormat = texture_format(&info, media->outFormat,
+	                                      &media->pictFormat);
+
+	unsigned nColumns, nRows;
+	int const tileWidth = tile_size(media->outWidth, info.max_texture_width,
+	                                &nColumns);
+	int const tileHeight = tile_size(media->outHeight, info.max_texture_height,
+	                                 &nRows);
+	if (nColumns * nRows > MEDIA_TILES_MAX)
+	{
+		fprintf(stderr, "Picture of %dx%d exceeds %d tiles of %dx%d\n",
+		        media->outWidth, media->outHeight, MEDIA_TILES_MAX,
+		        info.max_texture_width, info.max_texture_height);
+		return false;
+	}
+	media->nTiles = 0;
+	for (unsigned row = 0; row < nRows; ++row)
+		for (unsigned column = 0; column < nColumns; ++column)
+		{
+			SDL_Rect* const tile = &media->tiles[media->nTiles];
+			tile->x = column * tileWidth;
+			tile->y = row * tileHeight;
+			tile->w = FFMIN(tileWidth, media->outWidth - tile->x);
+			tile->h = FFMIN(tileHeight, media->outHeight - tile->y);
+			for (unsigned i = 0; i < MEDIA_TEXTURES; ++i)
+			{
+				SDL_Texture* const texture = Output_texture(media->output,
+				                             media->nTiles * MEDIA_TEXTURES + i,
+				                             media->textureFormat, tile->w, tile->h);
+				if (!texture) goto fail;
+				media->textures[media->nTiles][i] = texture;
+			}
+			++media->nTiles;
+		}
+	// Tiles of a previous playback
+	Output_textures_truncate(media->output, media->nTiles * MEDIA_TEXTURES);
+	if (media->nTiles > 1)
+		fprintf(stdout, "Picture split in %ux%u tiles of %dx%d\n", nColumns,
+		        nRows, tileWidth, tileHeight);
+	media->textureIndex = 0;
+	media->pictUploaded = -1;
+
 	for (size_t i = 0; i < PICTQUEUE_SIZE; ++i)
 	{
 		struct VideoPicture* const vp = &media->pictQueue[i];
 		vp->width = media->outWidth;
 		vp->height = media->outHeight;
-		vp->texture = SDL_CreateTexture(media->renderer,
-		                                SDL_PIXELFORMAT_YV12,
-		                                SDL_TEXTUREACCESS_STREAMING,
-		                                vp->width, vp->height);
-		if (!vp->texture) goto fail;
-		vp->planeY = malloc(sizeof(*vp->planeY) * planeSizeY);
-		vp->planeU = malloc(sizeof(*vp->planeU) * planeSizeUV);
-		vp->planeV = malloc(sizeof(*vp->planeV) * planeSizeUV);
-		if (!vp->planeY || !vp->planeU || !vp->planeV) goto fail;
+		vp->frame = av_frame_alloc();
+		if (!vp->frame) goto fail;
+		if (av_image_alloc(vp->data, vp->linesize, vp->width, vp->height,
+		                   media->pictFormat, 32) < 0)
+			goto fail;
 	}
+	// Planes of the step picture are allocated by the first step
+	media->pictStep.width = media->outWidth;
+	media->pictStep.height = media->outHeight;
+	media->pictStep.frame = av_frame_alloc();
+	if (!media->pictStep.frame) goto fail;
+	// Pictures and textures of the same size
+	int size = av_image_get_buffer_size(media->pictFormat, media->outWidth,
+	                                    media->outHeight, 1);
+	media->pictFootprint = (int64_t) size * (PICTQUEUE_SIZE + MEDIA_TEXTURES);
+	memstats_add(MEM_PICTURES, media->pictFootprint);
 	return true;
 fail:
 	Media_pictQueue_destroy(media);
@@ -103,14 +265,196 @@ fail:
 void Media_pictQueue_destroy(struct Media* const media)
 {
 	if (!media) return;
+	memstats_add(MEM_PICTURES, -media->pictFootprint);
+	media->pictFootprint = 0;
 	for (size_t i = 0; i < PICTQUEUE_SIZE; ++i)
 	{
 		struct VideoPicture* const vp = &media->pictQueue[i];
-		SDL_DestroyTexture(vp->texture);
-		free(vp->planeY);
-		free(vp->planeU);
-		free(vp->planeV);
+		av_freep(&vp->data[0]);
+		av_frame_free(&vp->frame);
+		memset(vp, 0, sizeof(struct VideoPicture));
 	}
+	av_freep(&media->pictStep.data[0]);
+	av_frame_free(&media->pictStep.frame);
+	memset(&media->pictStep, 0, sizeof(struct VideoPicture));
+	// Owned by media->output
+	memset(media->textures, 0, sizeof(media->textures));
+	media->nTiles = 0;
+	media->pictUploaded = -1;
+}
+/**
+ * @brief Copy of a tile of a picture into a locked texture.
+ */
+struct TileUpload
+{
+	uint8_t* dst[4];
+	int dstStride[4];
+	uint8_t const* src[4];
+	int srcStride[4];
+	enum AVPixelFormat format;
+	int width, height;
+};
+static void TileUpload_run(void* data)
+{
+	struct TileUpload* const tu = data;
+	av_image_copy(tu->dst, tu->dstStride, tu->src, tu->srcStride, tu->format,
+	              tu->width, tu->height);
+}
+/**
+ * @brief Plane layout of a locked texture of the given format and height.
+ */
+static void texture_planes(uint32_t format, void* pixels, int pitch,
+                           int height, uint8_t* planes[4], int pitches[4])
+{
+	memset(planes, 0, 4 * sizeof(uint8_t*));
+	memset(pitches, 0, 4 * sizeof(int));
+	planes[0] = pixels;
+	pitches[0] = pitch;
+	planes[1] = planes[0] + (size_t) pitch * height;
+	if (format == SDL_PIXELFORMAT_NV12 || format == SDL_PIXELFORMAT_NV21)
+	{
+		pitches[1] = (pitch + 1) / 2 * 2;
+		return;
+	}
+	pitches[1] = pitches[2] = (pitch + 1) / 2;
+	planes[2] = planes[1] + (size_t) pitches[1] * ((height + 1) / 2);
+	if (format == SDL_PIXELFORMAT_YV12) // Y, V, U
+	{
+		uint8_t* const planeU = planes[2];
+		planes[2] = planes[1];
+		planes[1] = planeU;
+	}
+}
+bool Media_pictQueue_upload(struct Media* const media,
+                            struct VideoPicture* const vp)
+{
+	struct AVPixFmtDescriptor const* const desc =
+	  av_pix_fmt_desc_get(media->pictFormat);
+	int steps[4];
+	av_image_fill_max_pixsteps(steps, NULL, desc);
+	uint8_t* const* const data = vp->frame->data[0] ? vp->frame->data : vp->data;
+	int const* const linesize = vp->frame->data[0] ? vp->frame->linesize :
+	                            vp->linesize;
+
+	// Only the render thread may lock textures. The copies may run anywhere.
+	struct TileUpload uploads[MEDIA_TILES_MAX];
+	unsigned nLocked = 0;
+	bool success = true;
+	for (; nLocked < media->nTiles; ++nLocked)
+	{
+		SDL_Rect const* const tile = &media->tiles[nLocked];
+		SDL_Texture* const texture =
+		  media->textures[nLocked][media->textureIndex ^ 1];
+		void* pixels;
+		int pitch;
+		if (SDL_LockTexture(texture, NULL, &pixels, &pitch) < 0)
+		{
+			fprintf(stderr, "[SDL] %s\n", SDL_GetError());
+			success = false;
+			break;
+		}
+		struct TileUpload* const tu = &uploads[nLocked];
+		texture_planes(media->textureFormat, pixels, pitch, tile->h, tu->dst,
+		               tu->dstStride);
+		for (int i = 0; i < 4; ++i)
+		{
+			tu->src[i] = NULL;
+			tu->srcStride[i] = linesize[i];
+			if (!data[i]) continue;
+			// Planes other than luma are subsampled
+			int const x = i == 0 ? tile->x : tile->x >> desc->log2_chroma_w;
+			int const y = i == 0 ? tile->y : tile->y >> desc->log2_chroma_h;
+			tu->src[i] = data[i] + (ptrdiff_t) y * linesize[i] + x * steps[i];
+		}
+		tu->format = media->pictFormat;
+		tu->width = tile->w;
+		tu->height = tile->h;
+	}
+
+	if (success && nLocked == 1)
+		TileUpload_run(&uploads[0]);
+	else if (success)
+	{
+		struct TaskGroup group;
+		TaskGroup_init(&group);
+		for (unsigned i = 0; i < nLocked; ++i)
+			scheduler_submit(&group, TileUpload_run, &uploads[i]);
+		TaskGroup_wait(&group);
+	}
+	for (unsigned i = 0; i < nLocked; ++i)
+		SDL_UnlockTexture(media->textures[i][media->textureIndex ^ 1]);
+	if (success)
+		av_frame_unref(vp->frame);
+	return success;
+}
+void Media_texture_swap(struct Media* const media)
+{
+	media->textureIndex ^= 1;
+}
+void Media_render_copy(struct Media* const media)
+{
+	int width, height;
+	if (SDL_GetRendererOutputSize(media->renderer, &width, &height) < 0)
+		return;
+	// Edges are scaled, not sizes, so that no gap opens between tiles
+	for (unsigned i = 0; i < media->nTiles; ++i)
+	{
+		SDL_Rect const* const tile = &media->tiles[i];
+		int const x0 = (int64_t) tile->x * width / media->outWidth;
+		int const y0 = (int64_t) tile->y * height / media->outHeight;
+		int const x1 = (int64_t) (tile->x + tile->w) * width / media->outWidth;
+		int const y1 = (int64_t) (tile->y + tile->h) * height / media->outHeight;
+		SDL_Rect const dst = { x0, y0, x1 - x0, y1 - y0 };
+		SDL_RenderCopy(media->renderer, media->textures[i][media->textureIndex],
+		               NULL, &dst);
+	}
+}
+bool Media_present_frame(struct Media* const media,
+                         struct AVFrame const* const frame)
+{
+	struct VideoPicture* const vp = &media->pictStep;
+	if (!vp->frame || frame->width != vp->width || frame->height != vp->height)
+		return false;
+	if (frame->format == media->pictFormat)
+	{
+		if (av_frame_ref(vp->frame, frame) < 0) return false;
+	}
+	else
+	{
+		if (!media->scaleStep.nSlices &&
+		    !SlicedScale_init(&media->scaleStep, vp->width, vp->height,
+		                      frame->format, media->pictFormat, SWS_BILINEAR, 0))
+			return false;
+		if (!vp->data[0])
+		{
+			if (av_image_alloc(vp->data, vp->linesize, vp->width, vp->height,
+			                   media->pictFormat, 32) < 0)
+				return false;
+			int const size = av_image_get_buffer_size(media->pictFormat, vp->width,
+			                                          vp->height, 1);
+			media->pictFootprint += size;
+			memstats_add(MEM_PICTURES, size);
+		}
+		SlicedScale_scale(&media->scaleStep, (uint8_t const* const*) frame->data,
+		                  frame->linesize, vp->data, vp->linesize);
+	}
+	// The back textures may hold the next picture of the queue
+	media->pictUploaded = -1;
+	if (!Media_pictQueue_upload(media, vp))
+	{
+		av_frame_unref(vp->frame);
+		return false;
+	}
+	Media_texture_swap(media);
+	SDL_RenderClear(media->renderer);
+	Media_render_copy(media);
+	// Without a timestamp, no subtitle is known to be shown with the frame
+	int64_t const pts = av_frame_get_best_effort_timestamp(frame);
+	if (pts != AV_NOPTS_VALUE)
+		Subtitles_render(&media->subtitles, media->renderer,
+		                 pts * av_q2d(media->streamV->time_base));
+	SDL_RenderPresent(media->renderer);
+	return true;
 }
 bool Media_pictQueue_wait_write(struct Media* const media)
 {
@@ -123,32 +467,100 @@ bool Media_pictQueue_wait_write(struct Media* const media)
 	if (media->state == STATE_QUIT) return false;
 	return true;
 }
+void Media_quit(struct Media* const media)
+{
+	assert(media);
+	media->state = STATE_QUIT;
+
+	PacketQueue* const queues[] =
+	{
+		&media->queueA, &media->queueV, &media->subtitles.queue
+	};
+	for (size_t i = 0; i < sizeof(queues) / sizeof(queues[0]); ++i)
+	{
+		SDL_LockMutex(queues[i]->mutex);
+		SDL_CondBroadcast(queues[i]->cond);
+		SDL_UnlockMutex(queues[i]->mutex);
+	}
+	SDL_LockMutex(media->pictQueueMutex);
+	SDL_CondBroadcast(media->pictQueueCond);
+	SDL_UnlockMutex(media->pictQueueMutex);
+	Subtitles_wake(&media->subtitles);
+}
 
+/**
+ * @return Index in fc of its audio stream number track. -1 if none.
+ */
+static int media_audio_stream(struct AVFormatContext const* fc, unsigned track)
+{
+	for (unsigned i = 0; i < fc->nb_streams; ++i)
+		if (fc->streams[i]->codec->codec_type == AVMEDIA_TYPE_AUDIO &&
+		    track-- == 0)
+			return i;
+	return -1;
+}
 bool Media_open_best_streams(struct Media* const media)
 {
-	// Audio stream
-	for (unsigned i = 0; i < media->formatContext->nb_streams; ++i)
-		if (media->formatContext->streams[i]->codec->codec_type == AVMEDIA_TYPE_AUDIO)
+	// Audio streams. The first one drives the audio clock, the others are
+	// mixed with it
+	struct AudioMixer* const mixer = &media->mixer;
+	unsigned const nTracks = mixer->nSpecs ? mixer->nSpecs : 1;
+	for (unsigned i = 0; i < nTracks && (i == 0 || media->ccA); ++i)
+	{
+		unsigned const track = mixer->nSpecs ? mixer->specs[i].index : 0;
+		int const index = media_audio_stream(media->formatContext, track);
+		if (index < 0)
 		{
-			if (!av_stream_context(media->formatContext, i, &media->ccA)) break;
-			media->streamIndexA = i;
-			media->streamA = media->formatContext->streams[i];
-			break;
+			fprintf(stderr, "No audio track %u\n", track);
+			continue;
+		}
+		struct AVCodecContext* cc = NULL;
+		if (AudioMixer_track(mixer, index) >= 0 ||
+		    !av_stream_context(media->formatContext, index, &cc,
+		                       media->liveLatency > 0.0))
+			continue;
+		if (!AudioMixer_add_track(mixer, index, cc,
+		                          mixer->nSpecs ? mixer->specs[i].gain : 1.0f))
+		{
+			avcodec_free_context(&cc);
+			continue;
 		}
+		if (i == 0)
+		{
+			media->ccA = cc;
+			media->streamIndexA = index;
+			media->streamA = media->formatContext->streams[index];
+		}
+	}
 	for (unsigned i = 0; i < media->formatContext->nb_streams; ++i)
 		if (media->formatContext->streams[i]->codec->codec_type == AVMEDIA_TYPE_VIDEO)
 		{
-			if (!av_stream_context(media->formatContext, i, &media->ccV)) break;
+			if (!av_stream_context(media->formatContext, i, &media->ccV,
+			                       media->liveLatency > 0.0)) break;
 
 			// TODO: Allow the window to be resized
 			media->streamIndexV = i;
 			media->streamV = media->formatContext->streams[i];
+
+			// Frames held by each decoding thread, reordering and the output
+			struct AVCodecContext const* const cc = media->ccV;
+			int frameSize = av_image_get_buffer_size(cc->pix_fmt, cc->width,
+			                cc->height, 1);
+			if (frameSize > 0)
+			{
+				int nFrames = (cc->thread_count > 1 ? cc->thread_count : 1) +
+				              cc->has_b_frames + 2;
+				media->decoderFootprint = (int64_t) frameSize * nFrames;
+				memstats_add(MEM_DECODER, media->decoderFootprint);
+			}
 			break;
 		}
 	return media->ccA || media->ccV;
 }
 void Media_close(struct Media* const media)
 {
+	memstats_add(MEM_DECODER, -media->decoderFootprint);
+	media->decoderFootprint = 0;
 	avcodec_close(media->ccA);
 	avcodec_close(media->ccV);
 }
@@ -168,10 +580,3 @@ double Media_synchronise_video(struct Media* const media,
 
 	return pts;
 }
-
-double Media_get_audio_clock(struct Media const* const media)
-{
-	double pts = media->clockAudio;
-
-	return pts;
-}
@@ -9,17 +9,48 @@
 
 #include "chalcocite.h"
 #include "videopicture.h"
+#include "syncstats.h"
+#include "scale.h"
+#include "output.h"
+#include "filter.h"
+#include "governor.h"
+#include "framecache.h"
+#include "sink.h"
+#include "mixer.h"
+#include "subtitle.h"
+#include "mediaclock.h"
+#include "trickplay.h"
 #include "container/packetqueue.h"
 
 #define AUDIO_QUEUE_MAX_SIZE (5 * 16 * 1024)
 #define VIDEO_QUEUE_MAX_SIZE (5 * 256 * 1024)
-#define PICTQUEUE_SIZE 1
+// Maximum duration of converted audio queued in the SDL audio device
+#define AUDIO_DEVICE_QUEUE_MAX_DURATION 0.5
+#define PICTQUEUE_SIZE 2
+#define MEDIA_TEXTURES 2 // Presented and uploading
+// Pictures beyond the maximum texture size of the renderer are split in tiles
+#define MEDIA_TILES_MAX 32
+
+// Live sources
+#define LIVE_PROBE_SIZE 32768 // Bytes read to detect the format
+#define LIVE_ANALYZE_DURATION 100000 // Microseconds read to find the streams
+#define LIVE_AUDIO_SAMPLES 512 // Audio device buffer, 1024 otherwise
+// Target latency in second at which the packet queues of a live source are
+// as large as those of files, about a second of each stream. They are scaled
+// with the latency
+#define LIVE_QUEUE_LATENCY 1.0
 
 /**
  * @brief Opens a AVFormatContext from the given fileName.
  * @return NULL if failed.
  */
 struct AVFormatContext* av_open_file(char const* fileName);
+/**
+ * @brief Opens a live source such as "-" (stdin), a named pipe or a udp:// or
+ *  tcp:// URL with small probe sizes and without demuxer buffering.
+ * @return NULL if failed.
+ */
+struct AVFormatContext* av_open_live(char const* url);
 /**
  * @brief Extracts and copies codec context of given stream. Guarenteed to
  *  clean up upon failure.
@@ -29,10 +60,12 @@ struct AVFormatContext* av_open_file(char const* fileName);
  *  less than fc->nb_streams
  * @param[out] cc Output to store the copied AVCodecContext. Must be
  *  dereferencible.
+ * @param[in] lowDelay Decodes with slice threads only and without output
+ *  delay, for live sources.
  * @return true if successful.
  */
 bool av_stream_context(struct AVFormatContext* const fc, unsigned streamIndex,
-                       struct AVCodecContext** const cc);
+                       struct AVCodecContext** const cc, bool lowDelay);
 
 /**
  * Must be initialised with \ref Media_init and destroyed by \red Media_destroy
@@ -43,23 +76,51 @@ struct Media
 	char fileName[1024]; ///< Path to the media file
 	_Atomic enum State state; ///< Playback state
 	struct AVFormatContext* formatContext;
+	/**
+	 * Target latency of a live source in second. 0 for files. Past it, frames
+	 *  are dropped and presented early to catch up.
+	 */
+	double liveLatency;
+	// Timestamp of the latest demuxed video packet, in streamV->time_base
+	_Atomic int64_t liveHeadV;
+	// Seek requested of the decode thread in AV_TIME_BASE. AV_NOPTS_VALUE if none
+	_Atomic int64_t seekTarget;
+	// Seeks performed by the decode thread. Pictures of an earlier one are stale
+	_Atomic unsigned seekSerial;
+	unsigned serialV; ///< seekSerial of the frames decoded. Video thread only
+	_Atomic bool demuxEnded; ///< The decode thread read the whole input
+	_Atomic int trickSpeed; ///< As of trick_speed_next. 0 if off
 
 	unsigned streamIndexA;
 	struct AVStream* streamA; ///< streamA is NULL if no audio
 	struct AVCodecContext* ccA; ///< Audio codec context
 	PacketQueue queueA; ///< Packet queue to store audio packets.
+	/**
+	 * Audio tracks decoded with streamA, the first of them, and mixed if
+	 *  AudioMixer_enabled. Configured before Media_open_best_streams.
+	 */
+	struct AudioMixer mixer;
 
 	struct SDL_AudioSpec audioSpec;
 	struct SwrContext* swrContext; ///< Converts audio to SDL playable format
-	SDL_AudioDeviceID audioDevice;
+	SDL_AudioDeviceID audioDevice; ///< 0 if no audio
 
 	unsigned streamIndexV;
 	struct AVStream* streamV; // = NULL if no video
 	struct AVCodecContext* ccV; ///< Video codec context
 	PacketQueue queueV;
 
-	struct SwsContext* swsContext; ///< Converts video to SDL playable format
+	/**
+	 * Composited over the pictures of the window. No stream with other sinks
+	 */
+	struct Subtitles subtitles;
+
+	struct VideoFilter filter; ///< Applied to decoded frames if filter.graph
+	struct Governor governor; ///< Decode quality of ccV
+	struct SlicedScale scale; ///< Converts video to SDL playable format
+	int64_t decoderFootprint; ///< Estimated bytes of the decoder frame pool
 	int outWidth, outHeight; ///< Dimension of the screen
+	enum AVPixelFormat outFormat; ///< Format of decoded or filtered frames
 	/**
 	 * This queue is filled by Media_pictQueue_init. The indices pictQueueIndexR,
 	 *  pictQueueIndexW are for reading and writing from the queue, respectively.
@@ -71,24 +132,58 @@ struct Media
 	int pictQueueSize, pictQueueIndexR, pictQueueIndexW;
 	SDL_mutex* pictQueueMutex;
 	SDL_cond* pictQueueCond;
+	enum AVPixelFormat pictFormat; ///< Pixel format of the pictures
+	/**
+	 * Decoded frames kept for stepping, filled by the video thread and by
+	 *  gopDecoder. Disabled with a filter graph or a live source.
+	 */
+	struct FrameCache frameCache;
+	struct GopDecoder gopDecoder;
+	int64_t cursor; ///< pts of the presented picture. AV_NOPTS_VALUE if none
+	// Picture presented by a step, and its conversion. Render thread only
+	struct VideoPicture pictStep;
+	struct SlicedScale scaleStep;
+	int64_t pictFootprint; ///< Bytes accounted for pictures and textures
+	/**
+	 * Pictures are uploaded into textures[i][textureIndex ^ 1] while
+	 *  textures[i][textureIndex] is presented. Texture i holds the area tiles[i]
+	 *  of the picture. Render thread only.
+	 */
+	SDL_Texture* textures[MEDIA_TILES_MAX][MEDIA_TEXTURES];
+	SDL_Rect tiles[MEDIA_TILES_MAX];
+	unsigned nTiles;
+	uint32_t textureFormat; ///< IYUV, YV12, NV12 or NV21
+	unsigned textureIndex;
+	int pictUploaded; ///< Picture in the back texture. -1 if none
 
 	/*
-	 * All synchronisation variables are in second
+	 * All synchronisation variables are in second. timer and lastPresentTime
+	 *  are times of clock_monotonic()
 	 */
-	double timer;
-	double clockAudio;
-	double clockVideo;
+	struct PlaybackClock clock; ///< Master clock the video is paced against
+	double timer; ///< Deadline of the next presentation
+	double clockVideo; ///< Timestamp predicted for the next decoded frame
 	double lastFrameDelay;
 	double lastFrameTimestamp;
+	double lastPresentTime; ///< Time of the last presentation
+	struct SyncStats sync;
 
-	SDL_Window* screen;
+	struct Output* output; ///< Owns screen, renderer, audioDevice, swrContext
+	struct Sink* sink; ///< Receives pictures and audio instead unless SINK_SDL
+	bool outputV, outputA; ///< Decoded video or audio has a destination
+	// The decoders returned their delayed frames at the end of the stream
+	_Atomic bool drainedV, drainedA;
+	SDL_Window* screen; ///< NULL if no video
 	SDL_Renderer* renderer;
+	SDL_TimerID refreshTimer; ///< Pending CHAL_EVENT_REFRESH
 	SDL_Thread* threadParse;
 	SDL_Thread* threadAudio;
 	SDL_Thread* threadVideo;
+	SDL_Thread* threadSubtitle;
 
 	// Cache
 	struct AVFrame* frameVideo;
+	struct AVFrame* frameFiltered;
 	struct AVFrame* frameAudio;
 
 };
@@ -101,7 +196,10 @@ void Media_destroy(struct Media* const);
  * @warning Uses SDl Render API (Not thread safe). User responsible for locking
  *  mutexes.
  * @brief Allocate components of the picture queue with dimensions outWidth *
- *  outHeight. The format for textures is YV12.
+ *  outHeight. The texture format supported by the renderer closest to
+ *  outFormat is chosen, so NV12, NV21 and YUV420P frames need no conversion.
+ *  Pictures larger than the maximum texture size are split in tiles. The
+ *  textures are taken from media->output.
  */
 bool Media_pictQueue_init(struct Media* const);
 /**
@@ -110,12 +208,45 @@ bool Media_pictQueue_init(struct Media* const);
  */
 void Media_pictQueue_destroy(struct Media* const);
 
+/**
+ * @warning Uses SDl Render API (Not thread safe).
+ * @brief Copies a picture into the back textures with SDL_LockTexture and
+ *  releases the frame it references. Tiles are copied in parallel on the
+ *  scheduler.
+ */
+bool Media_pictQueue_upload(struct Media* const, struct VideoPicture* const);
+/**
+ * @warning Uses SDl Render API (Not thread safe).
+ * @brief Makes the back textures the presented ones.
+ */
+void Media_texture_swap(struct Media* const);
+/**
+ * @warning Uses SDl Render API (Not thread safe).
+ * @brief Copies the presented textures to the whole output of the renderer.
+ */
+void Media_render_copy(struct Media* const);
+
+/**
+ * @warning Uses SDl Render API (Not thread safe).
+ * @brief Presents a decoded frame at once, outside of the picture queue, for
+ *  frame stepping, with its subtitles. The frame is converted into
+ *  media->pictStep.
+ * @return false if the frame cannot be presented.
+ */
+bool Media_present_frame(struct Media* const, struct AVFrame const* const);
+
 /**
  * @brief Wait for the writing position in media->pictQueue to be available.
  * @return false if media->state is set to quit
  */
 bool Media_pictQueue_wait_write(struct Media* const);
 
+/**
+ * @brief Sets the state to quit and wakes all threads waiting on the packet
+ *  queues, the picture queue or the subtitle overlays.
+ */
+void Media_quit(struct Media* const);
+
 /**
  * @brief Fills ccA/V, streamIndexA/V, streamA/V with appropriate values.
  * @return false if no audio and no video streams are found.
@@ -128,5 +259,4 @@ void Media_close(struct Media* const);
 
 double Media_synchronise_video(struct Media* const, struct AVFrame* const,
                                double pts);
-double Media_get_audio_clock(struct Media const* const);
 #endif // !CHALCOCITE__MEDIA_H_
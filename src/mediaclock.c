@@ -0,0 +1,193 @@
+#include "mediaclock.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <SDL2/SDL_timer.h>
+
+#ifdef __unix__
+	#include <time.h>
+#endif
+
+static char const* const clockSourceNames[CLOCK_SOURCE_COUNT] =
+{
+	[CLOCK_SOURCE_AUDIO] = "audio",
+	[CLOCK_SOURCE_VIDEO] = "video",
+	[CLOCK_SOURCE_EXTERNAL] = "external",
+};
+
+double clock_monotonic(void)
+{
+#if defined(__unix__) && defined(CLOCK_MONOTONIC)
+	struct timespec time;
+	if (clock_gettime(CLOCK_MONOTONIC, &time) == 0)
+		return time.tv_sec + time.tv_nsec / 1e9;
+#endif
+	return (double) SDL_GetPerformanceCounter() / SDL_GetPerformanceFrequency();
+}
+
+void MediaClock_init(struct MediaClock* const clock)
+{
+	memset(clock, 0, sizeof(struct MediaClock));
+	clock->pts = NAN;
+	clock->speed = 1.0;
+}
+/**
+ * @brief Time of the clock at now. Lock held.
+ */
+static double MediaClock_at(struct MediaClock const* const clock, double now)
+{
+	if (clock->paused) return clock->pts;
+	return clock->pts + (now - clock->lastUpdated) * clock->speed;
+}
+void MediaClock_set(struct MediaClock* const clock, double pts)
+{
+	double const now = clock_monotonic();
+	SDL_AtomicLock(&clock->lock);
+	clock->pts = pts;
+	clock->lastUpdated = now;
+	SDL_AtomicUnlock(&clock->lock);
+}
+double MediaClock_get(struct MediaClock* const clock)
+{
+	double const now = clock_monotonic();
+	SDL_AtomicLock(&clock->lock);
+	double const pts = MediaClock_at(clock, now);
+	SDL_AtomicUnlock(&clock->lock);
+	return pts;
+}
+void MediaClock_pause(struct MediaClock* const clock, bool paused)
+{
+	double const now = clock_monotonic();
+	SDL_AtomicLock(&clock->lock);
+	clock->pts = MediaClock_at(clock, now);
+	clock->lastUpdated = now;
+	clock->paused = paused;
+	SDL_AtomicUnlock(&clock->lock);
+}
+void MediaClock_set_speed(struct MediaClock* const clock, double speed)
+{
+	double const now = clock_monotonic();
+	SDL_AtomicLock(&clock->lock);
+	clock->pts = MediaClock_at(clock, now);
+	clock->lastUpdated = now;
+	clock->speed = speed;
+	SDL_AtomicUnlock(&clock->lock);
+}
+
+void PlaybackClock_init(struct PlaybackClock* const pc,
+                        enum ClockSource requested, bool audio, bool video)
+{
+	memset(pc, 0, sizeof(struct PlaybackClock));
+	MediaClock_init(&pc->audio);
+	MediaClock_init(&pc->video);
+	MediaClock_init(&pc->external);
+	pc->speed = 1.0;
+	pc->driftBeginTime = NAN;
+	atomic_init(&pc->driftRestart, false);
+	// A clock without its stream never advances
+	if ((requested == CLOCK_SOURCE_AUDIO && audio) ||
+	    (requested == CLOCK_SOURCE_VIDEO && video) ||
+	    requested == CLOCK_SOURCE_EXTERNAL)
+		pc->master = requested;
+	else
+		pc->master = audio ? CLOCK_SOURCE_AUDIO : CLOCK_SOURCE_EXTERNAL;
+}
+double PlaybackClock_master(struct PlaybackClock* const pc)
+{
+	switch (pc->master)
+	{
+	case CLOCK_SOURCE_AUDIO:
+		return MediaClock_get(&pc->audio);
+	case CLOCK_SOURCE_VIDEO:
+		return MediaClock_get(&pc->video);
+	default:
+		return MediaClock_get(&pc->external);
+	}
+}
+void PlaybackClock_set_audio(struct PlaybackClock* const pc, double pts)
+{
+	MediaClock_set(&pc->audio, pts);
+
+	double const now = clock_monotonic();
+	if (atomic_exchange(&pc->driftRestart, false) || isnan(pc->driftBeginTime))
+	{
+		pc->driftBeginTime = now;
+		pc->driftBeginPts = pts;
+		return;
+	}
+	double const elapsed = now - pc->driftBeginTime;
+	double const advance = pts - pc->driftBeginPts;
+	// Discontinuities of the timestamps are not drift
+	if (fabs(advance - elapsed) > CLOCK_RESYNC_THRESHOLD)
+	{
+		pc->driftBeginTime = now;
+		pc->driftBeginPts = pts;
+		return;
+	}
+	if (elapsed < CLOCK_DRIFT_MIN_DURATION) return;
+	pc->drift = (advance - elapsed) / elapsed;
+	pc->driftDuration = elapsed;
+	if (!pc->driftReported && fabs(pc->drift) > CLOCK_DRIFT_WARN)
+	{
+		fprintf(stdout, "[Clock] Audio drifts %+.0f ppm from the monotonic "
+		        "clock\n", pc->drift * 1e6);
+		pc->driftReported = true;
+	}
+}
+void PlaybackClock_set_video(struct PlaybackClock* const pc, double pts)
+{
+	MediaClock_set(&pc->video, pts);
+	double const external = MediaClock_get(&pc->external);
+	if (isnan(external) || fabs(external - pts) > CLOCK_RESYNC_THRESHOLD)
+	{
+		if (!isnan(external)) ++pc->nResyncs;
+		MediaClock_set(&pc->external, pts);
+	}
+}
+void PlaybackClock_pause(struct PlaybackClock* const pc, bool paused)
+{
+	MediaClock_pause(&pc->audio, paused);
+	MediaClock_pause(&pc->video, paused);
+	MediaClock_pause(&pc->external, paused);
+	atomic_store(&pc->driftRestart, true);
+}
+void PlaybackClock_reset(struct PlaybackClock* const pc)
+{
+	MediaClock_set(&pc->audio, NAN);
+	MediaClock_set(&pc->video, NAN);
+	MediaClock_set(&pc->external, NAN);
+	atomic_store(&pc->driftRestart, true);
+}
+bool PlaybackClock_set_speed(struct PlaybackClock* const pc, double speed)
+{
+	if (pc->master == CLOCK_SOURCE_AUDIO || speed < CLOCK_SPEED_MIN ||
+	    speed > CLOCK_SPEED_MAX)
+		return false;
+	pc->speed = speed;
+	MediaClock_set_speed(&pc->video, speed);
+	MediaClock_set_speed(&pc->external, speed);
+	return true;
+}
+void PlaybackClock_print(struct PlaybackClock const* const pc, FILE* file)
+{
+	fprintf(file, "Clock: %s master, speed %.2f, %llu resyncs",
+	        clock_source_name(pc->master), pc->speed,
+	        (unsigned long long) pc->nResyncs);
+	if (pc->driftDuration > 0.0)
+		fprintf(file, ", audio drift %+.0f ppm over %.0fs", pc->drift * 1e6,
+		        pc->driftDuration);
+	fprintf(file, "\n");
+}
+
+enum ClockSource clock_source_parse(char const* name)
+{
+	for (int i = 0; i < CLOCK_SOURCE_COUNT; ++i)
+		if (strcmp(name, clockSourceNames[i]) == 0)
+			return (enum ClockSource) i;
+	return CLOCK_SOURCE_COUNT;
+}
+char const* clock_source_name(enum ClockSource source)
+{
+	return source < CLOCK_SOURCE_COUNT ? clockSourceNames[source] : "unknown";
+}
@@ -0,0 +1,124 @@
+#ifndef CHALCOCITE__MEDIACLOCK_H_
+#define CHALCOCITE__MEDIACLOCK_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <SDL2/SDL_atomic.h>
+
+/**
+ * @brief Clocks video can be synchronised to.
+ */
+enum ClockSource
+{
+	CLOCK_SOURCE_AUDIO, ///< Audio played by the device
+	CLOCK_SOURCE_VIDEO, ///< Presented picture. Video is paced by its timestamps
+	CLOCK_SOURCE_EXTERNAL, ///< CLOCK_MONOTONIC at the playback speed
+	CLOCK_SOURCE_COUNT
+};
+
+// A clock this far from another is set to it instead of corrected
+#define CLOCK_RESYNC_THRESHOLD 10.0
+// Seconds the audio clock is measured against the monotonic clock
+#define CLOCK_DRIFT_MIN_DURATION 10.0
+#define CLOCK_DRIFT_WARN 1e-3 // Relative drift reported as it is detected
+#define CLOCK_SPEED_MIN 0.25
+#define CLOCK_SPEED_MAX 4.0
+
+/**
+ * @return Seconds of CLOCK_MONOTONIC, or of the SDL performance counter where
+ *  it is unavailable.
+ */
+double clock_monotonic(void);
+
+/**
+ * Must be initialised with \ref MediaClock_init. Thread safe.
+ * @brief Media time that advances with the monotonic clock at a speed from
+ *  the time it was last set, unless paused.
+ */
+struct MediaClock
+{
+	double pts; ///< Second at lastUpdated. NAN until set
+	double lastUpdated; ///< clock_monotonic() when set
+	double speed;
+	bool paused;
+	SDL_SpinLock lock;
+};
+
+void MediaClock_init(struct MediaClock* const);
+void MediaClock_set(struct MediaClock* const, double pts);
+/**
+ * @return Current media time. NAN if never set.
+ */
+double MediaClock_get(struct MediaClock* const);
+/**
+ * @brief Freezes or resumes the clock at its current time.
+ */
+void MediaClock_pause(struct MediaClock* const, bool paused);
+void MediaClock_set_speed(struct MediaClock* const, double speed);
+
+/**
+ * Must be initialised with \ref PlaybackClock_init.
+ * @brief Audio, video and external clocks of a playback, one of which is the
+ *  master the video is synchronised to. The audio clock is set by the audio
+ *  thread and measured against the monotonic clock for drift.
+ */
+struct PlaybackClock
+{
+	struct MediaClock audio, video, external;
+	enum ClockSource master;
+	double speed; ///< Of the video and external clocks
+	// Drift of the audio clock from the monotonic clock. Audio thread only
+	_Atomic bool driftRestart; ///< Set by pauses, which interrupt the audio
+	double driftBeginTime; ///< NAN if not measuring
+	double driftBeginPts;
+	double drift; ///< Relative. Positive if audio runs fast
+	double driftDuration; ///< Seconds drift was measured over
+	bool driftReported;
+	uint64_t nResyncs; ///< Of the external clock to the video
+};
+
+/**
+ * @param[in] requested CLOCK_SOURCE_COUNT to choose from the streams: audio
+ *  if played by the device, the external clock otherwise
+ */
+void PlaybackClock_init(struct PlaybackClock* const,
+                        enum ClockSource requested, bool audio, bool video);
+/**
+ * @return Time of the master clock. NAN until set.
+ */
+double PlaybackClock_master(struct PlaybackClock* const);
+/**
+ * @param[in] pts Timestamp of the audio leaving the device
+ */
+void PlaybackClock_set_audio(struct PlaybackClock* const, double pts);
+/**
+ * @brief Sets the video clock when a picture is presented. The external
+ *  clock starts at the first picture and is set again if the timestamps jump
+ *  by CLOCK_RESYNC_THRESHOLD.
+ */
+void PlaybackClock_set_video(struct PlaybackClock* const, double pts);
+void PlaybackClock_pause(struct PlaybackClock* const, bool paused);
+/**
+ * @brief Unsets the clocks after a seek, keeping the master, the speed and
+ *  the pause. Each clock is set again by its stream.
+ */
+void PlaybackClock_reset(struct PlaybackClock* const);
+/**
+ * @brief Changes the speed of the video and external clocks. The audio
+ *  clock runs at the speed of the device.
+ * @return false if the master is the audio clock or speed is out of
+ *  [CLOCK_SPEED_MIN, CLOCK_SPEED_MAX].
+ */
+bool PlaybackClock_set_speed(struct PlaybackClock* const, double speed);
+void PlaybackClock_print(struct PlaybackClock const* const, FILE*);
+
+/**
+ * @return CLOCK_SOURCE_COUNT if name is not "audio", "video" or "external".
+ */
+enum ClockSource clock_source_parse(char const* name);
+char const* clock_source_name(enum ClockSource);
+
+#endif // !CHALCOCITE__MEDIACLOCK_H_
@@ -0,0 +1,121 @@
+#include "memstats.h"
+
+#include <stdatomic.h>
+
+#ifdef __unix__
+	#include <sys/resource.h>
+	#include <unistd.h>
+#endif
+
+static _Atomic int64_t memstats_bytes[MEM_COUNT];
+static _Atomic int64_t memstats_peak[MEM_COUNT];
+static _Atomic int64_t memstats_totalBytes;
+static _Atomic int64_t memstats_totalPeak;
+static _Atomic size_t memstats_budgetBytes;
+
+static char const* const memstats_categoryNames[MEM_COUNT] =
+{
+	[MEM_PACKETS] = "packets",
+	[MEM_PICTURES] = "pictures",
+	[MEM_AUDIO] = "audio",
+	[MEM_DECODER] = "decoder",
+	[MEM_FRAME_CACHE] = "frame cache",
+	[MEM_SUBTITLES] = "subtitles",
+};
+
+char const* mem_category_name(enum MemCategory category)
+{
+	return category < MEM_COUNT ? memstats_categoryNames[category] : "unknown";
+}
+
+static void memstats_update_peak(_Atomic int64_t* const peak, int64_t value)
+{
+	int64_t current = atomic_load_explicit(peak, memory_order_relaxed);
+	while (value > current &&
+	       !atomic_compare_exchange_weak_explicit(peak, &current, value,
+	                                              memory_order_relaxed,
+	                                              memory_order_relaxed));
+}
+void memstats_add(enum MemCategory category, int64_t bytes)
+{
+	int64_t value = atomic_fetch_add_explicit(&memstats_bytes[category], bytes,
+	                memory_order_relaxed) + bytes;
+	int64_t total = atomic_fetch_add_explicit(&memstats_totalBytes, bytes,
+	                memory_order_relaxed) + bytes;
+	if (bytes > 0)
+	{
+		memstats_update_peak(&memstats_peak[category], value);
+		memstats_update_peak(&memstats_totalPeak, total);
+	}
+}
+int64_t memstats_get(enum MemCategory category)
+{
+	return atomic_load_explicit(&memstats_bytes[category], memory_order_relaxed);
+}
+int64_t memstats_total(void)
+{
+	return atomic_load_explicit(&memstats_totalBytes, memory_order_relaxed);
+}
+
+void memstats_set_budget(size_t bytes)
+{
+	atomic_store(&memstats_budgetBytes, bytes);
+}
+size_t memstats_budget(void)
+{
+	return atomic_load_explicit(&memstats_budgetBytes, memory_order_relaxed);
+}
+double memstats_queue_scale(void)
+{
+	size_t budget = memstats_budget();
+	if (!budget) return 1.0;
+
+	double pressure = memstats_total() / (double) budget;
+	if (pressure <= MEMSTATS_PRESSURE_BEGIN) return 1.0;
+	if (pressure >= 1.0) return MEMSTATS_SCALE_MIN;
+	double t = (pressure - MEMSTATS_PRESSURE_BEGIN) /
+	           (1.0 - MEMSTATS_PRESSURE_BEGIN);
+	return 1.0 - t * (1.0 - MEMSTATS_SCALE_MIN);
+}
+
+size_t memstats_rss(void)
+{
+#ifdef __linux__
+	FILE* file = fopen("/proc/self/statm", "r");
+	if (!file) return 0;
+	unsigned long pages = 0;
+	if (fscanf(file, "%*u %lu", &pages) != 1) pages = 0;
+	fclose(file);
+	return pages * (size_t) sysconf(_SC_PAGESIZE);
+#else
+	return 0;
+#endif
+}
+size_t memstats_peak_rss(void)
+{
+#ifdef __unix__
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage)) return 0;
+	return (size_t) usage.ru_maxrss * 1024; // Kilobytes on Linux
+#else
+	return 0;
+#endif
+}
+
+void memstats_print(FILE* file)
+{
+	fprintf(file, "%-10s %12s %12s\n", "Memory", "Current(KiB)", "Peak(KiB)");
+	for (unsigned i = 0; i < MEM_COUNT; ++i)
+		fprintf(file, "%-10s %12.1f %12.1f\n", mem_category_name(i),
+		        memstats_get(i) / 1024.0,
+		        atomic_load(&memstats_peak[i]) / 1024.0);
+	fprintf(file, "%-10s %12.1f %12.1f\n", "total",
+	        memstats_total() / 1024.0,
+	        atomic_load(&memstats_totalPeak) / 1024.0);
+	fprintf(file, "%-10s %12.1f %12.1f\n", "rss",
+	        memstats_rss() / 1024.0, memstats_peak_rss() / 1024.0);
+	size_t budget = memstats_budget();
+	if (budget)
+		fprintf(file, "Budget: %.1f KiB, queue scale %.3f\n",
+		        budget / 1024.0, memstats_queue_scale());
+}
@@ -0,0 +1,59 @@
+#ifndef CHALCOCITE__MEMSTATS_H_
+#define CHALCOCITE__MEMSTATS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @brief Categories of memory accounted for by the player.
+ */
+enum MemCategory
+{
+	MEM_PACKETS, ///< Demuxed packets in PacketQueues
+	MEM_PICTURES, ///< Picture queue planes and textures
+	MEM_AUDIO, ///< Converted audio, including the SDL device queue
+	MEM_DECODER, ///< Estimated decoder frame pools
+	MEM_FRAME_CACHE, ///< Decoded frames kept for stepping
+	MEM_SUBTITLES, ///< Subtitle overlays and their textures
+	MEM_COUNT
+};
+
+/*
+ * Queue depth targets are scaled down linearly once the accounted total
+ * exceeds MEMSTATS_PRESSURE_BEGIN of the budget, reaching
+ * MEMSTATS_SCALE_MIN at the budget.
+ */
+#define MEMSTATS_PRESSURE_BEGIN 0.5
+#define MEMSTATS_SCALE_MIN 0.125
+
+/**
+ * @brief Adjusts the bytes accounted to a category. Lock free.
+ */
+void memstats_add(enum MemCategory, int64_t bytes);
+int64_t memstats_get(enum MemCategory);
+int64_t memstats_total(void);
+
+/**
+ * @param[in] bytes Memory budget of a playback session. 0 disables the budget.
+ */
+void memstats_set_budget(size_t bytes);
+size_t memstats_budget(void);
+/**
+ * @brief Factor in [MEMSTATS_SCALE_MIN, 1] to apply to queue depth targets.
+ *  1 if no budget is set or the accounted memory is well below it.
+ */
+double memstats_queue_scale(void);
+
+/**
+ * @return Resident set size of the process in bytes. 0 if unavailable.
+ */
+size_t memstats_rss(void);
+size_t memstats_peak_rss(void);
+
+void memstats_print(FILE*);
+
+char const* mem_category_name(enum MemCategory);
+
+#endif // !CHALCOCITE__MEMSTATS_H_
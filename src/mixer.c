@@ -0,0 +1,509 @@
+#include "mixer.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/channel_layout.h>
+#include <libswresample/swresample.h>
+
+#include "memstats.h"
+
+#if defined(__SSE2__)
+	#include <emmintrin.h>
+	#define MIXER_SSE2
+#endif
+
+#define MIXER_CONVERT_FRAMES 1024 // Initial capacity of the converted frame
+
+// Parsing
+
+bool mixer_parse_tracks(char const* spec, struct MixerTrackSpec* specs,
+                        unsigned* const nSpecs)
+{
+	*nSpecs = 0;
+	char const* p = spec;
+	while (*p)
+	{
+		char* end = NULL;
+		long const index = strtol(p, &end, 10);
+		if (end == p || index < 0 || *nSpecs == MIXER_TRACKS_MAX)
+			break;
+		float gain = 1.0f;
+		p = end;
+		if (*p == ':')
+		{
+			double const decibel = strtod(p + 1, &end);
+			if (end == p + 1) break;
+			gain = powf(10.0f, decibel / 20.0);
+			p = end;
+		}
+		specs[(*nSpecs)++] = (struct MixerTrackSpec) { (unsigned) index, gain };
+		if (*p == ',' && p[1]) ++p;
+		else if (*p) break;
+	}
+	if (*p || *nSpecs == 0)
+	{
+		fprintf(stderr, "Invalid audio tracks %s. Expected up to %d track numbers"
+		        " with an optional gain in dB, for example 0,1:-6\n", spec,
+		        MIXER_TRACKS_MAX);
+		return false;
+	}
+	return true;
+}
+bool mixer_parse_downmix(char const* spec, int64_t* const layout,
+                         float* matrix, int* const nColumns)
+{
+	char name[64];
+	char const* const separator = strchr(spec, ':');
+	size_t const length = separator ? (size_t) (separator - spec) :
+	                      strlen(spec);
+	if (nColumns) *nColumns = 0;
+	*layout = 0;
+	if (length < sizeof(name))
+	{
+		memcpy(name, spec, length);
+		name[length] = '\0';
+		*layout = av_get_channel_layout(name);
+	}
+	int const channels = av_get_channel_layout_nb_channels(*layout);
+	if (channels <= 0 || channels > MIXER_CHANNELS_MAX)
+	{
+		fprintf(stderr, "Invalid downmix layout %s. Expected a layout of up to %d"
+		        " channels such as mono, stereo or 5.1\n", spec,
+		        MIXER_CHANNELS_MAX);
+		return false;
+	}
+	if (!separator) return true;
+
+	// Rows separated by |, coefficients by ,
+	char const* p = separator + 1;
+	int row = 0, columns = 0;
+	bool valid = true;
+	while (valid && *p)
+	{
+		int column = 0;
+		while (valid)
+		{
+			char* end = NULL;
+			double const coefficient = strtod(p, &end);
+			valid = end != p && row < channels && column < MIXER_CHANNELS_MAX;
+			if (!valid) break;
+			if (matrix)
+				matrix[row * MIXER_CHANNELS_MAX + column] = coefficient;
+			++column;
+			p = end;
+			if (*p != ',') break;
+			++p;
+		}
+		if (row == 0) columns = column;
+		valid = valid && column == columns;
+		++row;
+		if (*p == '|') ++p;
+		else if (*p) valid = false;
+	}
+	if (!valid || row != channels)
+	{
+		fprintf(stderr, "Invalid downmix matrix %s. Expected %d rows of"
+		        " coefficients separated by |\n", separator + 1, channels);
+		return false;
+	}
+	if (nColumns) *nColumns = columns;
+	return true;
+}
+
+// Kernels
+
+void mixer_gain_set(float* restrict dst, float const* restrict src,
+                    float gain, size_t n)
+{
+	size_t i = 0;
+#ifdef MIXER_SSE2
+	__m128 const g = _mm_set1_ps(gain);
+	for (; i + 8 <= n; i += 8)
+	{
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_loadu_ps(src + i), g));
+		_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_loadu_ps(src + i + 4), g));
+	}
+#endif
+	for (; i < n; ++i)
+		dst[i] = src[i] * gain;
+}
+void mixer_gain_add(float* restrict dst, float const* restrict src,
+                    float gain, size_t n)
+{
+	size_t i = 0;
+#ifdef MIXER_SSE2
+	__m128 const g = _mm_set1_ps(gain);
+	for (; i + 8 <= n; i += 8)
+	{
+		__m128 const a = _mm_add_ps(_mm_loadu_ps(dst + i),
+		                            _mm_mul_ps(_mm_loadu_ps(src + i), g));
+		__m128 const b = _mm_add_ps(_mm_loadu_ps(dst + i + 4),
+		                            _mm_mul_ps(_mm_loadu_ps(src + i + 4), g));
+		_mm_storeu_ps(dst + i, a);
+		_mm_storeu_ps(dst + i + 4, b);
+	}
+#endif
+	for (; i < n; ++i)
+		dst[i] += src[i] * gain;
+}
+static inline int16_t mixer_s16(float sample)
+{
+	float const value = sample * 32767.0f;
+	if (value >= 32767.0f) return 32767;
+	if (value <= -32768.0f) return -32768;
+	return (int16_t) lrintf(value);
+}
+#ifdef MIXER_SSE2
+/**
+ * @brief Converts 8 samples, rounding to nearest as lrintf.
+ */
+static inline __m128i mixer_pack_s16(float const* src)
+{
+	__m128 const scale = _mm_set1_ps(32767.0f);
+	__m128 const low = _mm_set1_ps(-32768.0f), high = _mm_set1_ps(32767.0f);
+	__m128 const a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src), scale),
+	                                       low), high);
+	__m128 const b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + 4),
+	                                                  scale), low), high);
+	return _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+}
+#endif
+void mixer_interleave_s16(int16_t* restrict dst, float const* const* src,
+                          int channels, size_t frames)
+{
+	size_t i = 0;
+#ifdef MIXER_SSE2
+	if (channels == 2)
+		for (; i + 8 <= frames; i += 8)
+		{
+			__m128i const left = mixer_pack_s16(src[0] + i);
+			__m128i const right = mixer_pack_s16(src[1] + i);
+			_mm_storeu_si128((__m128i*) (dst + 2 * i),
+			                 _mm_unpacklo_epi16(left, right));
+			_mm_storeu_si128((__m128i*) (dst + 2 * i + 8),
+			                 _mm_unpackhi_epi16(left, right));
+		}
+	else if (channels == 1)
+		for (; i + 8 <= frames; i += 8)
+			_mm_storeu_si128((__m128i*) (dst + i), mixer_pack_s16(src[0] + i));
+#endif
+	for (; i < frames; ++i)
+		for (int c = 0; c < channels; ++c)
+			dst[i * channels + c] = mixer_s16(src[c][i]);
+}
+
+// AudioMixer
+
+bool AudioMixer_init(struct AudioMixer* const mixer, char const* tracks,
+                     char const* downmix)
+{
+	assert(mixer);
+	memset(mixer, 0, sizeof(struct AudioMixer));
+	if (tracks && tracks[0] &&
+	    !mixer_parse_tracks(tracks, mixer->specs, &mixer->nSpecs))
+		return false;
+	if (downmix && downmix[0] &&
+	    !mixer_parse_downmix(downmix, &mixer->layoutRequested,
+	                         &mixer->matrixRequested[0][0],
+	                         &mixer->matrixColumns))
+		return false;
+	return true;
+}
+void AudioMixer_destroy(struct AudioMixer* const mixer)
+{
+	if (!mixer) return;
+	for (unsigned i = 0; i < mixer->nTracks; ++i)
+	{
+		struct MixerTrack* const track = &mixer->tracks[i];
+		if (i > 0) avcodec_free_context(&track->cc);
+		swr_free(&track->swrContext);
+		av_freep(&track->convert[0]);
+		av_freep(&track->fifo[0]);
+	}
+	av_freep(&mixer->mix[0]);
+	memstats_add(MEM_AUDIO, -mixer->footprint);
+	mixer->footprint = 0;
+	mixer->nTracks = 0;
+}
+
+bool AudioMixer_add_track(struct AudioMixer* const mixer, unsigned streamIndex,
+                          struct AVCodecContext* cc, float gain)
+{
+	if (mixer->nTracks == MIXER_TRACKS_MAX) return false;
+	struct MixerTrack* const track = &mixer->tracks[mixer->nTracks++];
+	memset(track, 0, sizeof(struct MixerTrack));
+	track->streamIndex = streamIndex;
+	track->cc = cc;
+	track->gain = gain;
+	track->channels = cc->channels;
+	track->layout = cc->channel_layout &&
+	                av_get_channel_layout_nb_channels(cc->channel_layout) ==
+	                cc->channels ? (int64_t) cc->channel_layout :
+	                av_get_default_channel_layout(cc->channels);
+	track->format = cc->sample_fmt;
+	track->rate = cc->sample_rate;
+	return true;
+}
+bool AudioMixer_enabled(struct AudioMixer const* const mixer)
+{
+	if (mixer->nTracks == 0) return false;
+	return mixer->nTracks > 1 || mixer->tracks[0].gain != 1.0f ||
+	       mixer->matrixColumns > 0 ||
+	       AudioMixer_layout(mixer) != mixer->tracks[0].layout;
+}
+int AudioMixer_track(struct AudioMixer const* const mixer, int streamIndex)
+{
+	for (unsigned i = 0; i < mixer->nTracks; ++i)
+		if ((int) mixer->tracks[i].streamIndex == streamIndex)
+			return i;
+	return -1;
+}
+int64_t AudioMixer_layout(struct AudioMixer const* const mixer)
+{
+	if (mixer->layoutRequested) return mixer->layoutRequested;
+	return mixer->nTracks ? mixer->tracks[0].layout : 0;
+}
+
+/**
+ * @brief Fills the matrix of a track: the requested matrix if it has as many
+ *  columns as the track has channels, the identity for the mix layout, or the
+ *  downmix of libswresample otherwise.
+ */
+static bool AudioMixer_track_matrix(struct AudioMixer const* const mixer,
+                                    struct MixerTrack* const track)
+{
+	memset(track->matrix, 0, sizeof(track->matrix));
+	if (mixer->matrixColumns == track->channels)
+		memcpy(track->matrix, mixer->matrixRequested, sizeof(track->matrix));
+	else if (track->layout == mixer->layout)
+		for (int c = 0; c < track->channels; ++c)
+			track->matrix[c][c] = 1.0f;
+	else
+	{
+		double matrix[MIXER_CHANNELS_MAX * MIXER_CHANNELS_MAX] = { 0.0 };
+		// Normalised so that an output channel cannot exceed full scale
+		if (swr_build_matrix(track->layout, mixer->layout, M_SQRT1_2, M_SQRT1_2,
+		                     0.0, 1.0, 1.0, matrix, MIXER_CHANNELS_MAX,
+		                     AV_MATRIX_ENCODING_NONE, NULL) < 0)
+			return false;
+		for (int o = 0; o < mixer->channels; ++o)
+			for (int i = 0; i < track->channels; ++i)
+				track->matrix[o][i] = matrix[o * MIXER_CHANNELS_MAX + i];
+	}
+	for (int o = 0; o < mixer->channels; ++o)
+		for (int i = 0; i < track->channels; ++i)
+			track->matrix[o][i] *= track->gain;
+	return true;
+}
+/**
+ * @brief Allocates planes of frames floats in a single buffer.
+ */
+static bool mixer_alloc_planes(struct AudioMixer* const mixer,
+                               float* planes[MIXER_CHANNELS_MAX],
+                               int channels, int frames)
+{
+	av_freep(&planes[0]);
+	planes[0] = av_malloc_array((size_t) channels * frames, sizeof(float));
+	if (!planes[0]) return false;
+	for (int c = 1; c < channels; ++c)
+		planes[c] = planes[0] + (size_t) c * frames;
+	mixer->footprint += (int64_t) channels * frames * sizeof(float);
+	memstats_add(MEM_AUDIO, (int64_t) channels * frames * sizeof(float));
+	return true;
+}
+/**
+ * @brief Grows the converted frame of a track to hold frames.
+ */
+static bool AudioMixer_reserve(struct AudioMixer* const mixer,
+                               struct MixerTrack* const track, int frames)
+{
+	if (frames <= track->convertCapacity) return true;
+	int capacity = track->convertCapacity * 2;
+	if (capacity < frames) capacity = frames;
+	if (capacity < MIXER_CONVERT_FRAMES) capacity = MIXER_CONVERT_FRAMES;
+	int64_t const previous = (int64_t) track->channels *
+	                         track->convertCapacity * sizeof(float);
+	mixer->footprint -= previous;
+	memstats_add(MEM_AUDIO, -previous);
+	track->convertCapacity = 0;
+	if (!mixer_alloc_planes(mixer, track->convert, track->channels, capacity))
+		return false;
+	track->convertCapacity = capacity;
+	return true;
+}
+bool AudioMixer_start(struct AudioMixer* const mixer, int rate)
+{
+	mixer->layout = AudioMixer_layout(mixer);
+	mixer->channels = av_get_channel_layout_nb_channels(mixer->layout);
+	mixer->rate = rate;
+	mixer->fifoCapacity = rate * MIXER_FIFO_DURATION;
+	if (mixer->channels <= 0 || mixer->channels > MIXER_CHANNELS_MAX ||
+	    !mixer_alloc_planes(mixer, mixer->mix, mixer->channels,
+	                        MIXER_PULL_FRAMES))
+		return false;
+	for (unsigned i = 0; i < mixer->nTracks; ++i)
+	{
+		struct MixerTrack* const track = &mixer->tracks[i];
+		if (track->channels <= 0 || track->channels > MIXER_CHANNELS_MAX)
+		{
+			fprintf(stderr, "Audio of %d channels cannot be mixed\n",
+			        track->channels);
+			return false;
+		}
+		// Rematrixing is done by the mixer, which can sum several tracks
+		track->swrContext = swr_alloc_set_opts(NULL,
+		                    track->layout, AV_SAMPLE_FMT_FLTP, rate,
+		                    track->layout, track->format, track->rate, 0, NULL);
+		if (!track->swrContext || swr_init(track->swrContext) < 0 ||
+		    !AudioMixer_track_matrix(mixer, track) ||
+		    !mixer_alloc_planes(mixer, track->fifo, mixer->channels,
+		                        mixer->fifoCapacity) ||
+		    !AudioMixer_reserve(mixer, track, MIXER_CONVERT_FRAMES))
+		{
+			fprintf(stderr, "Unable to mix audio track %u\n", i);
+			return false;
+		}
+	}
+	return true;
+}
+/**
+ * @brief Appends n converted frames of a track, downmixed, to its fifo.
+ */
+static void AudioMixer_downmix(struct AudioMixer* const mixer,
+                               struct MixerTrack* const track, int n)
+{
+	int const capacity = mixer->fifoCapacity;
+	int offset = 0; // Of the first converted frame kept
+	if (n > capacity)
+	{
+		offset = n - capacity;
+		mixer->nDropped += offset;
+		n = capacity;
+	}
+	if (n <= 0) return;
+	if (track->fifoEnd + n > capacity)
+	{
+		// Drops the oldest audio beyond the capacity and moves the rest first
+		int const size = track->fifoEnd - track->fifoBegin;
+		int const drop = size + n > capacity ? size + n - capacity : 0;
+		for (int c = 0; c < mixer->channels; ++c)
+			memmove(track->fifo[c], track->fifo[c] + track->fifoBegin + drop,
+			        (size - drop) * sizeof(float));
+		track->fifoBegin = 0;
+		track->fifoEnd = size - drop;
+		mixer->nDropped += drop;
+	}
+	for (int o = 0; o < mixer->channels; ++o)
+	{
+		float* const dst = track->fifo[o] + track->fifoEnd;
+		bool empty = true;
+		for (int i = 0; i < track->channels; ++i)
+		{
+			float const coefficient = track->matrix[o][i];
+			if (coefficient == 0.0f) continue;
+			if (empty)
+				mixer_gain_set(dst, track->convert[i] + offset, coefficient, n);
+			else
+				mixer_gain_add(dst, track->convert[i] + offset, coefficient, n);
+			empty = false;
+		}
+		if (empty) memset(dst, 0, n * sizeof(float));
+	}
+	track->fifoEnd += n;
+}
+bool AudioMixer_push(struct AudioMixer* const mixer, unsigned index,
+                     struct AVFrame const* frame)
+{
+	assert(index < mixer->nTracks);
+	struct MixerTrack* const track = &mixer->tracks[index];
+	if (!track->swrContext ||
+	    !AudioMixer_reserve(mixer, track,
+	                        swr_get_out_samples(track->swrContext,
+	                                            frame->nb_samples)))
+		return false;
+	int const n = swr_convert(track->swrContext, (uint8_t**) track->convert,
+	                          track->convertCapacity,
+	                          (uint8_t const**) frame->extended_data,
+	                          frame->nb_samples);
+	if (n < 0) return false;
+	AudioMixer_downmix(mixer, track, n);
+	return true;
+}
+void AudioMixer_end(struct AudioMixer* const mixer, unsigned index)
+{
+	assert(index < mixer->nTracks);
+	struct MixerTrack* const track = &mixer->tracks[index];
+	if (track->swrContext && track->convertCapacity > 0)
+	{
+		int const n = swr_convert(track->swrContext, (uint8_t**) track->convert,
+		                          track->convertCapacity, NULL, 0);
+		AudioMixer_downmix(mixer, track, n);
+	}
+	track->ended = true;
+}
+void AudioMixer_flush(struct AudioMixer* const mixer)
+{
+	for (unsigned i = 0; i < mixer->nTracks; ++i)
+	{
+		struct MixerTrack* const track = &mixer->tracks[i];
+		if (track->swrContext) swr_init(track->swrContext);
+		track->fifoBegin = track->fifoEnd = 0;
+		track->ended = false;
+	}
+}
+int AudioMixer_pull(struct AudioMixer* const mixer, int16_t* dst,
+                    int maxFrames)
+{
+	// Frames available in all tracks that have not ended
+	int n = -1, most = 0;
+	for (unsigned i = 0; i < mixer->nTracks; ++i)
+	{
+		struct MixerTrack const* const track = &mixer->tracks[i];
+		int const size = track->fifoEnd - track->fifoBegin;
+		if (size > most) most = size;
+		if (!track->ended && (n < 0 || size < n)) n = size;
+	}
+	if (n < 0 || (n == 0 && most > mixer->fifoCapacity / 2))
+		n = most;
+	if (n > maxFrames) n = maxFrames;
+	if (n > MIXER_PULL_FRAMES) n = MIXER_PULL_FRAMES;
+	if (n <= 0 || mixer->channels <= 0) return 0;
+
+	int padded = 0;
+	for (int c = 0; c < mixer->channels; ++c)
+		memset(mixer->mix[c], 0, n * sizeof(float));
+	for (unsigned i = 0; i < mixer->nTracks; ++i)
+	{
+		struct MixerTrack* const track = &mixer->tracks[i];
+		int const size = track->fifoEnd - track->fifoBegin;
+		int const take = size < n ? size : n;
+		if (!track->ended && n - take > padded) padded = n - take;
+		for (int c = 0; c < mixer->channels && take > 0; ++c)
+			mixer_gain_add(mixer->mix[c], track->fifo[c] + track->fifoBegin, 1.0f,
+			               take);
+		track->fifoBegin += take;
+		if (track->fifoBegin == track->fifoEnd)
+			track->fifoBegin = track->fifoEnd = 0;
+	}
+	mixer_interleave_s16(dst, (float const* const*) mixer->mix, mixer->channels,
+	                     n);
+	mixer->nFrames += n;
+	mixer->nPadded += padded;
+	return n;
+}
+void AudioMixer_print(struct AudioMixer const* const mixer, FILE* file)
+{
+	if (mixer->rate <= 0) return;
+	char layout[64];
+	av_get_channel_layout_string(layout, sizeof(layout), mixer->channels,
+	                             mixer->layout);
+	fprintf(file, "Audio mixer: %u tracks into %s, %.2fs mixed, %.2fs padded, "
+	        "%.2fs dropped\n", mixer->nTracks, layout,
+	        mixer->nFrames / (double) mixer->rate,
+	        mixer->nPadded / (double) mixer->rate,
+	        mixer->nDropped / (double) mixer->rate);
+}
@@ -0,0 +1,178 @@
+#ifndef CHALCOCITE__MIXER_H_
+#define CHALCOCITE__MIXER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct AVCodecContext;
+struct AVFrame;
+struct SwrContext;
+
+#define MIXER_TRACKS_MAX 8
+#define MIXER_CHANNELS_MAX 8
+#define MIXER_FIFO_DURATION 1.0 // Second of mixed audio each track may hold
+#define MIXER_PULL_FRAMES 4096 // Frames mixed at once
+
+/**
+ * @brief An audio track to mix, as given to --audio-tracks.
+ */
+struct MixerTrackSpec
+{
+	unsigned index; ///< Among the audio streams of the file
+	float gain; ///< Linear
+};
+/**
+ * @brief Parses comma separated audio track numbers, each optionally followed
+ *  by a gain in dB, for example "0,1:-6".
+ * @param[out] specs MIXER_TRACKS_MAX elements
+ * @return false if spec is invalid. Prints the error to stderr.
+ */
+bool mixer_parse_tracks(char const* spec, struct MixerTrackSpec* specs,
+                        unsigned* const nSpecs);
+/**
+ * @brief Parses a channel layout such as "stereo" or "5.1", optionally
+ *  followed by a matrix: "stereo:1,0,0.7,0,0.5,0|0,1,0.7,0,0,0.5". The matrix
+ *  has a row of coefficients per output channel and applies to tracks with as
+ *  many channels as it has columns.
+ * @param[out] matrix MIXER_CHANNELS_MAX * MIXER_CHANNELS_MAX elements, by
+ *  output then input channel. May be NULL
+ * @param[out] nColumns 0 if no matrix is given. May be NULL
+ * @return false if spec is invalid. Prints the error to stderr.
+ */
+bool mixer_parse_downmix(char const* spec, int64_t* const layout,
+                         float* matrix, int* const nColumns);
+
+// Kernels on float samples, vectorised with SSE where available
+
+/**
+ * @brief dst[i] = src[i] * gain
+ */
+void mixer_gain_set(float* dst, float const* src, float gain, size_t n);
+/**
+ * @brief dst[i] += src[i] * gain
+ */
+void mixer_gain_add(float* dst, float const* src, float gain, size_t n);
+/**
+ * @brief Interleaves planes into signed 16 bit samples, saturating beyond
+ *  [-1, 1].
+ */
+void mixer_interleave_s16(int16_t* dst, float const* const* src,
+                          int channels, size_t frames);
+
+struct MixerTrack
+{
+	unsigned streamIndex;
+	/**
+	 * Decoder of the track. That of the first track is media->ccA, the others
+	 *  belong to the mixer.
+	 */
+	struct AVCodecContext* cc;
+	float gain; ///< Linear
+	int64_t layout;
+	int channels, format, rate;
+	struct SwrContext* swrContext; ///< To planar float at the mix rate
+	/**
+	 * Gain times the downmix to the mix layout, by output then input channel
+	 */
+	float matrix[MIXER_CHANNELS_MAX][MIXER_CHANNELS_MAX];
+	float* convert[MIXER_CHANNELS_MAX]; ///< Converted frame, per channel
+	int convertCapacity; ///< Frames
+	/**
+	 * Downmixed audio waiting for the other tracks, per mix channel. Frames
+	 *  [fifoBegin, fifoEnd) are valid.
+	 */
+	float* fifo[MIXER_CHANNELS_MAX];
+	int fifoBegin, fifoEnd;
+	bool ended; ///< No more frames. The rest of the fifo is mixed alone
+};
+
+/**
+ * Must be initialised with \ref AudioMixer_init and destroyed with
+ *  \ref AudioMixer_destroy.
+ * @brief Takes the decoded frames of several audio tracks, applies their gain
+ *  and a downmix matrix to the mix layout, and sums them into 16 bit samples
+ *  for the output. Buffers are allocated by AudioMixer_start and grown only when a
+ *  frame exceeds them, never per frame.
+ */
+struct AudioMixer
+{
+	struct MixerTrackSpec specs[MIXER_TRACKS_MAX]; ///< Requested tracks
+	unsigned nSpecs; ///< 0 for the first audio stream at full gain
+	int64_t layoutRequested; ///< Mix layout. 0 for that of the first track
+	float matrixRequested[MIXER_CHANNELS_MAX][MIXER_CHANNELS_MAX];
+	int matrixColumns; ///< 0 if no matrix is requested
+
+	struct MixerTrack tracks[MIXER_TRACKS_MAX];
+	unsigned nTracks;
+	int64_t layout;
+	int channels, rate;
+	int fifoCapacity; ///< Frames
+	float* mix[MIXER_CHANNELS_MAX]; ///< MIXER_PULL_FRAMES per channel
+	int64_t footprint; ///< Bytes accounted to MEM_AUDIO
+	uint64_t nFrames; ///< Mixed
+	uint64_t nPadded; ///< Frames mixed while a track had none
+	uint64_t nDropped; ///< Frames dropped on fifo overflow
+};
+
+/**
+ * @param[in] tracks As parsed by mixer_parse_tracks. May be NULL
+ * @param[in] downmix As parsed by mixer_parse_downmix. May be NULL
+ * @return false if a description is invalid.
+ */
+bool AudioMixer_init(struct AudioMixer* const, char const* tracks,
+                     char const* downmix);
+void AudioMixer_destroy(struct AudioMixer* const);
+
+/**
+ * @brief Adds a track decoded by cc, which the mixer frees unless it is the
+ *  first track.
+ * @param[in] gain Linear
+ */
+bool AudioMixer_add_track(struct AudioMixer* const, unsigned streamIndex,
+                          struct AVCodecContext* cc, float gain);
+/**
+ * @brief Whether mixing is needed: several tracks, a gain or a downmix. Audio
+ *  is otherwise converted directly.
+ */
+bool AudioMixer_enabled(struct AudioMixer const* const);
+/**
+ * @return Track of a stream. -1 if the stream is not mixed.
+ */
+int AudioMixer_track(struct AudioMixer const* const, int streamIndex);
+/**
+ * @return Mix layout, once the tracks are added.
+ */
+int64_t AudioMixer_layout(struct AudioMixer const* const);
+
+/**
+ * @brief Builds the downmix matrices and resamplers to the given rate and
+ *  allocates the buffers.
+ */
+bool AudioMixer_start(struct AudioMixer* const, int rate);
+/**
+ * @brief Converts and downmixes a decoded frame of a track into its fifo. The
+ *  oldest audio is dropped if the fifo is full.
+ */
+bool AudioMixer_push(struct AudioMixer* const, unsigned track,
+                     struct AVFrame const* frame);
+/**
+ * @brief Flushes the resampler of a track, whose remaining audio is then
+ *  mixed without waiting.
+ */
+void AudioMixer_end(struct AudioMixer* const, unsigned track);
+/**
+ * @brief Drops the audio held in the resamplers and fifos, after a seek.
+ */
+void AudioMixer_flush(struct AudioMixer* const);
+/**
+ * @brief Mixes the audio available in all tracks that have not ended. A track
+ *  that lags by more than half its fifo is padded with silence.
+ * @param[out] dst Interleaved samples of the mix layout
+ * @return Frames written, at most maxFrames.
+ */
+int AudioMixer_pull(struct AudioMixer* const, int16_t* dst, int maxFrames);
+void AudioMixer_print(struct AudioMixer const* const, FILE*);
+
+#endif // !CHALCOCITE__MIXER_H_
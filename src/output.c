@@ -0,0 +1,173 @@
+#include "output.h"
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#include <libavutil/channel_layout.h>
+
+void Output_init(struct Output* const output)
+{
+	memset(output, 0, sizeof(struct Output));
+}
+static void Output_close_audio(struct Output* const output)
+{
+	swr_free(&output->swrContext);
+	if (output->audioDevice)
+		SDL_CloseAudioDevice(output->audioDevice);
+	output->audioDevice = 0;
+}
+void Output_destroy(struct Output* const output)
+{
+	Output_close_audio(output);
+	Output_textures_truncate(output, 0);
+	SDL_DestroyRenderer(output->renderer);
+	SDL_DestroyWindow(output->window);
+	output->renderer = NULL;
+	output->window = NULL;
+}
+
+bool Output_open_video(struct Output* const output, char const* title,
+                       int width, int height)
+{
+	SDL_DisplayMode mode;
+	if (SDL_GetDesktopDisplayMode(0, &mode) == 0 && mode.w > 0 && mode.h > 0 &&
+	    (width > mode.w || height > mode.h))
+	{
+		double const scale = fmin((double) mode.w / width,
+		                          (double) mode.h / height);
+		width = (int) (width * scale);
+		height = (int) (height * scale);
+	}
+	if (output->window)
+	{
+		SDL_SetWindowTitle(output->window, title);
+		int w, h;
+		SDL_GetWindowSize(output->window, &w, &h);
+		if (w != width || h != height)
+			SDL_SetWindowSize(output->window, width, height);
+		SDL_ShowWindow(output->window);
+		return true;
+	}
+
+	output->window = SDL_CreateWindow(title, SDL_WINDOWPOS_UNDEFINED,
+	                                  SDL_WINDOWPOS_UNDEFINED, width, height,
+	                                  SDL_WINDOW_RESIZABLE);
+	if (!output->window)
+	{
+		fprintf(stderr, "[SDL] %s\n", SDL_GetError());
+		return false;
+	}
+	output->renderer = SDL_CreateRenderer(output->window, -1, 0);
+	if (!output->renderer)
+	{
+		fprintf(stderr, "[SDL] %s\n", SDL_GetError());
+		SDL_DestroyWindow(output->window);
+		output->window = NULL;
+		return false;
+	}
+	return true;
+}
+SDL_Texture* Output_texture(struct Output* const output, unsigned index,
+                            uint32_t format, int width, int height)
+{
+	assert(index < OUTPUT_TEXTURES);
+	assert(output->renderer);
+	struct OutputTexture* const ot = &output->textures[index];
+	if (ot->texture && ot->format == format && ot->width == width &&
+	    ot->height == height)
+		return ot->texture;
+
+	SDL_DestroyTexture(ot->texture);
+	ot->texture = SDL_CreateTexture(output->renderer, format,
+	                                SDL_TEXTUREACCESS_STREAMING, width, height);
+	if (!ot->texture)
+		fprintf(stderr, "[SDL] %s\n", SDL_GetError());
+	ot->format = format;
+	ot->width = width;
+	ot->height = height;
+	return ot->texture;
+}
+void Output_textures_truncate(struct Output* const output, unsigned index)
+{
+	for (unsigned i = index; i < OUTPUT_TEXTURES; ++i)
+	{
+		struct OutputTexture* const ot = &output->textures[i];
+		if (ot->texture) SDL_DestroyTexture(ot->texture);
+		memset(ot, 0, sizeof(struct OutputTexture));
+	}
+}
+
+bool Output_open_audio(struct Output* const output,
+                       SDL_AudioSpec const* target)
+{
+	SDL_AudioSpec const* const current = &output->audioSpecTarget;
+	if (output->audioDevice && current->freq == target->freq &&
+	    current->format == target->format &&
+	    current->channels == target->channels &&
+	    current->samples == target->samples)
+	{
+		SDL_PauseAudioDevice(output->audioDevice, 1);
+		SDL_ClearQueuedAudio(output->audioDevice);
+		return true;
+	}
+
+	Output_close_audio(output);
+	output->audioDevice = SDL_OpenAudioDevice(NULL, 0, target,
+	                      &output->audioSpec, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+	if (!output->audioDevice)
+	{
+		fprintf(stderr, "[SDL] %s\n", SDL_GetError());
+		return false;
+	}
+	output->audioSpecTarget = *target;
+	return true;
+}
+struct SwrContext* Output_resampler(struct Output* const output,
+                                    int64_t layout, int format, int rate)
+{
+	assert(output->audioDevice);
+	// Initialised again to drop the samples delayed by the resampling filter
+	// at the end of the previous playback
+	if (output->swrContext && output->swrLayout == layout &&
+	    output->swrFormat == format && output->swrRate == rate)
+	{
+		if (swr_init(output->swrContext) >= 0)
+			return output->swrContext;
+		fprintf(stderr, "Unable to initialise Swr_Context\n");
+		swr_free(&output->swrContext);
+		return NULL;
+	}
+
+	swr_free(&output->swrContext);
+	output->swrContext = swr_alloc_set_opts(NULL,
+	                     av_get_default_channel_layout(output->audioSpec.channels),
+	                     AV_SAMPLE_FMT_S16, output->audioSpec.freq,
+	                     layout, format, rate, 0, NULL);
+	if (!output->swrContext)
+	{
+		fprintf(stderr, "Unable to allocate Swr_Context\n");
+		return NULL;
+	}
+	if (swr_init(output->swrContext) < 0)
+	{
+		fprintf(stderr, "Unable to initialise Swr_Context\n");
+		swr_free(&output->swrContext);
+		return NULL;
+	}
+	output->swrLayout = layout;
+	output->swrFormat = format;
+	output->swrRate = rate;
+	return output->swrContext;
+}
+
+void Output_release(struct Output* const output)
+{
+	if (output->audioDevice)
+	{
+		SDL_PauseAudioDevice(output->audioDevice, 1);
+		SDL_ClearQueuedAudio(output->audioDevice);
+	}
+	if (output->window)
+		SDL_HideWindow(output->window);
+}
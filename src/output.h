@@ -0,0 +1,84 @@
+#ifndef CHALCOCITE__OUTPUT_H_
+#define CHALCOCITE__OUTPUT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <SDL2/SDL.h>
+#include <libswresample/swresample.h>
+
+#define OUTPUT_TEXTURES 64 // Tiles of the presented and uploading pictures
+
+/**
+ * @brief A streaming texture and the properties it was created with.
+ */
+struct OutputTexture
+{
+	SDL_Texture* texture; ///< NULL if unused
+	uint32_t format;
+	int width, height;
+};
+
+/**
+ * Must be initialised with \ref Output_init and destroyed with
+ *  \ref Output_destroy. Only the thread owning the window may use it.
+ * @brief Window, renderer, textures, audio device and resampler, kept across
+ *  playbacks so that switching files does not reopen them.
+ */
+struct Output
+{
+	SDL_Window* window; ///< NULL until a video is played
+	SDL_Renderer* renderer;
+	struct OutputTexture textures[OUTPUT_TEXTURES];
+
+	SDL_AudioDeviceID audioDevice; ///< 0 until an audio stream is played
+	SDL_AudioSpec audioSpecTarget; ///< Spec requested when opening audioDevice
+	SDL_AudioSpec audioSpec; ///< Spec obtained
+	struct SwrContext* swrContext; ///< Converts to audioSpec
+	// Input of swrContext
+	int64_t swrLayout;
+	int swrFormat;
+	int swrRate;
+};
+
+void Output_init(struct Output* const);
+void Output_destroy(struct Output* const);
+
+/**
+ * @brief Creates the window and renderer, or retitles, resizes and shows the
+ *  existing window. A window larger than the display is shrunk to fit it,
+ *  keeping the aspect ratio.
+ */
+bool Output_open_video(struct Output* const, char const* title,
+                       int width, int height);
+/**
+ * @brief A streaming texture of the given format and dimension. The texture
+ *  at index is recreated if its format or dimension differs.
+ * @param[in] index Less than OUTPUT_TEXTURES
+ * @return NULL if the texture cannot be created.
+ */
+SDL_Texture* Output_texture(struct Output* const, unsigned index,
+                            uint32_t format, int width, int height);
+/**
+ * @brief Destroys the textures from index on.
+ */
+void Output_textures_truncate(struct Output* const, unsigned index);
+/**
+ * @brief Opens the audio device, or keeps the open one if target equals the
+ *  spec it was opened with. The device is paused and its queue is empty.
+ */
+bool Output_open_audio(struct Output* const, SDL_AudioSpec const* target);
+/**
+ * @brief A resampler from the given input to audioSpec, reused if the input
+ *  is unchanged. A reused resampler is reset, without the samples it delayed.
+ * @return NULL if the resampler cannot be initialised.
+ */
+struct SwrContext* Output_resampler(struct Output* const, int64_t layout,
+                                    int format, int rate);
+/**
+ * @brief Ends a playback: the audio device is paused and cleared, and the
+ *  window is hidden.
+ */
+void Output_release(struct Output* const);
+
+#endif // !CHALCOCITE__OUTPUT_H_
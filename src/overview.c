@@ -0,0 +1,479 @@
+#include "overview.h"
+
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/channel_layout.h>
+#include <libswresample/swresample.h>
+
+#include "media.h"
+#include "stats.h"
+#include "scheduler.h"
+
+#if defined(__SSE2__)
+	#include <emmintrin.h>
+	#define OVERVIEW_SSE2
+#endif
+
+#define OVERVIEW_COPY_SIZE 65536 // Bytes copied at once from temporary files
+
+// Kernel
+
+float overview_reduce(float const* samples, size_t n, float* const min,
+                      float* const max)
+{
+	size_t i = 0;
+	float low = *min, high = *max, sum = 0.0f;
+#ifdef OVERVIEW_SSE2
+	if (n >= 8)
+	{
+		__m128 low4 = _mm_set1_ps(low), high4 = _mm_set1_ps(high);
+		__m128 sumA = _mm_setzero_ps(), sumB = _mm_setzero_ps();
+		for (; i + 8 <= n; i += 8)
+		{
+			__m128 const a = _mm_loadu_ps(samples + i);
+			__m128 const b = _mm_loadu_ps(samples + i + 4);
+			low4 = _mm_min_ps(low4, _mm_min_ps(a, b));
+			high4 = _mm_max_ps(high4, _mm_max_ps(a, b));
+			sumA = _mm_add_ps(sumA, _mm_mul_ps(a, a));
+			sumB = _mm_add_ps(sumB, _mm_mul_ps(b, b));
+		}
+		float lanes[4];
+		_mm_storeu_ps(lanes, low4);
+		low = fminf(fminf(lanes[0], lanes[1]), fminf(lanes[2], lanes[3]));
+		_mm_storeu_ps(lanes, high4);
+		high = fmaxf(fmaxf(lanes[0], lanes[1]), fmaxf(lanes[2], lanes[3]));
+		_mm_storeu_ps(lanes, _mm_add_ps(sumA, sumB));
+		sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+	}
+#endif
+	for (; i < n; ++i)
+	{
+		float const sample = samples[i];
+		if (sample < low) low = sample;
+		if (sample > high) high = sample;
+		sum += sample * sample;
+	}
+	*min = low;
+	*max = high;
+	return sum;
+}
+static inline int16_t overview_s16(float sample)
+{
+	float const value = sample * 32767.0f;
+	if (value >= 32767.0f) return 32767;
+	if (value <= -32768.0f) return -32768;
+	return (int16_t) lrintf(value);
+}
+
+// Overview
+
+static void OverviewLevel_clear(struct OverviewLevel* const level)
+{
+	for (int c = 0; c < OVERVIEW_CHANNELS_MAX; ++c)
+	{
+		level->min[c] = FLT_MAX;
+		level->max[c] = -FLT_MAX;
+		level->sumSquares[c] = 0.0;
+	}
+	level->nSamples = 0;
+}
+bool Overview_init(struct Overview* const overview, int rate, int channels)
+{
+	memset(overview, 0, sizeof(struct Overview));
+	if (channels <= 0 || channels > OVERVIEW_CHANNELS_MAX) return false;
+	overview->rate = rate;
+	overview->channels = channels;
+	uint32_t samplesPerBucket = OVERVIEW_BUCKET;
+	for (int l = 0; l < OVERVIEW_LEVELS; ++l)
+	{
+		struct OverviewLevel* const level = &overview->levels[l];
+		level->samplesPerBucket = samplesPerBucket;
+		samplesPerBucket *= OVERVIEW_FACTOR;
+		OverviewLevel_clear(level);
+		level->file = tmpfile();
+		if (!level->file)
+		{
+			Overview_destroy(overview);
+			return false;
+		}
+	}
+	return true;
+}
+void Overview_destroy(struct Overview* const overview)
+{
+	for (int l = 0; l < OVERVIEW_LEVELS; ++l)
+		if (overview->levels[l].file)
+		{
+			fclose(overview->levels[l].file);
+			overview->levels[l].file = NULL;
+		}
+}
+/**
+ * @brief Writes the accumulated bucket of a level and reduces it into the
+ *  next level, which is written in turn once full.
+ */
+static void Overview_emit(struct Overview* const overview, int l)
+{
+	struct OverviewLevel* const level = &overview->levels[l];
+	struct OverviewBucket buckets[OVERVIEW_CHANNELS_MAX];
+	for (int c = 0; c < overview->channels; ++c)
+	{
+		float const rms = sqrt(level->sumSquares[c] / level->nSamples);
+		buckets[c].min = overview_s16(level->min[c]);
+		buckets[c].max = overview_s16(level->max[c]);
+		buckets[c].rms = (uint16_t) overview_s16(fminf(rms, 1.0f));
+	}
+	if (fwrite(buckets, sizeof(struct OverviewBucket), overview->channels,
+	           level->file) != (size_t) overview->channels)
+		overview->failed = true;
+	++level->nBuckets;
+
+	if (l + 1 < OVERVIEW_LEVELS)
+	{
+		struct OverviewLevel* const next = &overview->levels[l + 1];
+		for (int c = 0; c < overview->channels; ++c)
+		{
+			next->min[c] = fminf(next->min[c], level->min[c]);
+			next->max[c] = fmaxf(next->max[c], level->max[c]);
+			next->sumSquares[c] += level->sumSquares[c];
+		}
+		next->nSamples += level->nSamples;
+		OverviewLevel_clear(level);
+		if (next->nSamples == next->samplesPerBucket)
+			Overview_emit(overview, l + 1);
+	}
+	else
+		OverviewLevel_clear(level);
+}
+void Overview_push(struct Overview* const overview, float const* const* planes,
+                   size_t frames)
+{
+	struct OverviewLevel* const level = &overview->levels[0];
+	size_t i = 0;
+	while (i < frames)
+	{
+		// Up to the end of the bucket
+		size_t n = level->samplesPerBucket - level->nSamples;
+		if (n > frames - i) n = frames - i;
+		for (int c = 0; c < overview->channels; ++c)
+			level->sumSquares[c] += overview_reduce(planes[c] + i, n,
+			                                        &level->min[c],
+			                                        &level->max[c]);
+		level->nSamples += n;
+		i += n;
+		if (level->nSamples == level->samplesPerBucket)
+			Overview_emit(overview, 0);
+	}
+}
+/**
+ * @brief Appends the content of a temporary file to dst.
+ */
+static bool overview_copy(FILE* dst, FILE* src)
+{
+	char buffer[OVERVIEW_COPY_SIZE];
+	rewind(src);
+	size_t size;
+	while ((size = fread(buffer, 1, sizeof(buffer), src)) > 0)
+		if (fwrite(buffer, 1, size, dst) != size)
+			return false;
+	return !ferror(src);
+}
+bool Overview_save(struct Overview* const overview, char const* path)
+{
+	// The partial buckets, finest first as each feeds the next
+	for (int l = 0; l < OVERVIEW_LEVELS; ++l)
+		if (overview->levels[l].nSamples)
+			Overview_emit(overview, l);
+	if (overview->failed)
+	{
+		fprintf(stderr, "[Overview] Unable to write a temporary file\n");
+		return false;
+	}
+
+	char pathTemp[PATH_MAX];
+	snprintf(pathTemp, sizeof(pathTemp), "%s.tmp", path);
+	FILE* file = fopen(pathTemp, "wb");
+	if (!file)
+	{
+		fprintf(stderr, "[Overview] Unable to write %s\n", pathTemp);
+		return false;
+	}
+	uint32_t const header[] =
+	{
+		OVERVIEW_VERSION, (uint32_t) overview->rate,
+		(uint32_t) overview->channels, OVERVIEW_LEVELS
+	};
+	bool success = fwrite(OVERVIEW_MAGIC, sizeof(OVERVIEW_MAGIC), 1,
+	                      file) == 1 &&
+	               fwrite(header, sizeof(header), 1, file) == 1;
+	for (int l = 0; success && l < OVERVIEW_LEVELS; ++l)
+	{
+		struct OverviewLevel const* const level = &overview->levels[l];
+		success = fwrite(&level->samplesPerBucket,
+		                 sizeof(level->samplesPerBucket), 1, file) == 1 &&
+		          fwrite(&level->nBuckets, sizeof(level->nBuckets), 1,
+		                 file) == 1;
+	}
+	for (int l = 0; success && l < OVERVIEW_LEVELS; ++l)
+		success = overview_copy(file, overview->levels[l].file);
+	success = fclose(file) == 0 && success;
+	if (success && rename(pathTemp, path) == 0)
+		return true;
+	fprintf(stderr, "[Overview] Unable to write %s\n", path);
+	remove(pathTemp);
+	return false;
+}
+
+// Decoding
+
+/**
+ * @brief Converted frame, grown only when a frame exceeds it.
+ */
+struct OverviewConvert
+{
+	float* planes[OVERVIEW_CHANNELS_MAX];
+	int capacity; ///< Frames
+};
+static bool OverviewConvert_reserve(struct OverviewConvert* const convert,
+                                    int channels, int frames)
+{
+	if (frames <= convert->capacity) return true;
+	int capacity = convert->capacity * 2;
+	if (capacity < frames) capacity = frames;
+	if (capacity < OVERVIEW_CONVERT_FRAMES) capacity = OVERVIEW_CONVERT_FRAMES;
+	av_freep(&convert->planes[0]);
+	convert->capacity = 0;
+	convert->planes[0] = av_malloc_array((size_t) channels * capacity,
+	                                     sizeof(float));
+	if (!convert->planes[0]) return false;
+	for (int c = 1; c < channels; ++c)
+		convert->planes[c] = convert->planes[0] + (size_t) c * capacity;
+	convert->capacity = capacity;
+	return true;
+}
+/**
+ * @brief Converts a decoded frame, or with frame NULL the audio held by the
+ *  resampler, and reduces it.
+ */
+static bool overview_convert(struct Overview* const overview,
+                             struct SwrContext* const swrContext,
+                             struct OverviewConvert* const convert,
+                             struct AVFrame const* frame)
+{
+	int const nIn = frame ? frame->nb_samples : 0;
+	if (!OverviewConvert_reserve(convert, overview->channels,
+	                             swr_get_out_samples(swrContext, nIn)))
+		return false;
+	int const n = swr_convert(swrContext, (uint8_t**) convert->planes,
+	                          convert->capacity,
+	                          frame ? (uint8_t const**) frame->extended_data : NULL,
+	                          nIn);
+	if (n < 0) return false;
+	Overview_push(overview, (float const* const*) convert->planes, n);
+	return true;
+}
+bool overview_file(char const* fileIn, char const* fileOut)
+{
+	struct AVFormatContext* fc = NULL;
+	if (avformat_open_input(&fc, fileIn, NULL, NULL) < 0 ||
+	    avformat_find_stream_info(fc, NULL) < 0)
+	{
+		fprintf(stderr, "[Overview] Unable to open %s\n", fileIn);
+		avformat_close_input(&fc);
+		return false;
+	}
+	int const index = av_find_best_stream(fc, AVMEDIA_TYPE_AUDIO, -1, -1, NULL,
+	                                      0);
+	struct AVCodecContext* cc = NULL;
+	if (index < 0 || !av_stream_context(fc, index, &cc, false))
+	{
+		fprintf(stderr, "[Overview] No audio to decode in %s\n", fileIn);
+		avformat_close_input(&fc);
+		return false;
+	}
+	// Only the audio is demuxed
+	for (unsigned i = 0; i < fc->nb_streams; ++i)
+		if ((int) i != index)
+			fc->streams[i]->discard = AVDISCARD_ALL;
+
+	// Planar float at the rate of the stream, as for the mixer
+	int64_t const layoutIn = cc->channel_layout &&
+	                         av_get_channel_layout_nb_channels(cc->channel_layout)
+	                         == cc->channels ? (int64_t) cc->channel_layout :
+	                         av_get_default_channel_layout(cc->channels);
+	int64_t const layoutOut = cc->channels <= OVERVIEW_CHANNELS_MAX ?
+	                          layoutIn : (int64_t) AV_CH_LAYOUT_STEREO;
+	struct SwrContext* swrContext = swr_alloc_set_opts(NULL,
+	                                layoutOut, AV_SAMPLE_FMT_FLTP, cc->sample_rate,
+	                                layoutIn, cc->sample_fmt, cc->sample_rate, 0,
+	                                NULL);
+	struct Overview overview = { .failed = false };
+	bool success = swrContext && swr_init(swrContext) >= 0 &&
+	               Overview_init(&overview, cc->sample_rate,
+	                             av_get_channel_layout_nb_channels(layoutOut));
+	struct OverviewConvert convert = { .capacity = 0 };
+	struct AVFrame* frame = av_frame_alloc();
+	struct AVPacket packet;
+	bool ended = false;
+	while (success && frame && !ended)
+	{
+		// After the last packet, the decoder is drained with empty packets
+		ended = av_read_frame(fc, &packet) < 0;
+		if (ended)
+		{
+			av_init_packet(&packet);
+			packet.data = NULL;
+			packet.size = 0;
+		}
+		else if (packet.stream_index != index)
+		{
+			av_packet_unref(&packet);
+			continue;
+		}
+		struct AVPacket remaining = packet;
+		while (success && (remaining.size > 0 || ended))
+		{
+			int gotFrame = 0;
+			int const size = avcodec_decode_audio4(cc, frame, &gotFrame,
+			                                       &remaining);
+			if (size < 0) break; // Skipped
+			remaining.data += size;
+			remaining.size -= size;
+			if (gotFrame)
+				success = overview_convert(&overview, swrContext, &convert, frame);
+			else if (ended || size == 0)
+				break; // Drained, or more data needed
+		}
+		av_packet_unref(&packet);
+	}
+	if (success && frame)
+		success = overview_convert(&overview, swrContext, &convert, NULL) &&
+		          Overview_save(&overview, fileOut);
+	else
+		fprintf(stderr, "[Overview] Unable to reduce the audio of %s\n", fileIn);
+	Overview_destroy(&overview);
+	av_freep(&convert.planes[0]);
+	av_frame_free(&frame);
+	swr_free(&swrContext);
+	avcodec_free_context(&cc);
+	avformat_close_input(&fc);
+	return success;
+}
+
+// Batch
+
+struct OverviewJob
+{
+	char const* fileIn;
+	char fileOut[PATH_MAX];
+	bool duplicate; ///< fileOut is that of an earlier file. Not reduced
+	bool written;
+};
+/**
+ * @brief Orders jobs by output name, then by position in the list.
+ */
+static int OverviewJob_compare(void const* a, void const* b)
+{
+	struct OverviewJob const* const jobA = *(struct OverviewJob* const*) a;
+	struct OverviewJob const* const jobB = *(struct OverviewJob* const*) b;
+	int const result = strcmp(jobA->fileOut, jobB->fileOut);
+	if (result) return result;
+	return (jobA > jobB) - (jobA < jobB);
+}
+/**
+ * @brief Marks the jobs whose output name is that of an earlier job, such as
+ *  files of the same name in different directories, which would otherwise
+ *  overwrite each other's overview.
+ * @return false if out of memory.
+ */
+static bool overview_find_duplicates(struct OverviewJob* const jobs,
+                                     size_t nFiles)
+{
+	struct OverviewJob** const sorted = malloc((nFiles ? nFiles : 1) *
+	                                           sizeof(struct OverviewJob*));
+	if (!sorted) return false;
+	for (size_t i = 0; i < nFiles; ++i)
+		sorted[i] = &jobs[i];
+	qsort(sorted, nFiles, sizeof(struct OverviewJob*), OverviewJob_compare);
+	// The first of each run of equal names keeps it
+	struct OverviewJob const* first = nFiles ? sorted[0] : NULL;
+	for (size_t i = 1; i < nFiles; ++i)
+	{
+		if (strcmp(sorted[i]->fileOut, first->fileOut) != 0)
+		{
+			first = sorted[i];
+			continue;
+		}
+		sorted[i]->duplicate = true;
+		fprintf(stderr, "Skipped %s: %s is already the overview of %s\n",
+		        sorted[i]->fileIn, sorted[i]->fileOut, first->fileIn);
+	}
+	free(sorted);
+	return true;
+}
+/**
+ * @brief Writes the overview of a file. Task run on the scheduler.
+ */
+static void OverviewJob_run(void* data)
+{
+	struct OverviewJob* const job = data;
+	job->written = overview_file(job->fileIn, job->fileOut);
+}
+size_t overview_files(VectorPtr const* const fileNames, char const* directory,
+                      FILE* progress)
+{
+	uint64_t const timeBegin = stats_now();
+	size_t const nFiles = VectorPtr_size(fileNames);
+	struct OverviewJob* jobs = calloc(nFiles ? nFiles : 1,
+	                                  sizeof(struct OverviewJob));
+	if (!jobs) return 0;
+	for (size_t i = 0; i < nFiles; ++i)
+	{
+		char const* const fileIn = VectorPtr_at(fileNames, i);
+		char const* const slash = strrchr(fileIn, '/');
+		jobs[i].fileIn = fileIn;
+		snprintf(jobs[i].fileOut, sizeof(jobs[i].fileOut), "%s/%s%s", directory,
+		         slash ? slash + 1 : fileIn, OVERVIEW_EXTENSION);
+	}
+	if (!overview_find_duplicates(jobs, nFiles))
+	{
+		free(jobs);
+		return 0;
+	}
+
+	// Reduced in batches so that few files are open at once
+	unsigned const nWorkers = scheduler_workers();
+	size_t const batch = (nWorkers ? nWorkers : 1) * OVERVIEW_BATCH_PER_WORKER;
+	size_t nWritten = 0;
+	for (size_t begin = 0; begin < nFiles; begin += batch)
+	{
+		struct TaskGroup group;
+		TaskGroup_init(&group);
+		size_t const end = begin + batch < nFiles ? begin + batch : nFiles;
+		for (size_t i = begin; i < end; ++i)
+			if (!jobs[i].duplicate)
+				scheduler_submit(&group, OverviewJob_run, &jobs[i]);
+		TaskGroup_wait(&group);
+		for (size_t i = begin; i < end; ++i)
+			nWritten += jobs[i].written;
+		if (progress)
+		{
+			fprintf(progress, "\rReduced %zu/%zu", end, nFiles);
+			fflush(progress);
+		}
+	}
+	if (progress)
+	{
+		if (nFiles) fprintf(progress, "\n");
+		fprintf(progress, "%zu of %zu overviews written to %s in %.2fs\n",
+		        nWritten, nFiles, directory, (stats_now() - timeBegin) / 1e9);
+	}
+	free(jobs);
+	return nWritten;
+}
@@ -0,0 +1,111 @@
+#ifndef CHALCOCITE__OVERVIEW_H_
+#define CHALCOCITE__OVERVIEW_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "container/vectorptr.h"
+
+#define OVERVIEW_EXTENSION ".peaks"
+#define OVERVIEW_LEVELS 5
+#define OVERVIEW_BUCKET 256 // Samples per bucket of the finest level
+#define OVERVIEW_FACTOR 4 // Buckets of a level reduced into one of the next
+#define OVERVIEW_CHANNELS_MAX 8 // More channels are downmixed to stereo
+#define OVERVIEW_CONVERT_FRAMES 4096 // Initial capacity of the converted frame
+/*
+ * Files are reduced in batches of OVERVIEW_BATCH_PER_WORKER per scheduler
+ * worker, which bounds the files open at once.
+ */
+#define OVERVIEW_BATCH_PER_WORKER 2
+
+/*
+ * Overview file: OVERVIEW_MAGIC, then uint32_t version, sample rate, channels
+ * and OVERVIEW_LEVELS, then for each level uint32_t samples per bucket and
+ * uint64_t buckets. The buckets of each level follow, finest level first. A
+ * bucket is a struct OverviewBucket per channel. Native byte order.
+ */
+#define OVERVIEW_MAGIC "CHALPKS"
+#define OVERVIEW_VERSION 1
+
+/**
+ * @brief Peak and RMS of a channel over a bucket of samples, in units of
+ *  1/32767 of full scale. The last bucket of a level may be shorter.
+ */
+struct OverviewBucket
+{
+	int16_t min, max;
+	uint16_t rms;
+};
+
+/**
+ * @brief Reduces samples into a running minimum and maximum. Vectorised with
+ *  SSE where available.
+ * @param[in,out] min, max Updated with the samples
+ * @return Sum of the squares of the samples.
+ */
+float overview_reduce(float const* samples, size_t n, float* const min,
+                      float* const max);
+
+struct OverviewLevel
+{
+	FILE* file; ///< Temporary file of the buckets
+	uint32_t samplesPerBucket;
+	uint64_t nBuckets; ///< Written
+	// Bucket being accumulated, per channel
+	float min[OVERVIEW_CHANNELS_MAX], max[OVERVIEW_CHANNELS_MAX];
+	double sumSquares[OVERVIEW_CHANNELS_MAX];
+	uint32_t nSamples;
+};
+
+/**
+ * Must be initialised with \ref Overview_init and destroyed with
+ *  \ref Overview_destroy.
+ * @brief Reduces planar float audio, as it is decoded, into buckets of peaks
+ *  and RMS at OVERVIEW_LEVELS zoom levels. Each level is reduced from the
+ *  buckets of the level below and streamed to a temporary file, so that
+ *  memory does not grow with the length of the audio.
+ */
+struct Overview
+{
+	int rate, channels;
+	struct OverviewLevel levels[OVERVIEW_LEVELS];
+	bool failed; ///< A temporary file cannot be written
+};
+
+/**
+ * @return false if the temporary files cannot be created.
+ */
+bool Overview_init(struct Overview* const, int rate, int channels);
+void Overview_destroy(struct Overview* const);
+/**
+ * @param[in] planes A plane of frames samples per channel
+ */
+void Overview_push(struct Overview* const, float const* const* planes,
+                   size_t frames);
+/**
+ * @brief Writes the partial last buckets and the overview file. The previous
+ *  file is replaced atomically.
+ * @return false if the file cannot be written.
+ */
+bool Overview_save(struct Overview* const, char const* path);
+
+/**
+ * @brief Decodes the best audio stream of a file, without the other streams,
+ *  and writes its overview.
+ * @return false if the file has no decodable audio or the overview cannot be
+ *  written. Prints the error to stderr.
+ */
+bool overview_file(char const* fileIn, char const* fileOut);
+/**
+ * @brief Writes the overview of each file in parallel on the scheduler, to
+ *  the name of the file with OVERVIEW_EXTENSION in directory. A file of the
+ *  same name as an earlier one, in another directory, is skipped.
+ * @param[in] progress Receives progress and a summary. May be NULL
+ * @return Number of overviews written.
+ */
+size_t overview_files(VectorPtr const* const fileNames, char const* directory,
+                      FILE* progress);
+
+#endif // !CHALCOCITE__OVERVIEW_H_
@@ -1,15 +1,160 @@
 #include "playback.h"
 
 #include <assert.h>
-#include <libavutil/time.h>
+#include <stdatomic.h>
 
 #include "media.h"
 #include "video.h"
 #include "audio.h"
+#include "stats.h"
+#include "trace.h"
+#include "memstats.h"
+#include "scheduler.h"
+#include "threadpolicy.h"
+#include "control.h"
+
+// Size of the audio conversion buffer
+#define AUDIO_BUFFER_SIZE (192000 * 3 / 2)
 
 #define SYNC_LOWER_THRESHOULD 0.01
 #define SYNC_UPPER_THRESHOULD 10.0
 
+// stream_index of the empty packets that end a stream and flush its decoder
+#define PACKET_STREAM_END -1
+#define PACKET_STREAM_FLUSH -2
+
+#define PLAYBACK_PUBLISH_INTERVAL 0.1 // Second between published snapshots
+
+static struct SyncStats syncLast;
+static struct Governor governorLast;
+/*
+ * Snapshot of the current playback, written by the main thread only. The
+ *  sequence is odd while it is written, so readers retry a torn copy.
+ */
+static _Atomic unsigned snapshotSequence;
+static struct PlaybackSnapshot snapshotPublished;
+static double snapshotTime; ///< clock_monotonic() of the last publication
+static uint64_t nPlaybacks;
+// File requested by a control client, played once the current one stops
+static char playbackRequested[1024];
+
+struct SyncStats const* playback_last_sync(void)
+{
+	return &syncLast;
+}
+void playback_last_sync_reset(void)
+{
+	SyncStats_reset(&syncLast);
+}
+struct Governor const* playback_last_governor(void)
+{
+	return &governorLast;
+}
+
+void playback_snapshot(struct PlaybackSnapshot* const snapshot)
+{
+	while (true)
+	{
+		unsigned const begin = atomic_load_explicit(&snapshotSequence,
+		                                            memory_order_acquire);
+		if (begin & 1) continue;
+		memcpy(snapshot, &snapshotPublished, sizeof(struct PlaybackSnapshot));
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&snapshotSequence, memory_order_relaxed) == begin)
+			return;
+	}
+}
+/**
+ * @return Second of the first timestamp of the input.
+ */
+static double playback_start(struct Media const* const media)
+{
+	int64_t const start = media->formatContext->start_time;
+	return start == AV_NOPTS_VALUE ? 0.0 : start / (double) AV_TIME_BASE;
+}
+/**
+ * @return Second from the start of the presented picture in trick-play, of
+ *  the master clock otherwise. NAN if unknown.
+ */
+static double playback_position(struct Media* const media)
+{
+	double const timestamp = trick_enabled(atomic_load(&media->trickSpeed)) ?
+	                         media->lastFrameTimestamp :
+	                         PlaybackClock_master(&media->clock);
+	return timestamp - playback_start(media);
+}
+static void playback_publish(struct Media* const media, bool playing)
+{
+	struct PlaybackSnapshot snapshot =
+	{
+		.playing = playing,
+		.paused = media->state == STATE_PAUSE,
+		.live = media->liveLatency > 0.0,
+		.position = playback_position(media),
+		.duration = media->formatContext->duration == AV_NOPTS_VALUE ? NAN :
+		            media->formatContext->duration / (double) AV_TIME_BASE,
+		.master = media->clock.master,
+		.speed = media->clock.speed,
+		.trickSpeed = atomic_load(&media->trickSpeed),
+		.level = media->governor.level,
+		.framesPresented = atomic_load(&media->sync.framesPresented),
+		.framesLate = atomic_load(&media->sync.framesLate),
+		.framesDropped = atomic_load(&media->sync.framesDropped),
+		.framesRepeated = atomic_load(&media->sync.framesRepeated),
+		.audioUnderruns = atomic_load(&media->sync.audioUnderruns),
+		.aheadP99 = Histogram_percentile(&media->sync.offsetAhead, 0.99) / 1e9,
+		.behindP99 = Histogram_percentile(&media->sync.offsetBehind, 0.99) / 1e9,
+		.latenessP99 = Histogram_percentile(&media->sync.lateness, 0.99) / 1e9,
+		.nPlaybacks = nPlaybacks
+	};
+	snprintf(snapshot.fileName, sizeof(snapshot.fileName), "%s",
+	         media->fileName);
+
+	unsigned const sequence = atomic_load_explicit(&snapshotSequence,
+	                                               memory_order_relaxed);
+	atomic_store_explicit(&snapshotSequence, sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	memcpy(&snapshotPublished, &snapshot, sizeof(struct PlaybackSnapshot));
+	atomic_store_explicit(&snapshotSequence, sequence + 2, memory_order_release);
+	snapshotTime = clock_monotonic();
+}
+
+static uint32_t push_quit_event(uint32_t interval, void* data)
+{
+	(void) interval;
+
+	SDL_Event event;
+	event.type = CHAL_EVENT_QUIT;
+	event.user.data1 = data;
+	SDL_PushEvent(&event);
+	return 0; // Stops the timer
+}
+/**
+ * @brief Releases the picture at the reading position of the picture queue.
+ * @return Number of pictures left.
+ */
+static int video_queue_pop(struct Media* const media)
+{
+	++media->pictQueueIndexR;
+	if (media->pictQueueIndexR == PICTQUEUE_SIZE)
+		media->pictQueueIndexR = 0;
+	SDL_LockMutex(media->pictQueueMutex);
+	int size = --media->pictQueueSize;
+	SDL_CondSignal(media->pictQueueCond);
+	SDL_UnlockMutex(media->pictQueueMutex);
+	trace_counter("pictQueueSize", size);
+	return size;
+}
+/**
+ * @brief A picture is stale while a seek is requested and when it was decoded
+ *  before the last seek performed.
+ */
+static bool video_picture_stale(struct Media* const media,
+                                struct VideoPicture const* const vp)
+{
+	return atomic_load(&media->seekTarget) != AV_NOPTS_VALUE ||
+	       vp->serial != atomic_load(&media->seekSerial);
+}
 static void video_refresh_timer(struct Media* const media)
 {
 	if (media->state == STATE_QUIT)
@@ -19,7 +164,10 @@ static void video_refresh_timer(struct Media* const media)
 		SDL_RenderPresent(media->renderer);
 		return;
 	}
-	if (!media->streamV)
+	if (clock_monotonic() - snapshotTime >= PLAYBACK_PUBLISH_INTERVAL)
+		playback_publish(media, true);
+	// Sinks other than the window are not paced
+	if (!media->streamV || !media->screen || media->state == STATE_PAUSE)
 	{
 		schedule_refresh(media, 100);
 		return;
@@ -27,283 +175,1455 @@ static void video_refresh_timer(struct Media* const media)
 
 	if (media->pictQueueSize == 0)
 		schedule_refresh(media, 1);
+	else if (video_picture_stale(media, &media->pictQueue[media->pictQueueIndexR]))
+	{
+		// Dropped unseen, without setting the clock
+		av_frame_unref(media->pictQueue[media->pictQueueIndexR].frame);
+		if (media->pictUploaded == media->pictQueueIndexR)
+			media->pictUploaded = -1;
+		video_queue_pop(media);
+		schedule_refresh(media, 1);
+	}
 	else
 	{
 		// Show picture
 		struct VideoPicture* vp = &media->pictQueue[media->pictQueueIndexR];
-		assert(vp->texture &&
-		       vp->planeY && vp->planeU && vp->planeV);
+		assert(vp->data[0]);
 
+		// Trick-play is paced by the timestamps at its speed, without audio
+		int const trick = atomic_load(&media->trickSpeed);
 		double delay = vp->timestamp - media->lastFrameTimestamp;
-		if (delay <= 0.0 || delay >= 1.0)
-			delay = media->lastFrameDelay;
-		media->lastFrameDelay = delay;
+		if (trick_enabled(trick))
+			delay = trick_delay(vp->timestamp, media->lastFrameTimestamp, trick);
+		else
+		{
+			// Also unknown after a seek
+			if (!(delay > 0.0 && delay < 1.0))
+				delay = media->lastFrameDelay;
+			media->lastFrameDelay = delay;
+		}
 		media->lastFrameTimestamp = vp->timestamp;
+		double const frameInterval = delay;
+		double const deadline = media->timer;
 
-		// Synchronise with audio
-		double audioReference = Media_get_audio_clock(media);
-		double diff = vp->timestamp - audioReference;
-		double syncThreshould = (delay > SYNC_LOWER_THRESHOULD) ? delay :
-		                        SYNC_LOWER_THRESHOULD;
-		if (fabs(diff) < syncThreshould)
-		{
-			if (diff <= syncThreshould) // Video behind
-				delay = 0.0;
-			else if (diff >= syncThreshould) // Audio behind
-				delay *= 2.0;
-		}
-		media->timer += delay;
-		// 1,000,000 converts microsecond to second
-		double delayReal = media->timer - (av_gettime() / 1000000.0);
+		// Synchronise with the master clock. The video master follows the
+		// timestamps alone
+		if (!trick_enabled(trick) && media->clock.master != CLOCK_SOURCE_VIDEO)
+		{
+			double const diff = vp->timestamp - PlaybackClock_master(&media->clock);
+			if (!isnan(diff))
+			{
+				trace_counter("A/V diff", diff);
+				SyncStats_offset(&media->sync, diff);
+			}
+			double const syncThreshould = (delay > SYNC_LOWER_THRESHOULD) ?
+			                              delay : SYNC_LOWER_THRESHOULD;
+			// Beyond the upper threshould, the timestamps jumped
+			if (fabs(diff) < SYNC_UPPER_THRESHOULD)
+			{
+				if (diff <= -syncThreshould) // Video behind
+					delay = 0.0;
+				else if (diff >= syncThreshould) // Video ahead
+					delay *= 2.0;
+			}
+		}
+		media->timer += trick_enabled(trick) ? delay : delay / media->clock.speed;
+		double const now = clock_monotonic();
+		// A live source behind its target latency is presented without waiting
+		if (media->liveLatency > 0.0 &&
+		    (media->timer < now - media->liveLatency ||
+		     media->pictQueueSize == PICTQUEUE_SIZE))
+			media->timer = now;
+		// Trick-play falls behind on slow key frame seeks and does not catch up
+		if (trick_enabled(trick) && media->timer < now)
+			media->timer = now;
+		double delayReal = media->timer - now;
 		if (delayReal < 0.01) delayReal = 0.01;
 
-		fprintf(stdout, "\b[Video] F:%f, D:%f, A:%f, T:%f, R:%f\r",
-		        media->timer, delay, audioReference, vp->timestamp, delayReal);
-		fflush(stdout);
 		schedule_refresh(media, (int)(delayReal * 1000 + 0.5));
 
-
-		SDL_UpdateYUVTexture(vp->texture, NULL,
-		                     vp->planeY, vp->width,
-		                     vp->planeU, vp->width / 2,
-		                     vp->planeV, vp->width / 2);
+		// Usually uploaded after the previous presentation
+		if (media->pictUploaded != media->pictQueueIndexR)
+		{
+			uint64_t timeBegin = stats_now();
+			Media_pictQueue_upload(media, vp);
+			stats_record_since(STAGE_UPLOAD, timeBegin);
+			trace_complete("SDL_LockTexture", timeBegin);
+		}
+		media->pictUploaded = -1;
+		Media_texture_swap(media);
+		uint64_t timeBegin = stats_now();
 		//SDL_SetRenderDrawColor(media->renderer, 255, 127, 255, 255);
 		SDL_RenderClear(media->renderer);
-		SDL_RenderCopy(media->renderer, vp->texture, NULL, 0);
+		Media_render_copy(media);
+		Subtitles_render(&media->subtitles, media->renderer, vp->timestamp);
 		SDL_RenderPresent(media->renderer);
+		stats_record_since(STAGE_PRESENT, timeBegin);
+		trace_complete("SDL_RenderPresent", timeBegin);
+
+		double presentTime = clock_monotonic();
+		unsigned repeats = 0;
+		if (media->lastPresentTime > 0.0 && frameInterval > 0.0)
+		{
+			double intervals = (presentTime - media->lastPresentTime) / frameInterval;
+			if (intervals >= 2.0) repeats = (unsigned) intervals - 1;
+		}
+		media->lastPresentTime = presentTime;
+		SyncStats_present(&media->sync, presentTime - deadline, repeats);
+		if (!trick_enabled(trick))
+			PlaybackClock_set_video(&media->clock, vp->timestamp);
+		media->cursor = vp->pts;
+
+		int size = video_queue_pop(media);
 
-		++media->pictQueueIndexR;
-		if (media->pictQueueIndexR == PICTQUEUE_SIZE)
-			media->pictQueueIndexR = 0;
-		SDL_LockMutex(media->pictQueueMutex);
-		--media->pictQueueSize;
-		SDL_CondSignal(media->pictQueueCond);
-		SDL_UnlockMutex(media->pictQueueMutex);
+		// Upload the next picture while the current one is on screen
+		if (size > 0)
+		{
+			timeBegin = stats_now();
+			if (Media_pictQueue_upload(media,
+			                           &media->pictQueue[media->pictQueueIndexR]))
+				media->pictUploaded = media->pictQueueIndexR;
+			stats_record_since(STAGE_UPLOAD, timeBegin);
+			trace_complete("SDL_LockTexture", timeBegin);
+		}
 	}
 }
+/**
+ * @brief Converts frame into the next picture of media->sink.
+ * @return false if quitting or the sink fails.
+ */
+static bool video_sink_picture(struct Media* const media,
+                               struct AVFrame* const frame, double pts)
+{
+	uint8_t* data[4];
+	int linesize[4];
+	if (!Sink_picture_buffer(media->sink, data, linesize)) return false;
+
+	uint64_t timeBegin = stats_now();
+	if (media->scale.nSlices)
+		SlicedScale_scale(&media->scale, (uint8_t const* const*) frame->data,
+		                  frame->linesize, data, linesize);
+	else
+		av_image_copy(data, linesize, (uint8_t const**) frame->data,
+		              frame->linesize, SINK_PICTURE_FORMAT, media->outWidth,
+		              media->outHeight);
+	stats_record_since(STAGE_SCALE, timeBegin);
+	trace_complete("sws_scale", timeBegin);
+	// Filtered frames are in the time base of the filter graph
+	int64_t const ptsStream = media->filter.graph ? AV_NOPTS_VALUE :
+	                          av_frame_get_best_effort_timestamp(frame);
+	if (!Sink_picture_commit(media->sink, ptsStream, pts))
+	{
+		fprintf(stderr, "Unable to write to the %s sink\n",
+		        sink_type_name(media->sink->type));
+		push_quit_event(0, media);
+		return false;
+	}
+	return true;
+}
+/**
+ * @brief Waits for a free slot in the picture queue and fills it with frame.
+ * @return false if quitting.
+ */
+static bool video_queue_picture(struct Media* const media,
+                                struct AVFrame* const frame, double pts)
+{
+	// The picture queue and the conversion have a fixed size
+	if (frame->width != media->outWidth || frame->height != media->outHeight)
+		return true;
+	pts = Media_synchronise_video(media, frame, pts);
+	if (media->sink->type != SINK_SDL)
+		return video_sink_picture(media, frame, pts);
+	if (!Media_pictQueue_wait_write(media)) return false;
+	struct VideoPicture* vp = &media->pictQueue[media->pictQueueIndexW];
+
+	uint64_t timeBegin = stats_now();
+	if (media->scale.nSlices)
+		SlicedScale_scale(&media->scale, (uint8_t const* const*) frame->data,
+		                  frame->linesize, vp->data, vp->linesize);
+	else if (frame->buf[0]) // Already in the format of the picture queue
+		av_frame_ref(vp->frame, frame);
+	else
+		av_image_copy(vp->data, vp->linesize, (uint8_t const**) frame->data,
+		              frame->linesize, media->pictFormat, vp->width, vp->height);
+	stats_record_since(STAGE_SCALE, timeBegin);
+	trace_complete("sws_scale", timeBegin);
+	vp->timestamp = pts;
+	// Filtered frames are in the time base of the filter graph
+	vp->pts = media->filter.graph ? AV_NOPTS_VALUE :
+	          av_frame_get_best_effort_timestamp(frame);
+	vp->serial = media->serialV;
+
+	// Move picture queue writing index
+	if (++media->pictQueueIndexW == PICTQUEUE_SIZE)
+		media->pictQueueIndexW = 0;
+	SDL_LockMutex(media->pictQueueMutex);
+	++media->pictQueueSize;
+	SDL_UnlockMutex(media->pictQueueMutex);
+	trace_counter("pictQueueSize", media->pictQueueSize);
+	return true;
+}
+/**
+ * @brief Passes a decoded frame through the filter graph and queues the
+ *  filtered frames.
+ * @param[in] frame NULL at the end of the stream, to queue the frames the
+ *  filters hold back
+ * @return false if quitting.
+ */
+static bool video_filter_picture(struct Media* const media,
+                                 struct AVFrame* const frame)
+{
+	uint64_t timeBegin = stats_now();
+	if (frame)
+		frame->pts = av_frame_get_best_effort_timestamp(frame);
+	int result = VideoFilter_push(&media->filter, frame);
+	trace_complete("VideoFilter_push", timeBegin);
+	if (result < 0) return true;
+
+	struct AVFrame* const filtered = media->frameFiltered;
+	double const timeBase = av_q2d(VideoFilter_time_base(&media->filter));
+	bool running = true;
+	while (running)
+	{
+		timeBegin = stats_now();
+		result = VideoFilter_pull(&media->filter, filtered);
+		if (result < 0) break;
+		trace_complete("VideoFilter_pull", timeBegin);
+		double pts = filtered->pts == AV_NOPTS_VALUE ? 0.0 :
+		             filtered->pts * timeBase;
+		running = video_queue_picture(media, filtered, pts);
+		av_frame_unref(filtered);
+	}
+	return running;
+}
+/**
+ * @brief Catch-up with a live source. While the latest demuxed video packet is
+ *  more than the target latency ahead of frame, frames are dropped instead of
+ *  waiting for the picture queue and non-reference frames are not decoded.
+ * @return false if the frame should be dropped.
+ */
+static bool video_live_catch_up(struct Media* const media,
+                                struct AVFrame* const frame)
+{
+	int64_t const head = atomic_load(&media->liveHeadV);
+	int64_t const timestamp = av_frame_get_best_effort_timestamp(frame);
+	if (head == AV_NOPTS_VALUE || timestamp == AV_NOPTS_VALUE) return true;
+
+	double const backlog = (head - timestamp) * av_q2d(media->streamV->time_base);
+	trace_counter("live backlog", backlog);
+	if (backlog > media->liveLatency)
+	{
+		media->ccV->skip_frame = AVDISCARD_NONREF;
+		return false;
+	}
+	if (backlog < media->liveLatency / 2)
+		Governor_apply(&media->governor, media->ccV);
+	return true;
+}
 static int video_thread(struct Media* const media)
 {
+	stats_thread_register("video");
+	trace_thread_register("video");
+	thread_policy_apply(THREAD_ROLE_DECODE);
 	AVFrame* frame = media->frameVideo;
-
-	size_t pitchUV = media->outWidth / 2;
+	AVRational const frameRate = av_guess_frame_rate(media->formatContext,
+	                             media->streamV, NULL);
+	double const frameInterval = frameRate.num && frameRate.den ?
+	                             av_q2d(av_inv_q(frameRate)) : 40e-3;
+	int64_t const frameDuration = frameInterval /
+	                              av_q2d(media->streamV->time_base);
+	uint64_t decodeTime = 0; // Since the last decoded frame
+	// Packets decoded since the last decoded frame. The governor skips frames
+	unsigned nPackets = 0;
+	double trickNext = NAN; // Earliest timestamp presented in trick-play
+	bool keyframes = false; // Non-key frames are skipped for trick-play
 
 	double pts;
-	while (true)
+	bool running = true;
+	while (running)
 	{
 		struct AVPacket packet;
+		uint64_t timeBegin = stats_now();
 		if (PacketQueue_get(&media->queueV, &packet, true, &media->state) < 0)
 		{
 			break;
 		}
+		stats_record_since(STAGE_QUEUE_WAIT, timeBegin);
+		trace_complete("PacketQueue_get", timeBegin);
+		if (packet.stream_index == PACKET_STREAM_FLUSH)
+		{
+			media->serialV = (unsigned) packet.pos;
+			av_packet_unref(&packet);
+			avcodec_flush_buffers(media->ccV);
+			decodeTime = 0;
+			nPackets = 0;
+			trickNext = NAN;
+			continue;
+		}
+		int const trick = atomic_load(&media->trickSpeed);
+		if (trick_keyframes(trick) != keyframes)
+		{
+			keyframes = !keyframes;
+			if (keyframes)
+				media->ccV->skip_frame = AVDISCARD_NONKEY;
+			else
+				Governor_apply(&media->governor, media->ccV);
+		}
+		// An empty packet ends the stream. The decoder then returns the frames
+		// it holds back, one per call
+		bool const drain = packet.stream_index == PACKET_STREAM_END;
+		if (drain)
+		{
+			av_packet_unref(&packet);
+			packet.data = NULL;
+			packet.size = 0;
+		}
+		// Key frames of trick-play are not contiguous. Each is drained out of
+		// the decoder, which is then flushed for the next
+		bool const drainKey = keyframes && !drain;
 		int finished;
-		avcodec_decode_video2(media->ccV, frame, &finished, &packet);
-
-		pts = packet.dts == AV_NOPTS_VALUE ? 0.0 :
-		      av_frame_get_best_effort_timestamp(frame);
-		pts *= av_q2d(media->streamV->time_base);
-
-		if (finished)
-		{
-			pts = Media_synchronise_video(media, frame, pts);
-			if (!Media_pictQueue_wait_write(media)) break;
-			struct VideoPicture* vp = &media->pictQueue[media->pictQueueIndexW];
-
-			uint8_t* imageData[3];
-			int imageLinesize[3];
-			imageData[0] = vp->planeY;
-			imageData[1] = vp->planeU;
-			imageData[2] = vp->planeV;
-			imageLinesize[0] = media->outWidth;
-			imageLinesize[1] = pitchUV;
-			imageLinesize[2] = pitchUV;
-
-			sws_scale(media->swsContext,
-			          (uint8_t const* const*) frame->data,
-			          frame->linesize, 0, media->ccV->height,
-			          imageData, imageLinesize);
-			vp->timestamp = pts;
-
-			// Move picture queue writing index
-			if (++media->pictQueueIndexW == PICTQUEUE_SIZE)
-				media->pictQueueIndexW = 0;
-			SDL_LockMutex(media->pictQueueMutex);
-			++media->pictQueueSize;
-			SDL_UnlockMutex(media->pictQueueMutex);
+		do
+		{
+			timeBegin = stats_now();
+			avcodec_decode_video2(media->ccV, frame, &finished, &packet);
+			uint64_t const timeDecode = stats_now() - timeBegin;
+			stats_record(STAGE_DECODE, timeDecode);
+			trace_complete("avcodec_decode_video2", timeBegin);
+			decodeTime += timeDecode;
+			if (packet.data) ++nPackets;
+			bool const decoded = finished;
+			// Trick-play decodes at another rate than the frame rate
+			if (finished && !trick_enabled(trick))
+			{
+				struct Governor* const governor = &media->governor;
+				double const duration = frameInterval *
+				                        (nPackets > 0 ? nPackets : 1);
+				if (Governor_update(governor, decodeTime / 1e9, duration,
+				                    media->pictQueueSize))
+				{
+					Governor_apply(governor, media->ccV);
+					trace_counter("governor level", governor->level);
+					fprintf(stdout, "[Governor] %s, load %.2f\n",
+					        governor_level_name(governor->level), governor->load);
+				}
+			}
+			if (finished)
+			{
+				// The other packets were skipped by the decoder at the skip_frame
+				// level of the governor or of the live catch-up
+				if (nPackets > 1 && !keyframes &&
+				    media->ccV->skip_frame >= AVDISCARD_NONREF)
+					SyncStats_skip(&media->sync, nPackets - 1);
+				decodeTime = 0;
+				nPackets = 0;
+			}
 
-			av_packet_unref(&packet);
+			pts = packet.dts == AV_NOPTS_VALUE && packet.data ? 0.0 :
+			      av_frame_get_best_effort_timestamp(frame);
+			pts *= av_q2d(media->streamV->time_base);
+
+			if (finished && media->liveLatency > 0.0 &&
+			    !video_live_catch_up(media, frame))
+			{
+				SyncStats_drop(&media->sync);
+				finished = 0;
+			}
+			// Below the key frame speeds, frames beyond the presentation rate
+			if (finished && trick_enabled(trick) && !keyframes &&
+			    !trick_accept(&trickNext, pts, trick))
+				finished = 0;
+			if (finished)
+			{
+				if (media->filter.graph)
+					running = video_filter_picture(media, frame);
+				else
+				{
+					// Frames of trick-play are too sparse to step through
+					if (!trick_enabled(trick))
+						FrameCache_put(&media->frameCache, frame,
+						               av_frame_get_best_effort_timestamp(frame),
+						               frame->pkt_duration > 0 ? frame->pkt_duration :
+						               frameDuration);
+					running = video_queue_picture(media, frame, pts);
+				}
+			}
+			av_frame_unref(frame);
+			finished = decoded;
+			if (drainKey && packet.data)
+			{
+				av_packet_unref(&packet);
+				packet.data = NULL;
+				packet.size = 0;
+				finished = true;
+			}
+		} while ((drain || drainKey) && finished && running);
+		av_packet_unref(&packet);
+		if (drainKey)
+			avcodec_flush_buffers(media->ccV);
+		if (drain)
+		{
+			if (media->filter.graph && running)
+				video_filter_picture(media, NULL);
+			atomic_store(&media->drainedV, true);
+			break;
 		}
 	}
 	fprintf(stdout, "Video thread complete\n");
+	stats_thread_unregister();
+	trace_thread_unregister();
 	return 0;
 }
-static int audio_thread(struct Media* const media)
+/**
+ * @brief State of the audio thread between decoded frames.
+ */
+struct AudioThread
 {
-	AVFrame* frame = media->frameAudio;
-	uint8_t* buffer = malloc(192000 * 3 / 2);
-	while (true)
+	uint8_t* buffer; ///< AUDIO_BUFFER_SIZE bytes of converted audio
+	bool queued;
+	uint32_t queuedSize; ///< Accounted size of the device queue
+	uint64_t droppedSize; ///< Dropped to catch up with a live source
+	bool failed; ///< The sink cannot be written
+	double bytesPerSecond; ///< Of the device queue
+	double clock; ///< Timestamp of the end of the decoded first track. Second
+};
+/**
+ * @brief Sends size bytes of converted audio to the sink or the device queue.
+ */
+static void audio_write(struct Media* const media, struct AudioThread* const at,
+                        int size)
+{
+	if (media->sink->type != SINK_SDL)
 	{
-		struct AVPacket packet;
-		if (PacketQueue_get(&media->queueA, &packet, true, &media->state) < 0)
+		if (!at->failed && !Sink_write_audio(media->sink, at->buffer, size))
 		{
-			break;
+			fprintf(stderr, "Unable to write to the %s sink\n",
+			        sink_type_name(media->sink->type));
+			push_quit_event(0, media);
+			at->failed = true;
 		}
-		while (packet.size > 0)
+		return;
+	}
+	// The device queue would otherwise hold the entire stream
+	bool const live = media->liveLatency > 0.0;
+	uint32_t queueMax = at->bytesPerSecond * memstats_queue_scale() *
+	                    (live ? media->liveLatency :
+	                     AUDIO_DEVICE_QUEUE_MAX_DURATION);
+	bool drop = false;
+	if (live) // Cannot wait for a live source
+		drop = SDL_GetQueuedAudioSize(media->audioDevice) > queueMax;
+	else
+		while (SDL_GetQueuedAudioSize(media->audioDevice) > queueMax &&
+		       media->state != STATE_QUIT)
+			SDL_Delay(5);
+	if (drop)
+		at->droppedSize += size;
+	else
+	{
+		// The device queue ran dry since the last chunk
+		if (at->queued && SDL_GetQueuedAudioSize(media->audioDevice) == 0)
+			SyncStats_underrun(&media->sync);
+		SDL_QueueAudio(media->audioDevice, at->buffer, size);
+		at->queued = true;
+	}
+
+	uint32_t queuedSize = SDL_GetQueuedAudioSize(media->audioDevice);
+	memstats_add(MEM_AUDIO, (int64_t) queuedSize - at->queuedSize);
+	at->queuedSize = queuedSize;
+	stats_record(STAGE_AUDIO_QUEUE, queuedSize / at->bytesPerSecond * 1e9);
+}
+/**
+ * @brief Writes the audio the mixer can mix.
+ */
+static void audio_mix(struct Media* const media, struct AudioThread* const at)
+{
+	struct AudioMixer* const mixer = &media->mixer;
+	int const frameSize = mixer->channels * 2;
+	while (true)
+	{
+		uint64_t timeBegin = stats_now();
+		int const n = AudioMixer_pull(mixer, (int16_t*) at->buffer,
+		                              AUDIO_BUFFER_SIZE / frameSize);
+		stats_record_since(STAGE_SCALE, timeBegin);
+		trace_complete("AudioMixer_pull", timeBegin);
+		if (n <= 0) break;
+		audio_write(media, at, n * frameSize);
+	}
+}
+/**
+ * @brief Decodes a packet of a track and outputs the frames.
+ * @param[in] packet NULL to drain the decoder
+ */
+static void audio_decode(struct Media* const media, struct AudioThread* const at,
+                         unsigned track, struct AVPacket* packet)
+{
+	AVFrame* frame = media->frameAudio;
+	struct AVCodecContext* const cc = media->mixer.tracks[track].cc;
+	bool const mixing = AudioMixer_enabled(&media->mixer);
+	bool drain = !packet;
+	struct AVPacket empty;
+	if (drain)
+	{
+		av_init_packet(&empty);
+		empty.data = NULL;
+		empty.size = 0;
+		packet = &empty;
+	}
+	while (packet->size > 0 || drain)
+	{
+		int gotFrame = 0;
+		uint64_t timeBegin = stats_now();
+		int dataSize = avcodec_decode_audio4(cc, frame, &gotFrame, packet);
+		stats_record_since(STAGE_DECODE, timeBegin);
+		trace_complete("avcodec_decode_audio4", timeBegin);
+		if (dataSize >= 0 && gotFrame)
 		{
-			int gotFrame = 0;
-			int dataSize = avcodec_decode_audio4(media->ccA, frame,
-			                                     &gotFrame, &packet);
-			if (dataSize >= 0 && gotFrame)
+			packet->size -= dataSize;
+			packet->data += dataSize;
+			int bufferSize = av_samples_get_buffer_size(NULL, cc->channels,
+			                 frame->nb_samples, AV_SAMPLE_FMT_S16, true);
+			if (mixing)
 			{
-				packet.size -= dataSize;
-				packet.data += dataSize;
-				int bufferSize = av_samples_get_buffer_size(NULL, media->ccA->channels,
-				                 frame->nb_samples, AV_SAMPLE_FMT_S16, true);
-				swr_convert(media->swrContext, &buffer, bufferSize,
+				timeBegin = stats_now();
+				AudioMixer_push(&media->mixer, track, frame);
+				stats_record_since(STAGE_SCALE, timeBegin);
+				trace_complete("AudioMixer_push", timeBegin);
+				audio_mix(media, at);
+			}
+			else
+			{
+				timeBegin = stats_now();
+				swr_convert(media->swrContext, &at->buffer, bufferSize,
 				            (uint8_t const**) frame->extended_data,
 				            frame->nb_samples);
-				SDL_QueueAudio(media->audioDevice, buffer, bufferSize);
+				stats_record_since(STAGE_SCALE, timeBegin);
+				trace_complete("swr_convert", timeBegin);
+				audio_write(media, at, bufferSize);
+			}
 
-				media->clockAudio += bufferSize / (media->ccA->channels *
-				                                   media->ccA->sample_rate);
+			// The device plays the audio queued before this frame's end
+			if (track == 0 && media->sink->type == SINK_SDL)
+			{
+				int64_t const pts = av_frame_get_best_effort_timestamp(frame);
+				if (pts != AV_NOPTS_VALUE)
+					at->clock = pts * av_q2d(media->streamA->time_base);
+				at->clock += (double) frame->nb_samples / frame->sample_rate;
+				PlaybackClock_set_audio(&media->clock, at->clock -
+				                        at->queuedSize / at->bytesPerSecond);
 			}
-			else
+		}
+		else
+		{
+			packet->size = 0;
+			packet->data = NULL;
+			drain = false;
+		}
+	}
+}
+/**
+ * @brief Drops the audio decoded and queued before a seek.
+ */
+static void audio_flush(struct Media* const media, struct AudioThread* const at)
+{
+	for (unsigned i = 0; i < media->mixer.nTracks; ++i)
+		avcodec_flush_buffers(media->mixer.tracks[i].cc);
+	AudioMixer_flush(&media->mixer);
+	if (media->sink->type != SINK_SDL) return;
+	SDL_ClearQueuedAudio(media->audioDevice);
+	memstats_add(MEM_AUDIO, -(int64_t) at->queuedSize);
+	at->queuedSize = 0;
+	at->queued = false;
+}
+static int audio_thread(struct Media* const media)
+{
+	stats_thread_register("audio");
+	trace_thread_register("audio");
+	thread_policy_apply(THREAD_ROLE_AUDIO);
+	struct AudioThread at =
+	{
+		.buffer = malloc(AUDIO_BUFFER_SIZE),
+		.bytesPerSecond = media->audioSpec.freq * media->audioSpec.channels * 2.0
+	};
+	memstats_add(MEM_AUDIO, AUDIO_BUFFER_SIZE);
+	while (true)
+	{
+		struct AVPacket packet;
+		uint64_t timeBegin = stats_now();
+		if (PacketQueue_get(&media->queueA, &packet, true, &media->state) < 0)
+		{
+			break;
+		}
+		stats_record_since(STAGE_QUEUE_WAIT, timeBegin);
+		trace_complete("PacketQueue_get", timeBegin);
+		if (packet.stream_index == PACKET_STREAM_FLUSH)
+		{
+			av_packet_unref(&packet);
+			audio_flush(media, &at);
+			continue;
+		}
+		// The empty packet at the end of the stream drains the decoders
+		if (packet.stream_index == PACKET_STREAM_END)
+		{
+			av_packet_unref(&packet);
+			for (unsigned i = 0; i < media->mixer.nTracks; ++i)
 			{
-				packet.size = 0;
-				packet.data = NULL;
+				audio_decode(media, &at, i, NULL);
+				if (AudioMixer_enabled(&media->mixer))
+					AudioMixer_end(&media->mixer, i);
 			}
-
-			if (packet.pts != AV_NOPTS_VALUE)
-				media->clockAudio = av_q2d(media->streamA->time_base) * packet.pts;
+			if (AudioMixer_enabled(&media->mixer))
+				audio_mix(media, &at);
+			atomic_store(&media->drainedA, true);
+			break;
 		}
+		int const track = AudioMixer_track(&media->mixer, packet.stream_index);
+		if (track >= 0)
+			audio_decode(media, &at, track, &packet);
 		av_packet_unref(&packet);
 	}
-	free(buffer);
+	free(at.buffer);
+	memstats_add(MEM_AUDIO, -(int64_t) (AUDIO_BUFFER_SIZE + at.queuedSize));
+	if (at.droppedSize)
+		fprintf(stdout, "Dropped %.2fs of audio behind the live source\n",
+		        at.droppedSize / at.bytesPerSecond);
+	AudioMixer_print(&media->mixer, stdout);
 	fprintf(stdout, "Audio thread complete\n");
+	stats_thread_unregister();
+	trace_thread_unregister();
 	return 0;
 }
+static int subtitle_thread(struct Media* const media)
+{
+	stats_thread_register("subtitle");
+	trace_thread_register("subtitle");
+	thread_policy_apply(THREAD_ROLE_DECODE);
+	struct Subtitles* const subs = &media->subtitles;
+	while (true)
+	{
+		struct AVPacket packet;
+		if (PacketQueue_get(&subs->queue, &packet, true, &media->state) < 0)
+		{
+			break;
+		}
+		if (packet.stream_index == PACKET_STREAM_FLUSH)
+		{
+			Subtitles_flush(subs, (unsigned) packet.pos);
+			av_packet_unref(&packet);
+			avcodec_flush_buffers(subs->cc);
+			continue;
+		}
+		uint64_t const timeBegin = stats_now();
+		bool const end = packet.stream_index == PACKET_STREAM_END;
+		bool const running = end ||
+		                     Subtitles_decode(subs, &packet, &media->state);
+		trace_complete("avcodec_decode_subtitle2", timeBegin);
+		av_packet_unref(&packet);
+		if (end || !running)
+			break;
+	}
+	fprintf(stdout, "Subtitle thread complete\n");
+	stats_thread_unregister();
+	trace_thread_unregister();
+	return 0;
+}
+/**
+ * @brief Queues an empty packet with the stream index PACKET_STREAM_END, on
+ *  which the thread of the stream drains its decoder and completes.
+ */
+static void packet_queue_signal(PacketQueue* const queue, int streamIndex)
+{
+	struct AVPacket packet;
+	av_init_packet(&packet);
+	packet.data = NULL;
+	packet.size = 0;
+	packet.stream_index = streamIndex;
+	PacketQueue_put(queue, &packet);
+}
+/**
+ * @brief Drops the queued packets of a stream for an empty packet with the
+ *  stream index PACKET_STREAM_FLUSH, on which the thread of the stream flushes
+ *  its decoder. The packet carries the seek serial in pos.
+ */
+static void packet_queue_flush(PacketQueue* const queue, unsigned serial)
+{
+	PacketQueue_flush(queue);
+	struct AVPacket packet;
+	av_init_packet(&packet);
+	packet.data = NULL;
+	packet.size = 0;
+	packet.stream_index = PACKET_STREAM_FLUSH;
+	packet.pos = serial;
+	PacketQueue_put(queue, &packet);
+}
+/**
+ * @brief Seeks to the key frame at or before target, in AV_TIME_BASE. The
+ *  packets read before are replaced by a flush packet for each decoder, and
+ *  the pictures decoded before become stale.
+ */
+static void decode_seek(struct Media* const media, int64_t target)
+{
+	uint64_t const timeBegin = stats_now();
+	if (avformat_seek_file(media->formatContext, -1, INT64_MIN, target, target,
+	                       0) < 0)
+	{
+		fprintf(stderr, "[Seek] Unable to seek to %.3fs\n",
+		        target / (double) AV_TIME_BASE - playback_start(media));
+		return;
+	}
+	unsigned const serial = atomic_fetch_add(&media->seekSerial, 1) + 1;
+	if (media->outputV) packet_queue_flush(&media->queueV, serial);
+	if (media->outputA) packet_queue_flush(&media->queueA, serial);
+	if (media->subtitles.stream)
+	{
+		Subtitles_flush_request(&media->subtitles, serial);
+		packet_queue_flush(&media->subtitles.queue, serial);
+	}
+	trace_complete("avformat_seek_file", timeBegin);
+	fprintf(stdout, "[Seek] %.3fs in %.2fms\n",
+	        target / (double) AV_TIME_BASE - playback_start(media),
+	        (stats_now() - timeBegin) / 1e6);
+}
+/**
+ * @brief Position of key frame trick-play in the video stream.
+ */
+struct TrickCursor
+{
+	double next; ///< Second the next key frame is sought at or before
+	int64_t last; ///< Timestamp of the last key frame queued
+};
+/**
+ * @brief Seeks to the key frame of the next step of trick-play at speed and
+ *  queues it for the video thread. Rewinding past the first key frame resumes
+ *  normal playback from the start.
+ * @return false at the end of the input.
+ */
+static bool decode_trick_step(struct Media* const media, int speed,
+                              struct TrickCursor* const cursor)
+{
+	struct AVFormatContext* const formatContext = media->formatContext;
+	double const timeBase = av_q2d(media->streamV->time_base);
+	double const start = playback_start(media);
+	double const step = trick_step(speed);
+	struct AVPacket packet;
+	while (media->state != STATE_QUIT &&
+	       atomic_load(&media->seekTarget) == AV_NOPTS_VALUE)
+	{
+		if (cursor->next < start) cursor->next = start;
+		int64_t const target = (int64_t) (cursor->next / timeBase);
+		uint64_t timeBegin = stats_now();
+		if (avformat_seek_file(formatContext, media->streamIndexV, INT64_MIN,
+		                       target, target, 0) < 0)
+		{
+			fprintf(stderr, "[Trick] Unable to seek to %.3fs\n",
+			        cursor->next - start);
+			return false;
+		}
+		trace_complete("avformat_seek_file", timeBegin);
+		// Forward, key frames up to the last are passed
+		int readResult;
+		int64_t pts = AV_NOPTS_VALUE;
+		while ((readResult = av_read_frame(formatContext, &packet)) >= 0)
+		{
+			if (packet.stream_index == (int) media->streamIndexV &&
+			    (packet.flags & AV_PKT_FLAG_KEY))
+			{
+				pts = packet.pts != AV_NOPTS_VALUE ? packet.pts : packet.dts;
+				if (speed < 0 || cursor->last == AV_NOPTS_VALUE ||
+				    pts > cursor->last)
+					break;
+			}
+			av_packet_unref(&packet);
+			if (media->state == STATE_QUIT) return true;
+		}
+		stats_record_since(STAGE_DEMUX, timeBegin);
+		if (readResult < 0)
+			return false;
+		if (speed < 0 && cursor->last != AV_NOPTS_VALUE && pts >= cursor->last)
+		{
+			av_packet_unref(&packet);
+			if (cursor->next <= start)
+			{
+				// Nothing before this key frame
+				atomic_store(&media->trickSpeed, 0);
+				decode_seek(media, (int64_t) (start * AV_TIME_BASE));
+				fprintf(stdout, "[Trick] Beginning reached\n");
+				return true;
+			}
+			// The same key frame again. Step over it
+			cursor->next = fmin(cursor->next, cursor->last * timeBase) + step;
+			continue;
+		}
+		cursor->last = pts;
+		cursor->next = pts * timeBase + step;
+		PacketQueue_put(&media->queueV, &packet);
+		trace_counter("queueV", media->queueV.nPackets);
+		return true;
+	}
+	return true;
+}
 static int decode_thread(struct Media* const media)
 {
+	stats_thread_register("decode");
+	trace_thread_register("decode");
+	thread_policy_apply(THREAD_ROLE_DECODE);
 	struct AVPacket packet;
+	bool const live = media->liveLatency > 0.0;
+	// Packets beyond the target latency of a live source are dropped
+	double const liveScale = live ? media->liveLatency / LIVE_QUEUE_LATENCY :
+	                         1.0;
+	bool waitKeyV = false; // Video packets are dropped until a key frame
+	unsigned nDropped = 0;
+	struct TrickCursor trickCursor = { NAN, AV_NOPTS_VALUE };
 	while (true)
 	{
 		if (media->state == STATE_QUIT)
 			break;
-		// TODO: Seek
-		if (PacketQueue_size(&media->queueA) > AUDIO_QUEUE_MAX_SIZE ||
-		    PacketQueue_size(&media->queueV) > VIDEO_QUEUE_MAX_SIZE)
+		// The request is cleared once the seek serial changed, so that no
+		// picture is presented in between. A newer request is seeked next
+		int64_t seekTarget = atomic_load(&media->seekTarget);
+		if (seekTarget != AV_NOPTS_VALUE)
+		{
+			decode_seek(media, seekTarget);
+			trickCursor.next = seekTarget / (double) AV_TIME_BASE;
+			trickCursor.last = AV_NOPTS_VALUE;
+			atomic_compare_exchange_strong(&media->seekTarget, &seekTarget,
+			                               AV_NOPTS_VALUE);
+		}
+		// Trick-play from key frame to key frame, a few queued at a time
+		int const trick = atomic_load(&media->trickSpeed);
+		if (trick_keyframes(trick) && media->outputV)
 		{
+			if (media->queueV.nPackets >= TRICK_QUEUE_PACKETS)
+				SDL_Delay(10);
+			else if (!decode_trick_step(media, trick, &trickCursor))
+				break;
+			continue;
+		}
+		double const scale = memstats_queue_scale() * liveScale;
+		// Mixed tracks share the audio queue
+		unsigned const nTracks = media->mixer.nTracks ? media->mixer.nTracks : 1;
+		bool const fullA = PacketQueue_size(&media->queueA) >
+		                   AUDIO_QUEUE_MAX_SIZE * nTracks * scale;
+		bool const fullV = PacketQueue_size(&media->queueV) >
+		                   VIDEO_QUEUE_MAX_SIZE * scale;
+		// A live source is read as it arrives and the packets are dropped instead
+		if ((fullA || fullV) && !live)
+		{
+			uint64_t timeBegin = stats_now();
 			SDL_Delay(10);
+			trace_complete("queue full", timeBegin);
 			continue;
 		}
-		if (av_read_frame(media->formatContext, &packet) < 0)
+		uint64_t timeBegin = stats_now();
+		int readResult = av_read_frame(media->formatContext, &packet);
+		stats_record_since(STAGE_DEMUX, timeBegin);
+		trace_complete("av_read_frame", timeBegin);
+		if (readResult < 0)
 		{
-			break;
-			if (media->formatContext->pb->error == 0)
+			// A live source may have no data yet. Files end here
+			struct AVIOContext const* const pb = media->formatContext->pb;
+			if (readResult == AVERROR(EAGAIN) ||
+			    (live && readResult != AVERROR_EOF && (!pb || pb->error == 0)))
 			{
-				SDL_Delay(100);
+				SDL_Delay(live ? 1 : 100);
 				continue;
 			}
 			else
-				break; // Error
-
+				break; // End of file or error
 		}
 		// Stream switch
+		timeBegin = stats_now();
 		if (packet.stream_index == (int) media->streamIndexV)
 		{
-			if (media->screen)
+			if (live)
+			{
+				atomic_store(&media->liveHeadV, packet.dts != AV_NOPTS_VALUE ?
+				             packet.dts : packet.pts);
+				waitKeyV = fullV || (waitKeyV && !(packet.flags & AV_PKT_FLAG_KEY));
+			}
+			if (waitKeyV)
+			{
+				av_packet_unref(&packet);
+				++nDropped;
+			}
+			else if (media->outputV)
+			{
 				PacketQueue_put(&media->queueV, &packet);
+				trace_complete("PacketQueue_put", timeBegin);
+				trace_counter("queueV", media->queueV.nPackets);
+			}
 			else
 				av_packet_unref(&packet);
 		}
-		else if (packet.stream_index == (int) media->streamIndexA)
+		else if (AudioMixer_track(&media->mixer, packet.stream_index) >= 0)
 		{
-			if (media->audioDevice)
+			if (trick_enabled(trick)) // Muted
+				av_packet_unref(&packet);
+			else if (fullA) // Live only
+			{
+				av_packet_unref(&packet);
+				++nDropped;
+			}
+			else if (media->outputA)
+			{
 				PacketQueue_put(&media->queueA, &packet);
+				trace_complete("PacketQueue_put", timeBegin);
+				trace_counter("queueA", media->queueA.nPackets);
+			}
 			else
 				av_packet_unref(&packet);
 		}
+		else if (packet.stream_index == (int) media->subtitles.streamIndex &&
+		         !trick_enabled(trick))
+		{
+			PacketQueue_put(&media->subtitles.queue, &packet);
+			trace_counter("queueS", media->subtitles.queue.nPackets);
+		}
 		else
 			av_packet_unref(&packet);
 	}
-	while (media->state != STATE_QUIT)
-		SDL_Delay(100);
-
+	atomic_store(&media->demuxEnded, true);
+	if (media->state != STATE_QUIT)
+	{
+		if (media->outputV)
+			packet_queue_signal(&media->queueV, PACKET_STREAM_END);
+		if (media->outputA)
+			packet_queue_signal(&media->queueA, PACKET_STREAM_END);
+		if (media->subtitles.stream)
+			packet_queue_signal(&media->subtitles.queue, PACKET_STREAM_END);
+	}
+	// The window stays open until closed. Other sinks complete once written
+	if (media->sink->type == SINK_SDL)
+		while (media->state != STATE_QUIT)
+			SDL_Delay(100);
+	else
+		while (media->state != STATE_QUIT &&
+		       ((media->outputV && !atomic_load(&media->drainedV)) ||
+		        (media->outputA && !atomic_load(&media->drainedA))))
+			SDL_Delay(10);
 
 	SDL_Event event;
 	event.type = CHAL_EVENT_QUIT;
 	event.user.data1 = media;
 	SDL_PushEvent(&event);
+	if (nDropped)
+		fprintf(stdout, "Dropped %u packets behind the live source\n", nDropped);
 	fprintf(stdout, "Decoding complete\n");
+	stats_thread_unregister();
+	trace_thread_unregister();
 
 	return 0;
 }
-void play_file(char const* const fileName)
+/**
+ * @brief Decodes in the background the frames behind the cursor that the
+ *  frame cache lacks, up to FRAME_CACHE_BEHIND.
+ */
+static void playback_prefetch(struct Media* const media)
 {
-	struct Media media;
-	Media_init(&media);
-	strncpy(media.fileName, fileName, sizeof(media.fileName));
-	media.formatContext = av_open_file(fileName);
-	if (!media.formatContext)
+	if (!FrameCache_enabled(&media->frameCache) ||
+	    media->cursor == AV_NOPTS_VALUE)
+		return;
+	int64_t const behind = FRAME_CACHE_BEHIND /
+	                       av_q2d(media->streamV->time_base);
+	int64_t const begin = FrameCache_run_begin(&media->frameCache,
+	                                           media->cursor);
+	if (begin == AV_NOPTS_VALUE)
+		GopDecoder_submit(&media->gopDecoder, media->cursor);
+	else if (media->cursor - begin < behind)
+		GopDecoder_submit(&media->gopDecoder, begin - 1);
+}
+static void playback_pause(struct Media* const media, bool pause)
+{
+	if (media->state == STATE_QUIT ||
+	    (media->state == STATE_PAUSE) == pause)
+		return;
+	media->state = pause ? STATE_PAUSE : STATE_NORMAL;
+	if (media->audioDevice)
+		SDL_PauseAudioDevice(media->audioDevice, pause);
+	PlaybackClock_pause(&media->clock, pause);
+	if (pause)
+		playback_prefetch(media);
+	else
+	{
+		// The pause is neither a delay nor a repeat
+		media->timer = clock_monotonic();
+		media->lastPresentTime = 0.0;
+	}
+	fprintf(stdout, pause ? "Paused\n" : "Resumed\n");
+}
+/**
+ * @brief Pauses and presents the frame after (direction > 0) or before
+ *  (direction < 0) the presented one. Frames are taken from the frame cache,
+ *  and on a miss the group of pictures of the frame is decoded first.
+ */
+static void playback_step(struct Media* const media, int direction)
+{
+	if (!media->screen || !FrameCache_enabled(&media->frameCache) ||
+	    media->cursor == AV_NOPTS_VALUE)
+		return;
+	playback_pause(media, true);
+
+	uint64_t const timeBegin = stats_now();
+	int64_t pts = AV_NOPTS_VALUE;
+	struct AVFrame* frame = FrameCache_step(&media->frameCache, media->cursor,
+	                                        direction, &pts);
+	bool const hit = frame;
+	if (!frame)
+	{
+		GopDecoder_wait(&media->gopDecoder);
+		GopDecoder_submit(&media->gopDecoder, media->cursor + direction);
+		GopDecoder_wait(&media->gopDecoder);
+		frame = FrameCache_step(&media->frameCache, media->cursor, direction,
+		                        &pts);
+	}
+	if (!frame)
+	{
+		fprintf(stdout, "[Step] No frame %s %.3fs\n", direction > 0 ? "after" :
+		        "before", media->cursor * av_q2d(media->streamV->time_base));
+		return;
+	}
+	bool const presented = Media_present_frame(media, frame);
+	av_frame_free(&frame);
+	if (!presented) return;
+	media->cursor = pts;
+	fprintf(stdout, "[Step] %.3fs from %s in %.2fms\n",
+	        pts * av_q2d(media->streamV->time_base), hit ? "cache" : "decoder",
+	        (stats_now() - timeBegin) / 1e6);
+
+	// Queued pictures up to the cursor were presented by the steps
+	while (media->pictQueueSize > 0 &&
+	       media->pictQueue[media->pictQueueIndexR].pts <= media->cursor)
+	{
+		av_frame_unref(media->pictQueue[media->pictQueueIndexR].frame);
+		if (media->pictUploaded == media->pictQueueIndexR)
+			media->pictUploaded = -1;
+		video_queue_pop(media);
+	}
+	playback_prefetch(media);
+}
+/**
+ * @brief Halves (direction < 0) or doubles the playback speed, unless the
+ *  audio clock is the master.
+ */
+static void playback_speed(struct Media* const media, int direction)
+{
+	double const speed = direction < 0 ? media->clock.speed / 2 :
+	                     media->clock.speed * 2;
+	if (PlaybackClock_set_speed(&media->clock, speed))
+		fprintf(stdout, "Speed %.2f\n", speed);
+	else if (media->clock.master == CLOCK_SOURCE_AUDIO)
+		fprintf(stdout, "The speed of the audio clock cannot change\n");
+}
+/**
+ * @brief Requests the decode thread to seek to seconds from the start, or
+ *  from the position if relative. The clocks are set again by the frames
+ *  after the seek.
+ * @return Reason the seek is refused. NULL if requested.
+ */
+static char const* playback_seek(struct Media* const media, double seconds,
+                                 bool relative)
+{
+	if (media->state == STATE_QUIT) return "The playback is stopping";
+	if (media->liveLatency > 0.0) return "Live sources cannot seek";
+	if (atomic_load(&media->demuxEnded)) return "The whole input was read";
+	if (relative)
+	{
+		double const position = playback_position(media);
+		if (isnan(position)) return "The position is unknown";
+		seconds += position;
+	}
+	if (seconds < 0.0) seconds = 0.0;
+	int64_t const duration = media->formatContext->duration;
+	if (duration != AV_NOPTS_VALUE && seconds * AV_TIME_BASE >= duration)
+		return "Beyond the end";
+
+	atomic_store(&media->seekTarget,
+	             (int64_t) ((playback_start(media) + seconds) * AV_TIME_BASE));
+	PlaybackClock_reset(&media->clock);
+	media->timer = clock_monotonic();
+	media->lastPresentTime = 0.0;
+	media->lastFrameTimestamp = NAN;
+	return NULL;
+}
+/**
+ * @brief Switches to trick-play at speed, or back to normal playback with 0,
+ *  from the position by seeking there.
+ * @return Reason the speed is refused. NULL if set.
+ */
+static char const* playback_trick(struct Media* const media, int speed)
+{
+	if (speed == 1) speed = 0;
+	if (!trick_speed_valid(speed)) return "Unsupported trick-play speed";
+	if (!media->streamV || !media->screen)
+		return "Trick-play requires video in the window";
+	if (speed == atomic_load(&media->trickSpeed)) return NULL;
+	char const* const error = playback_seek(media, 0.0, true);
+	if (error) return error;
+	atomic_store(&media->trickSpeed, speed);
+	playback_pause(media, false);
+	if (speed)
+		fprintf(stdout, "[Trick] %+dx\n", speed);
+	else
+		fprintf(stdout, "[Trick] Off\n");
+	return NULL;
+}
+/**
+ * @brief Executes the command of a control client on the playback and
+ *  publishes the result.
+ */
+static void playback_control(struct Media* const media,
+                             struct ControlRequest* const request)
+{
+	char const* error = NULL;
+	switch (request->command)
+	{
+	case CONTROL_PAUSE:
+	case CONTROL_RESUME:
+		if (media->state == STATE_QUIT)
+			error = "The playback is stopping";
+		else
+			playback_pause(media, request->command == CONTROL_PAUSE);
+		break;
+	case CONTROL_SEEK:
+		error = playback_seek(media, request->seconds, request->relative);
+		break;
+	case CONTROL_TRICK:
+		error = playback_trick(media, request->speed);
+		break;
+	case CONTROL_PLAY:
+		snprintf(playbackRequested, sizeof(playbackRequested), "%s",
+		         request->argument);
+		push_quit_event(0, media);
+		break;
+	case CONTROL_STOP:
+	case CONTROL_QUIT:
+		push_quit_event(0, media);
+		break;
+	default:
+		error = "Unsupported command";
+		break;
+	}
+	ControlRequest_reply(request, error);
+	playback_publish(media, true);
+}
+/**
+ * @brief Space pauses and resumes. Right and period step forward, left and
+ *  comma step backward. S shows or hides the subtitles. [ and ] halve and
+ *  double the speed. F and R fast-forward and rewind faster, or the opposite
+ *  slower, down to normal playback.
+ */
+static void playback_key(struct Media* const media, SDL_Keycode key)
+{
+	switch (key)
+	{
+	case SDLK_SPACE:
+		playback_pause(media, media->state != STATE_PAUSE);
+		break;
+	case SDLK_RIGHT:
+	case SDLK_PERIOD:
+		playback_step(media, 1);
+		break;
+	case SDLK_LEFT:
+	case SDLK_COMMA:
+		playback_step(media, -1);
+		break;
+	case SDLK_s:
+		if (!media->subtitles.stream) break;
+		media->subtitles.visible = !media->subtitles.visible;
+		fprintf(stdout, "Subtitles %s\n", media->subtitles.visible ? "shown" :
+		        "hidden");
+		break;
+	case SDLK_LEFTBRACKET:
+		playback_speed(media, -1);
+		break;
+	case SDLK_RIGHTBRACKET:
+		playback_speed(media, 1);
+		break;
+	case SDLK_f:
+	case SDLK_r:
+	{
+		int const speed = trick_speed_next(atomic_load(&media->trickSpeed),
+		                                   key == SDLK_f ? 1 : -1);
+		char const* const error = playback_trick(media, speed);
+		if (error) fprintf(stdout, "[Trick] %s\n", error);
+		break;
+	}
+	default:
+		break;
+	}
+}
+struct AVFormatContext* playback_open(char const* const fileName,
+                                      struct PlaybackOptions const* options)
+{
+	if (options && options->latency > 0.0)
+		return av_open_live(fileName);
+	return av_open_file(fileName);
+}
+void play_file(char const* const fileName,
+               struct PlaybackOptions const* options)
+{
+	struct AVFormatContext* formatContext = playback_open(fileName, options);
+	if (!formatContext)
 	{
 		return;
 	}
+	play_format(formatContext, fileName, options);
+}
+
+struct PlaylistProbe
+{
+	char const* fileName;
+	struct PlaybackOptions const* options;
+	struct AVFormatContext* formatContext; ///< NULL if the file cannot be opened
+	struct TaskGroup group;
+};
+static void PlaylistProbe_run(void* data)
+{
+	struct PlaylistProbe* const probe = data;
+	probe->formatContext = playback_open(probe->fileName, probe->options);
+}
+static void PlaylistProbe_submit(struct PlaylistProbe* const probe,
+                                 char const* fileName,
+                                 struct PlaybackOptions const* options)
+{
+	probe->fileName = fileName;
+	probe->options = options;
+	probe->formatContext = NULL;
+	TaskGroup_init(&probe->group);
+	scheduler_submit(&probe->group, PlaylistProbe_run, probe);
+}
+/**
+ * @brief Plays the files requested by control clients during the playback
+ *  that just stopped.
+ */
+static void play_requested(struct PlaybackOptions const* options)
+{
+	char fileName[sizeof(playbackRequested)];
+	while (playbackRequested[0] && !control_quit())
+	{
+		strcpy(fileName, playbackRequested);
+		playbackRequested[0] = '\0';
+		play_file(fileName, options);
+	}
+}
+void play_playlist(VectorPtr const* const fileNames,
+                   struct PlaybackOptions const* options)
+{
+	size_t const n = VectorPtr_size(fileNames);
+	if (n == 0) return;
+
+	// The next file is opened and probed while the current one plays. A live
+	// source is opened once played, since its packets would age meanwhile
+	bool const probeNext = !options || options->latency <= 0.0;
+	struct PlaylistProbe probes[2];
+	PlaylistProbe_submit(&probes[0], VectorPtr_at(fileNames, 0), options);
+	for (size_t i = 0; i < n; ++i)
+	{
+		struct PlaylistProbe* const probe = &probes[i % 2];
+		if (i > 0 && !probeNext)
+			PlaylistProbe_submit(probe, VectorPtr_at(fileNames, i), options);
+		TaskGroup_wait(&probe->group);
+		if (i + 1 < n && probeNext)
+			PlaylistProbe_submit(&probes[(i + 1) % 2],
+			                     VectorPtr_at(fileNames, i + 1), options);
+		if (probe->formatContext)
+			play_format(probe->formatContext, probe->fileName, options);
+		play_requested(options);
+		if (control_quit())
+		{
+			if (i + 1 < n && probeNext)
+			{
+				struct PlaylistProbe* const next = &probes[(i + 1) % 2];
+				TaskGroup_wait(&next->group);
+				avformat_close_input(&next->formatContext);
+			}
+			break;
+		}
+	}
+}
+void play_serve(struct PlaybackOptions const* options)
+{
+	bool const receiver = control_receiver();
+	control_set_receiver(true);
+	fprintf(stdout, "Waiting for control commands\n");
+	fflush(stdout);
+	while (!control_quit())
+	{
+		SDL_Event event;
+		if (!SDL_WaitEvent(&event) || event.type == SDL_QUIT)
+			break;
+		if (event.type != CHAL_EVENT_CONTROL)
+			continue;
+		struct ControlRequest* const request = control_event_request(&event);
+		if (!request)
+			continue;
+		switch (request->command)
+		{
+		case CONTROL_PLAY:
+			snprintf(playbackRequested, sizeof(playbackRequested), "%s",
+			         request->argument);
+			ControlRequest_reply(request, NULL);
+			break;
+		case CONTROL_QUIT:
+			ControlRequest_reply(request, NULL);
+			break;
+		default:
+			ControlRequest_reply(request, "Nothing is playing");
+			break;
+		}
+		play_requested(options);
+	}
+	control_set_receiver(receiver);
+	if (!receiver)
+		control_reject_pending("Nothing is playing");
+}
+void play_format(struct AVFormatContext* formatContext, char const* name,
+                 struct PlaybackOptions const* options)
+{
+	uint64_t timeBegin = stats_now();
+	bool const receiver = control_receiver();
+	struct Media media;
+	Media_init(&media);
+	strncpy(media.fileName, name, sizeof(media.fileName) - 1);
+	// Output of this playback only unless one is supplied
+	struct Output outputLocal;
+	Output_init(&outputLocal);
+	media.output = options && options->output ? options->output : &outputLocal;
+	media.formatContext = formatContext;
 	av_dump_format(media.formatContext, 0, media.fileName, 0);
+	struct Sink sink;
+	media.sink = &sink;
+	bool const sinkReady = Sink_init(&sink, options ? options->sink : NULL,
+	                                 &media.state);
+
+	// Events left over from a previous playback
+	SDL_FlushEvent(CHAL_EVENT_REFRESH);
+	SDL_FlushEvent(CHAL_EVENT_QUIT);
+	SDL_TimerID timerDuration = 0;
 
 	// Find Audio and Video streams
 
-	// Converts av_gettime()'s microsecond to second
 	media.state = STATE_NORMAL;
-	media.timer = (double)av_gettime() / 1000000.0;
+	media.timer = clock_monotonic();
 	media.lastFrameDelay = 40e-3;
+	Governor_init(&media.governor, !(options && options->fullQuality));
+	// Frames of a filter graph or a live source cannot be decoded again, nor
+	// those of a custom AVIOContext since the GOP decoder opens the file name
+	int64_t cacheBudget = options && options->frameCache ? options->frameCache :
+	                      FRAME_CACHE_BUDGET_DEFAULT;
+	if ((options && ((options->filter && options->filter[0]) ||
+	                 options->latency > 0.0)) || sink.type != SINK_SDL ||
+	    (formatContext->flags & AVFMT_FLAG_CUSTOM_IO))
+		cacheBudget = 0;
+	FrameCache_init(&media.frameCache, cacheBudget);
+	if (options && options->latency > 0.0)
+	{
+		media.liveLatency = options->latency;
+		fprintf(stdout, "Live source, target latency %.0fms\n",
+		        media.liveLatency * 1000);
+	}
 
-	if (!Media_open_best_streams(&media))
+	if (!AudioMixer_init(&media.mixer, options ? options->audioTracks : NULL,
+	                     options ? options->downmix : NULL))
+	{
+		fprintf(stderr, "Playing the first audio track\n");
+		AudioMixer_init(&media.mixer, NULL, NULL);
+	}
+	if (!sinkReady || !Media_open_best_streams(&media))
 	{
 		goto complete;
 	}
-	if (media.streamA)
+	if (media.streamA && Sink_audio(&sink))
+		media.outputA = sink.type == SINK_SDL ? audio_load_SDL(&media) :
+		                audio_load_sink(&media);
+	// Before the audio thread sets the audio clock
+	PlaybackClock_init(&media.clock, options && options->clock ?
+	                   clock_source_parse(options->clock) : CLOCK_SOURCE_COUNT,
+	                   sink.type == SINK_SDL && media.outputA,
+	                   media.streamV && Sink_video(&sink));
+	if (media.streamA && Sink_audio(&sink))
 	{
-		audio_load_SDL(&media);
 		media.threadAudio = SDL_CreateThread((SDL_ThreadFunction) audio_thread,
 		                                      "audio", &media);
 	}
-	if (media.streamV)
+	if (media.streamV && Sink_video(&sink))
 	{
 		media.outWidth = media.ccV->width;
 		media.outHeight = media.ccV->height;
-		media.swsContext = sws_getContext(media.ccV->width, media.ccV->height,
-		                                   media.ccV->pix_fmt,
-		                                   media.outWidth, media.outHeight,
-		                                   AV_PIX_FMT_YUV420P, SWS_BILINEAR,
-		                                   NULL, NULL, NULL);
-		media.screen = SDL_CreateWindow(media.fileName, SDL_WINDOWPOS_UNDEFINED,
-		                                 SDL_WINDOWPOS_UNDEFINED,
-		                                 media.outWidth, media.outHeight,
-		                                 SDL_WINDOW_RESIZABLE);
-		if (!media.screen)
-		{
-			fprintf(stderr, "[SDL] %s\n", SDL_GetError());
-			goto start;
+		media.outFormat = media.ccV->pix_fmt;
+		if (options && options->filter && options->filter[0])
+		{
+			if (VideoFilter_init(&media.filter, options->filter, media.ccV,
+			                     media.streamV->time_base))
+			{
+				media.outWidth = VideoFilter_width(&media.filter);
+				media.outHeight = VideoFilter_height(&media.filter);
+				media.outFormat = VideoFilter_format(&media.filter);
+			}
+			else
+				fprintf(stderr, "Playing without filter\n");
+		}
+		if (sink.type != SINK_SDL)
+		{
+			media.pictFormat = SINK_PICTURE_FORMAT;
+			if (!Sink_open_video(&sink, media.outWidth, media.outHeight,
+			                     av_guess_frame_rate(media.formatContext,
+			                                         media.streamV, NULL),
+			                     media.streamV->sample_aspect_ratio,
+			                     media.streamV->codecpar->chroma_location))
+				goto start;
+		}
+		else
+		{
+			if (!Output_open_video(media.output, media.fileName,
+			                       media.outWidth, media.outHeight))
+				goto start;
+			media.screen = media.output->window;
+			media.renderer = media.output->renderer;
+			if (!Media_pictQueue_init(&media))
+			{
+				media.screen = NULL;
+				goto start;
+			}
 		}
-		media.renderer = SDL_CreateRenderer(media.screen, -1, 0);
-		if (!media.renderer)
+		// Output has the dimension of the input
+		if (media.outFormat != media.pictFormat &&
+		    !SlicedScale_init(&media.scale, media.outWidth, media.outHeight,
+		                      media.outFormat, media.pictFormat,
+		                      SWS_BILINEAR, 0))
 		{
-			fprintf(stderr, "[SDL] %s\n", SDL_GetError());
+			fprintf(stderr, "Unable to convert the video pixel format\n");
 			media.screen = NULL;
 			goto start;
 		}
-		Media_pictQueue_init(&media);
+		// Subtitles are only composited over the window
+		if (media.screen &&
+		    Subtitles_open(&media.subtitles, media.formatContext,
+		                   media.ccV->width, media.ccV->height,
+		                   media.liveLatency > 0.0))
+			media.threadSubtitle = SDL_CreateThread(
+				(SDL_ThreadFunction) subtitle_thread, "subtitle", &media);
+		GopDecoder_init(&media.gopDecoder, &media.frameCache, media.fileName,
+		                media.streamIndexV);
+		media.outputV = true;
 		media.threadVideo = SDL_CreateThread((SDL_ThreadFunction) video_thread,
 		                                      "video", &media);
 	}
 start:
+	stats_record_since(STAGE_OPEN, timeBegin);
+	++nPlaybacks;
+	playback_publish(&media, true);
 
 	media.threadParse = SDL_CreateThread((SDL_ThreadFunction) decode_thread,
 	                                      "decode", &media);
 
 	schedule_refresh(&media, 40);
+	if (options && options->duration > 0.0)
+		timerDuration = SDL_AddTimer((uint32_t) (options->duration * 1000),
+		                             push_quit_event, &media);
 
 	printf("\n");
 	fflush(stdout);
+	control_set_receiver(true);
 	while (true)
 	{
 		SDL_Event event;
@@ -318,16 +1638,62 @@ start:
 		case CHAL_EVENT_REFRESH:
 			video_refresh_timer(event.user.data1);
 			break;
+		case SDL_KEYDOWN:
+			playback_key(&media, event.key.keysym.sym);
+			break;
+		case CHAL_EVENT_CONTROL:
+		{
+			struct ControlRequest* const request = control_event_request(&event);
+			if (request) playback_control(&media, request);
+			break;
+		}
 		default:
 			break;
 		}
 	}
 
 complete:
+	control_set_receiver(receiver);
+	if (!receiver)
+		control_reject_pending("Nothing is playing");
+	// All threads must finish before media goes out of scope
+	Media_quit(&media);
+	SDL_WaitThread(media.threadParse, NULL);
+	SDL_WaitThread(media.threadVideo, NULL);
+	SDL_WaitThread(media.threadAudio, NULL);
+	SDL_WaitThread(media.threadSubtitle, NULL);
+	SDL_RemoveTimer(media.refreshTimer);
+	SDL_RemoveTimer(timerDuration);
+	SDL_FlushEvent(CHAL_EVENT_REFRESH);
+	SDL_FlushEvent(CHAL_EVENT_QUIT);
+
+	// Pictures left in the queue are never presented
+	for (int i = 0; i < media.pictQueueSize; ++i)
+		SyncStats_drop(&media.sync);
+	fprintf(stdout, "\nA/V sync:\n");
+	SyncStats_print(&media.sync, stdout);
+	PlaybackClock_print(&media.clock, stdout);
+	SyncStats_reset(&syncLast);
+	SyncStats_merge(&syncLast, &media.sync);
+	playback_publish(&media, false);
+	if (media.streamV)
+	{
+		Governor_print(&media.governor, stdout);
+		FrameCache_print(&media.frameCache, stdout);
+		Subtitles_print(&media.subtitles, stdout);
+	}
+	governorLast = media.governor;
+	if (sinkReady)
+	{
+		Sink_print(&sink, stdout);
+		Sink_destroy(&sink);
+	}
+
 	if (media.streamV) Media_pictQueue_destroy(&media);
-	SDL_DestroyRenderer(media.renderer);
-	SDL_DestroyWindow(media.screen);
+	Subtitles_clear(&media.subtitles);
 	audio_unload_SDL(&media);
+	Output_release(media.output);
+	Output_destroy(&outputLocal);
 
 	Media_close(&media);
 	avformat_close_input(&media.formatContext);
@@ -2,7 +2,131 @@
 #define CHALCOCITE__PLAYBACK_H_
 
 #include "media.h"
+#include "output.h"
+#include "container/vectorptr.h"
 
-void play_file(char const* const fileName);
+struct PlaybackOptions
+{
+	double duration; ///< Stops after this many seconds if positive
+	/**
+	 * Window and audio device kept across playbacks. If NULL, they are opened
+	 * and closed by each playback.
+	 */
+	struct Output* output;
+	/**
+	 * libavfilter graph applied to the video, as for ffmpeg -vf. Unused if NULL
+	 *  or empty.
+	 */
+	char const* filter;
+	/**
+	 * Target latency in second of live sources such as pipes and sockets. 0 if
+	 *  the inputs are files.
+	 */
+	double latency;
+	bool fullQuality; ///< Disables the decode quality governor
+	/**
+	 * Bytes of decoded frames kept for frame stepping. 0 for
+	 *  FRAME_CACHE_BUDGET_DEFAULT, negative to disable the frame cache.
+	 */
+	int64_t frameCache;
+	/**
+	 * Destination of the pictures and audio as parsed by Sink_init. The window
+	 *  and audio device if NULL.
+	 */
+	char const* sink;
+	/**
+	 * Audio tracks to mix with their gain, as parsed by mixer_parse_tracks. The
+	 *  first audio track if NULL or empty.
+	 */
+	char const* audioTracks;
+	/**
+	 * Mix layout and matrix as parsed by mixer_parse_downmix. That of the first
+	 *  track if NULL or empty.
+	 */
+	char const* downmix;
+	/**
+	 * Master clock as parsed by clock_source_parse. Chosen from the streams if
+	 *  NULL: audio if played by the device, the external clock otherwise.
+	 */
+	char const* clock;
+};
+
+/**
+ * @brief State of the current playback, published by the main thread and
+ *  read from any thread without blocking it.
+ */
+struct PlaybackSnapshot
+{
+	bool playing;
+	bool paused;
+	bool live;
+	char fileName[1024];
+	/// Second of the master clock, or of the picture in trick-play, from the
+	/// start. NAN if none
+	double position;
+	double duration; ///< Second. NAN if unknown
+	enum ClockSource master;
+	double speed;
+	int trickSpeed; ///< 0 if off
+	enum GovernorLevel level;
+	uint64_t framesPresented, framesLate, framesDropped, framesRepeated;
+	uint64_t audioUnderruns;
+	// 99th percentiles of the video ahead of and behind the master clock, and
+	// of the presentation after its deadline, in second
+	double aheadP99, behindP99, latenessP99;
+	uint64_t nPlaybacks; ///< Started since the process started
+};
+
+/**
+ * @brief Opens a file, or a live source if options->latency is positive.
+ * @param[in] options May be NULL
+ * @return NULL if failed.
+ */
+struct AVFormatContext* playback_open(char const* const fileName,
+                                      struct PlaybackOptions const* options);
+/**
+ * @param[in] options May be NULL
+ */
+void play_file(char const* const fileName,
+               struct PlaybackOptions const* options);
+/**
+ * @brief Plays the files one after another.
+ * @param[in] fileNames Elements are char const*
+ * @param[in] options May be NULL
+ */
+void play_playlist(VectorPtr const* const fileNames,
+                   struct PlaybackOptions const* options);
+/**
+ * @brief Plays an opened format context, for example one reading from a custom
+ *  AVIOContext. The format context is closed upon return. Frame stepping
+ *  reopens name, so it is disabled with a custom AVIOContext.
+ * @param[in] name Shown as window title
+ * @param[in] options May be NULL
+ */
+void play_format(struct AVFormatContext* formatContext, char const* name,
+                 struct PlaybackOptions const* options);
+/**
+ * @brief Waits for CONTROL_PLAY commands of control clients and plays the
+ *  requested files, until a client sends quit or SDL_QUIT is received.
+ * @param[in] options May be NULL
+ */
+void play_serve(struct PlaybackOptions const* options);
+/**
+ * @brief Copies the latest published state of the playback. A copy torn by a
+ *  concurrent update is retried, so the publisher never waits.
+ */
+void playback_snapshot(struct PlaybackSnapshot* const);
+/**
+ * @brief A/V synchronisation statistics of the most recent play_file call.
+ */
+struct SyncStats const* playback_last_sync(void);
+/**
+ * @brief Clears the counters and distributions of playback_last_sync().
+ */
+void playback_last_sync_reset(void);
+/**
+ * @brief Decode quality governor of the most recent play_file call.
+ */
+struct Governor const* playback_last_governor(void);
 
 #endif // !CHALCOCITE__PLAYBACK_H_
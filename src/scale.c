@@ -0,0 +1,135 @@
+#include "scale.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include <libavutil/pixdesc.h>
+
+#include "scheduler.h"
+
+struct ScaleSlice
+{
+	struct SlicedScale* scale;
+	unsigned index;
+	uint8_t const* const* src;
+	int const* srcStride;
+	uint8_t* const* dst;
+	int const* dstStride;
+};
+
+// Palettes and hardware surfaces cannot be addressed by rows
+static bool format_sliceable(enum AVPixelFormat format)
+{
+	AVPixFmtDescriptor const* const desc = av_pix_fmt_desc_get(format);
+	return desc && !(desc->flags & (AV_PIX_FMT_FLAG_PAL |
+	                                AV_PIX_FMT_FLAG_HWACCEL |
+	                                AV_PIX_FMT_FLAG_BITSTREAM));
+}
+/**
+ * @brief Byte offsets of row y in each plane. Planes holding no component,
+ *  such as pseudo-palettes, are not offset.
+ */
+static void plane_offsets(enum AVPixelFormat format, int y,
+                          int const stride[], ptrdiff_t offsets[4])
+{
+	AVPixFmtDescriptor const* const desc = av_pix_fmt_desc_get(format);
+	memset(offsets, 0, 4 * sizeof(ptrdiff_t));
+	for (int c = 0; c < desc->nb_components; ++c)
+	{
+		int const plane = desc->comp[c].plane;
+		int const shift = (c == 1 || c == 2) ? desc->log2_chroma_h : 0;
+		offsets[plane] = (ptrdiff_t) (y >> shift) * stride[plane];
+	}
+}
+
+bool SlicedScale_init(struct SlicedScale* const ss, int width, int height,
+                      enum AVPixelFormat formatSrc,
+                      enum AVPixelFormat formatDst, int flags,
+                      unsigned nSlices)
+{
+	memset(ss, 0, sizeof(struct SlicedScale));
+	ss->formatSrc = formatSrc;
+	ss->formatDst = formatDst;
+
+	if (nSlices == 0) nSlices = scheduler_workers();
+	if (nSlices > (unsigned) height / SCALE_MIN_SLICE_HEIGHT)
+		nSlices = height / SCALE_MIN_SLICE_HEIGHT;
+	if (nSlices > SCALE_MAX_SLICES) nSlices = SCALE_MAX_SLICES;
+	if (nSlices == 0 || !format_sliceable(formatSrc) ||
+	    !format_sliceable(formatDst))
+		nSlices = 1;
+
+	for (unsigned i = 0; i < nSlices; ++i)
+		ss->sliceY[i] = (int) ((int64_t) height * i / nSlices) /
+		                SCALE_SLICE_ALIGN * SCALE_SLICE_ALIGN;
+	ss->sliceY[nSlices] = height;
+	ss->nSlices = nSlices;
+
+	for (unsigned i = 0; i < nSlices; ++i)
+	{
+		int const sliceHeight = ss->sliceY[i + 1] - ss->sliceY[i];
+		ss->contexts[i] = sws_getContext(width, sliceHeight, formatSrc,
+		                                 width, sliceHeight, formatDst,
+		                                 flags, NULL, NULL, NULL);
+		if (!ss->contexts[i])
+		{
+			SlicedScale_destroy(ss);
+			return false;
+		}
+	}
+	return true;
+}
+void SlicedScale_destroy(struct SlicedScale* const ss)
+{
+	for (unsigned i = 0; i < SCALE_MAX_SLICES; ++i)
+	{
+		sws_freeContext(ss->contexts[i]);
+		ss->contexts[i] = NULL;
+	}
+	ss->nSlices = 0;
+}
+
+static void ScaleSlice_run(void* data)
+{
+	struct ScaleSlice const* const slice = data;
+	struct SlicedScale const* const ss = slice->scale;
+	int const y = ss->sliceY[slice->index];
+
+	ptrdiff_t offsetsSrc[4], offsetsDst[4];
+	plane_offsets(ss->formatSrc, y, slice->srcStride, offsetsSrc);
+	plane_offsets(ss->formatDst, y, slice->dstStride, offsetsDst);
+	uint8_t const* src[4];
+	uint8_t* dst[4];
+	for (int i = 0; i < 4; ++i)
+	{
+		src[i] = slice->src[i] ? slice->src[i] + offsetsSrc[i] : NULL;
+		dst[i] = slice->dst[i] ? slice->dst[i] + offsetsDst[i] : NULL;
+	}
+	sws_scale(ss->contexts[slice->index], src, slice->srcStride,
+	          0, ss->sliceY[slice->index + 1] - y, dst, slice->dstStride);
+}
+void SlicedScale_scale(struct SlicedScale* const ss,
+                       uint8_t const* const src[], int const srcStride[],
+                       uint8_t* const dst[], int const dstStride[])
+{
+	if (ss->nSlices == 1)
+	{
+		sws_scale(ss->contexts[0], src, srcStride, 0, ss->sliceY[1],
+		          dst, dstStride);
+		return;
+	}
+	struct ScaleSlice slices[SCALE_MAX_SLICES];
+	struct TaskGroup group;
+	TaskGroup_init(&group);
+	for (unsigned i = 0; i < ss->nSlices; ++i)
+	{
+		slices[i] = (struct ScaleSlice)
+		{
+			.scale = ss, .index = i,
+			.src = src, .srcStride = srcStride,
+			.dst = dst, .dstStride = dstStride
+		};
+		scheduler_submit(&group, ScaleSlice_run, &slices[i]);
+	}
+	TaskGroup_wait(&group);
+}
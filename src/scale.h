@@ -0,0 +1,48 @@
+#ifndef CHALCOCITE__SCALE_H_
+#define CHALCOCITE__SCALE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <libswscale/swscale.h>
+
+#define SCALE_MAX_SLICES 16
+#define SCALE_MIN_SLICE_HEIGHT 64 // Rows
+#define SCALE_SLICE_ALIGN 16 // Keeps slices aligned with chroma rows
+
+/**
+ * Must be initialised with \ref SlicedScale_init and destroyed with
+ *  \ref SlicedScale_destroy. A zeroed SlicedScale may be destroyed.
+ * @brief Pixel format conversion split into horizontal bands, each with its
+ *  own SwsContext, which are converted in parallel on the scheduler. The
+ *  source and destination have the same dimensions.
+ */
+struct SlicedScale
+{
+	struct SwsContext* contexts[SCALE_MAX_SLICES];
+	int sliceY[SCALE_MAX_SLICES + 1]; ///< First row of each slice
+	unsigned nSlices;
+	enum AVPixelFormat formatSrc, formatDst;
+};
+
+/**
+ * @param[in] nSlices 0 to use one slice per scheduler worker. Limited so that
+ *  slices have at least SCALE_MIN_SLICE_HEIGHT rows. Formats whose planes
+ *  cannot be split by rows, such as palettes, use a single slice.
+ * @return false if any SwsContext cannot be allocated.
+ */
+bool SlicedScale_init(struct SlicedScale* const, int width, int height,
+                      enum AVPixelFormat formatSrc,
+                      enum AVPixelFormat formatDst, int flags,
+                      unsigned nSlices);
+void SlicedScale_destroy(struct SlicedScale* const);
+
+/**
+ * @brief Converts a whole picture and returns once all slices are done.
+ *  Plane and stride arrays have 4 elements, unused planes being NULL.
+ */
+void SlicedScale_scale(struct SlicedScale* const,
+                       uint8_t const* const src[], int const srcStride[],
+                       uint8_t* const dst[], int const dstStride[]);
+
+#endif // !CHALCOCITE__SCALE_H_
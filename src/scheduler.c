@@ -0,0 +1,236 @@
+#include "scheduler.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#include "stats.h"
+#include "trace.h"
+#include "threadpolicy.h"
+
+// Waiters wake up this often to help with tasks queued while they sleep
+#define SCHEDULER_WAIT_TIMEOUT 10 // Milliseconds
+
+struct Task
+{
+	TaskFunction function;
+	void* data;
+	struct TaskGroup* group;
+};
+
+/*
+ * Tasks are stored in [head, tail), both taken modulo SCHEDULER_DEQUE_SIZE.
+ * The owner pushes and pops at the tail, thieves pop at the head.
+ */
+struct TaskDeque
+{
+	SDL_mutex* mutex;
+	struct Task tasks[SCHEDULER_DEQUE_SIZE];
+	unsigned head, tail;
+};
+
+static struct
+{
+	unsigned nWorkers; ///< Number of deques
+	unsigned nThreads; ///< Number of workers actually started
+	SDL_Thread* threads[SCHEDULER_MAX_WORKERS];
+	struct TaskDeque deques[SCHEDULER_MAX_WORKERS];
+	_Atomic unsigned next; ///< Deque receiving the next external task
+	/*
+	 * Holds one token per queued task. A thread takes a token before taking a
+	 * task, so holding a token guarantees that a task is queued somewhere.
+	 */
+	SDL_sem* tokens;
+	_Atomic bool quit;
+	SDL_mutex* doneMutex;
+	SDL_cond* doneCond; ///< Broadcast whenever a group finishes
+} scheduler;
+
+// Index of the deque owned by the calling thread, -1 outside the pool
+static _Thread_local int scheduler_workerIndex = -1;
+
+static bool TaskDeque_push_back(struct TaskDeque* const deque,
+                                struct Task const* const task)
+{
+	bool result = false;
+	SDL_LockMutex(deque->mutex);
+	if (deque->tail - deque->head < SCHEDULER_DEQUE_SIZE)
+	{
+		deque->tasks[deque->tail++ & (SCHEDULER_DEQUE_SIZE - 1)] = *task;
+		result = true;
+	}
+	SDL_UnlockMutex(deque->mutex);
+	return result;
+}
+static bool TaskDeque_pop(struct TaskDeque* const deque,
+                          struct Task* const task, bool back)
+{
+	bool result = false;
+	SDL_LockMutex(deque->mutex);
+	if (deque->tail != deque->head)
+	{
+		unsigned index = back ? --deque->tail : deque->head++;
+		*task = deque->tasks[index & (SCHEDULER_DEQUE_SIZE - 1)];
+		result = true;
+	}
+	SDL_UnlockMutex(deque->mutex);
+	return result;
+}
+
+/**
+ * @brief Takes a task, which must exist unless the scheduler is quitting,
+ *  after a token has been taken.
+ * @return false if quitting and no task is left.
+ */
+static bool scheduler_take(struct Task* const task)
+{
+	unsigned const n = scheduler.nWorkers;
+	bool const worker = scheduler_workerIndex >= 0;
+	unsigned const self = worker ? (unsigned) scheduler_workerIndex :
+	                      atomic_load(&scheduler.next) % n;
+	while (true)
+	{
+		// Own deque first, newest task first
+		for (unsigned i = 0; i < n; ++i)
+			if (TaskDeque_pop(&scheduler.deques[(self + i) % n], task,
+			                  worker && i == 0))
+				return true;
+		// Our task went to a thread whose own task is still queued. Retry.
+		if (atomic_load(&scheduler.quit))
+			return false;
+	}
+}
+static void scheduler_run(struct Task const* const task)
+{
+	task->function(task->data);
+	// The group may be gone as soon as pending drops to 0
+	if (atomic_fetch_sub(&task->group->pending, 1) == 1)
+	{
+		SDL_LockMutex(scheduler.doneMutex);
+		SDL_CondBroadcast(scheduler.doneCond);
+		SDL_UnlockMutex(scheduler.doneMutex);
+	}
+}
+static int scheduler_worker(void* data)
+{
+	scheduler_workerIndex = (int) (intptr_t) data;
+	stats_thread_register("worker");
+	trace_thread_register("worker");
+	thread_policy_apply(THREAD_ROLE_WORKER);
+	while (true)
+	{
+		SDL_SemWait(scheduler.tokens);
+		struct Task task;
+		if (!scheduler_take(&task))
+			break;
+		uint64_t timeBegin = stats_now();
+		scheduler_run(&task);
+		trace_complete("task", timeBegin);
+	}
+	stats_thread_unregister();
+	trace_thread_unregister();
+	return 0;
+}
+
+bool scheduler_init(unsigned nWorkers)
+{
+	if (scheduler.nWorkers) return true;
+	if (nWorkers == 0) nWorkers = SDL_GetCPUCount();
+	if (nWorkers > SCHEDULER_MAX_WORKERS) nWorkers = SCHEDULER_MAX_WORKERS;
+	if (nWorkers == 0) nWorkers = 1;
+
+	atomic_store(&scheduler.quit, false);
+	atomic_store(&scheduler.next, 0);
+	scheduler.tokens = SDL_CreateSemaphore(0);
+	scheduler.doneMutex = SDL_CreateMutex();
+	scheduler.doneCond = SDL_CreateCond();
+	for (unsigned i = 0; i < nWorkers; ++i)
+	{
+		struct TaskDeque* const deque = &scheduler.deques[i];
+		deque->mutex = SDL_CreateMutex();
+		deque->head = deque->tail = 0;
+	}
+	scheduler.nWorkers = nWorkers;
+
+	// Tasks in the deques of workers failing to start are stolen by the others
+	scheduler.nThreads = 0;
+	for (unsigned i = 0; i < nWorkers; ++i)
+	{
+		SDL_Thread* thread = SDL_CreateThread(scheduler_worker, "worker",
+		                                      (void*) (intptr_t) i);
+		if (thread)
+			scheduler.threads[scheduler.nThreads++] = thread;
+	}
+	if (!scheduler.nThreads)
+	{
+		fprintf(stderr, "[SDL] %s\n", SDL_GetError());
+		scheduler_quit();
+		return false;
+	}
+	return true;
+}
+void scheduler_quit(void)
+{
+	if (!scheduler.nWorkers) return;
+	atomic_store(&scheduler.quit, true);
+	for (unsigned i = 0; i < scheduler.nThreads; ++i)
+		SDL_SemPost(scheduler.tokens);
+	for (unsigned i = 0; i < scheduler.nThreads; ++i)
+		SDL_WaitThread(scheduler.threads[i], NULL);
+
+	for (unsigned i = 0; i < scheduler.nWorkers; ++i)
+	{
+		struct Task task;
+		while (TaskDeque_pop(&scheduler.deques[i], &task, false))
+			scheduler_run(&task);
+		SDL_DestroyMutex(scheduler.deques[i].mutex);
+	}
+	SDL_DestroySemaphore(scheduler.tokens);
+	SDL_DestroyMutex(scheduler.doneMutex);
+	SDL_DestroyCond(scheduler.doneCond);
+	memset(&scheduler, 0, sizeof(scheduler));
+}
+unsigned scheduler_workers(void)
+{
+	return scheduler.nThreads;
+}
+
+void scheduler_submit(struct TaskGroup* const group, TaskFunction function,
+                      void* data)
+{
+	atomic_fetch_add(&group->pending, 1);
+	struct Task const task = { function, data, group };
+	unsigned const n = scheduler.nWorkers;
+	if (n && !atomic_load(&scheduler.quit))
+	{
+		unsigned index = scheduler_workerIndex >= 0 ?
+		                 (unsigned) scheduler_workerIndex :
+		                 atomic_fetch_add(&scheduler.next, 1) % n;
+		if (TaskDeque_push_back(&scheduler.deques[index], &task))
+		{
+			SDL_SemPost(scheduler.tokens);
+			return;
+		}
+	}
+	scheduler_run(&task);
+}
+void TaskGroup_wait(struct TaskGroup* const group)
+{
+	while (atomic_load(&group->pending))
+	{
+		if (!atomic_load(&scheduler.quit) && scheduler.tokens &&
+		    SDL_SemTryWait(scheduler.tokens) == 0)
+		{
+			struct Task task;
+			if (scheduler_take(&task))
+				scheduler_run(&task);
+			continue;
+		}
+		SDL_LockMutex(scheduler.doneMutex);
+		if (atomic_load(&group->pending))
+			SDL_CondWaitTimeout(scheduler.doneCond, scheduler.doneMutex,
+			                    SCHEDULER_WAIT_TIMEOUT);
+		SDL_UnlockMutex(scheduler.doneMutex);
+	}
+}
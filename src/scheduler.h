@@ -0,0 +1,61 @@
+#ifndef CHALCOCITE__SCHEDULER_H_
+#define CHALCOCITE__SCHEDULER_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+/*
+ * Work-stealing task scheduler shared by all playbacks. Each worker owns a
+ * deque: it pops its own tasks from the back and steals from the front of the
+ * others when its own is empty. Tasks submitted from outside the pool are
+ * distributed round-robin.
+ *
+ * Threads waiting on a TaskGroup run queued tasks while they wait, so a task
+ * may itself submit tasks and wait for them.
+ */
+
+#define SCHEDULER_MAX_WORKERS 16
+#define SCHEDULER_DEQUE_SIZE 256 // Must be a power of two
+
+typedef void (*TaskFunction)(void* data);
+
+/**
+ * @brief Counts the unfinished tasks submitted with it.
+ */
+struct TaskGroup
+{
+	_Atomic unsigned pending;
+};
+
+/**
+ * @brief Starts the worker threads.
+ * @param[in] nWorkers 0 for the number of logical processors
+ * @return false if no worker could be started. Tasks then run on submission.
+ */
+bool scheduler_init(unsigned nWorkers);
+/**
+ * @brief Runs the remaining tasks and stops the workers.
+ */
+void scheduler_quit(void);
+/**
+ * @return Number of workers. 0 if the scheduler is not running.
+ */
+unsigned scheduler_workers(void);
+
+static inline void TaskGroup_init(struct TaskGroup* const group)
+{
+	atomic_init(&group->pending, 0);
+}
+/**
+ * @brief Queues function(data) as a task of group. The task runs immediately
+ *  on the calling thread if the scheduler is not running or the deque is full.
+ */
+void scheduler_submit(struct TaskGroup* const group, TaskFunction function,
+                      void* data);
+/**
+ * @brief Blocks until all tasks of the group have finished, running queued
+ *  tasks in the meantime.
+ */
+void TaskGroup_wait(struct TaskGroup* const group);
+
+#endif // !CHALCOCITE__SCHEDULER_H_
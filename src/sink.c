@@ -0,0 +1,413 @@
+#include "sink.h"
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include <libavutil/channel_layout.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libswresample/swresample.h>
+
+#ifdef __unix__
+	#include <signal.h>
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <unistd.h>
+#endif
+
+#define WAV_HEADER_SIZE 44
+#define Y4M_HEADER_MAX 128
+#define WAV_SIZE_UNKNOWN UINT32_C(0xffffffff) // Streamed to a pipe
+
+static char const* const sinkTypeNames[SINK_TYPE_COUNT] =
+{
+	[SINK_SDL] = "sdl",
+	[SINK_NULL] = "null",
+	[SINK_Y4M] = "y4m",
+	[SINK_WAV] = "wav",
+	[SINK_SHM] = "shm",
+};
+
+char const* sink_type_name(enum SinkType type)
+{
+	return type < SINK_TYPE_COUNT ? sinkTypeNames[type] : "unknown";
+}
+
+#ifdef __unix__
+// Original stdout once the messages of the player are redirected to stderr
+static int sinkStdout = -1;
+// Of the Y4M stream written to stdout, continued by the next playbacks
+static char sinkStdoutHeader[Y4M_HEADER_MAX];
+#endif
+
+/**
+ * @brief Creates target for writing. "-" is a duplicate of stdout.
+ */
+static FILE* sink_open_file(char const* target)
+{
+	if (strcmp(target, "-") != 0)
+		return fopen(target, "wb");
+#ifdef __unix__
+	if (sinkStdout < 0)
+	{
+		fflush(stdout);
+		sinkStdout = dup(STDOUT_FILENO);
+		if (sinkStdout < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+			return NULL;
+		// A closed pipe fails the writes instead of terminating the player
+		signal(SIGPIPE, SIG_IGN);
+	}
+	int const fd = dup(sinkStdout);
+	return fd < 0 ? NULL : fdopen(fd, "wb");
+#else
+	return NULL;
+#endif
+}
+bool Sink_init(struct Sink* const sink, char const* spec,
+               _Atomic enum State const* state)
+{
+	assert(sink);
+	memset(sink, 0, sizeof(struct Sink));
+	sink->state = state;
+	sink->fd = -1;
+	if (!spec) spec = sinkTypeNames[SINK_SDL];
+
+	char const* const separator = strchr(spec, ':');
+	size_t const length = separator ? (size_t) (separator - spec) :
+	                      strlen(spec);
+	sink->type = SINK_TYPE_COUNT;
+	for (unsigned i = 0; i < SINK_TYPE_COUNT; ++i)
+		if (strlen(sinkTypeNames[i]) == length &&
+		    strncmp(spec, sinkTypeNames[i], length) == 0)
+			sink->type = i;
+	// Only streams and the ring have a target
+	bool const targeted = sink->type == SINK_Y4M || sink->type == SINK_WAV ||
+	                      sink->type == SINK_SHM;
+	if (sink->type == SINK_TYPE_COUNT || targeted != (separator != NULL) ||
+	    (separator && !separator[1]))
+	{
+		fprintf(stderr, "Unknown sink %s. Expected sdl, null, y4m:<file>,"
+		        " wav:<file> or shm:<name>\n", spec);
+		sink->type = SINK_SDL;
+		return false;
+	}
+	if (separator)
+		strncpy(sink->target, separator + 1, sizeof(sink->target) - 1);
+
+	if (sink->type == SINK_Y4M || sink->type == SINK_WAV)
+	{
+		sink->file = sink_open_file(sink->target);
+		if (!sink->file)
+		{
+			fprintf(stderr, "Unable to create %s\n", sink->target);
+			return false;
+		}
+		sink->seekable = fseek(sink->file, 0, SEEK_CUR) == 0;
+	}
+#ifndef __unix__
+	if (sink->type == SINK_SHM)
+	{
+		fprintf(stderr, "Shared memory sinks require a Unix system\n");
+		return false;
+	}
+#endif
+	return true;
+}
+
+static void put_le16(uint8_t* p, uint16_t value)
+{
+	p[0] = value & 0xff;
+	p[1] = value >> 8;
+}
+static void put_le32(uint8_t* p, uint32_t value)
+{
+	put_le16(p, value & 0xffff);
+	put_le16(p + 2, value >> 16);
+}
+/**
+ * @brief Writes a header of 16 bit PCM.
+ * @param[in] dataSize WAV_SIZE_UNKNOWN if streamed
+ */
+static bool wav_write_header(FILE* file, int channels, int rate,
+                             uint32_t dataSize)
+{
+	uint8_t header[WAV_HEADER_SIZE];
+	memcpy(header, "RIFF", 4);
+	put_le32(header + 4, dataSize == WAV_SIZE_UNKNOWN ? WAV_SIZE_UNKNOWN :
+	         dataSize + WAV_HEADER_SIZE - 8);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	put_le32(header + 16, 16); // Size of the format chunk
+	put_le16(header + 20, 1); // PCM
+	put_le16(header + 22, channels);
+	put_le32(header + 24, rate);
+	put_le32(header + 28, rate * channels * 2); // Bytes per second
+	put_le16(header + 32, channels * 2); // Bytes per sample of all channels
+	put_le16(header + 34, 16); // Bits per sample
+	memcpy(header + 36, "data", 4);
+	put_le32(header + 40, dataSize);
+	return fwrite(header, 1, WAV_HEADER_SIZE, file) == WAV_HEADER_SIZE;
+}
+void Sink_destroy(struct Sink* const sink)
+{
+	if (!sink) return;
+	// The sizes are known once the stream is complete
+	if (sink->file && sink->type == SINK_WAV && sink->seekable &&
+	    sink->nBytes >= WAV_HEADER_SIZE && fseek(sink->file, 0, SEEK_SET) == 0)
+	{
+		uint64_t const dataSize = sink->nBytes - WAV_HEADER_SIZE;
+		wav_write_header(sink->file, sink->channels, sink->sampleRate,
+		                 dataSize < WAV_SIZE_UNKNOWN - WAV_HEADER_SIZE ?
+		                 dataSize : WAV_SIZE_UNKNOWN);
+	}
+	if (sink->file)
+		fclose(sink->file);
+	sink->file = NULL;
+	swr_free(&sink->swrContext);
+	av_freep(&sink->picture);
+#ifdef __unix__
+	if (sink->ring)
+	{
+		atomic_store(&sink->ring->finished, 1);
+		munmap(sink->ring, sink->mapSize);
+		shm_unlink(sink->target);
+	}
+	if (sink->fd >= 0)
+		close(sink->fd);
+#endif
+	sink->ring = NULL;
+	sink->fd = -1;
+}
+
+#ifdef __unix__
+/**
+ * @brief Creates the shared memory ring for pictures of width x height.
+ */
+static bool Sink_open_ring(struct Sink* const sink, int width, int height)
+{
+	// Names of shared memory objects begin with a slash
+	if (sink->target[0] != '/')
+	{
+		memmove(sink->target + 1, sink->target, sizeof(sink->target) - 2);
+		sink->target[0] = '/';
+	}
+	struct AVPixFmtDescriptor const* const desc =
+	  av_pix_fmt_desc_get(SINK_PICTURE_FORMAT);
+	int linesize[4];
+	if (av_image_fill_linesizes(linesize, SINK_PICTURE_FORMAT, width) < 0)
+		return false;
+	uint64_t planeOffset[4] = { 0 };
+	uint64_t offset = FFALIGN(sizeof(struct SinkRingSlot), SINK_RING_ALIGN);
+	for (int i = 0; i < 4 && linesize[i]; ++i)
+	{
+		linesize[i] = FFALIGN(linesize[i], SINK_RING_ALIGN);
+		int const shift = i == 1 || i == 2 ? desc->log2_chroma_h : 0;
+		int const rows = (height + (1 << shift) - 1) >> shift;
+		planeOffset[i] = offset;
+		offset += FFALIGN((uint64_t) linesize[i] * rows, SINK_RING_ALIGN);
+	}
+	uint64_t const slotOffset = FFALIGN(sizeof(struct SinkRing),
+	                                    SINK_RING_ALIGN);
+	sink->mapSize = slotOffset + offset * SINK_RING_SLOTS;
+
+	sink->fd = shm_open(sink->target, O_CREAT | O_RDWR | O_TRUNC, 0600);
+	if (sink->fd < 0 || ftruncate(sink->fd, sink->mapSize) < 0)
+	{
+		perror("shm_open");
+		return false;
+	}
+	void* const map = mmap(NULL, sink->mapSize, PROT_READ | PROT_WRITE,
+	                       MAP_SHARED, sink->fd, 0);
+	if (map == MAP_FAILED)
+	{
+		perror("mmap");
+		shm_unlink(sink->target);
+		return false;
+	}
+	struct SinkRing* const ring = map;
+	ring->version = SINK_RING_VERSION;
+	ring->nSlots = SINK_RING_SLOTS;
+	ring->width = width;
+	ring->height = height;
+	ring->format = SINK_PICTURE_FORMAT;
+	memcpy(ring->linesize, linesize, sizeof(linesize));
+	memcpy(ring->planeOffset, planeOffset, sizeof(planeOffset));
+	ring->slotOffset = slotOffset;
+	ring->slotSize = offset;
+	atomic_init(&ring->writeIndex, 0);
+	atomic_init(&ring->readIndex, 0);
+	atomic_init(&ring->readers, 0);
+	atomic_init(&ring->finished, 0);
+	// Readers may check the magic before anything else
+	atomic_thread_fence(memory_order_release);
+	ring->magic = SINK_RING_MAGIC;
+	sink->ring = ring;
+	return true;
+}
+#endif
+/**
+ * @return Y4M tag of the chroma siting of 4:2:0 pictures.
+ */
+static char const* y4m_chroma_tag(enum AVChromaLocation location)
+{
+	switch (location)
+	{
+	case AVCHROMA_LOC_LEFT: // MPEG-2, H.264 and later
+		return "C420mpeg2";
+	case AVCHROMA_LOC_TOPLEFT:
+		return "C420paldv";
+	default: // Centered, as in JPEG and MPEG-1
+		return "C420jpeg";
+	}
+}
+bool Sink_open_video(struct Sink* const sink, int width, int height,
+                     AVRational frameRate, AVRational aspect,
+                     enum AVChromaLocation chromaLocation)
+{
+	sink->width = width;
+	sink->height = height;
+	if (sink->type == SINK_SHM)
+	{
+#ifdef __unix__
+		if (!Sink_open_ring(sink, width, height)) return false;
+		fprintf(stdout, "Sharing %dx%d pictures in %s\n", width, height,
+		        sink->target);
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	// Contiguous, as written to the stream
+	sink->pictureSize = av_image_alloc(sink->data, sink->linesize, width,
+	                                   height, SINK_PICTURE_FORMAT, 1);
+	if (sink->pictureSize < 0) return false;
+	sink->picture = sink->data[0];
+	if (sink->type != SINK_Y4M) return true;
+
+	if (!frameRate.num || !frameRate.den)
+		frameRate = (AVRational) { 25, 1 };
+	if (!aspect.num || !aspect.den)
+		aspect = (AVRational) { 0, 0 };
+	char header[Y4M_HEADER_MAX];
+	snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:%d Ip A%d:%d %s\n",
+	         width, height, frameRate.num, frameRate.den, aspect.num, aspect.den,
+	         y4m_chroma_tag(chromaLocation));
+#ifdef __unix__
+	// Playbacks to stdout continue a single stream, which has one header
+	if (strcmp(sink->target, "-") == 0)
+	{
+		if (sinkStdoutHeader[0])
+		{
+			if (strcmp(header, sinkStdoutHeader) == 0) return true;
+			fprintf(stderr, "Unable to continue the Y4M stream of stdout, whose "
+			        "header is %.*s, with %s", (int) strlen(sinkStdoutHeader) - 1,
+			        sinkStdoutHeader, header);
+			return false;
+		}
+		strcpy(sinkStdoutHeader, header);
+	}
+#endif
+	if (fputs(header, sink->file) < 0) return false;
+	sink->nBytes += strlen(header);
+	return true;
+}
+bool Sink_picture_buffer(struct Sink* const sink, uint8_t* data[4],
+                         int linesize[4])
+{
+#ifdef __unix__
+	struct SinkRing* const ring = sink->ring;
+	if (ring)
+	{
+		uint64_t const index = sink->nFrames;
+		// Waits for a free slot only if someone reads the ring
+		while (atomic_load(&ring->readers) &&
+		       index - atomic_load_explicit(&ring->readIndex,
+		                                    memory_order_acquire) >= ring->nSlots)
+		{
+			if (*sink->state == STATE_QUIT) return false;
+			SDL_Delay(1);
+		}
+		uint8_t* const slot = (uint8_t*) ring + ring->slotOffset +
+		                      (index % ring->nSlots) * ring->slotSize;
+		for (int i = 0; i < 4; ++i)
+		{
+			data[i] = ring->planeOffset[i] ? slot + ring->planeOffset[i] : NULL;
+			linesize[i] = ring->linesize[i];
+		}
+		return true;
+	}
+#endif
+	if (!sink->picture) return false;
+	memcpy(data, sink->data, sizeof(sink->data));
+	memcpy(linesize, sink->linesize, sizeof(sink->linesize));
+	return true;
+}
+bool Sink_picture_commit(struct Sink* const sink, int64_t pts,
+                         double timestamp)
+{
+	uint64_t const index = sink->nFrames++;
+	switch (sink->type)
+	{
+	case SINK_Y4M:
+		if (fputs("FRAME\n", sink->file) < 0 ||
+		    fwrite(sink->picture, 1, sink->pictureSize, sink->file) !=
+		    (size_t) sink->pictureSize)
+			return false;
+		sink->nBytes += 6 + sink->pictureSize;
+		return true;
+	case SINK_SHM:
+	{
+		struct SinkRing* const ring = sink->ring;
+		if (!ring) return false;
+		struct SinkRingSlot* const slot = (struct SinkRingSlot*) ((uint8_t*) ring +
+		                                  ring->slotOffset +
+		                                  (index % ring->nSlots) * ring->slotSize);
+		slot->index = index;
+		slot->pts = pts;
+		slot->timestamp = timestamp;
+		atomic_store_explicit(&ring->writeIndex, index + 1, memory_order_release);
+		return true;
+	}
+	default:
+		return true;
+	}
+}
+
+bool Sink_open_audio(struct Sink* const sink, int64_t layout, int format,
+                     int rate, int channels)
+{
+	if (!layout)
+		layout = av_get_default_channel_layout(channels);
+	sink->swrContext = swr_alloc_set_opts(NULL, layout, AV_SAMPLE_FMT_S16, rate,
+	                                      layout, format, rate, 0, NULL);
+	if (!sink->swrContext || swr_init(sink->swrContext) < 0)
+	{
+		fprintf(stderr, "Unable to initialise the audio conversion\n");
+		swr_free(&sink->swrContext);
+		return false;
+	}
+	sink->sampleRate = rate;
+	sink->channels = channels;
+	if (sink->type != SINK_WAV) return true;
+	if (!wav_write_header(sink->file, channels, rate, WAV_SIZE_UNKNOWN))
+		return false;
+	sink->nBytes += WAV_HEADER_SIZE;
+	return true;
+}
+bool Sink_write_audio(struct Sink* const sink, uint8_t const* data, int size)
+{
+	if (sink->type != SINK_WAV) return true;
+	if (fwrite(data, 1, size, sink->file) != (size_t) size) return false;
+	sink->nBytes += size;
+	return true;
+}
+
+void Sink_print(struct Sink const* const sink, FILE* file)
+{
+	if (sink->type == SINK_SDL) return;
+	fprintf(file, "Sink %s%s%s: %llu pictures, %.1f MiB written\n",
+	        sink_type_name(sink->type), sink->target[0] ? " " : "",
+	        sink->target, (unsigned long long) sink->nFrames,
+	        sink->nBytes / (1024.0 * 1024.0));
+}
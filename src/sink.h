@@ -0,0 +1,162 @@
+#ifndef CHALCOCITE__SINK_H_
+#define CHALCOCITE__SINK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <libavutil/rational.h>
+#include <libavutil/pixfmt.h>
+
+#include "chalcocite.h"
+
+/**
+ * @brief Destinations of decoded pictures and audio.
+ */
+enum SinkType
+{
+	SINK_SDL, ///< Window and audio device of struct Output, paced by the clock
+	SINK_NULL, ///< Discards pictures and audio
+	SINK_Y4M, ///< YUV4MPEG2 video stream to a file or stdout
+	SINK_WAV, ///< WAV audio stream to a file or stdout
+	SINK_SHM, ///< Ring of pictures in POSIX shared memory
+	SINK_TYPE_COUNT
+};
+
+// Pictures of the sinks other than SINK_SDL
+#define SINK_PICTURE_FORMAT AV_PIX_FMT_YUV420P
+
+/*
+ * Layout of a SINK_SHM ring, for readers in other processes. The mapping
+ * begins with a SinkRing header followed by SINK_RING_SLOTS slots of slotSize
+ * bytes at slotOffset. A slot begins with a SinkRingSlot followed by the
+ * planes of the picture at planeOffset.
+ *
+ * Picture n is in slot n % nSlots and is published by incrementing
+ * writeIndex. A reader attaches by setting readIndex to writeIndex and then
+ * incrementing readers, and increments readIndex once done with a picture.
+ * While a reader is attached, the writer waits for a free slot. Without one,
+ * the oldest picture is overwritten. finished is set after the last picture.
+ */
+#define SINK_RING_MAGIC UINT64_C(0x474e49524c414843) // "CHALRING"
+#define SINK_RING_VERSION 1
+#define SINK_RING_SLOTS 8
+#define SINK_RING_ALIGN 64 // Of slots and planes
+
+struct SinkRing
+{
+	uint64_t magic;
+	uint32_t version;
+	uint32_t nSlots;
+	int32_t width, height;
+	int32_t format; ///< enum AVPixelFormat
+	int32_t linesize[4];
+	uint64_t planeOffset[4]; ///< From the start of a slot. 0 if unused
+	uint64_t slotOffset; ///< Of the first slot from the start of the mapping
+	uint64_t slotSize;
+	_Atomic uint64_t writeIndex; ///< Pictures published
+	_Atomic uint64_t readIndex; ///< Pictures released by the reader
+	_Atomic uint32_t readers;
+	_Atomic uint32_t finished;
+};
+struct SinkRingSlot
+{
+	uint64_t index; ///< Picture number
+	int64_t pts; ///< In the stream time base
+	double timestamp; ///< Second
+};
+
+/**
+ * Must be initialised with \ref Sink_init and destroyed with
+ *  \ref Sink_destroy.
+ * @brief Output of a playback other than the window and audio device. Such
+ *  sinks are not paced: pictures and audio are written as soon as decoded.
+ */
+struct Sink
+{
+	enum SinkType type;
+	char target[1024]; ///< File, "-" for stdout or shared memory name
+	_Atomic enum State const* state; ///< Waits end when set to quit
+	FILE* file; ///< SINK_Y4M and SINK_WAV
+	bool seekable; ///< The WAV header can be completed
+	struct SwrContext* swrContext; ///< Converts audio to S16
+	int sampleRate, channels;
+	int width, height;
+	// Picture filled by the video thread. Shared memory for SINK_SHM
+	uint8_t* data[4];
+	int linesize[4];
+	uint8_t* picture; ///< Staging picture of the other sinks
+	int pictureSize;
+	// SINK_SHM
+	int fd;
+	struct SinkRing* ring;
+	size_t mapSize;
+	uint64_t nFrames;
+	uint64_t nBytes; ///< Written to the file
+};
+
+/**
+ * @brief Parses a sink description: "sdl", "null", "y4m:<file>",
+ *  "wav:<file>" or "shm:<name>". "-" as file is stdout, in which case the
+ *  messages of the player are redirected to stderr.
+ * @param[in] spec NULL for "sdl"
+ * @param[in] state Aborts waits of the sink when set to quit
+ * @return false if spec is invalid or the file cannot be created. Prints the
+ *  error to stderr.
+ */
+bool Sink_init(struct Sink* const, char const* spec,
+               _Atomic enum State const* state);
+/**
+ * @brief Completes the WAV header if possible and marks the ring finished.
+ *  The shared memory name is unlinked; mappings of readers remain valid.
+ */
+void Sink_destroy(struct Sink* const);
+
+static inline bool Sink_video(struct Sink const* const sink)
+{
+	return sink->type != SINK_WAV;
+}
+static inline bool Sink_audio(struct Sink const* const sink)
+{
+	return sink->type != SINK_Y4M && sink->type != SINK_SHM;
+}
+
+/**
+ * @brief Prepares for pictures of SINK_PICTURE_FORMAT. Writes the Y4M header
+ *  or creates the shared memory ring. On stdout, the Y4M header is written by
+ *  the first playback only, and later ones must have the same.
+ * @param[in] aspect Sample aspect ratio. 0/1 if unknown
+ * @param[in] chromaLocation Siting written to the Y4M header
+ * @return false if the stream cannot be written or continued.
+ */
+bool Sink_open_video(struct Sink* const, int width, int height,
+                     AVRational frameRate, AVRational aspect,
+                     enum AVChromaLocation chromaLocation);
+/**
+ * @brief Destination of the next picture. For SINK_SHM, a free slot of the
+ *  ring, waited for if a reader lags.
+ * @return false if quitting.
+ */
+bool Sink_picture_buffer(struct Sink* const, uint8_t* data[4],
+                         int linesize[4]);
+/**
+ * @brief Writes or publishes the picture filled in the buffer.
+ * @return false if it cannot be written.
+ */
+bool Sink_picture_commit(struct Sink* const, int64_t pts, double timestamp);
+
+/**
+ * @brief Creates a resampler from the given input to interleaved S16 of the
+ *  same layout and rate, and writes the WAV header.
+ */
+bool Sink_open_audio(struct Sink* const, int64_t layout, int format, int rate,
+                     int channels);
+/**
+ * @return false if data cannot be written.
+ */
+bool Sink_write_audio(struct Sink* const, uint8_t const* data, int size);
+
+char const* sink_type_name(enum SinkType);
+void Sink_print(struct Sink const* const, FILE*);
+
+#endif // !CHALCOCITE__SINK_H_
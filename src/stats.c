@@ -0,0 +1,127 @@
+#include "stats.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+struct StatsThread
+{
+	char name[16];
+	_Atomic bool inUse;
+	struct Histogram stages[STAGE_COUNT];
+};
+
+/*
+ * Slots are never freed. stats_nThreads is published after the name of a new
+ * slot has been written, so readers only see initialised slots.
+ */
+static struct StatsThread stats_threads[STATS_MAX_THREADS];
+static _Atomic unsigned stats_nThreads;
+static atomic_flag stats_registerLock = ATOMIC_FLAG_INIT;
+static _Thread_local struct StatsThread* stats_current;
+
+static char const* const stats_stageNames[STAGE_COUNT] =
+{
+	[STAGE_DEMUX] = "demux",
+	[STAGE_QUEUE_WAIT] = "queue wait",
+	[STAGE_DECODE] = "decode",
+	[STAGE_SCALE] = "scale",
+	[STAGE_UPLOAD] = "upload",
+	[STAGE_PRESENT] = "present",
+	[STAGE_AUDIO_QUEUE] = "audio queue",
+	[STAGE_OPEN] = "open",
+};
+
+char const* stage_name(enum Stage stage)
+{
+	return stage < STAGE_COUNT ? stats_stageNames[stage] : "unknown";
+}
+
+void stats_thread_register(char const* name)
+{
+	while (atomic_flag_test_and_set_explicit(&stats_registerLock,
+	       memory_order_acquire));
+
+	unsigned n = atomic_load_explicit(&stats_nThreads, memory_order_relaxed);
+	struct StatsThread* slot = NULL;
+	for (unsigned i = 0; i < n; ++i)
+	{
+		struct StatsThread* const st = &stats_threads[i];
+		if (!atomic_load(&st->inUse) &&
+		    strncmp(st->name, name, sizeof(st->name) - 1) == 0)
+		{
+			slot = st;
+			break;
+		}
+	}
+	if (!slot)
+	{
+		if (n < STATS_MAX_THREADS)
+		{
+			slot = &stats_threads[n];
+			strncpy(slot->name, name, sizeof(slot->name) - 1);
+			atomic_store_explicit(&stats_nThreads, n + 1, memory_order_release);
+		}
+		else // Out of slots. Share the last one.
+			slot = &stats_threads[STATS_MAX_THREADS - 1];
+	}
+	atomic_store(&slot->inUse, true);
+	stats_current = slot;
+
+	atomic_flag_clear_explicit(&stats_registerLock, memory_order_release);
+}
+void stats_thread_unregister(void)
+{
+	if (!stats_current) return;
+	atomic_store(&stats_current->inUse, false);
+	stats_current = NULL;
+}
+
+uint64_t stats_now(void)
+{
+	uint64_t const counter = SDL_GetPerformanceCounter();
+	uint64_t const frequency = SDL_GetPerformanceFrequency();
+	return counter / frequency * 1000000000 +
+	       counter % frequency * 1000000000 / frequency;
+}
+void stats_record(enum Stage stage, uint64_t nanoseconds)
+{
+	if (!stats_current) stats_thread_register("thread");
+	Histogram_record(&stats_current->stages[stage], nanoseconds);
+}
+
+bool stats_print(FILE* file)
+{
+	bool any = false;
+	unsigned n = atomic_load_explicit(&stats_nThreads, memory_order_acquire);
+	for (unsigned i = 0; i < n; ++i)
+	{
+		struct StatsThread const* const st = &stats_threads[i];
+		for (unsigned j = 0; j < STAGE_COUNT; ++j)
+		{
+			struct Histogram const* const h = &st->stages[j];
+			uint64_t count = Histogram_count(h);
+			if (!count) continue;
+			if (!any)
+			{
+				fprintf(file, "%-8s %-12s %10s %10s %10s %10s\n", "Thread", "Stage",
+				        "Count", "p50(us)", "p99(us)", "Max(us)");
+				any = true;
+			}
+			fprintf(file, "%-8s %-12s %10llu %10.1f %10.1f %10.1f\n",
+			        st->name, stage_name(j), (unsigned long long) count,
+			        Histogram_percentile(h, 0.5) / 1000.0,
+			        Histogram_percentile(h, 0.99) / 1000.0,
+			        Histogram_max(h) / 1000.0);
+		}
+	}
+	return any;
+}
+void stats_reset(void)
+{
+	unsigned n = atomic_load_explicit(&stats_nThreads, memory_order_acquire);
+	for (unsigned i = 0; i < n; ++i)
+		for (unsigned j = 0; j < STAGE_COUNT; ++j)
+			Histogram_reset(&stats_threads[i].stages[j]);
+}
@@ -0,0 +1,64 @@
+#ifndef CHALCOCITE__STATS_H_
+#define CHALCOCITE__STATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "histogram.h"
+
+/**
+ * @brief Stages of the playback pipeline whose latency is recorded.
+ */
+enum Stage
+{
+	STAGE_DEMUX, ///< av_read_frame
+	STAGE_QUEUE_WAIT, ///< Blocking in PacketQueue_get
+	STAGE_DECODE, ///< avcodec_decode_*
+	STAGE_SCALE, ///< sws_scale/swr_convert
+	STAGE_UPLOAD, ///< Texture upload
+	STAGE_PRESENT, ///< SDL_RenderClear/Copy/Present
+	STAGE_AUDIO_QUEUE, ///< Duration of audio queued in the device
+	STAGE_OPEN, ///< Preparation of the streams and output of a playback
+	STAGE_COUNT
+};
+
+#define STATS_MAX_THREADS 16
+
+/**
+ * @brief Assigns a histogram slot to the calling thread. Threads registering
+ *  with the name of a thread that has unregistered take over its slot, so
+ *  samples accumulate across playbacks.
+ */
+void stats_thread_register(char const* name);
+/**
+ * @brief Releases the slot of the calling thread. Recorded samples are kept.
+ */
+void stats_thread_unregister(void);
+
+/**
+ * @brief Monotonic time in nanoseconds.
+ */
+uint64_t stats_now(void);
+/**
+ * @brief Records a sample into the histogram of the calling thread. Lock free.
+ *  Threads that have not registered are registered as "thread".
+ */
+void stats_record(enum Stage, uint64_t nanoseconds);
+/**
+ * @brief Shorthand for stats_record(stage, stats_now() - begin)
+ */
+static inline void stats_record_since(enum Stage stage, uint64_t begin)
+{
+	stats_record(stage, stats_now() - begin);
+}
+
+/**
+ * @brief Prints count, p50, p99 and max of every stage with samples.
+ * @return false if no samples have been recorded.
+ */
+bool stats_print(FILE*);
+void stats_reset(void);
+
+char const* stage_name(enum Stage);
+
+#endif // !CHALCOCITE__STATS_H_
@@ -0,0 +1,392 @@
+#include "subtitle.h"
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+
+#include "media.h"
+#include "memstats.h"
+
+void Subtitles_init(struct Subtitles* const subs)
+{
+	memset(subs, 0, sizeof(struct Subtitles));
+	subs->streamIndex = CHAL_UNSIGNED_INVALID;
+	PacketQueue_init(&subs->queue);
+	subs->mutex = SDL_CreateMutex();
+	subs->cond = SDL_CreateCond();
+	subs->visible = true;
+}
+void Subtitles_destroy(struct Subtitles* const subs)
+{
+	if (!subs) return;
+	Subtitles_clear(subs);
+	PacketQueue_destroy(&subs->queue);
+	avcodec_free_context(&subs->cc);
+	SDL_DestroyMutex(subs->mutex);
+	SDL_DestroyCond(subs->cond);
+}
+
+bool Subtitles_open(struct Subtitles* const subs, struct AVFormatContext* fc,
+                    int width, int height, bool lowDelay)
+{
+	for (unsigned i = 0; i < fc->nb_streams; ++i)
+	{
+		if (fc->streams[i]->codec->codec_type != AVMEDIA_TYPE_SUBTITLE ||
+		    !av_stream_context(fc, i, &subs->cc, lowDelay))
+			continue;
+		subs->streamIndex = i;
+		subs->stream = fc->streams[i];
+		subs->cc->pkt_timebase = subs->stream->time_base;
+		subs->videoWidth = width;
+		subs->videoHeight = height;
+		return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Frees the pixels and textures of an overlay. Mutex locked.
+ */
+static void subtitle_overlay_free(struct Subtitles* const subs,
+                                  struct SubtitleOverlay* const overlay)
+{
+	for (unsigned i = 0; i < overlay->nRects; ++i)
+	{
+		free(overlay->pixels[i]);
+		if (overlay->textures[i])
+			SDL_DestroyTexture(overlay->textures[i]);
+	}
+	subs->footprint -= overlay->size;
+	memstats_add(MEM_SUBTITLES, -overlay->size);
+}
+/**
+ * @brief Appends src to the text of an overlay, after a separator if
+ *  the text is not empty.
+ */
+static void subtitle_append_text(struct SubtitleOverlay* const overlay,
+                                 char const* src, bool ass)
+{
+	size_t const length = strlen(overlay->text);
+	size_t const separator = length ? 3 : 0;
+	if (length + separator + 1 >= sizeof(overlay->text)) return;
+	if (separator) memcpy(overlay->text + length, " / ", separator);
+	subtitle_plain_text(overlay->text + length + separator,
+	                    sizeof(overlay->text) - length - separator, src, ass);
+}
+/**
+ * @brief Converts a palettised rectangle to ARGB, the format of the palette.
+ */
+static uint32_t* subtitle_bitmap(struct AVSubtitleRect const* const rect)
+{
+	uint32_t* const pixels = malloc((size_t) rect->w * rect->h *
+	                                sizeof(uint32_t));
+	if (!pixels) return NULL;
+	uint32_t const* const palette = (uint32_t const*) rect->data[1];
+	for (int y = 0; y < rect->h; ++y)
+	{
+		uint8_t const* const src = rect->data[0] + (ptrdiff_t) y * rect->linesize[0];
+		uint32_t* const dst = pixels + (ptrdiff_t) y * rect->w;
+		for (int x = 0; x < rect->w; ++x)
+			dst[x] = palette[src[x]];
+	}
+	return pixels;
+}
+bool Subtitles_add(struct Subtitles* const subs, struct AVSubtitle const* sub,
+                   double base, double duration,
+                   _Atomic enum State const* state)
+{
+	struct SubtitleOverlay overlay;
+	memset(&overlay, 0, sizeof(overlay));
+	overlay.begin = base + sub->start_display_time / 1000.0;
+	if (sub->end_display_time != UINT32_MAX &&
+	    sub->end_display_time > sub->start_display_time)
+		overlay.end = base + sub->end_display_time / 1000.0;
+	else if (duration > 0.0)
+		overlay.end = base + duration;
+	else
+		overlay.end = INFINITY;
+	overlay.canvasWidth = subs->cc && subs->cc->width > 0 ? subs->cc->width :
+	                      subs->videoWidth;
+	overlay.canvasHeight = subs->cc && subs->cc->height > 0 ?
+	                       subs->cc->height : subs->videoHeight;
+
+	for (unsigned i = 0; i < sub->num_rects; ++i)
+	{
+		struct AVSubtitleRect const* const rect = sub->rects[i];
+		if (rect->type == SUBTITLE_TEXT && rect->text)
+			subtitle_append_text(&overlay, rect->text, false);
+		else if (rect->type == SUBTITLE_ASS && rect->ass)
+			subtitle_append_text(&overlay, rect->ass, true);
+		if (rect->type != SUBTITLE_BITMAP || rect->w <= 0 || rect->h <= 0 ||
+		    !rect->data[0] || !rect->data[1])
+			continue;
+		uint32_t* pixels = NULL;
+		if (overlay.nRects == SUBTITLE_RECTS_MAX ||
+		    !(pixels = subtitle_bitmap(rect)))
+		{
+			++subs->nDroppedRects;
+			continue;
+		}
+		overlay.pixels[overlay.nRects] = pixels;
+		overlay.rects[overlay.nRects] =
+			(SDL_Rect) { rect->x, rect->y, rect->w, rect->h };
+		overlay.size += (int64_t) rect->w * rect->h * sizeof(uint32_t);
+		++overlay.nRects;
+	}
+
+	SDL_LockMutex(subs->mutex);
+	// Ended overlays do not take room, up to SUBTITLE_HISTORY_MAX of them
+	while (subs->nOverlays - subs->nEnded >= SUBTITLE_OVERLAYS_MAX &&
+	       *state != STATE_QUIT &&
+	       atomic_load(&subs->serialRequested) == subs->serial)
+		SDL_CondWait(subs->cond, subs->mutex);
+	// Overlays before a pending flush would be removed by it
+	if (*state == STATE_QUIT ||
+	    atomic_load(&subs->serialRequested) != subs->serial)
+	{
+		SDL_UnlockMutex(subs->mutex);
+		for (unsigned i = 0; i < overlay.nRects; ++i)
+			free(overlay.pixels[i]);
+		return *state != STATE_QUIT;
+	}
+	// A page without an end is replaced by the next one, which may be empty
+	for (unsigned i = 0; i < subs->nOverlays; ++i)
+		if (isinf(subs->overlays[i].end) &&
+		    subs->overlays[i].begin <= overlay.begin)
+			subs->overlays[i].end = overlay.begin;
+	++subs->nDecoded;
+	if (overlay.nRects || overlay.text[0])
+	{
+		assert(subs->nOverlays < SUBTITLE_OVERLAYS_MAX + SUBTITLE_HISTORY_MAX);
+		unsigned index = subs->nOverlays;
+		while (index > 0 && subs->overlays[index - 1].begin > overlay.begin)
+		{
+			subs->overlays[index] = subs->overlays[index - 1];
+			--index;
+		}
+		subs->overlays[index] = overlay;
+		++subs->nOverlays;
+		subs->footprint += overlay.size;
+		memstats_add(MEM_SUBTITLES, overlay.size);
+	}
+	SDL_UnlockMutex(subs->mutex);
+	return true;
+}
+bool Subtitles_decode(struct Subtitles* const subs, struct AVPacket* packet,
+                      _Atomic enum State const* state)
+{
+	struct AVSubtitle sub;
+	int finished = 0;
+	if (avcodec_decode_subtitle2(subs->cc, &sub, &finished, packet) < 0 ||
+	    !finished)
+		return true;
+	double const timeBase = av_q2d(subs->stream->time_base);
+	double base = 0.0;
+	if (packet->pts != AV_NOPTS_VALUE)
+		base = packet->pts * timeBase;
+	else if (sub.pts != AV_NOPTS_VALUE)
+		base = sub.pts / (double) AV_TIME_BASE;
+	bool const running = Subtitles_add(subs, &sub, base,
+	                                   packet->duration > 0 ?
+	                                   packet->duration * timeBase : 0.0,
+	                                   state);
+	avsubtitle_free(&sub);
+	return running;
+}
+void Subtitles_wake(struct Subtitles* const subs)
+{
+	SDL_LockMutex(subs->mutex);
+	SDL_CondBroadcast(subs->cond);
+	SDL_UnlockMutex(subs->mutex);
+}
+void Subtitles_flush_request(struct Subtitles* const subs, unsigned serial)
+{
+	SDL_LockMutex(subs->mutex);
+	atomic_store(&subs->serialRequested, serial);
+	SDL_CondBroadcast(subs->cond);
+	SDL_UnlockMutex(subs->mutex);
+}
+void Subtitles_flush(struct Subtitles* const subs, unsigned serial)
+{
+	SDL_LockMutex(subs->mutex);
+	for (unsigned i = 0; i < subs->nOverlays; ++i)
+	{
+		// Textures exist only once shown, after the previous release
+		struct SubtitleOverlay* const overlay = &subs->overlays[i];
+		for (unsigned j = 0; j < overlay->nRects; ++j)
+			if (overlay->textures[j])
+			{
+				subs->released[subs->nReleased++] = overlay->textures[j];
+				overlay->textures[j] = NULL;
+			}
+		subtitle_overlay_free(subs, overlay);
+	}
+	subs->nOverlays = 0;
+	subs->nEnded = 0;
+	subs->serial = serial;
+	SDL_UnlockMutex(subs->mutex);
+}
+/**
+ * @brief Destroys the textures of flushed overlays. Mutex locked.
+ */
+static void subtitle_destroy_released(struct Subtitles* const subs)
+{
+	for (unsigned i = 0; i < subs->nReleased; ++i)
+		SDL_DestroyTexture(subs->released[i]);
+	subs->nReleased = 0;
+}
+
+/**
+ * @brief Uploads a rectangle of an overlay into a static texture and frees
+ *  its pixels. A rectangle that cannot be uploaded is dropped.
+ */
+static bool subtitle_upload(struct Subtitles* const subs,
+                            SDL_Renderer* renderer,
+                            struct SubtitleOverlay* const overlay, unsigned i)
+{
+	SDL_Rect* const rect = &overlay->rects[i];
+	SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+	                                         SDL_TEXTUREACCESS_STATIC,
+	                                         rect->w, rect->h);
+	if (!texture ||
+	    SDL_UpdateTexture(texture, NULL, overlay->pixels[i],
+	                      rect->w * sizeof(uint32_t)) < 0)
+	{
+		fprintf(stderr, "[SDL] %s\n", SDL_GetError());
+		if (texture) SDL_DestroyTexture(texture);
+		free(overlay->pixels[i]);
+		overlay->pixels[i] = NULL;
+		rect->w = rect->h = 0;
+		++subs->nDroppedRects;
+		return false;
+	}
+	SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+	free(overlay->pixels[i]);
+	overlay->pixels[i] = NULL;
+	overlay->textures[i] = texture;
+	++subs->nUploads;
+	return true;
+}
+void Subtitles_render(struct Subtitles* const subs, SDL_Renderer* renderer,
+                      double timestamp)
+{
+	if (!subs->stream) return;
+	SDL_LockMutex(subs->mutex);
+	subtitle_destroy_released(subs);
+	unsigned const nPending = subs->nOverlays - subs->nEnded;
+	// Ended overlays are counted again after a backward step
+	unsigned nEnded = 0;
+	for (unsigned i = 0; i < subs->nOverlays; ++i)
+		nEnded += subs->overlays[i].end <= timestamp;
+	// The earliest ended overlays beyond the history are removed
+	unsigned nRemoved = nEnded > SUBTITLE_HISTORY_MAX ?
+	                    nEnded - SUBTITLE_HISTORY_MAX : 0;
+	unsigned nKept = 0;
+	for (unsigned i = 0; i < subs->nOverlays; ++i)
+	{
+		if (nRemoved && subs->overlays[i].end <= timestamp)
+		{
+			subtitle_overlay_free(subs, &subs->overlays[i]);
+			--nRemoved;
+			--nEnded;
+		}
+		else
+			subs->overlays[nKept++] = subs->overlays[i];
+	}
+	subs->nOverlays = nKept;
+	if (nKept - nEnded < nPending)
+		SDL_CondSignal(subs->cond);
+	subs->nEnded = nEnded;
+
+	int width, height;
+	if (!subs->visible ||
+	    SDL_GetRendererOutputSize(renderer, &width, &height) < 0)
+	{
+		SDL_UnlockMutex(subs->mutex);
+		return;
+	}
+	for (unsigned i = 0; i < subs->nOverlays; ++i)
+	{
+		struct SubtitleOverlay* const overlay = &subs->overlays[i];
+		if (overlay->begin > timestamp) break;
+		if (!overlay->shown)
+		{
+			overlay->shown = true;
+			if (overlay->text[0])
+				fprintf(stdout, "[Subtitle] %s\n", overlay->text);
+		}
+		if (overlay->canvasWidth <= 0 || overlay->canvasHeight <= 0)
+			continue;
+		// The canvas covers the output, as the video does
+		for (unsigned j = 0; j < overlay->nRects; ++j)
+		{
+			SDL_Rect const* const rect = &overlay->rects[j];
+			if (rect->w == 0 ||
+			    (!overlay->textures[j] &&
+			     !subtitle_upload(subs, renderer, overlay, j)))
+				continue;
+			int const x0 = (int64_t) rect->x * width / overlay->canvasWidth;
+			int const y0 = (int64_t) rect->y * height / overlay->canvasHeight;
+			int const x1 = (int64_t) (rect->x + rect->w) * width /
+			               overlay->canvasWidth;
+			int const y1 = (int64_t) (rect->y + rect->h) * height /
+			               overlay->canvasHeight;
+			SDL_Rect const dst = { x0, y0, x1 - x0, y1 - y0 };
+			SDL_RenderCopy(renderer, overlay->textures[j], NULL, &dst);
+		}
+	}
+	SDL_UnlockMutex(subs->mutex);
+}
+void Subtitles_clear(struct Subtitles* const subs)
+{
+	SDL_LockMutex(subs->mutex);
+	subtitle_destroy_released(subs);
+	for (unsigned i = 0; i < subs->nOverlays; ++i)
+		subtitle_overlay_free(subs, &subs->overlays[i]);
+	subs->nOverlays = 0;
+	subs->nEnded = 0;
+	SDL_CondBroadcast(subs->cond);
+	SDL_UnlockMutex(subs->mutex);
+}
+void Subtitles_print(struct Subtitles const* const subs, FILE* file)
+{
+	if (!subs->stream) return;
+	fprintf(file, "Subtitles: stream %u, %llu decoded, %llu uploaded, "
+	        "%llu rectangles dropped\n", subs->streamIndex,
+	        (unsigned long long) subs->nDecoded,
+	        (unsigned long long) subs->nUploads,
+	        (unsigned long long) subs->nDroppedRects);
+}
+
+void subtitle_plain_text(char* dst, size_t size, char const* src, bool ass)
+{
+	assert(size > 0);
+	// Fields of the event before the text
+	if (ass)
+	{
+		bool const dialogue = strncmp(src, "Dialogue:", 9) == 0;
+		for (int nFields = dialogue ? 9 : 8; nFields > 0 && *src; ++src)
+			if (*src == ',') --nFields;
+	}
+	size_t length = 0;
+	bool tag = false;
+	for (; *src && length + 1 < size; ++src)
+	{
+		if (ass && *src == '{') tag = true;
+		else if (tag) tag = *src != '}';
+		else if (ass && src[0] == '\\' &&
+		         (src[1] == 'N' || src[1] == 'n' || src[1] == 'h'))
+		{
+			dst[length++] = ' ';
+			++src;
+		}
+		else if (*src == '\n')
+			dst[length++] = ' ';
+		else if (*src != '\r')
+			dst[length++] = *src;
+	}
+	dst[length] = '\0';
+}
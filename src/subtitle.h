@@ -0,0 +1,158 @@
+#ifndef CHALCOCITE__SUBTITLE_H_
+#define CHALCOCITE__SUBTITLE_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <SDL2/SDL.h>
+
+#include "chalcocite.h"
+#include "container/packetqueue.h"
+
+struct AVFormatContext;
+struct AVCodecContext;
+struct AVStream;
+struct AVSubtitle;
+
+// Overlays decoded ahead of the presented picture
+#define SUBTITLE_OVERLAYS_MAX 16
+// Ended overlays kept for backward steps
+#define SUBTITLE_HISTORY_MAX 8
+// Rectangles of an overlay. Further ones are dropped
+#define SUBTITLE_RECTS_MAX 8
+#define SUBTITLE_TEXT_SIZE 512
+
+/**
+ * @brief Subtitles shown during an interval. Bitmaps are converted to ARGB
+ *  once by the subtitle thread, and uploaded once to static textures by the
+ *  render thread when first shown.
+ */
+struct SubtitleOverlay
+{
+	double begin; ///< Second
+	double end; ///< Second. INFINITY until the next overlay begins
+	int canvasWidth, canvasHeight; ///< Space of the rectangles
+	unsigned nRects;
+	SDL_Rect rects[SUBTITLE_RECTS_MAX];
+	uint32_t* pixels[SUBTITLE_RECTS_MAX]; ///< ARGB. Freed once uploaded
+	SDL_Texture* textures[SUBTITLE_RECTS_MAX]; ///< NULL until first shown
+	/**
+	 * Text of text subtitles, printed when first shown since no font is
+	 *  rasterised. Empty if none.
+	 */
+	char text[SUBTITLE_TEXT_SIZE];
+	bool shown;
+	int64_t size; ///< Bytes of pixels and textures
+};
+
+/**
+ * Must be initialised with \ref Subtitles_init and destroyed with
+ *  \ref Subtitles_destroy.
+ * @brief A subtitle stream decoded on its own thread into overlays composited
+ *  over the video by the render thread. Nothing is converted or uploaded per
+ *  presented picture.
+ */
+struct Subtitles
+{
+	unsigned streamIndex;
+	struct AVStream* stream; ///< NULL if no subtitles
+	struct AVCodecContext* cc;
+	PacketQueue queue;
+	int videoWidth, videoHeight; ///< Canvas if the decoder gives none
+
+	/**
+	 * Sorted by begin. Lock mutex to access. Textures are created and
+	 *  destroyed by the render thread only.
+	 */
+	struct SubtitleOverlay overlays[SUBTITLE_OVERLAYS_MAX + SUBTITLE_HISTORY_MAX];
+	unsigned nOverlays;
+	// Overlays ended at the last rendered timestamp. At most SUBTITLE_HISTORY_MAX
+	unsigned nEnded;
+	// Textures of flushed overlays, destroyed by the render thread
+	SDL_Texture* released[(SUBTITLE_OVERLAYS_MAX + SUBTITLE_HISTORY_MAX) *
+	                      SUBTITLE_RECTS_MAX];
+	unsigned nReleased;
+	SDL_mutex* mutex;
+	SDL_cond* cond; ///< Signaled when an overlay ends or is removed
+	// Serial of the last flush requested, and processed by the subtitle thread
+	_Atomic unsigned serialRequested;
+	unsigned serial;
+	bool visible; ///< Render thread only
+	int64_t footprint; ///< Bytes accounted to MEM_SUBTITLES
+	uint64_t nDecoded, nUploads, nDroppedRects;
+};
+
+void Subtitles_init(struct Subtitles* const);
+/**
+ * @warning Uses SDL Render API (Not thread safe).
+ */
+void Subtitles_destroy(struct Subtitles* const);
+
+/**
+ * @brief Opens the decoder of the first subtitle stream of fc that has one.
+ * @param[in] width, height Dimension of the video, the canvas of decoders
+ *  that give none
+ * @return false if there is none.
+ */
+bool Subtitles_open(struct Subtitles* const, struct AVFormatContext* fc,
+                    int width, int height, bool lowDelay);
+/**
+ * @brief Decodes a packet of the stream and adds its overlay, waiting for room
+ *  while SUBTITLE_OVERLAYS_MAX overlays have not ended.
+ * @return false if quitting.
+ */
+bool Subtitles_decode(struct Subtitles* const, struct AVPacket* packet,
+                      _Atomic enum State const* state);
+/**
+ * @brief Converts a decoded subtitle into an overlay and adds it. An overlay
+ *  without an end, such as a DVB page, ends where this one begins.
+ * @param[in] base Timestamp of the subtitle packet in second
+ * @param[in] duration Duration of the packet in second. 0 if unknown
+ * @return false if quitting.
+ */
+bool Subtitles_add(struct Subtitles* const, struct AVSubtitle const* sub,
+                   double base, double duration,
+                   _Atomic enum State const* state);
+/**
+ * @brief Wakes the subtitle thread waiting for room.
+ */
+void Subtitles_wake(struct Subtitles* const);
+/**
+ * @brief Announces a flush packet queued with serial. The overlays decoded
+ *  until it is processed are dropped instead of waiting for room.
+ */
+void Subtitles_flush_request(struct Subtitles* const, unsigned serial);
+/**
+ * @brief Removes all overlays on the flush packet of serial, from the
+ *  subtitle thread. Their textures are destroyed by the render thread.
+ */
+void Subtitles_flush(struct Subtitles* const, unsigned serial);
+
+/**
+ * @warning Uses SDL Render API (Not thread safe).
+ * @brief Destroys the textures of flushed overlays, keeps the last
+ *  SUBTITLE_HISTORY_MAX overlays that ended before timestamp for backward
+ *  steps and removes the earlier ones, and copies those shown at timestamp
+ *  over the whole output of the renderer. Textures are created the first time
+ *  an overlay is shown.
+ */
+void Subtitles_render(struct Subtitles* const, SDL_Renderer* renderer,
+                      double timestamp);
+/**
+ * @warning Uses SDL Render API (Not thread safe).
+ * @brief Removes all overlays. Must be called while the renderer exists.
+ */
+void Subtitles_clear(struct Subtitles* const);
+void Subtitles_print(struct Subtitles const* const, FILE*);
+
+/**
+ * @brief Copies the text of a subtitle into dst. Line breaks become spaces.
+ * @param[in] ass src is an ASS dialogue event, whose fields before the text
+ *  and override tags are removed
+ */
+void subtitle_plain_text(char* dst, size_t size, char const* src, bool ass);
+
+#endif // !CHALCOCITE__SUBTITLE_H_
@@ -0,0 +1,80 @@
+#include "syncstats.h"
+
+static uint64_t atomic_get(_Atomic uint64_t const* const value)
+{
+	return atomic_load_explicit(value, memory_order_relaxed);
+}
+static void atomic_add(_Atomic uint64_t* const dst,
+                       _Atomic uint64_t const* const src)
+{
+	atomic_fetch_add_explicit(dst, atomic_get(src), memory_order_relaxed);
+}
+
+void SyncStats_reset(struct SyncStats* const ss)
+{
+	Histogram_reset(&ss->offsetAhead);
+	Histogram_reset(&ss->offsetBehind);
+	Histogram_reset(&ss->lateness);
+	atomic_store(&ss->framesPresented, 0);
+	atomic_store(&ss->framesLate, 0);
+	atomic_store(&ss->framesDropped, 0);
+	atomic_store(&ss->framesRepeated, 0);
+	atomic_store(&ss->audioUnderruns, 0);
+}
+void SyncStats_merge(struct SyncStats* const dst,
+                     struct SyncStats const* const src)
+{
+	Histogram_merge(&dst->offsetAhead, &src->offsetAhead);
+	Histogram_merge(&dst->offsetBehind, &src->offsetBehind);
+	Histogram_merge(&dst->lateness, &src->lateness);
+	atomic_add(&dst->framesPresented, &src->framesPresented);
+	atomic_add(&dst->framesLate, &src->framesLate);
+	atomic_add(&dst->framesDropped, &src->framesDropped);
+	atomic_add(&dst->framesRepeated, &src->framesRepeated);
+	atomic_add(&dst->audioUnderruns, &src->audioUnderruns);
+}
+
+void SyncStats_offset(struct SyncStats* const ss, double offset)
+{
+	if (offset >= 0.0)
+		Histogram_record(&ss->offsetAhead, (uint64_t)(offset * 1e9));
+	else
+		Histogram_record(&ss->offsetBehind, (uint64_t)(-offset * 1e9));
+}
+void SyncStats_present(struct SyncStats* const ss, double lateness,
+                       unsigned repeats)
+{
+	atomic_fetch_add_explicit(&ss->framesPresented, 1, memory_order_relaxed);
+	if (repeats)
+		atomic_fetch_add_explicit(&ss->framesRepeated, repeats,
+		                          memory_order_relaxed);
+	if (lateness <= 0.0) return;
+	Histogram_record(&ss->lateness, (uint64_t)(lateness * 1e9));
+	if (lateness > SYNC_LATE_THRESHOULD)
+		atomic_fetch_add_explicit(&ss->framesLate, 1, memory_order_relaxed);
+}
+
+static void SyncStats_print_distribution(struct Histogram const* const h,
+    char const* name, FILE* file)
+{
+	if (!Histogram_count(h)) return;
+	fprintf(file, "%-14s %8llu frames, p50 %.1fms, p99 %.1fms, max %.1fms\n",
+	        name, (unsigned long long) Histogram_count(h),
+	        Histogram_percentile(h, 0.5) / 1e6,
+	        Histogram_percentile(h, 0.99) / 1e6,
+	        Histogram_max(h) / 1e6);
+}
+void SyncStats_print(struct SyncStats const* const ss, FILE* file)
+{
+	fprintf(file, "Frames presented: %llu, late: %llu, dropped: %llu, "
+	        "repeated: %llu\n",
+	        (unsigned long long) atomic_get(&ss->framesPresented),
+	        (unsigned long long) atomic_get(&ss->framesLate),
+	        (unsigned long long) atomic_get(&ss->framesDropped),
+	        (unsigned long long) atomic_get(&ss->framesRepeated));
+	fprintf(file, "Audio underruns: %llu\n",
+	        (unsigned long long) atomic_get(&ss->audioUnderruns));
+	SyncStats_print_distribution(&ss->offsetAhead, "Video ahead", file);
+	SyncStats_print_distribution(&ss->offsetBehind, "Video behind", file);
+	SyncStats_print_distribution(&ss->lateness, "Lateness", file);
+}
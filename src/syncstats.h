@@ -0,0 +1,72 @@
+#ifndef CHALCOCITE__SYNCSTATS_H_
+#define CHALCOCITE__SYNCSTATS_H_
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "histogram.h"
+
+/*
+ * A frame presented more than SYNC_LATE_THRESHOULD seconds after its deadline
+ * counts as late.
+ */
+#define SYNC_LATE_THRESHOULD 0.01
+
+/**
+ * Must be initialised with \ref SyncStats_reset. All durations are recorded in
+ * nanoseconds.
+ * @brief Running A/V synchronisation quality of a playback session. Each
+ *  counter is written by one thread and may be read from any thread.
+ */
+struct SyncStats
+{
+	struct Histogram offsetAhead; ///< Video ahead of audio
+	struct Histogram offsetBehind; ///< Video behind audio
+	struct Histogram lateness; ///< Presentation after deadline
+	_Atomic uint64_t framesPresented;
+	_Atomic uint64_t framesLate;
+	// Decoded but never presented, or skipped by the decoder
+	_Atomic uint64_t framesDropped;
+	_Atomic uint64_t framesRepeated; ///< Intervals a frame stayed on screen
+	_Atomic uint64_t audioUnderruns; ///< Times the device queue ran dry
+};
+
+void SyncStats_reset(struct SyncStats* const);
+/**
+ * @brief Adds all counters and distributions of src to dst.
+ */
+void SyncStats_merge(struct SyncStats* const dst,
+                     struct SyncStats const* const src);
+
+/**
+ * @param[in] offset Video timestamp minus master clock in seconds.
+ */
+void SyncStats_offset(struct SyncStats* const, double offset);
+/**
+ * @param[in] lateness Seconds between the deadline and the actual
+ *  presentation. Negative if early.
+ * @param[in] repeats Number of frame intervals the previous frame was shown
+ *  for in addition to its own.
+ */
+void SyncStats_present(struct SyncStats* const, double lateness,
+                       unsigned repeats);
+static inline void SyncStats_drop(struct SyncStats* const ss)
+{
+	atomic_fetch_add_explicit(&ss->framesDropped, 1, memory_order_relaxed);
+}
+/**
+ * @brief Counts frames the decoder skipped as dropped.
+ */
+static inline void SyncStats_skip(struct SyncStats* const ss, unsigned frames)
+{
+	atomic_fetch_add_explicit(&ss->framesDropped, frames, memory_order_relaxed);
+}
+static inline void SyncStats_underrun(struct SyncStats* const ss)
+{
+	atomic_fetch_add_explicit(&ss->audioUnderruns, 1, memory_order_relaxed);
+}
+
+void SyncStats_print(struct SyncStats const* const, FILE*);
+
+#endif // !CHALCOCITE__SYNCSTATS_H_
@@ -1,204 +1,1724 @@
+#define _GNU_SOURCE // pthread_getaffinity_np
 #include "test.h"
 
 #include <stdbool.h>
 #include <assert.h>
+#include <float.h>
+#include <limits.h>
 #include <math.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+	#include <pthread.h>
+	#include <sched.h>
+#endif
+#ifdef __unix__
+	#include <sys/socket.h>
+	#include <sys/un.h>
+#endif
 
 #include <SDL2/SDL.h>
-#include <SDL2/SDL_thread.h>
+#include <libavutil/channel_layout.h>
 
 #include "chalcocite.h"
 #include "media.h"
+#include "playback.h"
+#include "scheduler.h"
+#include "governor.h"
+#include "threadpolicy.h"
+#include "library.h"
+#include "export.h"
+#include "framecache.h"
+#include "sink.h"
+#include "mixer.h"
+#include "subtitle.h"
+#include "control.h"
+#include "overview.h"
+#include "memstats.h"
+#include "container/pool.h"
+#include "container/vector.h"
 
-// Audio playing test code
+/*
+ * Synthetic media are generated and muxed into memory, then played through
+ * play_format for TEST_DURATION seconds. Run with SDL_VIDEODRIVER=dummy and
+ * SDL_AUDIODRIVER=dummy to test headlessly.
+ */
 
-#define TEST_WIDTH_IN 640
-#define TEST_HEIGHT_IN 480
-#define TEST_PIXFMT_IN AV_PIX_FMT_RGB24
+#define TEST_CONTAINER "matroska"
+#define TEST_FPS 25
+#define TEST_SAMPLE_RATE 48000
+#define TEST_LENGTH 3.0 // Length of generated media in seconds
+#define TEST_DURATION 2.0 // Duration of playback in seconds
+#define TEST_IO_BUFFER_SIZE 4096
+// Minimum fraction of TEST_FPS that must be presented
+#define TEST_MIN_THROUGHPUT 0.8
+// Frames presented beyond real time allowed for synchronisation corrections
+#define TEST_FRAME_TOLERANCE 4
+// Bound of the 99th percentile A/V offset, with the device queue as margin
+#define TEST_SYNC_BOUND (AUDIO_DEVICE_QUEUE_MAX_DURATION + 4.0 / TEST_FPS)
 
-static uint32_t test_refresh_timer_cb(uint32_t interval, void* data)
+struct TestCase
+{
+	char const* name;
+	int width, height;
+	enum AVCodecID codecV;
+	enum AVCodecID codecA; ///< AV_CODEC_ID_NONE for video only
+	char const* filter; ///< Video filter graph. May be NULL
+};
+static struct TestCase const testCases[] =
 {
-	(void) interval;
+	{ "mpeg4+mp2 320x240", 320, 240, AV_CODEC_ID_MPEG4, AV_CODEC_ID_MP2,
+	  NULL },
+	{ "mpeg2+pcm 640x480", 640, 480, AV_CODEC_ID_MPEG2VIDEO,
+	  AV_CODEC_ID_PCM_S16LE, NULL },
+	{ "mjpeg 1280x720", 1280, 720, AV_CODEC_ID_MJPEG, AV_CODEC_ID_NONE,
+	  NULL },
+	{ "mpeg4+mp2 640x480 yadif,crop", 640, 480, AV_CODEC_ID_MPEG4,
+	  AV_CODEC_ID_MP2, "yadif,crop=320:240" },
+};
 
-	SDL_Event event;
-	event.type = CHAL_EVENT_REFRESH;
-	event.user.data1 = data;
-	SDL_PushEvent(&event);
-	return 0; // Stops the timer
+// In-memory file backing a custom AVIOContext
+
+struct MemoryFile
+{
+	uint8_t* data;
+	size_t size;
+	size_t capacity;
+	size_t position;
+};
+
+static int MemoryFile_read(void* opaque, uint8_t* buffer, int size)
+{
+	struct MemoryFile* const file = opaque;
+	size_t remaining = file->size - file->position;
+	if (remaining == 0) return AVERROR_EOF;
+	if ((size_t) size > remaining) size = (int) remaining;
+	memcpy(buffer, file->data + file->position, size);
+	file->position += size;
+	return size;
 }
-static void test_schedule_refresh(struct Media* const media, int delay)
+static int MemoryFile_write(void* opaque, uint8_t* buffer, int size)
 {
-	if (!SDL_AddTimer(delay, test_refresh_timer_cb, media))
+	struct MemoryFile* const file = opaque;
+	size_t end = file->position + size;
+	if (end > file->capacity)
 	{
-		fprintf(stderr, "[SDL] %s\n", SDL_GetError());
+		size_t capacity = file->capacity ? file->capacity : 65536;
+		while (capacity < end) capacity *= 2;
+		uint8_t* data = realloc(file->data, capacity);
+		if (!data) return AVERROR(ENOMEM);
+		file->data = data;
+		file->capacity = capacity;
 	}
+	memcpy(file->data + file->position, buffer, size);
+	file->position = end;
+	if (end > file->size) file->size = end;
+	return size;
 }
-static void test_video_refresh_timer(struct Media* const media)
+static int64_t MemoryFile_seek(void* opaque, int64_t offset, int whence)
 {
-	if (media->streamV)
+	struct MemoryFile* const file = opaque;
+	switch (whence & ~AVSEEK_FORCE)
 	{
-		if (media->pictQueueSize == 0)
-			test_schedule_refresh(media, 1);
-		else
-		{
-			test_schedule_refresh(media, 40);
-
-			// Show picture
-			struct VideoPicture* vp = &media->pictQueue[media->pictQueueIndexR];
-			assert(vp->texture &&
-			       vp->planeY && vp->planeU && vp->planeV);
-
-			SDL_UpdateYUVTexture(vp->texture, NULL,
-			                     vp->planeY, vp->width,
-			                     vp->planeU, vp->width / 2,
-			                     vp->planeV, vp->width / 2);
-			//SDL_SetRenderDrawColor(media->renderer, 255, 127, 255, 255);
-			SDL_RenderClear(media->renderer);
-			SDL_RenderCopy(media->renderer, vp->texture, NULL, 0);
-			SDL_RenderPresent(media->renderer);
-
-			++media->pictQueueIndexR;
-			if (media->pictQueueIndexR == PICTQUEUE_SIZE)
-				media->pictQueueIndexR = 0;
-			SDL_LockMutex(media->pictQueueMutex);
-			--media->pictQueueSize;
-			SDL_CondSignal(media->pictQueueCond);
-			SDL_UnlockMutex(media->pictQueueMutex);
-		}
+	case AVSEEK_SIZE:
+		return file->size;
+	case SEEK_SET:
+		break;
+	case SEEK_CUR:
+		offset += file->position;
+		break;
+	case SEEK_END:
+		offset += file->size;
+		break;
+	default:
+		return -1;
+	}
+	if (offset < 0) return -1;
+	file->position = offset;
+	return offset;
+}
+static struct AVIOContext* MemoryFile_io(struct MemoryFile* const file,
+    bool write)
+{
+	uint8_t* buffer = av_malloc(TEST_IO_BUFFER_SIZE);
+	if (!buffer) return NULL;
+	struct AVIOContext* io = avio_alloc_context(buffer, TEST_IO_BUFFER_SIZE,
+	                         write, file,
+	                         write ? NULL : MemoryFile_read,
+	                         write ? MemoryFile_write : NULL,
+	                         MemoryFile_seek);
+	if (!io) av_free(buffer);
+	return io;
+}
+static void MemoryFile_io_free(struct AVIOContext** io)
+{
+	if (!*io) return;
+	av_freep(&(*io)->buffer);
+	av_freep(io);
+}
+
+// Generation of synthetic media
+
+struct TestEncoder
+{
+	struct AVCodecContext* cc;
+	struct AVStream* stream;
+	struct AVFrame* frame;
+	int64_t nFrames; ///< Frames sent to the encoder
+	bool flushed;
+};
+
+static bool TestEncoder_open(struct TestEncoder* const te,
+                             struct AVFormatContext* const oc,
+                             struct TestCase const* const tc, bool video)
+{
+	memset(te, 0, sizeof(struct TestEncoder));
+	AVCodec* codec = avcodec_find_encoder(video ? tc->codecV : tc->codecA);
+	if (!codec) return false;
+	te->cc = avcodec_alloc_context3(codec);
+	if (!te->cc) return false;
+	if (video)
+	{
+		te->cc->width = tc->width;
+		te->cc->height = tc->height;
+		te->cc->pix_fmt = codec->pix_fmts ? codec->pix_fmts[0] :
+		                  AV_PIX_FMT_YUV420P;
+		te->cc->time_base = (AVRational) { 1, TEST_FPS };
+		te->cc->gop_size = TEST_FPS / 2;
+		te->cc->bit_rate = (int64_t) tc->width * tc->height * 4;
+	}
+	else
+	{
+		te->cc->sample_fmt = codec->sample_fmts ? codec->sample_fmts[0] :
+		                     AV_SAMPLE_FMT_S16;
+		te->cc->sample_rate = TEST_SAMPLE_RATE;
+		te->cc->channel_layout = AV_CH_LAYOUT_STEREO;
+		te->cc->channels = 2;
+		te->cc->time_base = (AVRational) { 1, TEST_SAMPLE_RATE };
+		te->cc->bit_rate = 192000;
+	}
+	// test_fill_samples writes interleaved 16-bit samples
+	if (!video && te->cc->sample_fmt != AV_SAMPLE_FMT_S16) return false;
+	if (oc->oformat->flags & AVFMT_GLOBALHEADER)
+		te->cc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+	if (avcodec_open2(te->cc, codec, NULL) < 0) return false;
+
+	te->stream = avformat_new_stream(oc, NULL);
+	if (!te->stream) return false;
+	te->stream->time_base = te->cc->time_base;
+	if (avcodec_parameters_from_context(te->stream->codecpar, te->cc) < 0)
+		return false;
+
+	te->frame = av_frame_alloc();
+	if (!te->frame) return false;
+	if (video)
+	{
+		te->frame->format = te->cc->pix_fmt;
+		te->frame->width = tc->width;
+		te->frame->height = tc->height;
+	}
+	else
+	{
+		// Encoders with variable frame size report 0
+		te->frame->nb_samples = te->cc->frame_size ? te->cc->frame_size : 1024;
+		te->frame->format = te->cc->sample_fmt;
+		te->frame->channel_layout = te->cc->channel_layout;
+		te->frame->sample_rate = te->cc->sample_rate;
+	}
+	return av_frame_get_buffer(te->frame, 32) >= 0;
+}
+static void TestEncoder_close(struct TestEncoder* const te)
+{
+	av_frame_free(&te->frame);
+	avcodec_free_context(&te->cc);
+}
+/**
+ * @return Presentation time in seconds of the next frame to be encoded
+ */
+static double TestEncoder_time(struct TestEncoder const* const te)
+{
+	if (te->cc->codec_type == AVMEDIA_TYPE_VIDEO)
+		return te->nFrames / (double) TEST_FPS;
+	return te->nFrames * te->frame->nb_samples / (double) TEST_SAMPLE_RATE;
+}
+/**
+ * @brief Moving luma gradient over neutral chroma
+ */
+static void test_fill_picture(struct AVFrame* const frame, int64_t index)
+{
+	for (int y = 0; y < frame->height; ++y)
+	{
+		uint8_t* row = frame->data[0] + y * frame->linesize[0];
+		for (int x = 0; x < frame->width; ++x)
+			row[x] = (uint8_t) (x + y + index * 4);
+	}
+	for (int plane = 1; plane < 3; ++plane)
+		memset(frame->data[plane], 128,
+		       frame->linesize[plane] * ((frame->height + 1) / 2));
+}
+/**
+ * @brief 440Hz sine wave
+ */
+static void test_fill_samples(struct AVFrame* const frame, int64_t index)
+{
+	int16_t* samples = (int16_t*) frame->data[0];
+	int64_t offset = index * frame->nb_samples;
+	for (int i = 0; i < frame->nb_samples; ++i)
+	{
+		double t = (offset + i) / (double) TEST_SAMPLE_RATE;
+		int16_t value = (int16_t) (8000 * sin(2 * M_PI * 440.0 * t));
+		samples[2 * i] = samples[2 * i + 1] = value;
+	}
+}
+/**
+ * @brief Encodes the next frame, or flushes the encoder once TEST_LENGTH is
+ *  reached, and writes the resulting packet.
+ */
+static bool TestEncoder_step(struct TestEncoder* const te,
+                             struct AVFormatContext* const oc)
+{
+	bool video = te->cc->codec_type == AVMEDIA_TYPE_VIDEO;
+	struct AVFrame* frame = NULL;
+	if (TestEncoder_time(te) < TEST_LENGTH)
+	{
+		if (av_frame_make_writable(te->frame) < 0) return false;
+		if (video) test_fill_picture(te->frame, te->nFrames);
+		else test_fill_samples(te->frame, te->nFrames);
+		te->frame->pts = video ? te->nFrames :
+		                 te->nFrames * te->frame->nb_samples;
+		frame = te->frame;
+		++te->nFrames;
+	}
+
+	AVPacket packet;
+	av_init_packet(&packet);
+	packet.data = NULL;
+	packet.size = 0;
+	int gotPacket = 0;
+	int result = video ?
+	             avcodec_encode_video2(te->cc, &packet, frame, &gotPacket) :
+	             avcodec_encode_audio2(te->cc, &packet, frame, &gotPacket);
+	if (result < 0) return false;
+	if (!gotPacket)
+	{
+		te->flushed = !frame;
+		return true;
+	}
+	av_packet_rescale_ts(&packet, te->cc->time_base, te->stream->time_base);
+	packet.stream_index = te->stream->index;
+	return av_interleaved_write_frame(oc, &packet) >= 0;
+}
+/**
+ * @brief Generates TEST_LENGTH seconds of media described by tc into file,
+ *  in the container of the muxer named container.
+ * @return false if an encoder is unavailable or fails.
+ */
+static bool test_generate_in(struct TestCase const* const tc,
+                             char const* container,
+                             struct MemoryFile* const file)
+{
+	bool success = false;
+	struct AVFormatContext* oc = NULL;
+	struct AVIOContext* io = NULL;
+	struct TestEncoder encoders[2];
+	unsigned nEncoders = 0;
+
+	if (avformat_alloc_output_context2(&oc, NULL, container, NULL) < 0)
+		return false;
+	io = MemoryFile_io(file, true);
+	if (!io) goto complete;
+	oc->pb = io;
+
+	if (!TestEncoder_open(&encoders[nEncoders++], oc, tc, true))
+		goto complete;
+	if (tc->codecA != AV_CODEC_ID_NONE &&
+	    !TestEncoder_open(&encoders[nEncoders++], oc, tc, false))
+		goto complete;
+	if (avformat_write_header(oc, NULL) < 0) goto complete;
+
+	// Encode in presentation order across streams
+	while (true)
+	{
+		struct TestEncoder* next = NULL;
+		for (unsigned i = 0; i < nEncoders; ++i)
+			if (!encoders[i].flushed &&
+			    (!next || TestEncoder_time(&encoders[i]) < TestEncoder_time(next)))
+				next = &encoders[i];
+		if (!next) break;
+		if (!TestEncoder_step(next, oc)) goto complete;
+	}
+	success = av_write_trailer(oc) >= 0;
+	avio_flush(io);
+
+complete:
+	for (unsigned i = 0; i < nEncoders; ++i)
+		TestEncoder_close(&encoders[i]);
+	avformat_free_context(oc);
+	MemoryFile_io_free(&io);
+	return success;
+}
+static bool test_generate(struct TestCase const* const tc,
+                          struct MemoryFile* const file)
+{
+	return test_generate_in(tc, TEST_CONTAINER, file);
+}
+
+// Playback
+
+static struct AVFormatContext* test_open(struct AVIOContext* const io)
+{
+	struct AVFormatContext* fc = avformat_alloc_context();
+	if (!fc) return NULL;
+	fc->pb = io;
+	fc->flags |= AVFMT_FLAG_CUSTOM_IO;
+	if (avformat_open_input(&fc, "", NULL, NULL) < 0)
+	{
+		fprintf(stderr, "Unable to open synthetic media\n");
+		return NULL; // fc is freed on failure
+	}
+	if (avformat_find_stream_info(fc, NULL) < 0)
+	{
+		fprintf(stderr, "Unable to find streams within synthetic media\n");
+		avformat_close_input(&fc);
+		return NULL;
+	}
+	return fc;
+}
+/**
+ * @param[in] output Shared by all cases, as in the interactive console
+ * @return -1 if the test case failed, 0 if skipped, 1 if passed.
+ */
+static int test_playback(struct TestCase const* const tc,
+                         struct Output* const output)
+{
+	fprintf(stdout, "[Test] %s\n", tc->name);
+	struct MemoryFile file;
+	memset(&file, 0, sizeof(struct MemoryFile));
+	if (!test_generate(tc, &file))
+	{
+		fprintf(stdout, "[Test] %s: Skipped, unable to encode\n", tc->name);
+		free(file.data);
+		return 0;
 	}
-	else test_schedule_refresh(media, 100);
+
+	file.position = 0;
+	struct AVIOContext* io = MemoryFile_io(&file, false);
+	struct AVFormatContext* fc = io ? test_open(io) : NULL;
+	if (!fc)
+	{
+		MemoryFile_io_free(&io);
+		free(file.data);
+		return -1;
+	}
+	struct PlaybackOptions options =
+	{
+		.duration = TEST_DURATION,
+		.output = output,
+		.filter = tc->filter
+	};
+	uint64_t timeBegin = SDL_GetTicks();
+	play_format(fc, tc->name, &options);
+	double elapsed = (SDL_GetTicks() - timeBegin) / 1000.0;
+	MemoryFile_io_free(&io);
+	free(file.data);
+
+	struct SyncStats const* const ss = playback_last_sync();
+	uint64_t nFrames = atomic_load(&ss->framesPresented);
+	double throughput = nFrames / TEST_DURATION;
+	uint64_t offset = Histogram_percentile(&ss->offsetAhead, 0.99);
+	uint64_t offsetBehind = Histogram_percentile(&ss->offsetBehind, 0.99);
+	if (offsetBehind > offset) offset = offsetBehind;
+
+	bool passed = true;
+	fprintf(stdout, "[Test] %s: %llu frames in %.2fs, %.1f fps, "
+	        "p99 A/V offset %.1fms\n", tc->name, (unsigned long long) nFrames,
+	        elapsed, throughput, offset / 1e6);
+	if (throughput < TEST_FPS * TEST_MIN_THROUGHPUT)
+	{
+		fprintf(stdout, "[Test] %s: Throughput below %.1f fps\n", tc->name,
+		        TEST_FPS * TEST_MIN_THROUGHPUT);
+		passed = false;
+	}
+	// Frames must not be presented faster than real time
+	if (nFrames > TEST_FPS * TEST_DURATION + TEST_FRAME_TOLERANCE)
+	{
+		fprintf(stdout, "[Test] %s: More frames than real time allows\n",
+		        tc->name);
+		passed = false;
+	}
+	if (tc->codecA != AV_CODEC_ID_NONE && offset > TEST_SYNC_BOUND * 1e9)
+	{
+		fprintf(stdout, "[Test] %s: A/V offset exceeds %.1fms\n", tc->name,
+		        TEST_SYNC_BOUND * 1e3);
+		passed = false;
+	}
+	fprintf(stdout, "[Test] %s: %s\n", tc->name, passed ? "Passed" : "Failed");
+	return passed ? 1 : -1;
+}
+
+// Containers
+
+#define TEST_EXPECT(condition) \
+	if (!(condition)) \
+	{ \
+		fprintf(stdout, "[Test] %s: Expected %s\n", __func__, #condition); \
+		return false; \
+	}
+
+VECTOR_DEFINE(TestVector, int)
+SMALLVECTOR_DEFINE(TestSmallVector, int, 4)
+
+static bool test_vector(void)
+{
+	TestVector v;
+	TestVector_init(&v);
+	for (int i = 0; i < 1000; ++i)
+		TEST_EXPECT(TestVector_push_back(&v, i));
+	TEST_EXPECT(TestVector_size(&v) == 1000);
+	// Geometric growth
+	TEST_EXPECT(v.base.capacity >= 1000 && v.base.capacity < 2000);
+	for (int i = 0; i < 1000; ++i)
+		TEST_EXPECT(TestVector_at(&v, i) == i);
+
+	TestVector_remove(&v, 0);
+	TEST_EXPECT(TestVector_at(&v, 0) == 1 && TestVector_at(&v, 998) == 999);
+	TestVector_remove_unordered(&v, 0);
+	TEST_EXPECT(TestVector_at(&v, 0) == 999 && TestVector_at(&v, 1) == 2);
+	TEST_EXPECT(TestVector_size(&v) == 998);
+	TestVector_pop_back(&v);
+	TEST_EXPECT(TestVector_at(&v, 996) == 997);
+	TestVector_clear(&v);
+	TEST_EXPECT(TestVector_size(&v) == 0);
+	TestVector_destroy(&v);
+
+	TestSmallVector sv;
+	TestSmallVector_init(&sv);
+	for (int i = 0; i < 4; ++i)
+		TestSmallVector_push_back(&sv, i);
+	TEST_EXPECT(sv.base.data == sv.buffer);
+	TEST_EXPECT(TestSmallVector_push_back(&sv, 4));
+	TEST_EXPECT(sv.base.data != sv.buffer);
+	for (int i = 0; i < 5; ++i)
+		TEST_EXPECT(TestSmallVector_at(&sv, i) == i);
+	TestSmallVector_destroy(&sv);
+	TEST_EXPECT(sv.base.data == sv.buffer && TestSmallVector_size(&sv) == 0);
+	return true;
+}
+static bool test_pool(void)
+{
+	Pool pool;
+	Pool_init(&pool, 24, 8);
+	void* objects[20];
+	for (int i = 0; i < 20; ++i)
+	{
+		objects[i] = Pool_alloc(&pool);
+		TEST_EXPECT(objects[i]);
+		memset(objects[i], i, 24);
+	}
+	TEST_EXPECT(Pool_allocated(&pool) == 20);
+	size_t const footprint = Pool_footprint(&pool);
+	for (int i = 0; i < 20; ++i)
+		TEST_EXPECT(((unsigned char*) objects[i])[23] == i);
+
+	// Released objects are reused before the pool grows
+	for (int i = 0; i < 20; ++i)
+		Pool_free(&pool, objects[i]);
+	TEST_EXPECT(Pool_allocated(&pool) == 0);
+	for (int i = 0; i < 20; ++i)
+		objects[i] = Pool_alloc(&pool);
+	TEST_EXPECT(Pool_footprint(&pool) == footprint);
+	TEST_EXPECT(objects[0] != objects[1]);
+	Pool_destroy(&pool);
+	return true;
+}
+static bool test_containers(void)
+{
+	bool passed = test_vector() && test_pool();
+	fprintf(stdout, "[Test] containers: %s\n", passed ? "Passed" : "Failed");
+	return passed;
+}
+
+// Scheduler
+
+#define TEST_TASKS 64
+
+static void test_task_leaf(void* data)
+{
+	atomic_fetch_add((_Atomic unsigned*) data, 1);
+}
+// Submits and waits for nested tasks from within a task
+static void test_task_nested(void* data)
+{
+	struct TaskGroup group;
+	TaskGroup_init(&group);
+	for (int i = 0; i < TEST_TASKS; ++i)
+		scheduler_submit(&group, test_task_leaf, data);
+	TaskGroup_wait(&group);
+}
+static bool test_scheduler(void)
+{
+	_Atomic unsigned count;
+	atomic_init(&count, 0);
+	struct TaskGroup group;
+	TaskGroup_init(&group);
+	for (int i = 0; i < TEST_TASKS; ++i)
+		scheduler_submit(&group, test_task_nested, &count);
+	TaskGroup_wait(&group);
+	bool passed = atomic_load(&count) == TEST_TASKS * TEST_TASKS;
+	fprintf(stdout, "[Test] scheduler: %u workers, %s\n", scheduler_workers(),
+	        passed ? "Passed" : "Failed");
+	return passed;
+}
+
+// Thread policy
+
+#ifdef __linux__
+struct TestPolicy
+{
+	int policy; ///< Of the child thread
+	int nCpus; ///< Of the child thread
+	bool realtime; ///< The parent thread obtained SCHED_FIFO
+};
+static int test_policy_child(void* data)
+{
+	struct TestPolicy* const result = data;
+	thread_policy_apply(THREAD_ROLE_WORKER);
+	struct sched_param param;
+	pthread_getschedparam(pthread_self(), &result->policy, &param);
+	cpu_set_t set;
+	result->nCpus = pthread_getaffinity_np(pthread_self(), sizeof(set),
+	                                       &set) == 0 ? CPU_COUNT(&set) : -1;
+	return 0;
+}
+/**
+ * @brief Pins itself to CPU 0 and, if permitted, runs with SCHED_FIFO as the
+ *  presentation thread may, then starts a worker thread.
+ */
+static int test_policy_parent(void* data)
+{
+	struct TestPolicy* const result = data;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(0, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	struct sched_param param = { .sched_priority = 1 };
+	result->realtime = pthread_setschedparam(pthread_self(), SCHED_FIFO,
+	                                         &param) == 0;
+	SDL_WaitThread(SDL_CreateThread(test_policy_child, "policy child", data),
+	               NULL);
+	return 0;
 }
-static void test_fill_rgb24(uint8_t* const data, size_t width, size_t height)
+/**
+ * @brief A thread applying a role without policy does not keep the policy
+ *  and affinity inherited from its creator.
+ */
+static bool test_thread_policy(void)
 {
-	size_t width2 = width / 2;
-	size_t height2 = height / 2;
-	for (size_t i = 0; i < width2; ++i)
+	struct TestPolicy result = { .policy = -1, .nCpus = -1 };
+	SDL_WaitThread(SDL_CreateThread(test_policy_parent, "policy parent",
+	                                &result), NULL);
+	long const nCpus = sysconf(_SC_NPROCESSORS_ONLN);
+	fprintf(stdout, "[Test] thread policy: %d of %ld CPUs, %s from %s\n",
+	        result.nCpus, nCpus, result.policy == SCHED_OTHER ? "SCHED_OTHER" :
+	        "another policy", result.realtime ? "SCHED_FIFO" : "SCHED_OTHER");
+	TEST_EXPECT(result.policy == SCHED_OTHER);
+	// Not left on the CPU of the parent
+	TEST_EXPECT(result.nCpus > 1 || nCpus == 1);
+	return true;
+}
+#endif
+
+// Governor
+
+#define TEST_GOVERNOR_FRAMES 1000
+
+static bool test_governor(void)
+{
+	struct Governor gov;
+	Governor_init(&gov, true);
+	// Decoding takes the entire frame interval
+	int nFrames = 0;
+	while (gov.level == GOVERNOR_FULL && nFrames < TEST_GOVERNOR_FRAMES)
+	{
+		Governor_update(&gov, 0.04, 0.04, 1);
+		++nFrames;
+	}
+	TEST_EXPECT(gov.level == GOVERNOR_SKIP_LOOP_FILTER);
+	for (int i = 0; i < TEST_GOVERNOR_FRAMES; ++i)
+		Governor_update(&gov, 0.04, 0.04, 0);
+	TEST_EXPECT(gov.level == GOVERNOR_LEVEL_COUNT - 1);
+
+	// Recovers one level at a time, not before GOVERNOR_RECOVER_FRAMES
+	nFrames = 0;
+	while (gov.level == GOVERNOR_LEVEL_COUNT - 1 &&
+	       nFrames < TEST_GOVERNOR_FRAMES)
 	{
-		for (size_t j = 0; j < height2; ++j)
+		Governor_update(&gov, 0.01, 0.04, 1);
+		++nFrames;
+	}
+	TEST_EXPECT(nFrames >= GOVERNOR_RECOVER_FRAMES);
+	TEST_EXPECT(gov.level == GOVERNOR_LEVEL_COUNT - 2);
+	// A slow source alone is no pressure
+	for (int i = 0; i < TEST_GOVERNOR_FRAMES; ++i)
+		Governor_update(&gov, 0.01, 0.04, 0);
+	TEST_EXPECT(gov.level == GOVERNOR_LEVEL_COUNT - 2);
+
+	// Skipping frames, the decode time of each decoded frame covers those
+	// skipped before it
+	while (gov.level < GOVERNOR_SKIP_FRAME)
+		Governor_update(&gov, 0.04, 0.04, 0);
+	for (nFrames = 0; gov.level == GOVERNOR_SKIP_FRAME &&
+	     nFrames < TEST_GOVERNOR_FRAMES; ++nFrames)
+		Governor_update(&gov, 2 * 0.012, 2 * 0.04, 1);
+	TEST_EXPECT(gov.level == GOVERNOR_SKIP_FRAME - 1);
+
+	Governor_init(&gov, false);
+	for (int i = 0; i < TEST_GOVERNOR_FRAMES; ++i)
+		Governor_update(&gov, 0.08, 0.04, 0);
+	TEST_EXPECT(gov.level == GOVERNOR_FULL && gov.nChanges == 0);
+	TEST_EXPECT(gov.frames[GOVERNOR_FULL] == TEST_GOVERNOR_FRAMES);
+
+	fprintf(stdout, "[Test] governor: Passed\n");
+	return true;
+}
+
+// Library
+
+static bool test_write_file(char const* path, void const* data, size_t size)
+{
+	FILE* file = fopen(path, "wb");
+	if (!file) return false;
+	bool success = fwrite(data, 1, size, file) == size;
+	return fclose(file) == 0 && success;
+}
+static struct LibraryEntry const* test_library_find(
+  struct Library const* const lib, char const* path)
+{
+	for (size_t i = 0; i < LibraryEntries_size(&lib->entries); ++i)
+		if (strcmp(LibraryEntries_ptr(&lib->entries, i)->path, path) == 0)
+			return LibraryEntries_ptr(&lib->entries, i);
+	return NULL;
+}
+static bool test_library_scan(char const* dir)
+{
+	char pathMedia[PATH_MAX], pathText[PATH_MAX], pathIndex[PATH_MAX];
+	snprintf(pathMedia, sizeof(pathMedia), "%s/a.mkv", dir);
+	snprintf(pathText, sizeof(pathText), "%s/b.txt", dir);
+	snprintf(pathIndex, sizeof(pathIndex), "%s/index", dir);
+
+	struct MemoryFile file;
+	memset(&file, 0, sizeof(struct MemoryFile));
+	bool const generated = test_generate(&testCases[0], &file);
+	TEST_EXPECT(!generated || test_write_file(pathMedia, file.data, file.size));
+	free(file.data);
+	TEST_EXPECT(test_write_file(pathText, "Not media", 9));
+
+	struct Library lib;
+	Library_init(&lib, pathIndex);
+	TEST_EXPECT(LibraryEntries_size(&lib.entries) == 0);
+	TEST_EXPECT(Library_scan(&lib, dir, NULL));
+	Library_destroy(&lib);
+
+	// Read back from the index
+	Library_init(&lib, pathIndex);
+	struct LibraryEntry const* const text = test_library_find(&lib, pathText);
+	struct LibraryEntry const* const media = test_library_find(&lib, pathMedia);
+	bool passed = text && text->nStreams == 0 && text->size == 9;
+	if (generated)
+		passed = passed && media && media->nStreams == 2 &&
+		         media->width == testCases[0].width &&
+		         strcmp(media->codecV, "mpeg4") == 0 && media->nKeyframes > 0 &&
+		         fabs(media->duration - TEST_LENGTH) < 0.5;
+	// Removed files leave the index, which is not indexed itself
+	remove(pathText);
+	passed = passed && !test_library_find(&lib, pathIndex) &&
+	         Library_scan(&lib, dir, NULL) &&
+	         !test_library_find(&lib, pathText) &&
+	         Library_print(&lib, NULL, stdout) == (generated ? 1 : 0);
+	Library_destroy(&lib);
+
+	// A count beyond the size of the file is read as truncated
+	uint32_t const counts[2] = { 1, UINT32_MAX }; // Version and count
+	char corrupt[8 + sizeof(counts)] = "CHALLIB";
+	memcpy(corrupt + 8, counts, sizeof(counts));
+	passed = passed && test_write_file(pathIndex, corrupt, sizeof(corrupt));
+	Library_init(&lib, pathIndex);
+	passed = passed && LibraryEntries_size(&lib.entries) == 0 &&
+	         lib.entries.base.capacity < 1024;
+	Library_destroy(&lib);
+
+	remove(pathMedia);
+	remove(pathIndex);
+	TEST_EXPECT(passed);
+	return true;
+}
+/**
+ * @brief Runs body in a new temporary directory, which body must empty.
+ */
+static bool test_in_directory(char const* name, bool (*body)(char const* dir))
+{
+	char dir[] = "/tmp/chalcocite-XXXXXX";
+	if (!mkdtemp(dir))
+	{
+		fprintf(stdout, "[Test] %s: Skipped, unable to create %s\n", name, dir);
+		return true;
+	}
+	bool passed = body(dir);
+	rmdir(dir);
+	fprintf(stdout, "[Test] %s: %s\n", name, passed ? "Passed" : "Failed");
+	return passed;
+}
+
+// Export
+
+#define TEST_EXPORT_START 1.1
+#define TEST_EXPORT_END 2.0
+
+/**
+ * @brief Decodes the first video frame of a file.
+ * @param[out] luma Top-left luma sample, index * 4 of test_fill_picture
+ */
+static bool test_first_luma(char const* path, int* const luma)
+{
+	struct AVFormatContext* fc = av_open_file(path);
+	if (!fc) return false;
+	int const index = av_find_best_stream(fc, AVMEDIA_TYPE_VIDEO, -1, -1, NULL,
+	                                      0);
+	struct AVCodecContext* cc = NULL;
+	struct AVFrame* frame = av_frame_alloc();
+	int finished = 0;
+	if (index >= 0 && frame && av_stream_context(fc, index, &cc, false))
+	{
+		struct AVPacket packet;
+		while (!finished && av_read_frame(fc, &packet) >= 0)
 		{
-			size_t base = i + j * width;
-			data[base * 3 + 0] = 0;
-			data[base * 3 + 1] = 127;
-			data[base * 3 + 2] = 255;
+			if (packet.stream_index == index)
+				avcodec_decode_video2(cc, frame, &finished, &packet);
+			av_packet_unref(&packet);
 		}
-		for (size_t j = height2; j < height; ++j)
+		if (!finished)
 		{
-			size_t base = i + j * width;
-			data[base * 3 + 0] = 255;
-			data[base * 3 + 1] = 255;
-			data[base * 3 + 2] = 0;
+			av_init_packet(&packet);
+			packet.data = NULL;
+			packet.size = 0;
+			avcodec_decode_video2(cc, frame, &finished, &packet);
 		}
+		if (finished) *luma = frame->data[0][0];
 	}
-	for (size_t i = width2; i < width; ++i)
+	av_frame_free(&frame);
+	avcodec_free_context(&cc);
+	avformat_close_input(&fc);
+	return finished;
+}
+/**
+ * @brief Exports from a Matroska file, and from an MPEG-TS one, whose
+ *  timestamps do not begin at 0.
+ */
+static bool test_export_segment(char const* dir)
+{
+	char pathIn[PATH_MAX], pathOut[PATH_MAX];
+	snprintf(pathOut, sizeof(pathOut), "%s/out.mkv", dir);
+	char const* const containers[] = { TEST_CONTAINER, "mpegts" };
+	for (unsigned c = 0; c < sizeof(containers) / sizeof(containers[0]); ++c)
 	{
-		for (size_t j = 0; j < height2; ++j)
+		snprintf(pathIn, sizeof(pathIn), "%s/in.%s", dir, containers[c]);
+		struct MemoryFile file;
+		memset(&file, 0, sizeof(struct MemoryFile));
+		if (!test_generate_in(&testCases[0], containers[c], &file))
 		{
-			size_t base = i + j * width;
-			data[base * 3 + 0] = 0;
-			data[base * 3 + 1] = 0;
-			data[base * 3 + 2] = 255;
+			free(file.data);
+			continue; // Skipped
 		}
-		for (size_t j = height2; j < height; ++j)
+		bool const written = test_write_file(pathIn, file.data, file.size);
+		free(file.data);
+		TEST_EXPECT(written);
+
+		bool passed = export_segment(pathIn, TEST_EXPORT_START, TEST_EXPORT_END,
+		                             pathOut, false);
+		struct AVFormatContext* fc = passed ? av_open_file(pathOut) : NULL;
+		// From the preceding key frame, at most a GOP earlier
+		int const gop = TEST_FPS / 2;
+		if (fc)
 		{
-			size_t base = i + j * width;
-			data[base * 3 + 0] = 255;
-			data[base * 3 + 1] = 127;
-			data[base * 3 + 2] = 0;
+			double const duration = fc->duration / (double) AV_TIME_BASE;
+			passed = fc->nb_streams == 2 &&
+			         duration > TEST_EXPORT_END - TEST_EXPORT_START - 0.1 &&
+			         duration < TEST_EXPORT_END - TEST_EXPORT_START +
+			                    (gop + 1) / (double) TEST_FPS;
+			fprintf(stdout, "[Test] export: %.3fs exported from %s\n", duration,
+			        containers[c]);
+			avformat_close_input(&fc);
 		}
+		else
+			passed = false;
+		// The first picture is the key frame before the start, with a margin
+		// for the encoding
+		int luma = -1;
+		int const first = (int) (TEST_EXPORT_START * TEST_FPS);
+		passed = passed && test_first_luma(pathOut, &luma) &&
+		         luma >= (first - gop) * 4 - 8 && luma <= first * 4 + 8;
+		// Accurate cuts are refused without edit lists, leaving no output
+		remove(pathOut);
+		passed = passed && !export_segment(pathIn, TEST_EXPORT_START,
+		                                   TEST_EXPORT_END, pathOut, true) &&
+		         access(pathOut, F_OK) != 0;
+		remove(pathIn);
+		remove(pathOut);
+		TEST_EXPECT(passed);
+	}
+	return true;
+}
+
+// Frame cache
+
+#define TEST_FRAME_CACHE_FRAMES 4 // Fit in the budget
+
+static bool test_frame_cache(void)
+{
+	struct AVFrame* frame = av_frame_alloc();
+	TEST_EXPECT(frame);
+	frame->format = AV_PIX_FMT_YUV420P;
+	frame->width = frame->height = 64;
+	if (av_frame_get_buffer(frame, 32) < 0)
+	{
+		av_frame_free(&frame);
+		TEST_EXPECT(false);
+	}
+	int64_t size = 0;
+	for (size_t i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; ++i)
+		size += frame->buf[i]->size;
+
+	struct FrameCache cache;
+	FrameCache_init(&cache, size * TEST_FRAME_CACHE_FRAMES);
+	for (int64_t pts = 0; pts < 10; ++pts)
+		FrameCache_put(&cache, frame, pts, 1);
+	av_frame_free(&frame);
+	bool passed = FrameCacheEntries_size(&cache.entries) ==
+	              TEST_FRAME_CACHE_FRAMES && cache.nEvictions == 6;
+	// The least recently used frame is evicted, not the oldest one
+	frame = FrameCache_get(&cache, 6);
+	passed = passed && frame;
+	if (frame)
+	{
+		FrameCache_put(&cache, frame, 10, 1);
+		av_frame_free(&frame);
 	}
+	frame = FrameCache_get(&cache, 7);
+	passed = passed && !frame;
+	av_frame_free(&frame);
+
+	// 6, 8, 9 and 10 are cached
+	int64_t found = AV_NOPTS_VALUE;
+	frame = FrameCache_step(&cache, 8, 1, &found);
+	passed = passed && frame && found == 9;
+	av_frame_free(&frame);
+	frame = FrameCache_step(&cache, 10, -1, &found);
+	passed = passed && frame && found == 9;
+	av_frame_free(&frame);
+	// 7 is missing
+	frame = FrameCache_step(&cache, 8, -1, &found);
+	passed = passed && !frame && FrameCache_run_begin(&cache, 10) == 8;
+	av_frame_free(&frame);
+	FrameCache_destroy(&cache);
+	TEST_EXPECT(passed);
+	TEST_EXPECT(memstats_get(MEM_FRAME_CACHE) == 0);
+
+	fprintf(stdout, "[Test] frame cache: Passed\n");
+	return true;
 }
-static int test_video_thread(struct Media* const media)
+static bool test_frame_cache_gop(char const* dir)
 {
-	uint8_t* dataIn[3];
-	uint8_t dataInRGB[TEST_WIDTH_IN * TEST_HEIGHT_IN * 3];
-	dataIn[0] = dataInRGB;
-	dataIn[1] = dataInRGB;
-	dataIn[2] = dataInRGB;
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/gop.mkv", dir);
+	struct MemoryFile file;
+	memset(&file, 0, sizeof(struct MemoryFile));
+	if (!test_generate(&testCases[0], &file))
+	{
+		free(file.data);
+		return true; // Skipped
+	}
+	bool const written = test_write_file(path, file.data, file.size);
+	free(file.data);
+	TEST_EXPECT(written);
 
-	int linesizeIn[3];
-	linesizeIn[0] = TEST_WIDTH_IN * 3;
-	linesizeIn[1] = TEST_WIDTH_IN * 3;
-	linesizeIn[2] = TEST_WIDTH_IN * 3;
-	uint8_t* dataOut[3];
-	int linesizeOut[3];
-	
-	test_fill_rgb24(dataInRGB, TEST_WIDTH_IN, TEST_HEIGHT_IN);
-	size_t pitchUV = media->outWidth / 2;
+	struct AVFormatContext* fc = av_open_file(path);
+	int const index = fc ? av_find_best_stream(fc, AVMEDIA_TYPE_VIDEO, -1, -1,
+	                                           NULL, 0) : -1;
+	bool passed = index >= 0;
+	if (passed)
+	{
+		AVRational const timeBase = fc->streams[index]->time_base;
+		int64_t const target = av_rescale_q(1, (AVRational) { 1, 1 }, timeBase);
+		// Decoded from the preceding key frame
+		int64_t const gop = av_rescale_q(TEST_FPS / 2,
+		                                 (AVRational) { 1, TEST_FPS }, timeBase);
+		struct FrameCache cache;
+		FrameCache_init(&cache, FRAME_CACHE_BUDGET_DEFAULT);
+		struct GopDecoder dec;
+		GopDecoder_init(&dec, &cache, path, index);
+		passed = GopDecoder_submit(&dec, target);
+		GopDecoder_wait(&dec);
+		int64_t const begin = FrameCache_run_begin(&cache, target);
+		struct AVFrame* frame = FrameCache_get(&cache, target);
+		passed = passed && frame && begin != AV_NOPTS_VALUE &&
+		         target - begin < gop && begin <= target &&
+		         frame->width == testCases[0].width;
+		av_frame_free(&frame);
+		GopDecoder_destroy(&dec);
+		FrameCache_destroy(&cache);
+	}
+	avformat_close_input(&fc);
+	remove(path);
+	TEST_EXPECT(passed);
+	return true;
+}
 
-	while (true)
+// Sinks
+
+/**
+ * @brief Plays the synthetic media of tc to sink until its end.
+ */
+static bool test_play_sink(struct TestCase const* const tc, char const* sink)
+{
+	struct MemoryFile file;
+	memset(&file, 0, sizeof(struct MemoryFile));
+	bool const generated = test_generate(tc, &file);
+	file.position = 0;
+	struct AVIOContext* io = generated ? MemoryFile_io(&file, false) : NULL;
+	struct AVFormatContext* fc = io ? test_open(io) : NULL;
+	bool const opened = fc;
+	if (opened)
+	{
+		struct PlaybackOptions options = { .sink = sink };
+		play_format(fc, tc->name, &options); // Closes fc
+	}
+	MemoryFile_io_free(&io);
+	free(file.data);
+	return opened;
+}
+static long test_file_size(char const* path)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file) return -1;
+	fseek(file, 0, SEEK_END);
+	long const size = ftell(file);
+	fclose(file);
+	return size;
+}
+static bool test_sink(char const* dir)
+{
+	_Atomic enum State state = STATE_NORMAL;
+	struct Sink sink;
+	TEST_EXPECT(!Sink_init(&sink, "y4m", &state));
+	TEST_EXPECT(!Sink_init(&sink, "null:x", &state));
+	TEST_EXPECT(!Sink_init(&sink, "tv", &state));
+
+	// The chroma siting of MPEG-2 and later in the header
+	char path[PATH_MAX], spec[PATH_MAX + 4];
+	snprintf(path, sizeof(path), "%s/out.y4m", dir);
+	snprintf(spec, sizeof(spec), "y4m:%s", path);
+	bool opened = Sink_init(&sink, spec, &state) &&
+	              Sink_open_video(&sink, 64, 48, (AVRational) { 25, 1 },
+	                              (AVRational) { 1, 1 }, AVCHROMA_LOC_LEFT);
+	Sink_destroy(&sink);
+	char line[64] = "";
+	FILE* file = opened ? fopen(path, "rb") : NULL;
+	if (file)
 	{
+		opened = fgets(line, sizeof(line), file) != NULL;
+		fclose(file);
+	}
+	remove(path);
+	TEST_EXPECT(opened && strcmp(line, "YUV4MPEG2 W64 H48 F25:1 Ip A1:1 "
+	                             "C420mpeg2\n") == 0);
 
-		if (!Media_pictQueue_wait_write(media)) break;
-		struct VideoPicture* vp = &media->pictQueue[media->pictQueueIndexW];
-		dataOut[0] = vp->planeY;
-		dataOut[1] = vp->planeU;
-		dataOut[2] = vp->planeV;
-		linesizeOut[0] = media->outWidth;
-		linesizeOut[1] = pitchUV;
-		linesizeOut[2] = pitchUV;
+	// Every frame, including those the decoder holds at the end
+	struct TestCase const* const tc = &testCases[0];
+	bool const playedV = test_play_sink(tc, spec);
+	long const sizeV = test_file_size(path);
+	remove(path);
+	long const sizeFrame = 6 + tc->width * tc->height * 3 / 2;
+	long const header = playedV && sizeV > 0 ? sizeV % sizeFrame : 0;
+	fprintf(stdout, "[Test] sink: %ld bytes of Y4M\n", sizeV);
+	TEST_EXPECT(playedV);
+	TEST_EXPECT(header > 0 && header < 64);
+	TEST_EXPECT(sizeV / sizeFrame == (long) (TEST_LENGTH * TEST_FPS));
 
+	snprintf(path, sizeof(path), "%s/out.wav", dir);
+	snprintf(spec, sizeof(spec), "wav:%s", path);
+	bool const playedA = test_play_sink(tc, spec);
+	long const sizeA = test_file_size(path);
+	remove(path);
+	long const expected = TEST_LENGTH * TEST_SAMPLE_RATE * 2 * 2; // Stereo S16
+	fprintf(stdout, "[Test] sink: %ld bytes of WAV\n", sizeA);
+	TEST_EXPECT(playedA);
+	TEST_EXPECT(sizeA > expected * 0.95 && sizeA < expected * 1.05);
+	return true;
+}
 
-		sws_scale(media->swsContext,
-		          (uint8_t const* const*) dataIn, linesizeIn, 0, TEST_HEIGHT_IN,
-		          dataOut, linesizeOut);
+// Mixer
 
-		// Move picture queue writing index
-		if (++media->pictQueueIndexW == PICTQUEUE_SIZE)
-			media->pictQueueIndexW = 0;
-		SDL_LockMutex(media->pictQueueMutex);
-		++media->pictQueueSize;
-		SDL_UnlockMutex(media->pictQueueMutex);
+static bool test_mixer_kernels(void)
+{
+	// Lengths that are not a multiple of the vector width
+	float a[13], b[13];
+	for (int i = 0; i < 13; ++i)
+	{
+		a[i] = (float) i;
+		b[i] = 1.f;
 	}
-	return 0;
+	mixer_gain_add(b, a, 0.5f, 13);
+	bool passed = true;
+	for (int i = 0; i < 13; ++i)
+		passed = passed && b[i] == 1.f + i * 0.5f;
+	mixer_gain_set(b, a, 2.f, 13);
+	for (int i = 0; i < 13; ++i)
+		passed = passed && b[i] == 2.f * i;
+	TEST_EXPECT(passed);
+
+	float left[11], right[11];
+	for (int i = 0; i < 11; ++i)
+	{
+		left[i] = i % 3 ? 0.25f : 2.f;
+		right[i] = i % 2 ? -2.f : -0.25f;
+	}
+	float const* planes[2] = { left, right };
+	int16_t samples[22];
+	mixer_interleave_s16(samples, planes, 2, 11);
+	for (int i = 0; i < 11; ++i)
+		passed = passed && samples[2 * i] == (i % 3 ? 8192 : INT16_MAX) &&
+		         samples[2 * i + 1] == (i % 2 ? INT16_MIN : -8192);
+	mixer_interleave_s16(samples, planes, 1, 11);
+	for (int i = 0; i < 11; ++i)
+		passed = passed && samples[i] == (i % 3 ? 8192 : INT16_MAX);
+	TEST_EXPECT(passed);
+	return true;
 }
-void test()
+static bool test_mixer_parse(void)
 {
-	fprintf(stdout, "Executing Chalcocite test routine\n");
+	struct MixerTrackSpec specs[MIXER_TRACKS_MAX];
+	unsigned nSpecs = 0;
+	TEST_EXPECT(mixer_parse_tracks("0,1:-6", specs, &nSpecs));
+	TEST_EXPECT(nSpecs == 2 && specs[0].index == 0 && specs[0].gain == 1.f);
+	TEST_EXPECT(specs[1].index == 1 && fabsf(specs[1].gain - 0.501f) < 1e-3f);
+	TEST_EXPECT(!mixer_parse_tracks("", specs, &nSpecs));
+	TEST_EXPECT(!mixer_parse_tracks("0,", specs, &nSpecs));
+	TEST_EXPECT(!mixer_parse_tracks("0:loud", specs, &nSpecs));
+	TEST_EXPECT(!mixer_parse_tracks("0,1,2,3,4,5,6,7,8", specs, &nSpecs));
 
-	struct Media media;
-	Media_init(&media);
-	media.state = STATE_NORMAL;
-
-	media.streamV = (void*) 1;
-	media.outWidth = TEST_WIDTH_IN;
-	media.outHeight = TEST_HEIGHT_IN;
-	media.screen = SDL_CreateWindow("Test",
-	                                SDL_WINDOWPOS_UNDEFINED,
-	                                SDL_WINDOWPOS_UNDEFINED,
-	                                media.outWidth, media.outHeight,
-	                                SDL_WINDOW_RESIZABLE);
-	media.renderer = SDL_CreateRenderer(media.screen, -1, 0);
-
-	media.swsContext = sws_getContext(TEST_WIDTH_IN, TEST_HEIGHT_IN,
-	                                  TEST_PIXFMT_IN,
-	                                  media.outWidth, media.outHeight,
-	                                  AV_PIX_FMT_YUV420P, SWS_BILINEAR,
-	                                  NULL, NULL, NULL);
-	Media_pictQueue_init(&media);
-
-	media.threadVideo = SDL_CreateThread((SDL_ThreadFunction) test_video_thread,
-	                                     "video", &media);
-	test_schedule_refresh(&media, 40);
-	while (true)
+	int64_t layout = 0;
+	float matrix[MIXER_CHANNELS_MAX * MIXER_CHANNELS_MAX];
+	int nColumns = -1;
+	TEST_EXPECT(mixer_parse_downmix("stereo", &layout, matrix, &nColumns));
+	TEST_EXPECT(layout == AV_CH_LAYOUT_STEREO && nColumns == 0);
+	TEST_EXPECT(mixer_parse_downmix("stereo:1,0,0.5|0,1,0.5", &layout, matrix,
+	                                &nColumns));
+	TEST_EXPECT(nColumns == 3 && matrix[2] == 0.5f &&
+	            matrix[MIXER_CHANNELS_MAX + 1] == 1.f);
+	// Rows of unequal length, too many rows, unknown layout
+	TEST_EXPECT(!mixer_parse_downmix("stereo:1,0|0", &layout, NULL, NULL));
+	TEST_EXPECT(!mixer_parse_downmix("stereo:1|1|1", &layout, NULL, NULL));
+	TEST_EXPECT(!mixer_parse_downmix("bogus", &layout, NULL, NULL));
+	return true;
+}
+static struct AVFrame* test_mixer_frame(int channels, int nSamples,
+                                        float value)
+{
+	struct AVFrame* frame = av_frame_alloc();
+	if (!frame) return NULL;
+	frame->format = AV_SAMPLE_FMT_FLTP;
+	frame->channels = channels;
+	frame->channel_layout = av_get_default_channel_layout(channels);
+	frame->nb_samples = nSamples;
+	if (av_frame_get_buffer(frame, 0) < 0)
 	{
-		SDL_Event event;
-		SDL_WaitEvent(&event);
-		switch (event.type)
-		{
-		case CHAL_EVENT_QUIT:
-		case SDL_QUIT:
-			media.state = STATE_QUIT;
-			SDL_Quit();
-			goto finish;
-			break;
-		case CHAL_EVENT_REFRESH:
-			test_video_refresh_timer(event.user.data1);
-			break;
-		default:
-			break;
-		}
+		av_frame_free(&frame);
+		return NULL;
 	}
+	for (int c = 0; c < channels; ++c)
+		for (int i = 0; i < nSamples; ++i)
+			((float*) frame->extended_data[c])[i] = value;
+	return frame;
+}
+static bool test_mixer(void)
+{
+	if (!test_mixer_kernels() || !test_mixer_parse())
+		return false;
+
+	// Stereo track at full gain and mono track at half gain, in stereo
+	struct AVCodecContext* cc[2] =
+	{
+		avcodec_alloc_context3(NULL), avcodec_alloc_context3(NULL)
+	};
+	struct AVFrame* stereo = test_mixer_frame(2, 1000, 0.25f);
+	struct AVFrame* mono = test_mixer_frame(1, 600, 0.5f);
+	struct AudioMixer mixer;
+	AudioMixer_init(&mixer, NULL, NULL);
+	bool passed = cc[0] && cc[1] && stereo && mono;
+	for (int i = 0; passed && i < 2; ++i)
+	{
+		cc[i]->sample_fmt = AV_SAMPLE_FMT_FLTP;
+		cc[i]->sample_rate = TEST_SAMPLE_RATE;
+		cc[i]->channels = 2 - i;
+		cc[i]->channel_layout = av_get_default_channel_layout(2 - i);
+	}
+	passed = passed && AudioMixer_add_track(&mixer, 1, cc[0], 1.f) &&
+	         AudioMixer_add_track(&mixer, 3, cc[1], 0.5f);
+	if (passed)
+		cc[1] = NULL; // Owned by the mixer
+	passed = passed && AudioMixer_enabled(&mixer) &&
+	         AudioMixer_track(&mixer, 3) == 1 &&
+	         AudioMixer_track(&mixer, 2) < 0 &&
+	         AudioMixer_start(&mixer, TEST_SAMPLE_RATE) &&
+	         mixer.channels == 2;
+
+	static int16_t samples[MIXER_PULL_FRAMES * MIXER_CHANNELS_MAX];
+	// Waits for the second track
+	passed = passed && AudioMixer_push(&mixer, 0, stereo) &&
+	         AudioMixer_pull(&mixer, samples, MIXER_PULL_FRAMES) == 0;
+	passed = passed && AudioMixer_push(&mixer, 1, mono) &&
+	         AudioMixer_pull(&mixer, samples, MIXER_PULL_FRAMES) == 600;
+	int const expected =
+		(int) lrintf((0.25f + 0.5f * 0.5f * (float) M_SQRT1_2) * INT16_MAX);
+	passed = passed && abs(samples[0] - expected) <= 1 &&
+	         abs(samples[1199] - expected) <= 1;
+	// The rest of the first track once both have ended
+	AudioMixer_end(&mixer, 0);
+	AudioMixer_end(&mixer, 1);
+	passed = passed &&
+	         AudioMixer_pull(&mixer, samples, MIXER_PULL_FRAMES) == 400 &&
+	         abs(samples[0] - 8192) <= 1 &&
+	         AudioMixer_pull(&mixer, samples, MIXER_PULL_FRAMES) == 0;
+
+	AudioMixer_destroy(&mixer);
+	av_frame_free(&stereo);
+	av_frame_free(&mono);
+	avcodec_free_context(&cc[0]);
+	avcodec_free_context(&cc[1]);
+	TEST_EXPECT(passed);
+	TEST_EXPECT(memstats_get(MEM_AUDIO) == 0);
+
+	fprintf(stdout, "[Test] mixer: Passed\n");
+	return true;
+}
+
+// Subtitles
+
+static bool test_subtitles(void)
+{
+	char text[64];
+	subtitle_plain_text(text, sizeof(text),
+	                    "0,0,Default,,0,0,0,,{\\i1}Hello\\Nworld", true);
+	TEST_EXPECT(strcmp(text, "Hello world") == 0);
+	subtitle_plain_text(text, sizeof(text), "Dialogue: 0,0:00:01.00,"
+	                    "0:00:02.00,Default,,0,0,0,,a, b", true);
+	TEST_EXPECT(strcmp(text, "a, b") == 0);
+	subtitle_plain_text(text, 4, "Line\nbreak", false);
+	TEST_EXPECT(strcmp(text, "Lin") == 0);
+
+	_Atomic enum State state;
+	atomic_init(&state, STATE_NORMAL);
+	struct Subtitles subs;
+	Subtitles_init(&subs);
+	subs.videoWidth = 1280;
+	subs.videoHeight = 720;
+
+	// A bitmap page without an end, then an empty page that clears it
+	uint8_t indices[2][4] = { { 0, 1, 1, 0 }, { 1, 0, 0, 1 } };
+	uint32_t palette[256] = { 0, 0xff00ff00 };
+	struct AVSubtitleRect rect =
+	{
+		.x = 10, .y = 20, .w = 4, .h = 2, .nb_colors = 2,
+		.type = SUBTITLE_BITMAP
+	};
+	rect.data[0] = indices[0];
+	rect.linesize[0] = 4;
+	rect.data[1] = (uint8_t*) palette;
+	struct AVSubtitleRect* rects[] = { &rect };
+	struct AVSubtitle page =
+	{
+		.end_display_time = UINT32_MAX, .num_rects = 1, .rects = rects
+	};
+	bool passed = Subtitles_add(&subs, &page, 1.0, 0.0, &state);
+	struct SubtitleOverlay const* overlay = &subs.overlays[0];
+	passed = passed && subs.nOverlays == 1 && isinf(overlay->end) &&
+	         overlay->canvasWidth == 1280 && overlay->rects[0].x == 10 &&
+	         overlay->pixels[0][0] == 0 && overlay->pixels[0][1] == 0xff00ff00 &&
+	         overlay->pixels[0][4] == 0xff00ff00 &&
+	         memstats_get(MEM_SUBTITLES) == 4 * 2 * 4;
+	struct AVSubtitle clear = { .end_display_time = UINT32_MAX };
+	passed = passed && Subtitles_add(&subs, &clear, 3.0, 0.0, &state) &&
+	         subs.nOverlays == 1 && overlay->end == 3.0;
+
+	// A text cue that ends with its packet, sorted before the page
+	struct AVSubtitleRect cue = { .type = SUBTITLE_TEXT, .text = "Hi" };
+	struct AVSubtitleRect* cues[] = { &cue };
+	struct AVSubtitle line = { .num_rects = 1, .rects = cues };
+	passed = passed && Subtitles_add(&subs, &line, 0.5, 1.0, &state) &&
+	         subs.nOverlays == 2 && overlay->begin == 0.5 &&
+	         overlay->end == 1.5 && strcmp(overlay->text, "Hi") == 0 &&
+	         subs.nDecoded == 3;
 
-finish:
-	return;
+	// Ended overlays are kept for backward steps, without taking room. Without
+	// a renderer, nothing is drawn
+	struct AVStream stream;
+	memset(&stream, 0, sizeof(stream));
+	subs.stream = &stream;
+	while (passed && subs.nOverlays < SUBTITLE_OVERLAYS_MAX)
+		passed = Subtitles_add(&subs, &line, 4.0 + subs.nOverlays, 1.0, &state);
+	Subtitles_render(&subs, NULL, 10.5);
+	passed = passed && subs.nOverlays == SUBTITLE_OVERLAYS_MAX &&
+	         subs.nEnded == 6 && Subtitles_add(&subs, &line, 40.0, 1.0, &state) &&
+	         subs.nOverlays == SUBTITLE_OVERLAYS_MAX + 1;
+	Subtitles_render(&subs, NULL, 25.0);
+	passed = passed && subs.nEnded == SUBTITLE_HISTORY_MAX &&
+	         subs.nOverlays == SUBTITLE_HISTORY_MAX + 1 &&
+	         subs.overlays[0].begin == 12.0;
+	Subtitles_render(&subs, NULL, 12.5);
+	passed = passed && subs.nEnded == 0 &&
+	         subs.nOverlays == SUBTITLE_HISTORY_MAX + 1;
+	subs.stream = NULL;
+
+	// Once full, a pending flush drops the overlay instead of waiting for room
+	while (passed && subs.nOverlays < SUBTITLE_OVERLAYS_MAX)
+		passed = Subtitles_add(&subs, &line, 4.0 + subs.nOverlays, 1.0, &state);
+	Subtitles_flush_request(&subs, 1);
+	passed = passed && Subtitles_add(&subs, &line, 30.0, 1.0, &state) &&
+	         subs.nOverlays == SUBTITLE_OVERLAYS_MAX;
+	Subtitles_flush(&subs, 1);
+	passed = passed && subs.nOverlays == 0 &&
+	         memstats_get(MEM_SUBTITLES) == 0 &&
+	         Subtitles_add(&subs, &line, 30.0, 1.0, &state) &&
+	         subs.nOverlays == 1;
+	Subtitles_destroy(&subs);
+	TEST_EXPECT(passed);
+	TEST_EXPECT(memstats_get(MEM_SUBTITLES) == 0);
+
+	fprintf(stdout, "[Test] subtitles: Passed\n");
+	return true;
+}
+
+// Clock
+
+#define TEST_CLOCK_WAIT 50 // Milliseconds
+
+static bool test_clock(void)
+{
+	TEST_EXPECT(clock_source_parse("external") == CLOCK_SOURCE_EXTERNAL);
+	TEST_EXPECT(clock_source_parse("wall") == CLOCK_SOURCE_COUNT);
+
+	// Chosen from the streams unless the requested one has its stream
+	struct PlaybackClock pc;
+	PlaybackClock_init(&pc, CLOCK_SOURCE_COUNT, true, true);
+	TEST_EXPECT(pc.master == CLOCK_SOURCE_AUDIO);
+	TEST_EXPECT(!PlaybackClock_set_speed(&pc, 2.0));
+	PlaybackClock_init(&pc, CLOCK_SOURCE_AUDIO, false, true);
+	TEST_EXPECT(pc.master == CLOCK_SOURCE_EXTERNAL);
+	PlaybackClock_init(&pc, CLOCK_SOURCE_VIDEO, true, true);
+	TEST_EXPECT(pc.master == CLOCK_SOURCE_VIDEO);
+
+	// The external clock starts at the first picture and runs at the speed
+	PlaybackClock_init(&pc, CLOCK_SOURCE_COUNT, false, true);
+	TEST_EXPECT(isnan(PlaybackClock_master(&pc)));
+	PlaybackClock_set_video(&pc, 100.0);
+	TEST_EXPECT(PlaybackClock_set_speed(&pc, 2.0));
+	TEST_EXPECT(!PlaybackClock_set_speed(&pc, CLOCK_SPEED_MAX * 2));
+	double const timeBegin = clock_monotonic();
+	SDL_Delay(TEST_CLOCK_WAIT);
+	double const elapsed = clock_monotonic() - timeBegin;
+	double const advance = PlaybackClock_master(&pc) - 100.0;
+	TEST_EXPECT(elapsed >= TEST_CLOCK_WAIT / 1e3 * 0.9);
+	TEST_EXPECT(advance >= elapsed * 2 && advance < elapsed * 2 + 0.05);
+
+	// Frozen while paused
+	PlaybackClock_pause(&pc, true);
+	double const paused = PlaybackClock_master(&pc);
+	SDL_Delay(TEST_CLOCK_WAIT / 5);
+	TEST_EXPECT(PlaybackClock_master(&pc) == paused);
+	PlaybackClock_pause(&pc, false);
+	// A jump of the timestamps sets the external clock again
+	PlaybackClock_set_video(&pc, paused + 1.0);
+	TEST_EXPECT(pc.nResyncs == 0);
+	PlaybackClock_set_video(&pc, paused + CLOCK_RESYNC_THRESHOLD * 2);
+	TEST_EXPECT(pc.nResyncs == 1);
+	TEST_EXPECT(PlaybackClock_master(&pc) >= paused + CLOCK_RESYNC_THRESHOLD * 2);
+
+	fprintf(stdout, "[Test] clock: Passed\n");
+	return true;
+}
+
+// Overview
+
+/**
+ * @brief Reads the header of an overview file and the first bucket of each
+ *  level, for up to 2 channels.
+ */
+static bool test_overview_read(char const* path, uint32_t header[4],
+                               uint64_t nBuckets[OVERVIEW_LEVELS],
+                               struct OverviewBucket first[OVERVIEW_LEVELS][2])
+{
+	FILE* file = fopen(path, "rb");
+	if (!file) return false;
+	char magic[sizeof(OVERVIEW_MAGIC)];
+	bool success = fread(magic, sizeof(magic), 1, file) == 1 &&
+	               memcmp(magic, OVERVIEW_MAGIC, sizeof(magic)) == 0 &&
+	               fread(header, sizeof(uint32_t), 4, file) == 4 &&
+	               header[0] == OVERVIEW_VERSION && header[2] <= 2 &&
+	               header[3] == OVERVIEW_LEVELS;
+	uint32_t samplesPerBucket = 0;
+	for (int l = 0; success && l < OVERVIEW_LEVELS; ++l)
+		success = fread(&samplesPerBucket, sizeof(samplesPerBucket), 1,
+		                file) == 1 &&
+		          fread(&nBuckets[l], sizeof(nBuckets[l]), 1, file) == 1;
+	for (int l = 0; success && l < OVERVIEW_LEVELS; ++l)
+	{
+		success = fread(first[l], sizeof(struct OverviewBucket), header[2],
+		                file) == header[2];
+		fseek(file, (nBuckets[l] - 1) * header[2] *
+		      sizeof(struct OverviewBucket), SEEK_CUR);
+	}
+	fclose(file);
+	return success;
+}
+static bool test_overview(char const* dir)
+{
+	// Lengths that are not a multiple of the vector width
+	float samples[13];
+	for (int i = 0; i < 13; ++i)
+		samples[i] = (i - 6) / 8.f;
+	float min = FLT_MAX, max = -FLT_MAX;
+	float const sum = overview_reduce(samples, 13, &min, &max);
+	TEST_EXPECT(min == -0.75f && max == 0.75f);
+	TEST_EXPECT(fabsf(sum - 182.f / 64.f) < 1e-5f);
+
+	// A constant and a square wave, pushed in pieces across the buckets
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/a%s", dir, OVERVIEW_EXTENSION);
+	size_t const nFrames = OVERVIEW_BUCKET * OVERVIEW_FACTOR * 2 + 100;
+	float* const planes = malloc(2 * nFrames * sizeof(float));
+	TEST_EXPECT(planes);
+	for (size_t i = 0; i < nFrames; ++i)
+	{
+		planes[i] = 0.5f;
+		planes[nFrames + i] = i % 2 ? 0.25f : -0.25f;
+	}
+	struct Overview overview;
+	bool passed = Overview_init(&overview, 1000, 2);
+	for (size_t i = 0; passed && i < nFrames; i += 333)
+	{
+		float const* const pieces[2] = { planes + i, planes + nFrames + i };
+		Overview_push(&overview, pieces, i + 333 < nFrames ? 333 : nFrames - i);
+	}
+	passed = passed && Overview_save(&overview, path);
+	Overview_destroy(&overview);
+	free(planes);
+	uint32_t header[4];
+	uint64_t nBuckets[OVERVIEW_LEVELS];
+	struct OverviewBucket first[OVERVIEW_LEVELS][2];
+	passed = passed && test_overview_read(path, header, nBuckets, first) &&
+	         header[1] == 1000 && header[2] == 2 &&
+	         nBuckets[0] == (nFrames + OVERVIEW_BUCKET - 1) / OVERVIEW_BUCKET &&
+	         nBuckets[1] == 3 && nBuckets[2] == 1 &&
+	         nBuckets[OVERVIEW_LEVELS - 1] == 1;
+	for (int l = 0; passed && l < OVERVIEW_LEVELS; ++l)
+		passed = first[l][0].min == 16384 && first[l][0].max == 16384 &&
+		         first[l][0].rms == 16384 && first[l][1].min == -8192 &&
+		         first[l][1].max == 8192 && first[l][1].rms == 8192;
+	remove(path);
+	TEST_EXPECT(passed);
+
+	// Decoded from the audio of a file, as the 440Hz sine of test_fill_samples
+	struct MemoryFile file;
+	memset(&file, 0, sizeof(struct MemoryFile));
+	if (!test_generate(&testCases[0], &file))
+	{
+		free(file.data);
+		return true; // Skipped
+	}
+	char pathIn[PATH_MAX];
+	snprintf(pathIn, sizeof(pathIn), "%s/in.mkv", dir);
+	// Of the same name in another directory, so not reduced
+	char pathSub[PATH_MAX], pathOther[PATH_MAX];
+	snprintf(pathSub, sizeof(pathSub), "%s/sub", dir);
+	snprintf(pathOther, sizeof(pathOther), "%s/in.mkv", pathSub);
+	bool const written = test_write_file(pathIn, file.data, file.size) &&
+	                     mkdir(pathSub, 0700) == 0 &&
+	                     test_write_file(pathOther, file.data, file.size);
+	free(file.data);
+	TEST_EXPECT(written);
+	VectorPtr files;
+	VectorPtr_init(&files);
+	VectorPtr_push_back(&files, pathIn);
+	VectorPtr_push_back(&files, pathOther);
+	passed = overview_files(&files, dir, stdout) == 1;
+	VectorPtr_destroy(&files);
+	remove(pathOther);
+	rmdir(pathSub);
+	snprintf(path, sizeof(path), "%s%s", pathIn, OVERVIEW_EXTENSION);
+	passed = passed && test_overview_read(path, header, nBuckets, first);
+	remove(pathIn);
+	remove(path);
+	double const expected = TEST_LENGTH * TEST_SAMPLE_RATE / OVERVIEW_BUCKET;
+	TEST_EXPECT(passed && header[1] == TEST_SAMPLE_RATE && header[2] == 2);
+	TEST_EXPECT(fabs(nBuckets[0] - expected) < expected * 0.05);
+	// The coarsest bucket spans many periods of the sine
+	struct OverviewBucket const* const coarse = first[OVERVIEW_LEVELS - 1];
+	TEST_EXPECT(abs(coarse[0].max - 8000) < 800 &&
+	            abs(coarse[0].min + 8000) < 800);
+	TEST_EXPECT(abs(coarse[0].rms - 5657) < 600);
+	return true;
+}
+
+// Trick-play
+
+static bool test_trickplay(void)
+{
+	// The ladder in both directions, through normal playback
+	int speed = 0;
+	int const forward[] = { 2, 4, 8, 16, 32, 32 };
+	for (unsigned i = 0; i < sizeof(forward) / sizeof(forward[0]); ++i)
+	{
+		speed = trick_speed_next(speed, 1);
+		TEST_EXPECT(speed == forward[i]);
+	}
+	int const backward[] = { 16, 8, 4, 2, 0, -2, -4, -8, -16, -32, -32 };
+	for (unsigned i = 0; i < sizeof(backward) / sizeof(backward[0]); ++i)
+	{
+		speed = trick_speed_next(speed, -1);
+		TEST_EXPECT(speed == backward[i]);
+	}
+	TEST_EXPECT(trick_speed_next(-2, 1) == 0 && trick_speed_next(1, 1) == 2);
+	TEST_EXPECT(trick_speed_valid(0) && trick_speed_valid(-32));
+	TEST_EXPECT(!trick_speed_valid(-1) && !trick_speed_valid(33));
+	TEST_EXPECT(!trick_enabled(1) && trick_enabled(2));
+	TEST_EXPECT(!trick_keyframes(2) && trick_keyframes(4) &&
+	            trick_keyframes(-2));
+
+	// 25 fps at 2x is beyond the presentation rate. Every other frame is kept
+	double next = NAN;
+	unsigned nAccepted = 0;
+	for (unsigned i = 0; i < 50; ++i)
+		nAccepted += trick_accept(&next, i / 25.0, 2);
+	TEST_EXPECT(nAccepted == 25);
+	TEST_EXPECT(fabs(trick_delay(2.0, 1.0, 4) - 0.25) < 1e-9);
+	TEST_EXPECT(fabs(trick_delay(1.0, 3.0, -8) - 0.25) < 1e-9);
+	TEST_EXPECT(trick_delay(10.0, 0.0, 2) == TRICK_DELAY_MAX);
+	TEST_EXPECT(trick_delay(1.0, NAN, 2) == 0.0);
+	TEST_EXPECT(trick_step(-8) == -2.0);
+
+	fprintf(stdout, "[Test] trick-play: Passed\n");
+	return true;
+}
+
+// Control
+
+static bool test_control(void)
+{
+	struct ControlRequest request;
+	char const* error;
+	TEST_EXPECT(control_parse("seek 1:30", &request, &error));
+	TEST_EXPECT(request.command == CONTROL_SEEK && !request.relative &&
+	            request.seconds == 90.0);
+	TEST_EXPECT(control_parse("seek -2.5", &request, &error));
+	TEST_EXPECT(request.relative && request.seconds == -2.5);
+	TEST_EXPECT(!control_parse("seek +x", &request, &error) && error);
+	TEST_EXPECT(control_parse("play a b.mkv", &request, &error));
+	TEST_EXPECT(request.command == CONTROL_PLAY &&
+	            strcmp(request.argument, "a b.mkv") == 0);
+	TEST_EXPECT(!control_parse("play", &request, &error));
+	TEST_EXPECT(!control_parse("pause now", &request, &error));
+	TEST_EXPECT(!control_parse("pauses", &request, &error));
+	TEST_EXPECT(control_parse("stats", &request, &error) &&
+	            request.command == CONTROL_STATS);
+	TEST_EXPECT(control_parse("trick -8", &request, &error) &&
+	            request.command == CONTROL_TRICK && request.speed == -8);
+	TEST_EXPECT(!control_parse("trick 64", &request, &error));
+	TEST_EXPECT(!control_parse("trick", &request, &error));
+
+	char json[16];
+	TEST_EXPECT(control_json_string(json, sizeof(json), "a\"b\n\x01") == 14);
+	TEST_EXPECT(strcmp(json, "\"a\\\"b\\n\\u0001\"") == 0);
+	// Truncated before an escape that does not fit
+	TEST_EXPECT(control_json_string(json, 7, "abc\"") == 5 &&
+	            strcmp(json, "\"abc\"") == 0);
+
+	fprintf(stdout, "[Test] control: Passed\n");
+	return true;
+}
+#ifdef __unix__
+/**
+ * @brief Sends commands on the control socket and reads a line per command.
+ */
+static bool test_control_socket(char const* dir)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	char* const path = addr.sun_path;
+	snprintf(path, sizeof(addr.sun_path), "%s/control", dir);
+	struct ControlServer server;
+	TEST_EXPECT(ControlServer_start(&server, path));
+
+	int const fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	struct timeval timeout = { .tv_sec = 2 };
+	bool passed = fd >= 0 &&
+	              setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+	                         sizeof(timeout)) == 0 &&
+	              connect(fd, (struct sockaddr const*) &addr, sizeof(addr)) == 0;
+	char const commands[] = "stats\npause\r\nrewind\n";
+	passed = passed && send(fd, commands, sizeof(commands) - 1, 0) ==
+	         (ssize_t) sizeof(commands) - 1;
+	char replies[4096];
+	size_t size = 0;
+	unsigned nLines = 0;
+	while (passed && nLines < 3 && size < sizeof(replies) - 1)
+	{
+		ssize_t const received = recv(fd, replies + size,
+		                              sizeof(replies) - 1 - size, 0);
+		passed = received > 0;
+		for (ssize_t i = 0; passed && i < received; ++i)
+			nLines += replies[size + i] == '\n';
+		size += passed ? received : 0;
+	}
+	replies[size] = '\0';
+	if (fd >= 0) close(fd);
+	ControlServer_stop(&server);
+
+	// No playback receives commands between the tests
+	static char const stats[] = "{\"ok\":true,\"playing\":false,";
+	static char const pause[] =
+		"{\"ok\":false,\"error\":\"Nothing is playing\"}\n";
+	static char const unknown[] =
+		"{\"ok\":false,\"error\":\"Unknown command\"}\n";
+	char const* const second = strchr(replies, '\n');
+	TEST_EXPECT(passed && nLines == 3);
+	TEST_EXPECT(strncmp(replies, stats, sizeof(stats) - 1) == 0);
+	TEST_EXPECT(strstr(replies, "\"memory\":{\"packets\":"));
+	TEST_EXPECT(strncmp(second + 1, pause, sizeof(pause) - 1) == 0);
+	TEST_EXPECT(strcmp(second + sizeof(pause), unknown) == 0);
+	TEST_EXPECT(access(path, F_OK) != 0);
+	return true;
+}
+/**
+ * @brief Connects to the control socket with a receive timeout.
+ * @return -1 if failed.
+ */
+static int test_control_connect(struct sockaddr_un const* addr)
+{
+	int const fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	struct timeval timeout = { .tv_sec = 2 };
+	if (fd >= 0 &&
+	    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0 &&
+	    connect(fd, (struct sockaddr const*) addr, sizeof(*addr)) == 0)
+		return fd;
+	if (fd >= 0) close(fd);
+	return -1;
+}
+/**
+ * @brief Sends a command and receives a reply line.
+ */
+static bool test_control_command(int fd, char const* line, char* reply,
+                                 size_t size)
+{
+	size_t const length = strlen(line);
+	if (send(fd, line, length, 0) != (ssize_t) length) return false;
+	size_t n = 0;
+	while (n + 1 < size && (n == 0 || reply[n - 1] != '\n'))
+	{
+		ssize_t const received = recv(fd, reply + n, size - 1 - n, 0);
+		if (received <= 0) return false;
+		n += received;
+	}
+	reply[n] = '\0';
+	return true;
+}
+/**
+ * @brief While a command waits for the main thread, here this one, the other
+ *  clients are served.
+ */
+static bool test_control_pending(char const* dir)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/control", dir);
+	struct ControlServer server;
+	TEST_EXPECT(ControlServer_start(&server, addr.sun_path));
+	bool const receiver = control_receiver();
+	control_set_receiver(true);
+
+	int const waiting = test_control_connect(&addr);
+	int const other = test_control_connect(&addr);
+	char const pause[] = "pause\n";
+	char reply[CONTROL_REPLY_MAX + 1];
+	bool passed = waiting >= 0 && other >= 0 &&
+	              send(waiting, pause, sizeof(pause) - 1, 0) ==
+	              (ssize_t) sizeof(pause) - 1;
+	uint32_t const timeBegin = SDL_GetTicks();
+	passed = passed && test_control_command(other, "stats\n", reply,
+	                                        sizeof(reply)) &&
+	         strncmp(reply, "{\"ok\":true,", 11) == 0 &&
+	         SDL_GetTicks() - timeBegin < CONTROL_TIMEOUT / 2;
+
+	// Answered once the event is handled
+	SDL_Event event;
+	int nEvents = 0;
+	for (int i = 0; passed && i < 100 && nEvents <= 0; ++i)
+	{
+		nEvents = SDL_PeepEvents(&event, 1, SDL_GETEVENT, CHAL_EVENT_CONTROL,
+		                         CHAL_EVENT_CONTROL);
+		if (nEvents <= 0) SDL_Delay(10);
+	}
+	struct ControlRequest* const request = nEvents > 0 ?
+	                                       control_event_request(&event) : NULL;
+	passed = passed && request && request->command == CONTROL_PAUSE;
+	if (request) ControlRequest_reply(request, NULL);
+	passed = passed && test_control_command(waiting, "", reply, sizeof(reply)) &&
+	         strcmp(reply, "{\"ok\":true}\n") == 0;
+
+	if (waiting >= 0) close(waiting);
+	if (other >= 0) close(other);
+	control_set_receiver(receiver);
+	ControlServer_stop(&server);
+	TEST_EXPECT(passed);
+	return true;
+}
+#endif
+
+bool test()
+{
+	fprintf(stdout, "Executing Chalcocite test routine\n");
+
+#ifdef __linux__
+	if (!test_thread_policy())
+		return false;
+#endif
+	if (!test_containers() || !test_scheduler() || !test_governor() ||
+	    !test_clock() || !test_frame_cache() || !test_mixer() ||
+	    !test_subtitles() ||
+	    !test_in_directory("library", test_library_scan) ||
+	    !test_in_directory("export", test_export_segment) ||
+	    !test_in_directory("GOP decode", test_frame_cache_gop) ||
+	    !test_in_directory("sink", test_sink) ||
+	    !test_in_directory("overview", test_overview) || !test_trickplay() ||
+	    !test_control())
+		return false;
+#ifdef __unix__
+	if (!test_in_directory("control socket", test_control_socket) ||
+	    !test_in_directory("control pending", test_control_pending))
+		return false;
+#endif
+
+	unsigned const nCases = sizeof(testCases) / sizeof(testCases[0]);
+	unsigned nPassed = 0, nFailed = 0;
+	struct Output output;
+	Output_init(&output);
+	for (unsigned i = 0; i < nCases; ++i)
+	{
+		int result = test_playback(&testCases[i], &output);
+		if (result > 0) ++nPassed;
+		else if (result < 0) ++nFailed;
+	}
+	Output_destroy(&output);
+	fprintf(stdout, "[Test] %u passed, %u failed, %u skipped\n",
+	        nPassed, nFailed, nCases - nPassed - nFailed);
+	return nFailed == 0;
 }
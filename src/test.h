@@ -1,9 +1,13 @@
 #ifndef CHALCOCITE__TEST_H_
 #define CHALCOCITE__TEST_H_
 
+#include <stdbool.h>
+
 /**
- * @warning Not responsible for any clean-up
+ * @brief Plays synthetic media generated in memory for a fixed duration and
+ *  checks frame count, A/V synchronisation and throughput.
+ * @return true if no test case failed.
  */
-void test();
+bool test();
 
 #endif // !CHALCOCITE__TEST_H_
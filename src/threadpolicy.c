@@ -0,0 +1,198 @@
+#define _GNU_SOURCE // pthread_setaffinity_np
+#include "threadpolicy.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#ifdef __linux__
+	#include <pthread.h>
+	#include <sched.h>
+	#include <unistd.h>
+#endif
+
+enum PolicyState
+{
+	POLICY_PENDING, ///< No thread of the role has started
+	POLICY_WRITING,
+	POLICY_APPLIED
+};
+
+struct ThreadPolicy
+{
+	bool realtime;
+	int priority; ///< SCHED_FIFO priority if realtime
+	uint64_t affinity; ///< Bit i set for CPU i. 0 for any CPU
+	char cpus[32]; ///< affinity as given
+	/*
+	 * Outcome of the first thread applying the policy. Written once, then
+	 * published by setting state to POLICY_APPLIED.
+	 */
+	_Atomic int state;
+	char outcome[128];
+};
+
+static struct ThreadPolicy thread_policies[THREAD_ROLE_COUNT] =
+{
+	[THREAD_ROLE_AUDIO] = { .priority = THREAD_RT_PRIORITY_AUDIO },
+	[THREAD_ROLE_PRESENT] = { .priority = THREAD_RT_PRIORITY_PRESENT },
+};
+
+static char const* const thread_roleNames[THREAD_ROLE_COUNT] =
+{
+	[THREAD_ROLE_AUDIO] = "audio",
+	[THREAD_ROLE_PRESENT] = "present",
+	[THREAD_ROLE_DECODE] = "decode",
+	[THREAD_ROLE_WORKER] = "worker",
+};
+
+char const* thread_role_name(enum ThreadRole role)
+{
+	return role < THREAD_ROLE_COUNT ? thread_roleNames[role] : "unknown";
+}
+
+void thread_policy_set_realtime(bool realtime)
+{
+	thread_policies[THREAD_ROLE_AUDIO].realtime = realtime;
+	thread_policies[THREAD_ROLE_PRESENT].realtime = realtime;
+}
+// Parses a list such as "0,2-3" into a mask
+static bool parse_cpus(char const* str, uint64_t* const mask)
+{
+	*mask = 0;
+	while (true)
+	{
+		char* end;
+		long first = strtol(str, &end, 10);
+		long last = first;
+		if (end == str) return false;
+		if (*end == '-')
+		{
+			str = end + 1;
+			last = strtol(str, &end, 10);
+			if (end == str) return false;
+		}
+		if (first < 0 || last < first || last >= THREAD_POLICY_MAX_CPUS)
+			return false;
+		for (long i = first; i <= last; ++i)
+			*mask |= (uint64_t) 1 << i;
+		if (*end == '\0') return true;
+		if (*end != ',') return false;
+		str = end + 1;
+	}
+}
+bool thread_policy_parse_affinity(char const* argument)
+{
+	char const* cpus = strchr(argument, '=');
+	if (!cpus) return false;
+	for (int role = 0; role < THREAD_ROLE_COUNT; ++role)
+	{
+		size_t const length = strlen(thread_roleNames[role]);
+		if ((size_t) (cpus - argument) != length ||
+		    strncmp(argument, thread_roleNames[role], length) != 0)
+			continue;
+
+		struct ThreadPolicy* const policy = &thread_policies[role];
+		if (!parse_cpus(cpus + 1, &policy->affinity)) return false;
+		snprintf(policy->cpus, sizeof(policy->cpus), "%s", cpus + 1);
+		return true;
+	}
+	return false;
+}
+
+// Fallback when SCHED_FIFO is not available
+static char const* thread_sdl_priority(void)
+{
+	return SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH) == 0 ?
+	       "SDL high priority" : "default priority";
+}
+void thread_policy_apply(enum ThreadRole role)
+{
+	struct ThreadPolicy* const policy = &thread_policies[role];
+	char outcome[sizeof(policy->outcome)];
+	int length = 0;
+
+	if (policy->realtime)
+	{
+#ifdef __linux__
+		struct sched_param param = { .sched_priority = policy->priority };
+		int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if (error == 0)
+			length = snprintf(outcome, sizeof(outcome), "SCHED_FIFO %d",
+			                  policy->priority);
+		else // Usually EPERM without CAP_SYS_NICE or an RLIMIT_RTPRIO
+			length = snprintf(outcome, sizeof(outcome),
+			                  "SCHED_FIFO denied (%s), %s", strerror(error),
+			                  thread_sdl_priority());
+#else
+		length = snprintf(outcome, sizeof(outcome),
+		                  "SCHED_FIFO unsupported, %s", thread_sdl_priority());
+#endif
+	}
+	else
+	{
+		// Threads inherit the policy of their creator, which may be realtime
+#ifdef __linux__
+		struct sched_param param = { .sched_priority = 0 };
+		pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+#endif
+		SDL_SetThreadPriority(SDL_THREAD_PRIORITY_NORMAL);
+		length = snprintf(outcome, sizeof(outcome), "default priority");
+	}
+
+	if (length < (int) sizeof(outcome))
+	{
+		char* const rest = outcome + length;
+		size_t const restSize = sizeof(outcome) - length;
+#ifdef __linux__
+		// Without an affinity, any CPU, as the creator may have been pinned
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		long const nCpus = sysconf(_SC_NPROCESSORS_CONF);
+		for (int i = 0; i < CPU_SETSIZE; ++i)
+			if (policy->affinity ? i < THREAD_POLICY_MAX_CPUS &&
+			    (policy->affinity & ((uint64_t) 1 << i)) : i < nCpus)
+				CPU_SET(i, &set);
+		int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if (policy->affinity && error == 0)
+			snprintf(rest, restSize, ", CPUs %s", policy->cpus);
+		else if (policy->affinity)
+			snprintf(rest, restSize, ", affinity %s denied (%s)", policy->cpus,
+			         strerror(error));
+#else
+		if (policy->affinity)
+			snprintf(rest, restSize, ", affinity unsupported");
+#endif
+	}
+
+	int expected = POLICY_PENDING;
+	if (atomic_compare_exchange_strong(&policy->state, &expected,
+	                                   POLICY_WRITING))
+	{
+		memcpy(policy->outcome, outcome, sizeof(outcome));
+		atomic_store(&policy->state, POLICY_APPLIED);
+		if (policy->realtime || policy->affinity)
+			fprintf(stdout, "[Policy] %s: %s\n", thread_role_name(role), outcome);
+	}
+}
+void thread_policy_report(FILE* file)
+{
+	fprintf(file, "%-8s %-24s %s\n", "thread", "requested", "applied");
+	for (int role = 0; role < THREAD_ROLE_COUNT; ++role)
+	{
+		struct ThreadPolicy const* const policy = &thread_policies[role];
+		char requested[64];
+		int length = policy->realtime ?
+		             snprintf(requested, sizeof(requested), "SCHED_FIFO %d",
+		                      policy->priority) :
+		             snprintf(requested, sizeof(requested), "default");
+		if (policy->affinity && length < (int) sizeof(requested))
+			snprintf(requested + length, sizeof(requested) - length, ", CPUs %s",
+			         policy->cpus);
+		fprintf(file, "%-8s %-24s %s\n", thread_role_name(role), requested,
+		        atomic_load(&policy->state) == POLICY_APPLIED ?
+		        policy->outcome : "not started");
+	}
+}
@@ -0,0 +1,53 @@
+#ifndef CHALCOCITE__THREADPOLICY_H_
+#define CHALCOCITE__THREADPOLICY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Scheduling policy and CPU affinity of the pipeline threads. Policies are
+ * configured per role before playback and applied by each thread when it
+ * starts. Settings the process is not permitted to apply fall back to
+ * SDL_SetThreadPriority, and the outcome is kept for thread_policy_report.
+ */
+
+#define THREAD_POLICY_MAX_CPUS 64
+
+/**
+ * @brief Roles of threads sharing a policy.
+ */
+enum ThreadRole
+{
+	THREAD_ROLE_AUDIO, ///< audio_thread
+	THREAD_ROLE_PRESENT, ///< Main thread, which presents the video
+	THREAD_ROLE_DECODE, ///< decode_thread and video_thread
+	THREAD_ROLE_WORKER, ///< Scheduler workers
+	THREAD_ROLE_COUNT
+};
+
+#define THREAD_RT_PRIORITY_AUDIO 60
+#define THREAD_RT_PRIORITY_PRESENT 50
+
+/**
+ * @brief Requests SCHED_FIFO for the audio and presentation threads.
+ */
+void thread_policy_set_realtime(bool realtime);
+/**
+ * @brief Parses "role=cpus", where cpus is a list such as "0,2-3".
+ * @return false if the role or the list is invalid.
+ */
+bool thread_policy_parse_affinity(char const* argument);
+/**
+ * @brief Applies the policy of the role to the calling thread. Only the first
+ *  thread of each role reports its outcome to stdout.
+ */
+void thread_policy_apply(enum ThreadRole);
+/**
+ * @brief Prints the requested and applied policy of each role.
+ */
+void thread_policy_report(FILE*);
+
+char const* thread_role_name(enum ThreadRole);
+
+#endif // !CHALCOCITE__THREADPOLICY_H_
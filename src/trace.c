@@ -0,0 +1,167 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+
+enum TracePhase
+{
+	TRACE_PHASE_COMPLETE,
+	TRACE_PHASE_COUNTER
+};
+struct TraceEvent
+{
+	char const* name;
+	uint64_t timestamp;
+	union
+	{
+		uint64_t duration; // TRACE_PHASE_COMPLETE
+		double value; // TRACE_PHASE_COUNTER
+	};
+	enum TracePhase phase;
+};
+struct TraceThread
+{
+	char name[16];
+	_Atomic bool inUse;
+	struct TraceEvent* events; // Ring buffer of TRACE_BUFFER_SIZE
+	_Atomic uint64_t head; // Number of events ever recorded
+};
+
+_Atomic bool trace_on;
+
+static char* trace_fileName;
+static uint64_t trace_origin;
+static struct TraceThread trace_threads[TRACE_MAX_THREADS];
+static _Atomic unsigned trace_nThreads;
+static atomic_flag trace_registerLock = ATOMIC_FLAG_INIT;
+static _Thread_local struct TraceThread* trace_current;
+
+void trace_enable(char const* fileName)
+{
+	free(trace_fileName);
+	trace_fileName = strdup(fileName);
+	trace_origin = stats_now();
+	atomic_store(&trace_on, true);
+}
+void trace_thread_register(char const* name)
+{
+	if (!trace_enabled()) return;
+	while (atomic_flag_test_and_set_explicit(&trace_registerLock,
+	       memory_order_acquire));
+
+	unsigned n = atomic_load_explicit(&trace_nThreads, memory_order_relaxed);
+	struct TraceThread* slot = NULL;
+	for (unsigned i = 0; i < n; ++i)
+	{
+		struct TraceThread* const tt = &trace_threads[i];
+		if (!atomic_load(&tt->inUse) &&
+		    strncmp(tt->name, name, sizeof(tt->name) - 1) == 0)
+		{
+			slot = tt;
+			break;
+		}
+	}
+	if (!slot && n < TRACE_MAX_THREADS)
+	{
+		struct TraceThread* const tt = &trace_threads[n];
+		tt->events = malloc(sizeof(struct TraceEvent) * TRACE_BUFFER_SIZE);
+		if (tt->events)
+		{
+			strncpy(tt->name, name, sizeof(tt->name) - 1);
+			atomic_store_explicit(&trace_nThreads, n + 1, memory_order_release);
+			slot = tt;
+		}
+	}
+	if (slot) atomic_store(&slot->inUse, true);
+	trace_current = slot; // Events of threads without a slot are dropped
+
+	atomic_flag_clear_explicit(&trace_registerLock, memory_order_release);
+}
+void trace_thread_unregister(void)
+{
+	if (!trace_current) return;
+	atomic_store(&trace_current->inUse, false);
+	trace_current = NULL;
+}
+
+static void trace_push(struct TraceEvent const* const event)
+{
+	struct TraceThread* const tt = trace_current;
+	if (!tt) return; // Thread not registered
+	uint64_t head = atomic_load_explicit(&tt->head, memory_order_relaxed);
+	tt->events[head & (TRACE_BUFFER_SIZE - 1)] = *event;
+	atomic_store_explicit(&tt->head, head + 1, memory_order_release);
+}
+void trace_complete(char const* name, uint64_t begin)
+{
+	if (!trace_enabled()) return;
+	struct TraceEvent event =
+	{
+		.name = name,
+		.timestamp = begin,
+		.duration = stats_now() - begin,
+		.phase = TRACE_PHASE_COMPLETE
+	};
+	trace_push(&event);
+}
+void trace_counter(char const* name, double value)
+{
+	if (!trace_enabled()) return;
+	struct TraceEvent event =
+	{
+		.name = name,
+		.timestamp = stats_now(),
+		.value = value,
+		.phase = TRACE_PHASE_COUNTER
+	};
+	trace_push(&event);
+}
+
+bool trace_write(void)
+{
+	if (!trace_enabled()) return false;
+	atomic_store(&trace_on, false);
+
+	FILE* file = fopen(trace_fileName, "w");
+	if (!file)
+	{
+		fprintf(stderr, "Unable to open trace file %s\n", trace_fileName);
+		return false;
+	}
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	bool first = true;
+	unsigned n = atomic_load_explicit(&trace_nThreads, memory_order_acquire);
+	for (unsigned i = 0; i < n; ++i)
+	{
+		struct TraceThread const* const tt = &trace_threads[i];
+		fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+		        "\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+		        first ? "" : ",\n", i, tt->name);
+		first = false;
+
+		uint64_t head = atomic_load_explicit(&tt->head, memory_order_acquire);
+		uint64_t tail = head > TRACE_BUFFER_SIZE ? head - TRACE_BUFFER_SIZE : 0;
+		for (uint64_t j = tail; j < head; ++j)
+		{
+			struct TraceEvent const* const e =
+			    &tt->events[j & (TRACE_BUFFER_SIZE - 1)];
+			double timestamp = (int64_t)(e->timestamp - trace_origin) / 1000.0;
+			if (e->phase == TRACE_PHASE_COMPLETE)
+				fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+				        "\"ts\":%.3f,\"dur\":%.3f}",
+				        e->name, i, timestamp, e->duration / 1000.0);
+			else
+				fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"tid\":%u,"
+				        "\"ts\":%.3f,\"args\":{\"value\":%g}}",
+				        e->name, i, timestamp, e->value);
+		}
+	}
+	fprintf(file, "\n]}\n");
+	bool success = !ferror(file);
+	fclose(file);
+	fprintf(stdout, "Trace written to %s\n", trace_fileName);
+	return success;
+}
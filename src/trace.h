@@ -0,0 +1,51 @@
+#ifndef CHALCOCITE__TRACE_H_
+#define CHALCOCITE__TRACE_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Timeline recorder producing Chrome trace-event JSON, which can be opened in
+ * chrome://tracing or Perfetto. Each registered thread owns a ring buffer of
+ * TRACE_BUFFER_SIZE events; once full the oldest events are overwritten.
+ * All timestamps are taken from stats_now().
+ *
+ * Recording functions return immediately unless trace_enable has been called.
+ * Event names are stored by pointer and must be string literals.
+ */
+
+#define TRACE_MAX_THREADS 16
+#define TRACE_BUFFER_SIZE (1 << 16) // Must be a power of two
+
+extern _Atomic bool trace_on;
+
+/**
+ * @brief Starts recording. The trace is written to fileName by trace_write.
+ *  Must be called before any thread registers.
+ */
+void trace_enable(char const* fileName);
+static inline bool trace_enabled(void)
+{
+	return atomic_load_explicit(&trace_on, memory_order_relaxed);
+}
+/**
+ * @brief Assigns a ring buffer to the calling thread. Slots are reused by name
+ *  as in stats_thread_register. Events of unregistered threads are dropped.
+ */
+void trace_thread_register(char const* name);
+void trace_thread_unregister(void);
+
+/**
+ * @brief Records a span from begin (obtained from stats_now()) until now.
+ */
+void trace_complete(char const* name, uint64_t begin);
+void trace_counter(char const* name, double value);
+
+/**
+ * @brief Writes all recorded events and stops recording.
+ * @return false if tracing is not enabled or the file cannot be written.
+ */
+bool trace_write(void);
+
+#endif // !CHALCOCITE__TRACE_H_
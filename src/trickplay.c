@@ -0,0 +1,39 @@
+#include "trickplay.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+int trick_speed_next(int speed, int direction)
+{
+	if (speed == 1) speed = 0;
+	if (direction < 0)
+		return -trick_speed_next(-speed, 1);
+	if (speed >= TRICK_SPEED_MAX)
+		return TRICK_SPEED_MAX;
+	if (speed >= 2)
+		return speed * 2 < TRICK_SPEED_MAX ? speed * 2 : TRICK_SPEED_MAX;
+	if (speed <= -4)
+		return speed / 2;
+	return speed < 0 ? 0 : 2;
+}
+bool trick_speed_valid(int speed)
+{
+	return abs(speed) <= TRICK_SPEED_MAX && speed != -1;
+}
+double trick_step(int speed)
+{
+	return speed / TRICK_KEYFRAME_RATE;
+}
+bool trick_accept(double* const next, double timestamp, int speed)
+{
+	if (!isnan(*next) && timestamp < *next)
+		return false;
+	*next = timestamp + abs(speed) / TRICK_PRESENT_RATE;
+	return true;
+}
+double trick_delay(double timestamp, double previous, int speed)
+{
+	double const delay = fabs(timestamp - previous) / abs(speed);
+	if (isnan(delay)) return 0.0;
+	return delay < TRICK_DELAY_MAX ? delay : TRICK_DELAY_MAX;
+}
@@ -0,0 +1,62 @@
+#ifndef CHALCOCITE__TRICKPLAY_H_
+#define CHALCOCITE__TRICKPLAY_H_
+
+#include <stdbool.h>
+
+/*
+ * Fast-forward and rewind. Up to TRICK_KEYFRAME_SPEED, every frame is decoded
+ * and TRICK_PRESENT_RATE pictures per second of them are presented. From
+ * TRICK_KEYFRAME_SPEED, and always when rewinding, the decode thread seeks
+ * from key frame to key frame, TRICK_KEYFRAME_RATE times per second, and only
+ * key frames are decoded. Audio and subtitles are muted.
+ */
+#define TRICK_SPEED_MAX 32
+#define TRICK_KEYFRAME_SPEED 4
+#define TRICK_PRESENT_RATE 30.0
+#define TRICK_KEYFRAME_RATE 4.0
+#define TRICK_DELAY_MAX 1.0 // Second a picture stays on screen at most
+#define TRICK_QUEUE_PACKETS 2 // Key frames queued ahead of the decoder
+
+/**
+ * @param[in] speed Current speed. 0 or 1 if trick-play is off, negative if
+ *  rewinding
+ * @param[in] direction Positive for faster forward or slower rewind, negative
+ *  for the opposite
+ * @return Next speed of the ladder -TRICK_SPEED_MAX, ..., -4, -2, 0, 2, 4,
+ *  ..., TRICK_SPEED_MAX, where 0 is normal playback.
+ */
+int trick_speed_next(int speed, int direction);
+/**
+ * @return true if speed is 0, 1, or in [2, TRICK_SPEED_MAX] in magnitude.
+ */
+bool trick_speed_valid(int speed);
+static inline bool trick_enabled(int speed)
+{
+	return speed != 0 && speed != 1;
+}
+/**
+ * @return true if only key frames are demuxed and decoded at speed.
+ */
+static inline bool trick_keyframes(int speed)
+{
+	return speed < 0 || speed >= TRICK_KEYFRAME_SPEED;
+}
+/**
+ * @return Media seconds between the key frames presented at speed, negative
+ *  when rewinding.
+ */
+double trick_step(int speed);
+/**
+ * @brief Drops decoded frames beyond TRICK_PRESENT_RATE at speed.
+ * @param[in,out] next Earliest timestamp of the next accepted frame. NAN
+ *  accepts any frame
+ * @return false if the frame at timestamp is dropped.
+ */
+bool trick_accept(double* const next, double timestamp, int speed);
+/**
+ * @return Seconds the previous picture stays on screen, from the difference of
+ *  the timestamps at speed.
+ */
+double trick_delay(double timestamp, double previous, int speed);
+
+#endif // !CHALCOCITE__TRICKPLAY_H_
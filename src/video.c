@@ -12,7 +12,8 @@ static uint32_t push_refresh_event(uint32_t interval, void* data)
 }
 bool schedule_refresh(struct Media* const media, int delay)
 {
-	bool flag = SDL_AddTimer(delay, push_refresh_event, media);
+	media->refreshTimer = SDL_AddTimer(delay, push_refresh_event, media);
+	bool flag = media->refreshTimer != 0;
 	if (!flag) {
 		fprintf(stderr, "[SDL] %s\n", SDL_GetError());
 	}
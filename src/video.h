@@ -6,7 +6,8 @@
 #include "media.h"
 
 /**
- * @brief push a SDL_EVENT of type CHAL_EVENT_REFRESH after a delay
+ * @brief push a SDL_EVENT of type CHAL_EVENT_REFRESH after a delay. The timer
+ *  is stored in media->refreshTimer.
  * @param[in] media equals event.user.data1
  * @param[in] delay delay in miliseconds.
  * @return True if successful. Prints error to stderr if fails
@@ -5,19 +5,23 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_thread.h>
 
+/**
+ * @brief A decoded picture waiting to be uploaded to a texture.
+ */
 struct VideoPicture
 {
-	/*
-	 * The SDL Render API can only be called from one thread. That includes any
-	 * allocation/destruction of textures.
-	 */
-	SDL_Texture* texture;
 	int width, height; // Source
-	// Must be allocated with texture
-	uint8_t* planeY;
-	uint8_t* planeU;
-	uint8_t* planeV;
+	// Planes in the pixel format of the picture queue. NULL if unused
+	uint8_t* data[4];
+	int linesize[4];
+	/**
+	 * Reference to a decoded or filtered frame already in the pixel format of
+	 *  the picture queue, used instead of data if it holds one.
+	 */
+	struct AVFrame* frame;
 	double timestamp;
+	int64_t pts; ///< Frame timestamp in the stream time base
+	unsigned serial; ///< Seek after which the frame was decoded
 };
 
 SDL_mutex* screenMutex;